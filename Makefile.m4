@@ -25,7 +25,7 @@ EFLAGS=\
 	-s MODULARIZE=1 \
 	-s STACK_SIZE=1048576 \
 	-s ASYNCIFY \
-	-s "ASYNCIFY_IMPORTS=['libavjs_wait_reader', 'jsfetch_open_js', 'jsfetch_read_js', 'jsfetch_seek_js']" \
+	-s "ASYNCIFY_IMPORTS=['libavjs_wait_reader', 'libavjs_wait_writer', 'libavjs_avio_source_read', 'jsfetch_open_js', 'jsfetch_read_js', 'jsfetch_seek_js']" \
 	-s INITIAL_MEMORY=25165824 \
 	-s ALLOW_MEMORY_GROWTH=1 \
 	-s WASM_BIGINT=0
@@ -93,12 +93,13 @@ dist/libav.types.d.ts: build/libav.types.d.ts
 define([[[buildrule]]], [[[
 dist/libav-$(LIBAVJS_VERSION)-%.$2$1.$5: build/ffmpeg-$(FFMPEG_VERSION)/build-$3-%/libavformat/libavformat.a \
 	build/exports-%.json src/pre.js build/post-%.js src/extern-post.js \
-        src/bindings.c src/b-*.c
+        src/bindings.c src/b-*.c build/snapshots-%/snapshots.c
 	mkdir -p $(@).d
 	$(EMCC) $(OPTFLAGS) $(EFLAGS) \
 		--post-js build/post-$(*).js \
 		-s "EXPORTED_FUNCTIONS=@build/exports-$(*).json" \
 		-Ibuild/ffmpeg-$(FFMPEG_VERSION) -Ibuild/ffmpeg-$(FFMPEG_VERSION)/build-$3-$(*) \
+		-Ibuild/snapshots-$(*) \
 		`test ! -e configs/configs/$(*)/link-flags.txt || cat configs/configs/$(*)/link-flags.txt` \
 		src/bindings.c \
 		`grep LIBAVJS_WITH_CLI configs/configs/$(*)/link-flags.txt > /dev/null 2>&1 && echo ' \
@@ -148,6 +149,11 @@ build/exports-%.json: configs/configs/%/components.txt funcs.json \
 	mkdir -p build
 	./tools/mk-exports.js $(*) > $@
 
+build/snapshots-%/snapshots.c: configs/configs/%/components.txt funcs.json \
+	tools/mk-snapshots.js
+	mkdir -p build/snapshots-$(*)
+	./tools/mk-snapshots.js $(*) > $@
+
 build/frontend-$(LIBAVJS_VERSION)-%.js: configs/configs/%/components.txt \
 	funcs.json src/frontend.in.js tools/mk-frontend.js
 	mkdir -p build
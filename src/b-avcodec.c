@@ -13,6 +13,11 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#if LIBAVJS_WITH_SWSCALE
+#include "libavutil/imgutils.h"
+#include "libswscale/swscale.h"
+#endif
+
 #if LIBAVJS_FULL_AVCODEC
 /* AVCodec */
 #define B(type, field) A(AVCodec, type, field)
@@ -171,6 +176,130 @@ enum AVPacketSideDataType AVPacketSideData_type(AVPacketSideData *a, int idx) {
     return a[idx].type;
 }
 
+/*
+ * Packet batches, as made by ff_read_frame_batch and ff_encode_batch_js and
+ * read by ff_decode_batch_js. Many packets' payloads are packed into a single
+ * arena followed by a struct-of-arrays index, so that JavaScript can copy a
+ * whole batch in or out in one go. The layout is:
+ *
+ *   int32 header[8]: total size, result, packet count, data offset,
+ *                    data size, index offset, reserved, reserved
+ *   uint8 data[data size]
+ *   (padding to 8 bytes)
+ *   double pts[n], dts[n], duration[n]
+ *   int32 stream_index[n], flags[n], offset[n], size[n],
+ *         time_base_num[n], time_base_den[n]
+ *
+ * Timestamps are stored as doubles, which represent every timestamp up to 2^53
+ * (and AV_NOPTS_VALUE) exactly. Offsets are relative to the data region.
+ */
+#define FF_PACKET_BATCH_HEADER_SIZE 32
+
+typedef struct FFPacketBatchEntry {
+    double pts, dts, duration;
+    int32_t stream_index, flags, offset, size, time_base_num, time_base_den;
+} FFPacketBatchEntry;
+
+// A packet batch being built
+typedef struct FFPacketBatchBuilder {
+    uint8_t *batch;
+    unsigned int batch_alloc, entries_alloc;
+    FFPacketBatchEntry *entries;
+    size_t data_size;
+    int nb_packets;
+} FFPacketBatchBuilder;
+
+static int packet_batch_init(FFPacketBatchBuilder *b) {
+    memset(b, 0, sizeof(*b));
+    b->batch = av_fast_realloc(NULL, &b->batch_alloc, FF_PACKET_BATCH_HEADER_SIZE);
+    return b->batch ? 0 : AVERROR(ENOMEM);
+}
+
+// Append a copy of a packet, with the given time base
+static int packet_batch_add(FFPacketBatchBuilder *b, const AVPacket *pkt, AVRational tb) {
+    FFPacketBatchEntry *entry;
+    uint8_t *tmp;
+
+    // Make room for the index entry and the data
+    tmp = av_fast_realloc(b->entries, &b->entries_alloc,
+        (b->nb_packets + 1) * sizeof(FFPacketBatchEntry));
+    if (!tmp)
+        return AVERROR(ENOMEM);
+    b->entries = (FFPacketBatchEntry *) tmp;
+    if (b->data_size + pkt->size > INT_MAX / 2)
+        return AVERROR(ENOMEM);
+    tmp = av_fast_realloc(b->batch, &b->batch_alloc,
+        FF_PACKET_BATCH_HEADER_SIZE + b->data_size + pkt->size);
+    if (!tmp)
+        return AVERROR(ENOMEM);
+    b->batch = tmp;
+
+    if (pkt->size)
+        memcpy(b->batch + FF_PACKET_BATCH_HEADER_SIZE + b->data_size, pkt->data,
+            pkt->size);
+
+    entry = &b->entries[b->nb_packets++];
+    entry->pts = pkt->pts;
+    entry->dts = pkt->dts;
+    entry->duration = pkt->duration;
+    entry->stream_index = pkt->stream_index;
+    entry->flags = pkt->flags;
+    entry->offset = b->data_size;
+    entry->size = pkt->size;
+    entry->time_base_num = tb.num;
+    entry->time_base_den = tb.den;
+    b->data_size += pkt->size;
+    return 0;
+}
+
+/* Append the index and header, with ret as the batch's result, and return the
+ * finished batch (or NULL if out of memory). The builder is freed either way. */
+static uint8_t *packet_batch_finish(FFPacketBatchBuilder *b, int ret) {
+    int nb_packets = b->nb_packets;
+    size_t index_offset, total_size;
+    int32_t *header;
+    double *dindex;
+    int32_t *iindex;
+    uint8_t *batch;
+
+    // Append the index after the data
+    index_offset = (FF_PACKET_BATCH_HEADER_SIZE + b->data_size + 7) & ~7;
+    total_size = index_offset + nb_packets * (3 * sizeof(double) + 6 * sizeof(int32_t));
+    batch = av_realloc(b->batch, total_size);
+    if (!batch) {
+        av_free(b->batch);
+        av_free(b->entries);
+        return NULL;
+    }
+
+    dindex = (double *) (batch + index_offset);
+    iindex = (int32_t *) (dindex + 3 * nb_packets);
+    for (int i = 0; i < nb_packets; i++) {
+        FFPacketBatchEntry *entry = &b->entries[i];
+        dindex[i] = entry->pts;
+        dindex[nb_packets + i] = entry->dts;
+        dindex[2 * nb_packets + i] = entry->duration;
+        iindex[i] = entry->stream_index;
+        iindex[nb_packets + i] = entry->flags;
+        iindex[2 * nb_packets + i] = entry->offset;
+        iindex[3 * nb_packets + i] = entry->size;
+        iindex[4 * nb_packets + i] = entry->time_base_num;
+        iindex[5 * nb_packets + i] = entry->time_base_den;
+    }
+    av_free(b->entries);
+
+    header = (int32_t *) batch;
+    header[0] = total_size;
+    header[1] = ret;
+    header[2] = nb_packets;
+    header[3] = FF_PACKET_BATCH_HEADER_SIZE;
+    header[4] = b->data_size;
+    header[5] = index_offset;
+    header[6] = header[7] = 0;
+
+    return batch;
+}
+
 uint64_t av_channel_layout_default_mask(int nb)
 {
     AVChannelLayout l;
@@ -212,6 +341,382 @@ const char *ff_get_color_range_name(enum AVColorRange val) {
     return av_color_range_name(val);
 }
 
+#if LIBAVJS_FULL_AVCODEC
+/**
+ * Batch decoding and encoding, for ff_decode_batch and ff_encode_batch. The
+ * send/receive loop runs here over a whole packet batch (see
+ * FFPacketBatchBuilder) or list of frames, instead of once per packet or frame
+ * from JavaScript.
+ *
+ * Decoded frames are received into the slots of a frame pool, which are reused
+ * from batch to batch. Their data stays in the decoder's own refcounted buffer
+ * pools, and goes back to them when the slots are reset. Each batch also
+ * fills in one row of the pool's metadata table per frame.
+ */
+#define FF_BATCH_FIN 1 // End of stream: flush after the batch
+#define FF_BATCH_IGNORE_ERRORS 2 // Skip packets the decoder rejects
+
+/* One row of a frame pool's metadata table. 64 bytes, read by offset in
+ * ff_decode_batch (p-avcodec.in.js): pts @0, duration @8, frame @16, format
+ * @20, width @24, height @28, nb_samples @32, channels @36, sample_rate @40,
+ * flags @44, key_frame @48, pict_type @52, time base @56. */
+typedef struct FFFrameInfo {
+    double pts, duration;
+    AVFrame *frame;
+    int32_t format, width, height;
+    int32_t nb_samples, channels, sample_rate;
+    int32_t flags, key_frame, pict_type;
+    int32_t time_base_num, time_base_den;
+} FFFrameInfo;
+
+typedef struct FFFramePool {
+    // Public: frames in the current batch @0, and their metadata table @4
+    int32_t nb_frames;
+    FFFrameInfo *info;
+
+    AVFrame **frames;
+    int nb_alloc;
+} FFFramePool;
+
+FFFramePool *ff_frame_pool_alloc(void)
+{
+    return av_mallocz(sizeof(FFFramePool));
+}
+
+// Unreference the current batch's frames, keeping the slots
+void ff_frame_pool_reset(FFFramePool *pool)
+{
+    for (int i = 0; i < pool->nb_frames; i++)
+        av_frame_unref(pool->frames[i]);
+    pool->nb_frames = 0;
+}
+
+void ff_frame_pool_free(FFFramePool *pool)
+{
+    if (!pool)
+        return;
+    for (int i = 0; i < pool->nb_alloc; i++)
+        av_frame_free(&pool->frames[i]);
+    av_free(pool->frames);
+    av_free(pool->info);
+    av_free(pool);
+}
+
+// The next free slot, allocating one if needed
+static AVFrame *frame_pool_next(FFFramePool *pool) {
+    if (pool->nb_frames == pool->nb_alloc) {
+        int nb_alloc = FFMAX(8, pool->nb_alloc * 2);
+        AVFrame **frames = av_realloc_array(pool->frames, nb_alloc, sizeof(*frames));
+        if (!frames)
+            return NULL;
+        pool->frames = frames;
+        FFFrameInfo *info = av_realloc_array(pool->info, nb_alloc, sizeof(*info));
+        if (!info)
+            return NULL;
+        pool->info = info;
+        for (; pool->nb_alloc < nb_alloc; pool->nb_alloc++) {
+            if (!(pool->frames[pool->nb_alloc] = av_frame_alloc()))
+                return NULL;
+        }
+    }
+    return pool->frames[pool->nb_frames];
+}
+
+// Receive every frame the decoder has ready into the pool
+static int decode_batch_receive(AVCodecContext *ctx, FFFramePool *pool) {
+    while (1) {
+        AVFrame *frame = frame_pool_next(pool);
+        FFFrameInfo *info;
+        int ret;
+
+        if (!frame)
+            return AVERROR(ENOMEM);
+        ret = avcodec_receive_frame(ctx, frame);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+            return 0;
+        if (ret < 0)
+            return ret;
+        if (!frame->time_base.num)
+            frame->time_base = ctx->time_base;
+
+        info = &pool->info[pool->nb_frames++];
+        info->pts = frame->pts;
+        info->duration = frame->duration;
+        info->frame = frame;
+        info->format = frame->format;
+        info->width = frame->width;
+        info->height = frame->height;
+        info->nb_samples = frame->nb_samples;
+        info->channels = frame->ch_layout.nb_channels;
+        info->sample_rate = frame->sample_rate;
+        info->flags = frame->flags;
+        info->key_frame = !!(frame->flags & AV_FRAME_FLAG_KEY);
+        info->pict_type = frame->pict_type;
+        info->time_base_num = frame->time_base.num;
+        info->time_base_den = frame->time_base.den;
+    }
+}
+
+/**
+ * Decode a packet batch (which may be NULL, to only flush with FF_BATCH_FIN)
+ * into pool, replacing its previous batch. Packets are rescaled to the
+ * decoder's time base, if both are known. Returns the number of frames
+ * decoded, or a negative error code, in which case the frames decoded before
+ * the error are still in the pool.
+ */
+int ff_decode_batch_js(AVCodecContext *ctx, AVPacket *pkt, const uint8_t *batch,
+                       int flags, FFFramePool *pool)
+{
+    int ret;
+
+    ff_frame_pool_reset(pool);
+
+    if (batch) {
+        const int32_t *header = (const int32_t *) batch;
+        int count = header[2];
+        const uint8_t *data = batch + header[3];
+        const double *dindex = (const double *) (batch + header[5]);
+        const int32_t *iindex = (const int32_t *) (dindex + 3 * count);
+
+        for (int i = 0; i < count; i++) {
+            AVRational tb = {iindex[4 * count + i], iindex[5 * count + i]};
+
+            /* The packet isn't refcounted, so avcodec_send_packet copies it
+             * (with padding) straight out of the batch */
+            av_packet_unref(pkt);
+            pkt->data = (uint8_t *) data + iindex[2 * count + i];
+            pkt->size = iindex[3 * count + i];
+            pkt->pts = dindex[i];
+            pkt->dts = dindex[count + i];
+            pkt->duration = dindex[2 * count + i];
+            pkt->stream_index = iindex[i];
+            pkt->flags = iindex[count + i];
+            pkt->time_base = tb;
+            if (ctx->time_base.num && tb.num) {
+                av_packet_rescale_ts(pkt, tb, ctx->time_base);
+                pkt->time_base = ctx->time_base;
+            }
+
+            ret = avcodec_send_packet(ctx, pkt);
+            pkt->data = NULL;
+            pkt->size = 0;
+            if (ret < 0) {
+                if (!(flags & FF_BATCH_IGNORE_ERRORS))
+                    return ret;
+                fprintf(stderr, "[ff_decode_batch_js] %s\n", av_err2str(ret));
+                continue;
+            }
+            if ((ret = decode_batch_receive(ctx, pool)) < 0)
+                return ret;
+        }
+    }
+
+    if (flags & FF_BATCH_FIN) {
+        ret = avcodec_send_packet(ctx, NULL);
+        if (ret < 0 && ret != AVERROR_EOF && !(flags & FF_BATCH_IGNORE_ERRORS))
+            return ret;
+        if ((ret = decode_batch_receive(ctx, pool)) < 0)
+            return ret;
+    }
+
+    return pool->nb_frames;
+}
+
+/**
+ * Encode nb_frames frames (then flush, with FF_BATCH_FIN), returning the
+ * packets as a packet batch, or NULL if out of memory. Frames are rescaled to
+ * the encoder's time base, if both are known, and are unreferenced. The
+ * batch's result is 0 or the error that stopped encoding.
+ */
+uint8_t *ff_encode_batch_js(AVCodecContext *ctx, AVFrame **frames, int nb_frames,
+                            AVPacket *pkt, int flags)
+{
+    FFPacketBatchBuilder b;
+    int i, ret = 0;
+
+    if (packet_batch_init(&b) < 0) {
+        for (i = 0; i < nb_frames; i++)
+            av_frame_unref(frames[i]);
+        return NULL;
+    }
+
+    for (i = 0; i <= nb_frames; i++) {
+        AVFrame *frame = NULL;
+
+        if (i < nb_frames) {
+            frame = frames[i];
+            if (ctx->time_base.num && frame->time_base.num) {
+                if (frame->pts != AV_NOPTS_VALUE)
+                    frame->pts = av_rescale_q(frame->pts, frame->time_base, ctx->time_base);
+                frame->time_base = ctx->time_base;
+            }
+        } else if (!(flags & FF_BATCH_FIN)) {
+            break;
+        }
+
+        ret = avcodec_send_frame(ctx, frame);
+        if (frame)
+            av_frame_unref(frame);
+        if (ret < 0)
+            break;
+
+        while ((ret = avcodec_receive_packet(ctx, pkt)) >= 0) {
+            AVRational tb = pkt->time_base.num ? pkt->time_base : ctx->time_base;
+            ret = packet_batch_add(&b, pkt, tb);
+            av_packet_unref(pkt);
+            if (ret < 0)
+                break;
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF)
+            break;
+        ret = 0;
+    }
+
+    // Frames after an error weren't sent
+    for (i++; i < nb_frames; i++)
+        av_frame_unref(frames[i]);
+
+    return packet_batch_finish(&b, ret);
+}
+#endif
+
+#if LIBAVJS_WITH_SWSCALE
+/**
+ * Decoding straight to scaled, packed video, for ff_decode_multi's scale
+ * option. Each received frame is converted by a cached SwsContext into a
+ * packed buffer owned by the scaler, and described in its public fields, so
+ * the JavaScript side reads one struct instead of calling accessors.
+ */
+typedef struct FFVideoScaler {
+    /* Public, read by offset in ff_decode_multi (p-avcodec.in.js). The last
+     * frame's geometry (width @0, height @4, format @8), packed size @12,
+     * plane count @16, plane offsets @20 and strides @36, then pts @52,
+     * ptshi @56, flags @60, key_frame @64, pict_type @68, time base @72,
+     * sample aspect ratio @80, and the data pointer @88. */
+    int32_t width, height, format, size;
+    int32_t nb_planes;
+    int32_t offset[4], stride[4];
+    uint32_t pts, ptshi;
+    int32_t flags, key_frame, pict_type;
+    int32_t time_base_num, time_base_den;
+    int32_t sample_aspect_ratio_num, sample_aspect_ratio_den;
+    uint8_t *data;
+
+    // Settings
+    int dst_width, dst_height, dst_format, sws_flags;
+
+    struct SwsContext *sws;
+    int data_size;
+} FFVideoScaler;
+
+/**
+ * Allocate a scaler. width and height may be 0 to follow the source frames
+ * (if only one is 0, keeping their aspect ratio), and pix_fmt may be -1 to
+ * keep their format. sws_flags defaults to SWS_BILINEAR.
+ */
+FFVideoScaler *ff_video_scaler_alloc(int width, int height, int pix_fmt, int sws_flags)
+{
+    FFVideoScaler *s = av_mallocz(sizeof(*s));
+    if (!s)
+        return NULL;
+    s->dst_width = width;
+    s->dst_height = height;
+    s->dst_format = pix_fmt;
+    s->sws_flags = sws_flags ? sws_flags : SWS_BILINEAR;
+    return s;
+}
+
+void ff_video_scaler_free(FFVideoScaler *s)
+{
+    if (!s)
+        return;
+    sws_freeContext(s->sws);
+    av_free(s->data);
+    av_free(s);
+}
+
+// Scale a frame into s's packed buffer and describe it
+static int video_scaler_scale(FFVideoScaler *s, const AVFrame *frame)
+{
+    uint8_t *dst_data[4];
+    int dst_linesize[4];
+    int width = s->dst_width, height = s->dst_height;
+    enum AVPixelFormat format = s->dst_format >= 0 ? s->dst_format : frame->format;
+    int size, ret;
+
+    if (frame->width <= 0 || frame->height <= 0)
+        return AVERROR(EINVAL);
+    if (!width && !height) {
+        width = frame->width;
+        height = frame->height;
+    } else if (!width) {
+        width = FFMAX(1, av_rescale(height, frame->width, frame->height));
+    } else if (!height) {
+        height = FFMAX(1, av_rescale(width, frame->height, frame->width));
+    }
+
+    s->sws = sws_getCachedContext(s->sws,
+        frame->width, frame->height, frame->format,
+        width, height, format,
+        s->sws_flags, NULL, NULL, NULL);
+    if (!s->sws)
+        return AVERROR(EINVAL);
+
+    if ((size = av_image_get_buffer_size(format, width, height, 1)) < 0)
+        return size;
+    if (size > s->data_size) {
+        av_free(s->data);
+        s->data_size = 0;
+        if (!(s->data = av_malloc(size)))
+            return AVERROR(ENOMEM);
+        s->data_size = size;
+    }
+    if ((ret = av_image_fill_arrays(dst_data, dst_linesize, s->data,
+                                    format, width, height, 1)) < 0)
+        return ret;
+
+    if ((ret = sws_scale(s->sws, (const uint8_t * const *) frame->data,
+                         frame->linesize, 0, frame->height,
+                         dst_data, dst_linesize)) < 0)
+        return ret;
+
+    s->width = width;
+    s->height = height;
+    s->format = format;
+    s->size = size;
+    s->nb_planes = av_pix_fmt_count_planes(format);
+    for (int p = 0; p < 4; p++) {
+        s->offset[p] = p < s->nb_planes ? dst_data[p] - s->data : 0;
+        s->stride[p] = p < s->nb_planes ? dst_linesize[p] : 0;
+    }
+    s->pts = (uint32_t) frame->pts;
+    s->ptshi = (uint32_t) (frame->pts >> 32);
+    s->flags = frame->flags;
+    s->key_frame = !!(frame->flags & AV_FRAME_FLAG_KEY);
+    s->pict_type = frame->pict_type;
+    s->time_base_num = frame->time_base.num;
+    s->time_base_den = frame->time_base.den;
+    s->sample_aspect_ratio_num = frame->sample_aspect_ratio.num;
+    s->sample_aspect_ratio_den = frame->sample_aspect_ratio.den;
+    return 0;
+}
+
+/**
+ * Receive a frame from a decoder and scale it with s. Returns 0, or the
+ * (negative) result of avcodec_receive_frame, including EAGAIN and EOF, or of
+ * scaling. The frame is unreferenced either way.
+ */
+int ff_decode_receive_scaled_js(AVCodecContext *ctx, AVFrame *frame, FFVideoScaler *s)
+{
+    int ret = avcodec_receive_frame(ctx, frame);
+    if (ret < 0)
+        return ret;
+    ret = video_scaler_scale(s, frame);
+    av_frame_unref(frame);
+    return ret;
+}
+#endif
+
 static const int LIBAVCODEC_VERSION_INT_V = LIBAVCODEC_VERSION_INT;
 #undef LIBAVCODEC_VERSION_INT
 int LIBAVCODEC_VERSION_INT() { return LIBAVCODEC_VERSION_INT_V; }
@@ -13,8 +13,17 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <float.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "libswresample/swresample.h"
 #include "libavutil/audio_fifo.h"
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#if LIBAVJS_WITH_SWSCALE
+#include "libswscale/swscale.h"
+#endif
 
 /* AVFormatContext */
 #define B(type, field) A(AVFormatContext, type, field)
@@ -62,6 +71,114 @@ int avformat_seek_file_approx(
     return avformat_seek_file(s, stream_index, INT64_MIN, ts, INT64_MAX, flags);
 }
 
+// Modes of ff_decode_frame_at
+#define FF_DECODE_FRAME_AT_EXACT 0    // The frame shown at ts
+#define FF_DECODE_FRAME_AT_KEYFRAME 1 // The keyframe at or before ts
+#define FF_DECODE_FRAME_AT_NEXT 2     // The first frame at or after ts
+
+static int64_t decode_frame_at_pts(const AVFrame *frame) {
+    return frame->best_effort_timestamp != AV_NOPTS_VALUE ?
+        frame->best_effort_timestamp : frame->pts;
+}
+
+/**
+ * Seek to the keyframe before ts (in stream_index's time base) and decode up
+ * to the frame that mode asks for, entirely in C: frames before the target
+ * are dropped as they're decoded, and only the target is left in frame, with
+ * its time_base set to the stream's. dec_ctx must be an opened decoder for
+ * stream_index. Returns 0 on success, or AVERROR_EOF if the stream has no
+ * such frame.
+ */
+int ff_decode_frame_at(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, int stream_index,
+                       int64_t ts, int mode, AVFrame *frame) {
+    AVPacket *pkt = NULL;
+    AVFrame *prev = NULL;
+    enum AVDiscard skip_frame = dec_ctx->skip_frame;
+    int have_prev = 0, demux_eof = 0;
+    int ret;
+
+    if (stream_index < 0 || stream_index >= (int) fmt_ctx->nb_streams ||
+        mode < FF_DECODE_FRAME_AT_EXACT || mode > FF_DECODE_FRAME_AT_NEXT)
+        return AVERROR(EINVAL);
+
+    ret = avformat_seek_file(fmt_ctx, stream_index, INT64_MIN, ts, ts, 0);
+    if (ret < 0)
+        ret = avformat_seek_file(fmt_ctx, stream_index, INT64_MIN, ts, INT64_MAX, 0);
+    if (ret < 0) return ret;
+    avcodec_flush_buffers(dec_ctx);
+    av_frame_unref(frame);
+
+    pkt = av_packet_alloc();
+    prev = av_frame_alloc();
+    if (!pkt || !prev) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if (mode == FF_DECODE_FRAME_AT_KEYFRAME)
+        dec_ctx->skip_frame = AVDISCARD_NONKEY;
+
+    while (1) {
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret >= 0) {
+            int64_t pts = decode_frame_at_pts(frame);
+            if (mode == FF_DECODE_FRAME_AT_KEYFRAME ||
+                (mode == FF_DECODE_FRAME_AT_NEXT && pts != AV_NOPTS_VALUE && pts >= ts))
+                break;
+            if (mode == FF_DECODE_FRAME_AT_EXACT && pts != AV_NOPTS_VALUE && pts > ts) {
+                // Past the target: the previous frame is the one shown at ts
+                if (have_prev) {
+                    av_frame_unref(frame);
+                    av_frame_move_ref(frame, prev);
+                }
+                break;
+            }
+            av_frame_unref(prev);
+            av_frame_move_ref(prev, frame);
+            have_prev = 1;
+            continue;
+        }
+
+        if (ret == AVERROR_EOF) {
+            // Out of frames: the last one is shown from there on
+            if (mode == FF_DECODE_FRAME_AT_EXACT && have_prev) {
+                av_frame_move_ref(frame, prev);
+                ret = 0;
+            }
+            goto end;
+        }
+        if (ret != AVERROR(EAGAIN)) goto end;
+
+        if (demux_eof) {
+            if ((ret = avcodec_send_packet(dec_ctx, NULL)) < 0) goto end;
+            continue;
+        }
+        ret = av_read_frame(fmt_ctx, pkt);
+        if (ret == AVERROR_EOF) {
+            demux_eof = 1;
+            continue;
+        }
+        if (ret < 0) goto end;
+        if (pkt->stream_index == stream_index &&
+            (mode != FF_DECODE_FRAME_AT_KEYFRAME || (pkt->flags & AV_PKT_FLAG_KEY))) {
+            ret = avcodec_send_packet(dec_ctx, pkt);
+            // Damaged packets right after a seek are expected
+            if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+                av_packet_unref(pkt);
+                goto end;
+            }
+        }
+        av_packet_unref(pkt);
+    }
+    frame->time_base = fmt_ctx->streams[stream_index]->time_base;
+    ret = 0;
+
+end:
+    dec_ctx->skip_frame = skip_frame;
+    av_frame_free(&prev);
+    av_packet_free(&pkt);
+    return ret;
+}
+
 int avformat_get_rotation(AVStream *st) {
     AVDictionaryEntry *tag = NULL;
     const uint8_t *displaymatrix = NULL;
@@ -98,12 +215,624 @@ int avformat_get_rotation(AVStream *st) {
     return 0;
 }
 
-double ff_get_media_duration(AVFormatContext* fmt_ctx) {
+/*
+ * Seek indexes. An FFSeekIndex holds the keyframes of every stream of a file
+ * (pts, dts, byte position and packet size). It's filled from the packets of
+ * any demux pass while it's attached to the demuxer (ff_seek_index_attach),
+ * or by ff_seek_index_scan, and can be serialized to a blob, loaded back, and
+ * applied to a newly opened demuxer, so that seeking doesn't depend on the
+ * file's own index. The serialized layout (little-endian) is:
+ *
+ *   char magic[4] = "LAVI", int32 version, int32 nb_streams
+ *   per stream: int32 time_base_num, time_base_den, count,
+ *               then count * {int64 pts, dts, pos; int32 size, flags}
+ */
+#define FF_SEEK_INDEX_VERSION 1
+#define FF_SEEK_INDEX_ENTRY_SIZE 32
+
+typedef struct FFSeekIndexEntry {
+    int64_t pts, dts, pos;
+    int32_t size, flags;
+} FFSeekIndexEntry;
+
+typedef struct FFSeekIndexStream {
+    FFSeekIndexEntry *entries;
+    int count, cap;
+    AVRational time_base;
+    int sorted;
+    int from_demuxer; // Taken from the demuxer's own index by ff_seek_index_scan
+} FFSeekIndexStream;
+
+typedef struct FFSeekIndex {
+    FFSeekIndexStream *streams;
+    int nb_streams;
+    int min_interval_ms; // Keyframes closer than this to the last one are skipped
+} FFSeekIndex;
+
+/**
+ * Allocate a seek index. Keyframes less than min_interval_ms after the last
+ * indexed one of the same stream are left out, which keeps streams in which
+ * every packet is a keyframe (audio) small.
+ */
+FFSeekIndex *ff_seek_index_alloc(int min_interval_ms) {
+    FFSeekIndex *idx = av_mallocz(sizeof(FFSeekIndex));
+    if (idx)
+        idx->min_interval_ms = FFMAX(min_interval_ms, 0);
+    return idx;
+}
+
+void ff_seek_index_free(FFSeekIndex *idx) {
+    if (!idx) return;
+    for (int i = 0; i < idx->nb_streams; i++)
+        av_free(idx->streams[i].entries);
+    av_free(idx->streams);
+    av_free(idx);
+}
+
+static FFSeekIndexStream *seek_index_stream(FFSeekIndex *idx, int stream_index) {
+    if (stream_index < 0) return NULL;
+    if (stream_index >= idx->nb_streams) {
+        FFSeekIndexStream *streams = av_realloc_array(idx->streams, stream_index + 1,
+                                                      sizeof(FFSeekIndexStream));
+        if (!streams) return NULL;
+        memset(streams + idx->nb_streams, 0,
+               (stream_index + 1 - idx->nb_streams) * sizeof(FFSeekIndexStream));
+        for (int i = idx->nb_streams; i <= stream_index; i++)
+            streams[i].sorted = 1;
+        idx->streams = streams;
+        idx->nb_streams = stream_index + 1;
+    }
+    return &idx->streams[stream_index];
+}
+
+static int seek_index_add(FFSeekIndex *idx, int stream_index, AVRational time_base,
+                          int64_t pts, int64_t dts, int64_t pos, int size, int flags) {
+    FFSeekIndexStream *st = seek_index_stream(idx, stream_index);
+    if (!st) return AVERROR(ENOMEM);
+    if (pts == AV_NOPTS_VALUE) pts = dts;
+    if (pts == AV_NOPTS_VALUE) return 0;
+    if (!st->time_base.num) st->time_base = time_base;
+
+    if (st->count) {
+        FFSeekIndexEntry *last = &st->entries[st->count - 1];
+        int64_t interval = st->time_base.num ?
+            av_rescale_q(idx->min_interval_ms, (AVRational){1, 1000}, st->time_base) : 0;
+        // Already indexed (e.g. a second pass over the same range)
+        if (pts == last->pts || (pos >= 0 && pos == last->pos)) return 0;
+        if (pts > last->pts && pts - last->pts < interval) return 0;
+        if (pts < last->pts) st->sorted = 0;
+    }
+
+    if (st->count >= st->cap) {
+        int cap = FFMAX(st->cap * 2, 64);
+        FFSeekIndexEntry *entries = av_realloc_array(st->entries, cap,
+                                                     sizeof(FFSeekIndexEntry));
+        if (!entries) return AVERROR(ENOMEM);
+        st->entries = entries;
+        st->cap = cap;
+    }
+    st->entries[st->count++] = (FFSeekIndexEntry) {
+        .pts = pts, .dts = dts, .pos = pos, .size = size, .flags = flags
+    };
+    return 0;
+}
+
+static int seek_index_cmp(const void *a, const void *b) {
+    const FFSeekIndexEntry *ea = a, *eb = b;
+    return FFDIFFSIGN(ea->pts, eb->pts);
+}
+
+// Sort a stream's entries by pts, dropping duplicates
+static void seek_index_sort(FFSeekIndexStream *st) {
+    int n = 0;
+    if (st->sorted) return;
+    qsort(st->entries, st->count, sizeof(FFSeekIndexEntry), seek_index_cmp);
+    for (int i = 0; i < st->count; i++) {
+        if (n && st->entries[n - 1].pts == st->entries[i].pts) continue;
+        st->entries[n++] = st->entries[i];
+    }
+    st->count = n;
+    st->sorted = 1;
+}
+
+/**
+ * Add a packet to a seek index. Only keyframes are indexed.
+ */
+int ff_seek_index_add_packet(FFSeekIndex *idx, AVFormatContext *fmt_ctx, const AVPacket *pkt) {
+    AVRational tb = pkt->time_base;
+    if (!(pkt->flags & AV_PKT_FLAG_KEY)) return 0;
+    if (fmt_ctx && pkt->stream_index < (int) fmt_ctx->nb_streams)
+        tb = fmt_ctx->streams[pkt->stream_index]->time_base;
+    return seek_index_add(idx, pkt->stream_index, tb, pkt->pts, pkt->dts, pkt->pos,
+                          pkt->size, pkt->flags);
+}
+
+/**
+ * Attach a seek index to a demuxer (or detach it, if idx is NULL), so that
+ * every packet read by ff_read_frame_multi or ff_read_frame_batch is added to
+ * it. The index isn't owned by the demuxer, and must outlive the attachment.
+ * This uses the demuxer's opaque field.
+ */
+void ff_seek_index_attach(AVFormatContext *fmt_ctx, FFSeekIndex *idx) {
+    fmt_ctx->opaque = idx;
+}
+
+// Add a packet just read to the attached seek index, if any
+void ff_seek_index_record(AVFormatContext *fmt_ctx, const AVPacket *pkt) {
+    if (fmt_ctx->opaque)
+        ff_seek_index_add_packet(fmt_ctx->opaque, fmt_ctx, pkt);
+}
+
+/**
+ * Fill a seek index for a whole file, without decoding. Streams for which the
+ * demuxer already has an index from the file (e.g. MP4, or WebM with cues)
+ * are taken from it; if any other stream isn't discarded, every packet is
+ * read (but not decoded), and the demuxer is then seeked back to the start.
+ */
+int ff_seek_index_scan(AVFormatContext *fmt_ctx, FFSeekIndex *idx) {
+    AVPacket *pkt;
+    int need_read = 0, ret;
+    // With a generic index, the demuxer only knows what it has read so far
+    int native = !(fmt_ctx->iformat->flags & AVFMT_GENERIC_INDEX);
+
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        int n = native ? avformat_index_get_entries_count(st) : 0;
+        if (st->discard >= AVDISCARD_ALL) continue;
+        if (!n) {
+            need_read = 1;
+            continue;
+        }
+        for (int j = 0; j < n; j++) {
+            const AVIndexEntry *e = avformat_index_get_entry(st, j);
+            if (!(e->flags & AVINDEX_KEYFRAME)) continue;
+            if ((ret = seek_index_add(idx, i, st->time_base, e->timestamp, e->timestamp,
+                                      e->pos, e->size, AV_PKT_FLAG_KEY)) < 0)
+                return ret;
+        }
+        if (i < (unsigned) idx->nb_streams)
+            idx->streams[i].from_demuxer = 1;
+    }
+    if (!need_read) return 0;
+
+    pkt = av_packet_alloc();
+    if (!pkt) return AVERROR(ENOMEM);
+    while ((ret = av_read_frame(fmt_ctx, pkt)) >= 0) {
+        if (pkt->stream_index >= idx->nb_streams ||
+            !idx->streams[pkt->stream_index].from_demuxer)
+            ret = ff_seek_index_add_packet(idx, fmt_ctx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) break;
+    }
+    av_packet_free(&pkt);
+    if (ret != AVERROR_EOF) return ret;
+
+    // Unseekable input (a pipe) can't be rewound, but the index is complete
+    avformat_seek_file(fmt_ctx, -1, INT64_MIN,
+                       fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0,
+                       INT64_MAX, 0);
+    return 0;
+}
+
+/**
+ * Number of entries in a seek index for a stream.
+ */
+int ff_seek_index_count(FFSeekIndex *idx, int stream_index) {
+    if (stream_index < 0 || stream_index >= idx->nb_streams) return 0;
+    seek_index_sort(&idx->streams[stream_index]);
+    return idx->streams[stream_index].count;
+}
+
+/**
+ * Serialize a seek index into a newly allocated blob in *out (to be freed by
+ * the caller). Returns the size of the blob.
+ */
+int ff_seek_index_serialize(FFSeekIndex *idx, uint8_t **out) {
+    size_t size = 12;
+    uint8_t *buf, *p;
+
+    *out = NULL;
+    for (int i = 0; i < idx->nb_streams; i++) {
+        seek_index_sort(&idx->streams[i]);
+        size += 12 + (size_t) idx->streams[i].count * FF_SEEK_INDEX_ENTRY_SIZE;
+    }
+    if (size > INT_MAX) return AVERROR(ERANGE);
+
+    p = buf = av_malloc(size);
+    if (!buf) return AVERROR(ENOMEM);
+    memcpy(p, "LAVI", 4);
+    AV_WL32(p + 4, FF_SEEK_INDEX_VERSION);
+    AV_WL32(p + 8, idx->nb_streams);
+    p += 12;
+    for (int i = 0; i < idx->nb_streams; i++) {
+        const FFSeekIndexStream *st = &idx->streams[i];
+        AV_WL32(p, st->time_base.num);
+        AV_WL32(p + 4, st->time_base.den);
+        AV_WL32(p + 8, st->count);
+        p += 12;
+        for (int j = 0; j < st->count; j++) {
+            const FFSeekIndexEntry *e = &st->entries[j];
+            AV_WL64(p, e->pts);
+            AV_WL64(p + 8, e->dts);
+            AV_WL64(p + 16, e->pos);
+            AV_WL32(p + 24, e->size);
+            AV_WL32(p + 28, e->flags);
+            p += FF_SEEK_INDEX_ENTRY_SIZE;
+        }
+    }
+
+    *out = buf;
+    return size;
+}
+
+/**
+ * Load a seek index serialized by ff_seek_index_serialize into *out.
+ */
+int ff_seek_index_load(const uint8_t *data, int size, FFSeekIndex **out) {
+    const uint8_t *p = data, *end = data + size;
+    FFSeekIndex *idx;
+    int nb_streams, ret;
+
+    *out = NULL;
+    if (size < 12 || memcmp(p, "LAVI", 4) || AV_RL32(p + 4) != FF_SEEK_INDEX_VERSION)
+        return AVERROR_INVALIDDATA;
+    nb_streams = AV_RL32(p + 8);
+    p += 12;
+    if (nb_streams < 0 || nb_streams > (end - p) / 12) return AVERROR_INVALIDDATA;
+
+    if (!(idx = ff_seek_index_alloc(0))) return AVERROR(ENOMEM);
+    if (nb_streams && !seek_index_stream(idx, nb_streams - 1)) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (int i = 0; i < nb_streams; i++) {
+        FFSeekIndexStream *st = &idx->streams[i];
+        int count;
+        if (end - p < 12) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+        st->time_base = (AVRational){AV_RL32(p), AV_RL32(p + 4)};
+        count = AV_RL32(p + 8);
+        p += 12;
+        if (count < 0 || count > (end - p) / FF_SEEK_INDEX_ENTRY_SIZE) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+        if (count && !(st->entries = av_malloc_array(count, sizeof(FFSeekIndexEntry)))) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        st->count = st->cap = count;
+        st->sorted = 0;
+        for (int j = 0; j < count; j++) {
+            st->entries[j] = (FFSeekIndexEntry) {
+                .pts = AV_RL64(p), .dts = AV_RL64(p + 8), .pos = AV_RL64(p + 16),
+                .size = AV_RL32(p + 24), .flags = AV_RL32(p + 28)
+            };
+            p += FF_SEEK_INDEX_ENTRY_SIZE;
+        }
+        seek_index_sort(st);
+    }
+
+    *out = idx;
+    return 0;
+
+fail:
+    ff_seek_index_free(idx);
+    return ret;
+}
+
+/**
+ * Add the entries of a seek index to a demuxer's own index (as with
+ * av_add_index_entry), so that avformat_seek_file can use them.
+ */
+int ff_seek_index_apply(AVFormatContext *fmt_ctx, FFSeekIndex *idx) {
+    for (int i = 0; i < idx->nb_streams && i < (int) fmt_ctx->nb_streams; i++) {
+        FFSeekIndexStream *sst = &idx->streams[i];
+        AVStream *st = fmt_ctx->streams[i];
+        int rescale = sst->time_base.num && av_cmp_q(sst->time_base, st->time_base);
+        seek_index_sort(sst);
+        for (int j = 0; j < sst->count; j++) {
+            const FFSeekIndexEntry *e = &sst->entries[j];
+            int64_t ts = e->dts != AV_NOPTS_VALUE ? e->dts : e->pts;
+            if (e->pos < 0) continue;
+            if (rescale) ts = av_rescale_q(ts, sst->time_base, st->time_base);
+            if (av_add_index_entry(st, e->pos, ts, e->size, 0, AVINDEX_KEYFRAME) < 0)
+                return AVERROR(ENOMEM);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Seek to the last keyframe of stream_index at or before ts (in the stream's
+ * time base), as found by binary search in a seek index. The index should
+ * have been applied to the demuxer with ff_seek_index_apply, so that the
+ * demuxer seeks straight to the keyframe's position. Falls back to a plain
+ * avformat_seek_file if the index has nothing for the stream.
+ */
+int ff_seek_index_seek(AVFormatContext *fmt_ctx, FFSeekIndex *idx, int stream_index,
+                       int64_t ts) {
+    FFSeekIndexStream *sst;
+    const FFSeekIndexEntry *e;
+    AVRational tb;
+    int lo = 0, hi;
+
+    if (stream_index < 0 || stream_index >= (int) fmt_ctx->nb_streams)
+        return AVERROR(EINVAL);
+    if (stream_index >= idx->nb_streams || !idx->streams[stream_index].count)
+        return avformat_seek_file(fmt_ctx, stream_index, INT64_MIN, ts, ts, 0);
+
+    sst = &idx->streams[stream_index];
+    tb = fmt_ctx->streams[stream_index]->time_base;
+    seek_index_sort(sst);
+    if (sst->time_base.num && av_cmp_q(sst->time_base, tb))
+        ts = av_rescale_q(ts, tb, sst->time_base);
+
+    // Last entry with pts <= ts, or the first if there's none
+    hi = sst->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (sst->entries[mid].pts <= ts)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    e = &sst->entries[lo];
+
+    // The demuxer's index is keyed by dts, as ff_seek_index_apply adds it
+    ts = e->dts != AV_NOPTS_VALUE ? e->dts : e->pts;
+    if (sst->time_base.num && av_cmp_q(sst->time_base, tb))
+        ts = av_rescale_q(ts, sst->time_base, tb);
+    return avformat_seek_file(fmt_ctx, stream_index, INT64_MIN, ts, ts, 0);
+}
+
+/*
+ * Packet batches. ff_read_frame_batch reads many packets in one call, packed
+ * as described at FFPacketBatchBuilder (b-avcodec.c), so that JavaScript can
+ * copy the whole batch out in one go.
+ */
+uint8_t *ff_read_frame_batch(
+    AVFormatContext *fmt_ctx, AVPacket *pkt, int stream_index, int limit,
+    int max_packets
+) {
+    FFPacketBatchBuilder b;
+    int ret;
+
+    if (packet_batch_init(&b) < 0)
+        return NULL;
+
+    while (1) {
+        AVRational tb;
+
+        ret = av_read_frame(fmt_ctx, pkt);
+        if (ret < 0)
+            break;
+        ff_seek_index_record(fmt_ctx, pkt);
+
+        if (stream_index >= 0 && pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        tb = pkt->time_base;
+        if (!tb.num)
+            tb = fmt_ctx->streams[pkt->stream_index]->time_base;
+
+        ret = packet_batch_add(&b, pkt, tb);
+        av_packet_unref(pkt);
+        if (ret < 0)
+            break;
+
+        // Check byte limit and packet count limit (always return at least 1 packet)
+        if ((limit > 0 && b.data_size >= limit) ||
+            (max_packets > 0 && b.nb_packets >= max_packets)) {
+            ret = AVERROR(EAGAIN);
+            break;
+        }
+    }
+
+    return packet_batch_finish(&b, ret);
+}
+
+/*
+ * Media duration probing. The container or stream headers are used if they
+ * have a duration. Otherwise, only a bounded window at the end of the file is
+ * read, and if even that fails, the duration is estimated from the bitrate.
+ * The confidence of the result is reported as one of FF_DURATION_*.
+ */
+#define FF_DURATION_NONE 0      // No duration could be determined
+#define FF_DURATION_ESTIMATE 1  // Estimated from the bitrate and file size
+#define FF_DURATION_TAIL 2      // Measured from the last packets of the file
+#define FF_DURATION_HEADER 3    // Given by the container or stream headers
+
+#define FF_DURATION_TAIL_BYTES (4 * 1024 * 1024)
+#define FF_DURATION_TAIL_PACKETS 4096
+
+/* Durations of recently probed files, keyed by path, size, mtime and the
+ * tail-scan limits, so that reopening the same media doesn't probe it again,
+ * but a probe with different limits doesn't get another probe's result */
+#define FF_DURATION_CACHE_SIZE 64
+typedef struct FFDurationCacheEntry {
+    char *path;
+    int64_t size, mtime;
+    int tail_bytes, tail_packets;
+    double duration;
+    int confidence;
+} FFDurationCacheEntry;
+static FFDurationCacheEntry ff_duration_cache[FF_DURATION_CACHE_SIZE];
+static int ff_duration_cache_next = 0;
+
+// Get the cache key of a file. Returns 0 if it can't be cached.
+static int ff_duration_cache_key(
+    AVFormatContext *fmt_ctx, int64_t *size, int64_t *mtime
+) {
+    struct stat st;
+
+    if (!fmt_ctx->url || !fmt_ctx->url[0])
+        return 0;
+
+    if (stat(fmt_ctx->url, &st) == 0) {
+        *size = st.st_size;
+        *mtime = st.st_mtime;
+    } else {
+        // Not a file (e.g. a URL), so the size is all we have
+        *size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+        *mtime = 0;
+    }
+
+    return *size > 0;
+}
+
+static FFDurationCacheEntry *ff_duration_cache_find(
+    const char *path, int64_t size, int64_t mtime, int tail_bytes,
+    int tail_packets
+) {
+    for (int i = 0; i < FF_DURATION_CACHE_SIZE; i++) {
+        FFDurationCacheEntry *entry = &ff_duration_cache[i];
+        if (entry->path && entry->size == size && entry->mtime == mtime &&
+            entry->tail_bytes == tail_bytes &&
+            entry->tail_packets == tail_packets &&
+            !strcmp(entry->path, path))
+            return entry;
+    }
+    return NULL;
+}
+
+static void ff_duration_cache_add(
+    const char *path, int64_t size, int64_t mtime, int tail_bytes,
+    int tail_packets, double duration, int confidence
+) {
+    FFDurationCacheEntry *entry = ff_duration_cache_find(path, size, mtime,
+        tail_bytes, tail_packets);
+    if (!entry) {
+        entry = &ff_duration_cache[ff_duration_cache_next];
+        ff_duration_cache_next =
+            (ff_duration_cache_next + 1) % FF_DURATION_CACHE_SIZE;
+        av_freep(&entry->path);
+        entry->path = av_strdup(path);
+        if (!entry->path)
+            return;
+        entry->size = size;
+        entry->mtime = mtime;
+        entry->tail_bytes = tail_bytes;
+        entry->tail_packets = tail_packets;
+    }
+    entry->duration = duration;
+    entry->confidence = confidence;
+}
+
+/**
+ * Measure the duration from the last packets of each video stream, reading at
+ * most tail_bytes bytes and tail_packets packets. Returns 0 if the end of the
+ * file wasn't reached within those limits.
+ */
+static double ff_get_media_duration_tail(
+    AVFormatContext *fmt_ctx, int tail_bytes, int tail_packets
+) {
+    int64_t size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+    int have_video = 0, seeked = 0, eof = 0;
+    int64_t read_bytes = 0;
+    int read_packets = 0;
+    double max_end = 0.0;
+    AVPacket *pkt;
+
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (fmt_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+            have_video = 1;
+    }
+    if (!have_video)
+        return 0.0;
+
+    /* Jump straight to the tail window if the demuxer can seek by bytes,
+     * otherwise to the last keyframe */
+    if (size > tail_bytes && tail_bytes > 0 && fmt_ctx->iformat &&
+        !(fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        seeked = av_seek_frame(fmt_ctx, -1, size - tail_bytes,
+            AVSEEK_FLAG_BYTE) >= 0;
+    if (!seeked)
+        seeked = av_seek_frame(fmt_ctx, av_find_default_stream_index(fmt_ctx),
+            INT64_MAX, AVSEEK_FLAG_BACKWARD) >= 0;
+    if (!seeked)
+        return 0.0;
+
+    pkt = av_packet_alloc();
+    if (!pkt)
+        return 0.0;
+
+    while (1) {
+        AVStream *st;
+        int ret = av_read_frame(fmt_ctx, pkt);
+        if (ret < 0) {
+            eof = (ret == AVERROR_EOF);
+            break;
+        }
+
+        st = fmt_ctx->streams[pkt->stream_index];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            pkt->pts != AV_NOPTS_VALUE) {
+            double tb = av_q2d(st->time_base);
+            double end_sec = pkt->pts * tb + fmax(0.0, pkt->duration * tb);
+            if (end_sec > max_end)
+                max_end = end_sec;
+        }
+
+        read_bytes += pkt->size;
+        read_packets++;
+        av_packet_unref(pkt);
+
+        if ((tail_bytes > 0 && read_bytes > tail_bytes) ||
+            (tail_packets > 0 && read_packets >= tail_packets))
+            break;
+    }
+    av_packet_free(&pkt);
+
+    return eof ? max_end : 0.0;
+}
+
+// Estimate the duration from the bitrate and file size
+static double ff_get_media_duration_estimate(AVFormatContext *fmt_ctx) {
+    int64_t size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+    int64_t bit_rate = fmt_ctx->bit_rate;
+
+    if (size <= 0)
+        return 0.0;
+
+    if (bit_rate <= 0) {
+        bit_rate = 0;
+        for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+            if (fmt_ctx->streams[i]->codecpar->bit_rate > 0)
+                bit_rate += fmt_ctx->streams[i]->codecpar->bit_rate;
+        }
+    }
+    if (bit_rate <= 0)
+        return 0.0;
+
+    return size * 8.0 / bit_rate;
+}
+
+/**
+ * Probe the duration of a media file, reading at most a bounded tail window
+ * (tail_bytes bytes and tail_packets packets; 0 for no limit) when the headers
+ * don't give a duration. If confidence is non-NULL, the confidence of the
+ * result (FF_DURATION_*) is written to it.
+ */
+double ff_get_media_duration_probe(
+    AVFormatContext *fmt_ctx, int tail_bytes, int tail_packets,
+    int *confidence
+) {
+    FFDurationCacheEntry *entry;
+    int64_t size, mtime;
+    int cacheable, conf = FF_DURATION_NONE;
+    double duration = 0.0;
+
     if (fmt_ctx->duration != AV_NOPTS_VALUE && fmt_ctx->duration > 0) {
+        if (confidence)
+            *confidence = FF_DURATION_HEADER;
         return fmt_ctx->duration / (double)AV_TIME_BASE;
     }
 
-    double max_sec = 0.0;
     for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
         AVStream *st = fmt_ctx->streams[i];
         if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
@@ -112,41 +841,48 @@ double ff_get_media_duration(AVFormatContext* fmt_ctx) {
         if (st->duration != AV_NOPTS_VALUE && st->duration > 0) {
             AVRational tb = st->time_base;
             double sec = st->duration * ((double)tb.num / tb.den);
-            if (sec > max_sec) max_sec = sec;
+            if (sec > duration) duration = sec;
         }
     }
-    if (max_sec > 0.0) {
-        return max_sec;
+    if (duration > 0.0) {
+        if (confidence)
+            *confidence = FF_DURATION_HEADER;
+        return duration;
     }
 
-    double max_fallback = 0.0;
-    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
-        AVStream *st = fmt_ctx->streams[i];
-        if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
-            continue;
+    // The rest requires reading, so check the cache first
+    cacheable = ff_duration_cache_key(fmt_ctx, &size, &mtime);
+    if (cacheable) {
+        entry = ff_duration_cache_find(fmt_ctx->url, size, mtime,
+            tail_bytes, tail_packets);
+        if (entry) {
+            if (confidence)
+                *confidence = entry->confidence;
+            return entry->duration;
         }
-        if (av_seek_frame(fmt_ctx, i, INT64_MAX, AVSEEK_FLAG_BACKWARD) < 0)
-            continue;
+    }
 
-        AVPacket *pkt = av_packet_alloc();
-        if (!pkt) continue;
-
-        while (av_read_frame(fmt_ctx, pkt) == 0) {
-            if (pkt->stream_index == (int)i && pkt->pts != AV_NOPTS_VALUE) {
-                AVRational tb = st->time_base;
-                double sec = pkt->pts * ((double)tb.num / tb.den);
-                double duration_sec = pkt->duration * ((double)tb.num / tb.den);
-                double gap_sec = fmax(0.0, duration_sec);
-                double end_sec = sec + gap_sec;
-                if (end_sec > max_fallback) {
-                    max_fallback = end_sec;
-                }
-            }
-            av_packet_unref(pkt);
-        }
-        av_packet_free(&pkt);
+    duration = ff_get_media_duration_tail(fmt_ctx, tail_bytes, tail_packets);
+    if (duration > 0.0) {
+        conf = FF_DURATION_TAIL;
+    } else {
+        duration = ff_get_media_duration_estimate(fmt_ctx);
+        if (duration > 0.0)
+            conf = FF_DURATION_ESTIMATE;
     }
-    return max_fallback;
+
+    if (cacheable && conf != FF_DURATION_NONE)
+        ff_duration_cache_add(fmt_ctx->url, size, mtime, tail_bytes,
+            tail_packets, duration, conf);
+
+    if (confidence)
+        *confidence = conf;
+    return duration;
+}
+
+double ff_get_media_duration(AVFormatContext* fmt_ctx) {
+    return ff_get_media_duration_probe(fmt_ctx, FF_DURATION_TAIL_BYTES,
+        FF_DURATION_TAIL_PACKETS, NULL);
 }
 
 const char *ff_get_timecode(AVFormatContext *fmt_ctx) {
@@ -192,20 +928,167 @@ int avstream_get_sample_aspect_ratio_den(AVStream *st) {
     return st->sample_aspect_ratio.den;
 }
 
-AVFormatContext *avformat_alloc_output_context2_js(AVOutputFormat *oformat,
-    const char *format_name, const char *filename)
-{
-    AVFormatContext *ret = NULL;
-    int err = avformat_alloc_output_context2(&ret, oformat, format_name, filename);
-    if (err < 0)
-        fprintf(stderr, "[avformat_alloc_output_context2_js] %s\n", av_err2str(err));
-    return ret;
-}
+/**
+ * Batch probing for media import. Each file is opened with a small probesize
+ * and analyzeduration, and avformat_find_stream_info (which decodes frames of
+ * every stream) is only run if the container headers leave something out.
+ * The results are written as one fixed-layout FFProbeResult per file.
+ */
+#define FF_PROBE_BATCH_FULL 1 // Always run avformat_find_stream_info
 
-AVFormatContext *avformat_open_input_js(const char *url, AVInputFormat *fmt,
-    AVDictionary *options)
-{
-    AVDictionary** options_p = &options;
+// FFProbeResult flags
+#define FF_PROBE_DECODED 1 // The headers didn't suffice, so streams were probed
+
+/* 128 bytes, read by offset in ff_probe_batch (p-avformat.in.js), so keep the
+ * two in step */
+typedef struct FFProbeResult {
+    int32_t status; // 0, or a negative error code
+    int32_t flags;
+    int32_t nb_streams;
+    int32_t video_index, audio_index; // -1 if there is none
+    int32_t video_codec_id, width, height, rotation;
+    int32_t audio_codec_id, sample_rate, channels;
+    double duration, frame_rate, bit_rate; // at 48, 56, 64
+    char timecode[16]; // at 72
+    char format_name[32]; // at 88
+    char major_brand[8]; // at 120
+} FFProbeResult;
+
+// Duration from the headers, in seconds, or 0 if they don't give one
+static double probe_duration(AVFormatContext *fmt_ctx) {
+    double duration = 0.0;
+    if (fmt_ctx->duration != AV_NOPTS_VALUE && fmt_ctx->duration > 0)
+        return fmt_ctx->duration / (double)AV_TIME_BASE;
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        if (st->duration != AV_NOPTS_VALUE && st->duration > 0)
+            duration = FFMAX(duration, st->duration * av_q2d(st->time_base));
+    }
+    return duration;
+}
+
+// Whether the headers alone give everything FFProbeResult needs
+static int probe_headers_suffice(AVFormatContext *fmt_ctx) {
+    if ((fmt_ctx->ctx_flags & AVFMTCTX_NOHEADER) || !fmt_ctx->nb_streams)
+        return 0;
+
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        if (par->codec_id == AV_CODEC_ID_NONE)
+            return 0;
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO &&
+            !(st->disposition & AV_DISPOSITION_ATTACHED_PIC) &&
+            (par->width <= 0 || par->height <= 0 ||
+             avstream_get_frame_rate(st) <= 0))
+            return 0;
+        if (par->codec_type == AVMEDIA_TYPE_AUDIO &&
+            (par->sample_rate <= 0 || par->ch_layout.nb_channels <= 0))
+            return 0;
+    }
+
+    return probe_duration(fmt_ctx) > 0;
+}
+
+static int probe_file(const char *filename, int probesize, double analyze_duration,
+                      int flags, FFProbeResult *res) {
+    AVFormatContext *fmt_ctx = avformat_alloc_context();
+    const char *tag;
+    int64_t size;
+    int ret;
+
+    if (!fmt_ctx)
+        return AVERROR(ENOMEM);
+    if (probesize > 0)
+        fmt_ctx->probesize = probesize;
+    if (analyze_duration > 0)
+        fmt_ctx->max_analyze_duration = (int64_t)(analyze_duration * AV_TIME_BASE);
+
+    if ((ret = avformat_open_input(&fmt_ctx, filename, NULL, NULL)) < 0)
+        return ret;
+
+    if ((flags & FF_PROBE_BATCH_FULL) || !probe_headers_suffice(fmt_ctx)) {
+        if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0)
+            goto end;
+        res->flags |= FF_PROBE_DECODED;
+    }
+
+    res->nb_streams = fmt_ctx->nb_streams;
+    res->duration = probe_duration(fmt_ctx);
+    res->bit_rate = fmt_ctx->bit_rate;
+    size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+    if (res->bit_rate <= 0 && size > 0 && res->duration > 0)
+        res->bit_rate = size * 8.0 / res->duration;
+
+    res->video_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (res->video_index >= 0) {
+        AVStream *st = fmt_ctx->streams[res->video_index];
+        res->video_codec_id = st->codecpar->codec_id;
+        res->width = st->codecpar->width;
+        res->height = st->codecpar->height;
+        res->rotation = avformat_get_rotation(st);
+        res->frame_rate = avstream_get_frame_rate(st);
+    } else {
+        res->video_index = -1;
+    }
+
+    res->audio_index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (res->audio_index >= 0) {
+        AVCodecParameters *par = fmt_ctx->streams[res->audio_index]->codecpar;
+        res->audio_codec_id = par->codec_id;
+        res->sample_rate = par->sample_rate;
+        res->channels = par->ch_layout.nb_channels;
+    } else {
+        res->audio_index = -1;
+    }
+
+    if ((tag = ff_get_timecode(fmt_ctx)))
+        av_strlcpy(res->timecode, tag, sizeof(res->timecode));
+    if (fmt_ctx->iformat)
+        av_strlcpy(res->format_name, fmt_ctx->iformat->name, sizeof(res->format_name));
+    if ((tag = ff_get_major_brand(fmt_ctx)))
+        av_strlcpy(res->major_brand, tag, sizeof(res->major_brand));
+    ret = 0;
+
+end:
+    avformat_close_input(&fmt_ctx);
+    return ret;
+}
+
+/**
+ * Probe nb_files files, writing an FFProbeResult for each to out. probesize
+ * (bytes) and analyze_duration (seconds) limit what is read if the streams
+ * must be probed; 0 keeps libavformat's defaults. A file that can't be probed
+ * only gets an error status. Returns the number of files probed successfully.
+ */
+int ff_probe_batch_js(char **filenames, int nb_files, int probesize,
+                      double analyze_duration, int flags, FFProbeResult *out) {
+    int ok = 0;
+    for (int i = 0; i < nb_files; i++) {
+        FFProbeResult *res = &out[i];
+        memset(res, 0, sizeof(*res));
+        res->video_index = res->audio_index = -1;
+        res->status = probe_file(filenames[i], probesize, analyze_duration, flags, res);
+        if (res->status >= 0)
+            ok++;
+    }
+    return ok;
+}
+
+AVFormatContext *avformat_alloc_output_context2_js(AVOutputFormat *oformat,
+    const char *format_name, const char *filename)
+{
+    AVFormatContext *ret = NULL;
+    int err = avformat_alloc_output_context2(&ret, oformat, format_name, filename);
+    if (err < 0)
+        fprintf(stderr, "[avformat_alloc_output_context2_js] %s\n", av_err2str(err));
+    return ret;
+}
+
+AVFormatContext *avformat_open_input_js(const char *url, AVInputFormat *fmt,
+    AVDictionary *options)
+{
+    AVDictionary** options_p = &options;
     AVFormatContext *ret = avformat_alloc_context();
 
     if (!ret) {
@@ -221,6 +1104,128 @@ AVFormatContext *avformat_open_input_js(const char *url, AVInputFormat *fmt,
     return ret;
 }
 
+/**
+ * Stream info snapshots. avformat_find_stream_info may decode several frames
+ * of every stream, so reopening a file that has already been probed can
+ * restore what it found instead.
+ */
+typedef struct FFStreamInfoStream {
+    AVCodecParameters *codecpar;
+    AVRational r_frame_rate, avg_frame_rate, sample_aspect_ratio;
+    int64_t start_time, duration, nb_frames;
+} FFStreamInfoStream;
+
+typedef struct FFStreamInfo {
+    const AVInputFormat *iformat;
+    int64_t size; // Of the input, to notice a different file with the same name
+    int64_t start_time, duration, bit_rate;
+    FFStreamInfoStream *streams;
+    unsigned nb_streams;
+} FFStreamInfo;
+
+void ff_stream_info_free(FFStreamInfo *info) {
+    if (!info) return;
+    for (unsigned i = 0; i < info->nb_streams; i++)
+        avcodec_parameters_free(&info->streams[i].codecpar);
+    av_free(info->streams);
+    av_free(info);
+}
+
+/**
+ * Snapshot the stream parameters of a probed demuxer. Returns NULL if out of
+ * memory.
+ */
+FFStreamInfo *ff_stream_info_snapshot(AVFormatContext *fmt_ctx) {
+    FFStreamInfo *info = av_mallocz(sizeof(FFStreamInfo));
+    if (!info) return NULL;
+
+    info->iformat = fmt_ctx->iformat;
+    info->size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+    info->start_time = fmt_ctx->start_time;
+    info->duration = fmt_ctx->duration;
+    info->bit_rate = fmt_ctx->bit_rate;
+    info->streams = av_calloc(fmt_ctx->nb_streams, sizeof(*info->streams));
+    if (!info->streams && fmt_ctx->nb_streams) goto fail;
+    info->nb_streams = fmt_ctx->nb_streams;
+
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        FFStreamInfoStream *sst = &info->streams[i];
+        sst->codecpar = avcodec_parameters_alloc();
+        if (!sst->codecpar || avcodec_parameters_copy(sst->codecpar, st->codecpar) < 0)
+            goto fail;
+        sst->r_frame_rate = st->r_frame_rate;
+        sst->avg_frame_rate = st->avg_frame_rate;
+        sst->sample_aspect_ratio = st->sample_aspect_ratio;
+        sst->start_time = st->start_time;
+        sst->duration = st->duration;
+        sst->nb_frames = st->nb_frames;
+    }
+
+    return info;
+
+fail:
+    ff_stream_info_free(info);
+    return NULL;
+}
+
+// Whether a snapshot describes a just-opened (unprobed) demuxer
+static int stream_info_matches(AVFormatContext *fmt_ctx, FFStreamInfo *info) {
+    int64_t size = fmt_ctx->pb ? avio_size(fmt_ctx->pb) : -1;
+
+    // Demuxers without a header only find their streams by reading
+    if (fmt_ctx->ctx_flags & AVFMTCTX_NOHEADER)
+        return 0;
+    if (fmt_ctx->iformat != info->iformat || size != info->size ||
+        fmt_ctx->nb_streams != info->nb_streams)
+        return 0;
+
+    for (unsigned i = 0; i < info->nb_streams; i++) {
+        const AVCodecParameters *par = fmt_ctx->streams[i]->codecpar;
+        const AVCodecParameters *probed = info->streams[i].codecpar;
+        if ((par->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+             par->codec_type != probed->codec_type) ||
+            (par->codec_id != AV_CODEC_ID_NONE &&
+             par->codec_id != probed->codec_id))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Give a just-opened demuxer the stream parameters of a snapshot taken of the
+ * same file, instead of probing it. If the snapshot doesn't match (or is NULL),
+ * the demuxer is probed with avformat_find_stream_info after all. Returns 1 if
+ * the snapshot was restored, 0 if the demuxer was probed, or a negative error
+ * code.
+ */
+int ff_stream_info_restore(AVFormatContext *fmt_ctx, FFStreamInfo *info) {
+    int ret;
+
+    if (!info || !stream_info_matches(fmt_ctx, info)) {
+        ret = avformat_find_stream_info(fmt_ctx, NULL);
+        return (ret < 0) ? ret : 0;
+    }
+
+    for (unsigned i = 0; i < info->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        FFStreamInfoStream *sst = &info->streams[i];
+        if ((ret = avcodec_parameters_copy(st->codecpar, sst->codecpar)) < 0)
+            return ret;
+        st->r_frame_rate = sst->r_frame_rate;
+        st->avg_frame_rate = sst->avg_frame_rate;
+        st->sample_aspect_ratio = sst->sample_aspect_ratio;
+        st->start_time = sst->start_time;
+        st->duration = sst->duration;
+        st->nb_frames = sst->nb_frames;
+    }
+    fmt_ctx->start_time = info->start_time;
+    fmt_ctx->duration = info->duration;
+    fmt_ctx->bit_rate = info->bit_rate;
+
+    return 1;
+}
+
 AVIOContext *avio_open2_js(const char *url, int flags,
     const AVIOInterruptCB *int_cb, AVDictionary *options)
 {
@@ -232,6 +1237,119 @@ AVIOContext *avio_open2_js(const char *url, int flags,
     return ret;
 }
 
+/*
+ * AVIO sources. These read input straight from a JS source (a Blob, an
+ * ArrayBuffer or a reader object, see mkaviosource) into the AVIOContext's
+ * buffer, rather than through an Emscripten FS device, which would first copy
+ * it into the device and then again into the AVIOContext.
+ */
+EM_JS(int, libavjs_avio_source_read, (int id, uint8_t *buf, int size, double pos), {
+    // Asyncify replays this body on resume, so the read must be in here
+    return Asyncify.handleAsync(function() {
+        return Promise.resolve(Module.avioSourceRead(id, buf, size, pos));
+    });
+});
+
+typedef struct AVIOSource {
+    int id;
+    int64_t pos, size;
+} AVIOSource;
+
+static int avio_source_read(void *opaque, uint8_t *buf, int size) {
+    AVIOSource *src = opaque;
+    int ret;
+    if (src->pos >= src->size) return AVERROR_EOF;
+    size = FFMIN(size, src->size - src->pos);
+    ret = libavjs_avio_source_read(src->id, buf, size, src->pos);
+    if (ret > 0) src->pos += ret;
+    else if (ret == 0) ret = AVERROR_EOF;
+    return ret;
+}
+
+static int64_t avio_source_seek(void *opaque, int64_t offset, int whence) {
+    AVIOSource *src = opaque;
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE: return src->size;
+        case SEEK_SET: break;
+        case SEEK_CUR: offset += src->pos; break;
+        case SEEK_END: offset += src->size; break;
+        default: return AVERROR(EINVAL);
+    }
+    if (offset < 0) return AVERROR(EINVAL);
+    src->pos = offset;
+    return offset;
+}
+
+/**
+ * Open a demuxer on AVIO source id (see mkaviosource), which is size bytes
+ * long, reading it in buffer_size chunks. Returns NULL on failure. Close it
+ * with ff_avio_source_close, not avformat_close_input.
+ */
+AVFormatContext *ff_avio_source_open(int id, double size, int buffer_size,
+                                     AVInputFormat *fmt) {
+    AVFormatContext *fmt_ctx = NULL;
+    AVIOSource *src = NULL;
+    AVIOContext *pb = NULL;
+    uint8_t *buf = NULL;
+    int ret;
+
+    if (buffer_size <= 0) buffer_size = 262144;
+    src = av_mallocz(sizeof(AVIOSource));
+    buf = av_malloc(buffer_size);
+    if (!src || !buf) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    src->id = id;
+    src->size = size;
+
+    pb = avio_alloc_context(buf, buffer_size, 0, src, avio_source_read, NULL,
+                            avio_source_seek);
+    if (!pb) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    buf = NULL;
+    pb->seekable = AVIO_SEEKABLE_NORMAL;
+
+    fmt_ctx = avformat_alloc_context();
+    if (!fmt_ctx) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    fmt_ctx->pb = pb;
+    // GENPTS as in avformat_open_input_js, so this matches ff_init_demuxer_file
+    fmt_ctx->flags |= AVFMT_FLAG_CUSTOM_IO | AVFMT_FLAG_GENPTS;
+
+    // On failure, this frees fmt_ctx but leaves our pb
+    if ((ret = avformat_open_input(&fmt_ctx, NULL, fmt, NULL)) < 0)
+        goto fail;
+    return fmt_ctx;
+
+fail:
+    fprintf(stderr, "[ff_avio_source_open] %s\n", av_err2str(ret));
+    if (pb) av_freep(&pb->buffer);
+    avio_context_free(&pb);
+    av_free(buf);
+    av_free(src);
+    return NULL;
+}
+
+/**
+ * Close a demuxer opened with ff_avio_source_open, and free its AVIOContext.
+ */
+void ff_avio_source_close(AVFormatContext *fmt_ctx) {
+    AVIOContext *pb;
+    if (!fmt_ctx) return;
+    pb = fmt_ctx->pb;
+    avformat_close_input(&fmt_ctx);
+    if (pb) {
+        av_free(pb->opaque);
+        av_freep(&pb->buffer);
+        avio_context_free(&pb);
+    }
+}
+
 void cleanup(AVFormatContext *in_fmt, AVFormatContext *out_fmt) {
     if (out_fmt && !(out_fmt->oformat->flags & AVFMT_NOFILE)) 
         avio_closep(&out_fmt->pb);
@@ -239,113 +1357,247 @@ void cleanup(AVFormatContext *in_fmt, AVFormatContext *out_fmt) {
     avformat_close_input(&in_fmt);
 }
 
-int ff_extract_audio(const char *in_filename, const char *out_filename, void (*progress_cb)(int current, int total)) {
-    AVFormatContext *in_fmt = NULL, *out_fmt = NULL;
-    AVPacket pkt;
-    int audio_stream_index = -1;
-    int ret = 0;
+/* Demuxer sessions. Each helper below that reads a whole input has a version
+ * taking a filename, which opens and probes it, and a *_ctx version taking an
+ * AVFormatContext the caller already opened and probed (or restored, see
+ * ff_stream_info_restore), so that one demuxer can be shared by several jobs
+ * on the same file. */
 
-    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
-    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
+// Open and probe an input for one of the helpers
+static int demuxer_session_open(const char *filename, AVFormatContext **fmt_ctx,
+                                const char *tag) {
+    int ret = avformat_open_input(fmt_ctx, filename, NULL, NULL);
+    if (ret >= 0 && (ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0)
+        avformat_close_input(fmt_ctx);
+    if (ret < 0)
+        fprintf(stderr, "%s: errorno=%d (%s)\n", tag, ret, av_err2str(ret));
+    return ret;
+}
 
-    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
-        if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            audio_stream_index = i;
-            break;
-        }
-    }
-    if (audio_stream_index < 0) {
-        ret = AVERROR_STREAM_NOT_FOUND;
-        goto fail;
+// Stop discarding streams, as the helpers discard those they don't use
+static void demuxer_session_release(AVFormatContext *fmt_ctx) {
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; i++)
+        fmt_ctx->streams[i]->discard = AVDISCARD_DEFAULT;
+}
+
+/* Prepare a shared demuxer for a helper that reads from the start, since the
+ * last job may have left it anywhere in the file */
+static int demuxer_session_rewind(AVFormatContext *fmt_ctx, const char *tag) {
+    int64_t start = (fmt_ctx->start_time != AV_NOPTS_VALUE) ? fmt_ctx->start_time : 0;
+    int ret;
+
+    demuxer_session_release(fmt_ctx);
+    ret = av_seek_frame(fmt_ctx, -1, start, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0)
+        ret = av_seek_frame(fmt_ctx, -1, 0, AVSEEK_FLAG_BYTE);
+    if (ret < 0) {
+        fprintf(stderr, "%s: could not rewind: errorno=%d (%s)\n", tag, ret, av_err2str(ret));
+        return ret;
     }
+    avformat_flush(fmt_ctx);
+    return 0;
+}
 
-    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
-        if (i != audio_stream_index) {
-            in_fmt->streams[i]->discard = AVDISCARD_ALL;
-        }
+// Open an output file for a stream copy of in_stream, and write its header
+static int audio_copy_open_output(const char *out_filename, AVStream *in_stream,
+                                   AVFormatContext **out_fmt_p) {
+    AVFormatContext *out_fmt = NULL;
+    AVStream *out_stream;
+    int ret;
+
+    if ((ret = avformat_alloc_output_context2(&out_fmt, NULL, NULL, out_filename)) < 0)
+        return ret;
+    *out_fmt_p = out_fmt;
+
+    out_stream = avformat_new_stream(out_fmt, NULL);
+    if (!out_stream) return AVERROR_UNKNOWN;
+    if ((ret = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar)) < 0)
+        return ret;
+    out_stream->codecpar->codec_tag = 0;
+    out_stream->time_base = in_stream->time_base;
+
+    if (!(out_fmt->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open(&out_fmt->pb, out_filename, AVIO_FLAG_WRITE)) < 0)
+            return ret;
     }
 
-    if ((ret = avformat_alloc_output_context2(&out_fmt, NULL, NULL, out_filename)) < 0) goto fail;
+    return avformat_write_header(out_fmt, NULL);
+}
 
+/**
+ * Extract several audio streams from a file in a single pass, each to its own
+ * output file. stream_indexes gives the input stream for each of the
+ * nb_outputs outputs, or if it's NULL, the first nb_outputs audio streams are
+ * used. Progress is reported in the time base of the first output's stream.
+ */
+static int extract_audio_streams(AVFormatContext *in_fmt, char **out_filenames,
+                                 const int *stream_indexes, int nb_outputs,
+                                 void (*progress_cb)(int current, int total)) {
+    AVFormatContext **out_fmts = NULL;
+    int *out_for_stream = NULL;
+    AVPacket *pkt = NULL;
+    int ret = 0;
 
-    AVStream *in_stream = in_fmt->streams[audio_stream_index];
-    AVStream *out_stream = avformat_new_stream(out_fmt, NULL);
-    if (!out_stream) {
-        ret = AVERROR_UNKNOWN;
+    if (nb_outputs <= 0) {
+        ret = AVERROR(EINVAL);
         goto fail;
     }
-    ret = avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar);
-    if (ret < 0) {
+
+    out_fmts = av_calloc(nb_outputs, sizeof(*out_fmts));
+    out_for_stream = av_malloc_array(in_fmt->nb_streams, sizeof(*out_for_stream));
+    pkt = av_packet_alloc();
+    if (!out_fmts || !out_for_stream || !pkt) {
+        ret = AVERROR(ENOMEM);
         goto fail;
     }
-    out_stream->codecpar->codec_tag = 0;
-    out_stream->time_base = in_stream->time_base;
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++)
+        out_for_stream[i] = -1;
 
-    if (!(out_fmt->oformat->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&out_fmt->pb, out_filename, AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            goto fail;
+    // Choose the input stream for each output
+    unsigned next_audio = 0;
+    for (int oi = 0; oi < nb_outputs; oi++) {
+        int si;
+        if (stream_indexes) {
+            si = stream_indexes[oi];
+            if (si < 0 || si >= (int)in_fmt->nb_streams ||
+                in_fmt->streams[si]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO ||
+                out_for_stream[si] >= 0) {
+                ret = AVERROR(EINVAL);
+                goto fail;
+            }
+        } else {
+            while (next_audio < in_fmt->nb_streams &&
+                   in_fmt->streams[next_audio]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+                next_audio++;
+            if (next_audio >= in_fmt->nb_streams) {
+                ret = AVERROR_STREAM_NOT_FOUND;
+                goto fail;
+            }
+            si = next_audio++;
         }
+        out_for_stream[si] = oi;
     }
 
-    ret = avformat_write_header(out_fmt, NULL);
-    if (ret < 0) {
-        goto fail;
+    int main_stream_index = -1;
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (out_for_stream[i] < 0)
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+        else if (out_for_stream[i] == 0)
+            main_stream_index = i;
+    }
+
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        int oi = out_for_stream[i];
+        if (oi < 0) continue;
+        if ((ret = audio_copy_open_output(out_filenames[oi], in_fmt->streams[i],
+                                          &out_fmts[oi])) < 0)
+            goto fail;
     }
 
+    AVStream *main_stream = in_fmt->streams[main_stream_index];
     int64_t total_duration = 0;
-    if (in_stream->duration != AV_NOPTS_VALUE && in_stream->duration > 0) {
-        total_duration = in_stream->duration;
+    if (main_stream->duration != AV_NOPTS_VALUE && main_stream->duration > 0) {
+        total_duration = main_stream->duration;
     } else if (in_fmt->duration != AV_NOPTS_VALUE && in_fmt->duration > 0) {
-        total_duration = av_rescale_q(in_fmt->duration, AV_TIME_BASE_Q, in_stream->time_base);
+        total_duration = av_rescale_q(in_fmt->duration, AV_TIME_BASE_Q, main_stream->time_base);
     }
 
     int64_t processed_pts = 0;
     int packet_count = 0;
     const int progress_update_interval = 100;
 
-    while (av_read_frame(in_fmt, &pkt) >= 0) {
-        if (pkt.stream_index == audio_stream_index) {
-            if (pkt.pts != AV_NOPTS_VALUE) {
-                processed_pts = pkt.pts;
-            }
+    while (av_read_frame(in_fmt, pkt) >= 0) {
+        int oi = out_for_stream[pkt->stream_index];
+        if (oi < 0) {
+            av_packet_unref(pkt);
+            continue;
+        }
 
-            av_packet_rescale_ts(&pkt, in_stream->time_base, out_stream->time_base);
-            pkt.stream_index = out_stream->index;
-            av_interleaved_write_frame(out_fmt, &pkt);
-            
-            packet_count++;
-            
-            if (progress_cb && packet_count % progress_update_interval == 0) {
-                progress_cb(processed_pts, total_duration);
-            }
+        AVStream *in_stream = in_fmt->streams[pkt->stream_index];
+        AVStream *out_stream = out_fmts[oi]->streams[0];
+        if (pkt->pts != AV_NOPTS_VALUE) {
+            int64_t pts = av_rescale_q(pkt->pts, in_stream->time_base, main_stream->time_base);
+            processed_pts = FFMAX(processed_pts, pts);
+        }
+
+        av_packet_rescale_ts(pkt, in_stream->time_base, out_stream->time_base);
+        pkt->stream_index = out_stream->index;
+        ret = av_interleaved_write_frame(out_fmts[oi], pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) goto fail;
+
+        packet_count++;
+        if (progress_cb && packet_count % progress_update_interval == 0) {
+            progress_cb(processed_pts, total_duration);
         }
-        av_packet_unref(&pkt);
     }
 
-    av_write_trailer(out_fmt);
-    cleanup(in_fmt, out_fmt);
-    return ret;
+    for (int oi = 0; oi < nb_outputs; oi++) {
+        if ((ret = av_write_trailer(out_fmts[oi])) < 0) goto fail;
+    }
+
+    ret = 0;
+    goto end;
 
 fail:
     {
         char errbuf[AV_ERROR_MAX_STRING_SIZE];
         av_strerror(ret, errbuf, sizeof(errbuf));
-        fprintf(stderr, "ff_extract_audio: errorno=%d (%s)\n", ret, errbuf);
-        cleanup(in_fmt, out_fmt);
+        fprintf(stderr, "ff_extract_audio_streams: errorno=%d (%s)\n", ret, errbuf);
+    }
+end:
+    av_packet_free(&pkt);
+    if (out_fmts) {
+        for (int oi = 0; oi < nb_outputs; oi++)
+            cleanup(NULL, out_fmts[oi]);
     }
+    av_free(out_fmts);
+    av_free(out_for_stream);
     return ret;
 }
 
-int ff_slice_audio(const char *in_filename, const char *out_filename, double start_time, double duration) {
-    AVFormatContext *in_fmt = NULL, *out_fmt = NULL;
+int ff_extract_audio_streams(const char *in_filename, char **out_filenames,
+                             const int *stream_indexes, int nb_outputs,
+                             void (*progress_cb)(int current, int total)) {
+    AVFormatContext *in_fmt = NULL;
+    int ret;
+    if ((ret = demuxer_session_open(in_filename, &in_fmt, "ff_extract_audio_streams")) < 0)
+        return ret;
+    ret = extract_audio_streams(in_fmt, out_filenames, stream_indexes, nb_outputs,
+                                progress_cb);
+    avformat_close_input(&in_fmt);
+    return ret;
+}
+
+int ff_extract_audio_streams_ctx(AVFormatContext *in_fmt, char **out_filenames,
+                                 const int *stream_indexes, int nb_outputs,
+                                 void (*progress_cb)(int current, int total)) {
+    int ret;
+    if ((ret = demuxer_session_rewind(in_fmt, "ff_extract_audio_streams")) < 0)
+        return ret;
+    ret = extract_audio_streams(in_fmt, out_filenames, stream_indexes, nb_outputs,
+                                progress_cb);
+    demuxer_session_release(in_fmt);
+    return ret;
+}
+
+int ff_extract_audio(const char *in_filename, const char *out_filename, void (*progress_cb)(int current, int total)) {
+    char *out_filenames[1] = {(char *) out_filename};
+    return ff_extract_audio_streams(in_filename, out_filenames, NULL, 1, progress_cb);
+}
+
+int ff_extract_audio_ctx(AVFormatContext *in_fmt, const char *out_filename,
+                         void (*progress_cb)(int current, int total)) {
+    char *out_filenames[1] = {(char *) out_filename};
+    return ff_extract_audio_streams_ctx(in_fmt, out_filenames, NULL, 1, progress_cb);
+}
+
+static int slice_audio(AVFormatContext *in_fmt, const char *out_filename, double start_time, double duration) {
+    AVFormatContext *out_fmt = NULL;
     AVPacket pkt;
     int audio_stream_index = -1;
     int ret = 0;
 
-    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
-    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
-
     for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
         if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
             if (audio_stream_index < 0) {
@@ -426,7 +1678,7 @@ int ff_slice_audio(const char *in_filename, const char *out_filename, double sta
     }
 
     av_write_trailer(out_fmt);
-    cleanup(in_fmt, out_fmt);
+    cleanup(NULL, out_fmt);
     return ret;
 
 fail:
@@ -434,22 +1686,317 @@ fail:
         char errbuf[AV_ERROR_MAX_STRING_SIZE];
         av_strerror(ret, errbuf, sizeof(errbuf));
         fprintf(stderr, "ff_slice_audio: errorno=%d (%s)\n", ret, errbuf);
-        cleanup(in_fmt, out_fmt);
+        cleanup(NULL, out_fmt);
     }
     return ret;
 }
 
-static int transcode_mp3_select_sample_rate(const AVCodec *codec, int src_rate) {
-    const int *rates = NULL;
-    int n = 0;
-    if (avcodec_get_supported_config(NULL, codec, AV_CODEC_CONFIG_SAMPLE_RATE,
-                                     0, (const void **)&rates, &n) < 0 ||
-        !rates || n <= 0) {
-        return src_rate;
-    }
+int ff_slice_audio(const char *in_filename, const char *out_filename, double start_time, double duration) {
+    AVFormatContext *in_fmt = NULL;
+    int ret;
+    if ((ret = demuxer_session_open(in_filename, &in_fmt, "ff_slice_audio")) < 0)
+        return ret;
+    ret = slice_audio(in_fmt, out_filename, start_time, duration);
+    avformat_close_input(&in_fmt);
+    return ret;
+}
 
-    int below = 0, lowest = rates[0];
-    for (int i = 0; i < n; i++) {
+// Slicing seeks to the slice anyway, so a shared demuxer needn't be rewound
+int ff_slice_audio_ctx(AVFormatContext *in_fmt, const char *out_filename,
+                       double start_time, double duration) {
+    int ret;
+    demuxer_session_release(in_fmt);
+    ret = slice_audio(in_fmt, out_filename, start_time, duration);
+    demuxer_session_release(in_fmt);
+    return ret;
+}
+
+/* Flags for ff_slice_audio_ranges */
+#define FF_SLICE_AUDIO_EXACT 1 // Trim each slice to exact sample boundaries
+
+/* Muxers that honor a negative start and a shortened last packet (as an edit
+ * list), so copied edge packets can be trimmed without re-encoding */
+#define SLICE_AUDIO_EXACT_MUXERS "mov,mp4,ipod,ismv,3gp,3g2,psp,f4v"
+
+/* Bytes per sample (across channels) if the codec is PCM, whose packets can be
+ * cut at any sample, or 0 otherwise */
+static int slice_audio_pcm_sample_size(AVCodecParameters *par) {
+    int bits = av_get_exact_bits_per_sample(par->codec_id);
+    if (bits <= 0 || bits % 8 || par->ch_layout.nb_channels <= 0)
+        return 0;
+    return bits / 8 * par->ch_layout.nb_channels;
+}
+
+/* Check that an output can be trimmed to exact samples: PCM is cut directly,
+ * and anything else relies on the muxer to drop the edge samples */
+static int slice_audio_check_exact(const char *out_filename, AVCodecParameters *par) {
+    const AVOutputFormat *ofmt;
+    if (slice_audio_pcm_sample_size(par))
+        return 0;
+    ofmt = av_guess_format(NULL, out_filename, NULL);
+    if (!ofmt)
+        return AVERROR_MUXER_NOT_FOUND;
+    if (!av_match_name(ofmt->name, SLICE_AUDIO_EXACT_MUXERS)) {
+        fprintf(stderr, "ff_slice_audio_ranges: %s can't be trimmed to exact "
+                "samples without re-encoding\n", out_filename);
+        return AVERROR(EINVAL);
+    }
+    return 0;
+}
+
+/* Number of samples in a packet. Only decodes the packet (with a decoder that
+ * is opened on first use) if the demuxer doesn't know its duration. */
+static int64_t slice_audio_packet_samples(AVStream *st, AVPacket *pkt,
+                                          AVCodecContext **dec_ctx, AVFrame *frame) {
+    AVRational sample_tb = {1, st->codecpar->sample_rate};
+    const AVCodec *decoder;
+    int64_t nb_samples;
+    int ret;
+
+    if (pkt->duration > 0)
+        return av_rescale_q(pkt->duration, st->time_base, sample_tb);
+
+    if (!*dec_ctx) {
+        decoder = avcodec_find_decoder(st->codecpar->codec_id);
+        if (!decoder) return st->codecpar->frame_size;
+        *dec_ctx = avcodec_alloc_context3(decoder);
+        if (!*dec_ctx) return st->codecpar->frame_size;
+        if (avcodec_parameters_to_context(*dec_ctx, st->codecpar) < 0 ||
+            avcodec_open2(*dec_ctx, decoder, NULL) < 0) {
+            avcodec_free_context(dec_ctx);
+            return st->codecpar->frame_size;
+        }
+    }
+
+    avcodec_flush_buffers(*dec_ctx);
+    ret = avcodec_send_packet(*dec_ctx, pkt);
+    if (ret >= 0)
+        ret = avcodec_receive_frame(*dec_ctx, frame);
+    if (ret < 0)
+        return st->codecpar->frame_size;
+    nb_samples = frame->nb_samples;
+    av_frame_unref(frame);
+    return nb_samples;
+}
+
+/**
+ * Cut many slices out of the first audio stream of a file, with one demuxer.
+ * ranges is nb_ranges (start, duration) pairs in seconds, sorted by start, and
+ * out_filenames is the output file for each. Slices that are within
+ * seek_threshold seconds of the current read position are reached by reading
+ * forward rather than seeking. With FF_SLICE_AUDIO_EXACT, slices are trimmed
+ * to exact sample boundaries, and timestamps are relative to the requested
+ * start rather than the first packet. Packets are still copied, not
+ * re-encoded: PCM edge packets are cut, and other edge packets are written
+ * whole with a negative start and a shortened duration, which only the mov
+ * family of muxers turns into an edit list. Other outputs are rejected with
+ * AVERROR(EINVAL) before anything is written.
+ */
+int ff_slice_audio_ranges(const char *in_filename, const double *ranges,
+                          char **out_filenames, int nb_ranges, int flags,
+                          double seek_threshold) {
+    AVFormatContext *in_fmt = NULL, *out_fmt = NULL;
+    AVCodecContext *dec_ctx = NULL;
+    AVPacket *pkt = NULL, *out_pkt = NULL;
+    AVFrame *frame = NULL;
+    int audio_stream_index = -1;
+    int pending = 0, eof = 0;
+    int ret = 0;
+
+    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
+    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
+
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+            audio_stream_index < 0) {
+            audio_stream_index = i;
+        } else {
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    if (audio_stream_index < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto fail;
+    }
+
+    AVStream *in_stream = in_fmt->streams[audio_stream_index];
+    AVRational tb = in_stream->time_base;
+    AVRational sample_tb = {1, in_stream->codecpar->sample_rate};
+    int pcm_sample_size = slice_audio_pcm_sample_size(in_stream->codecpar);
+
+    if (flags & FF_SLICE_AUDIO_EXACT) {
+        for (int ri = 0; ri < nb_ranges; ri++) {
+            if ((ret = slice_audio_check_exact(out_filenames[ri], in_stream->codecpar)) < 0)
+                goto fail;
+        }
+    }
+    int64_t frame_duration = in_stream->codecpar->frame_size > 0 && sample_tb.den > 0
+        ? av_rescale_q(in_stream->codecpar->frame_size, sample_tb, tb)
+        : 0;
+    int64_t threshold_pts = (int64_t)(seek_threshold / av_q2d(tb));
+
+    /* Where the next packet starts. If a packet is pending (read, but not
+     * finished with), this is that packet's timestamp. */
+    int64_t next_pts = in_stream->start_time != AV_NOPTS_VALUE ? in_stream->start_time : 0;
+
+    pkt = av_packet_alloc();
+    out_pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!pkt || !out_pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    for (int ri = 0; ri < nb_ranges; ri++) {
+        int64_t start_pts = (int64_t)(ranges[ri * 2] / av_q2d(tb));
+        int64_t end_pts = start_pts + (int64_t)(ranges[ri * 2 + 1] / av_q2d(tb));
+        int64_t base_pts = AV_NOPTS_VALUE;
+
+        // Only seek if the slice is behind us or too far ahead to read to
+        if (start_pts < next_pts || start_pts - next_pts > threshold_pts) {
+            if ((ret = av_seek_frame(in_fmt, audio_stream_index, start_pts,
+                                     AVSEEK_FLAG_BACKWARD)) < 0) goto fail;
+            avformat_flush(in_fmt);
+            av_packet_unref(pkt);
+            pending = eof = 0;
+            next_pts = start_pts;
+        }
+
+        if ((ret = audio_copy_open_output(out_filenames[ri], in_stream, &out_fmt)) < 0)
+            goto fail;
+        AVStream *out_stream = out_fmt->streams[0];
+
+        while (1) {
+            int64_t pts, out_pts, pkt_duration;
+
+            if (!pending) {
+                if (eof) break;
+                if (av_read_frame(in_fmt, pkt) < 0) {
+                    eof = 1;
+                    break;
+                }
+                if (pkt->stream_index != audio_stream_index) {
+                    av_packet_unref(pkt);
+                    continue;
+                }
+                pending = 1;
+            }
+
+            pts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+            if (pts == AV_NOPTS_VALUE) {
+                av_packet_unref(pkt);
+                pending = 0;
+                continue;
+            }
+            pkt_duration = pkt->duration > 0 ? pkt->duration : frame_duration;
+            next_pts = pts;
+
+            // Belongs to a later slice
+            if (pts >= end_pts) break;
+
+            // Entirely before this slice
+            if (pkt_duration > 0 ? pts + pkt_duration <= start_pts : pts < start_pts) {
+                next_pts = pts + pkt_duration;
+                av_packet_unref(pkt);
+                pending = 0;
+                continue;
+            }
+
+            if (base_pts == AV_NOPTS_VALUE)
+                base_pts = (flags & FF_SLICE_AUDIO_EXACT) ? start_pts : pts;
+
+            if ((ret = av_packet_ref(out_pkt, pkt)) < 0) goto fail;
+            out_pts = pts;
+
+            if ((flags & FF_SLICE_AUDIO_EXACT) && sample_tb.den > 0 &&
+                (pts < start_pts || pkt_duration <= 0 || pts + pkt_duration > end_pts)) {
+                // Edge packet: trim it to the exact samples of the slice
+                int64_t nb_samples = pcm_sample_size
+                    ? pkt->size / pcm_sample_size
+                    : slice_audio_packet_samples(in_stream, pkt, &dec_ctx, frame);
+                int64_t skip_start = 0, skip_end = 0;
+                pkt_duration = av_rescale_q(nb_samples, sample_tb, tb);
+                if (pts < start_pts)
+                    skip_start = av_rescale_q(start_pts - pts, tb, sample_tb);
+                if (pts + pkt_duration > end_pts)
+                    skip_end = av_rescale_q(pts + pkt_duration - end_pts, tb, sample_tb);
+                skip_start = FFMIN(skip_start, nb_samples);
+                skip_end = FFMIN(skip_end, nb_samples - skip_start);
+
+                if (pcm_sample_size) {
+                    // Cut the samples out of the packet itself
+                    out_pkt->data += skip_start * pcm_sample_size;
+                    out_pkt->size -= (skip_start + skip_end) * pcm_sample_size;
+                    out_pts = pts + av_rescale_q(skip_start, sample_tb, tb);
+                    out_pkt->duration = av_rescale_q(nb_samples - skip_start - skip_end,
+                                                     sample_tb, tb);
+                } else {
+                    if (skip_start || skip_end) {
+                        uint8_t *sd = av_packet_new_side_data(out_pkt, AV_PKT_DATA_SKIP_SAMPLES, 10);
+                        if (!sd) {
+                            ret = AVERROR(ENOMEM);
+                            goto fail;
+                        }
+                        AV_WL32(sd, skip_start);
+                        AV_WL32(sd + 4, skip_end);
+                        sd[8] = sd[9] = 0;
+                    }
+                    if (skip_end)
+                        out_pkt->duration = end_pts - pts;
+                }
+            }
+
+            if (out_pkt->size > 0) {
+                out_pkt->pts = out_pts - base_pts;
+                out_pkt->dts = out_pkt->pts;
+                out_pkt->stream_index = out_stream->index;
+                av_packet_rescale_ts(out_pkt, tb, out_stream->time_base);
+                if ((ret = av_interleaved_write_frame(out_fmt, out_pkt)) < 0) goto fail;
+            } else {
+                av_packet_unref(out_pkt);
+            }
+
+            // A packet that runs past the end may also start the next slice
+            if (pkt_duration > 0 && pts + pkt_duration > end_pts) break;
+            next_pts = pts + pkt_duration;
+            av_packet_unref(pkt);
+            pending = 0;
+        }
+
+        if ((ret = av_write_trailer(out_fmt)) < 0) goto fail;
+        cleanup(NULL, out_fmt);
+        out_fmt = NULL;
+    }
+
+    ret = 0;
+    goto end;
+
+fail:
+    {
+        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "ff_slice_audio_ranges: errorno=%d (%s)\n", ret, errbuf);
+    }
+end:
+    av_frame_free(&frame);
+    av_packet_free(&out_pkt);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec_ctx);
+    cleanup(in_fmt, out_fmt);
+    return ret;
+}
+
+static int transcode_audio_select_sample_rate(const AVCodec *codec, int src_rate) {
+    const int *rates = NULL;
+    int n = 0;
+    if (avcodec_get_supported_config(NULL, codec, AV_CODEC_CONFIG_SAMPLE_RATE,
+                                     0, (const void **)&rates, &n) < 0 ||
+        !rates || n <= 0) {
+        return src_rate;
+    }
+
+    int below = 0, lowest = rates[0];
+    for (int i = 0; i < n; i++) {
         if (rates[i] == src_rate) return src_rate;
         if (rates[i] < src_rate && rates[i] > below) below = rates[i];
         if (rates[i] < lowest) lowest = rates[i];
@@ -457,7 +2004,7 @@ static int transcode_mp3_select_sample_rate(const AVCodec *codec, int src_rate)
     return below > 0 ? below : lowest;
 }
 
-static enum AVSampleFormat transcode_mp3_select_sample_fmt(const AVCodec *codec) {
+static enum AVSampleFormat transcode_audio_select_sample_fmt(const AVCodec *codec) {
     const enum AVSampleFormat *fmts = NULL;
     int n = 0;
     if (avcodec_get_supported_config(NULL, codec, AV_CODEC_CONFIG_SAMPLE_FORMAT,
@@ -471,8 +2018,8 @@ static enum AVSampleFormat transcode_mp3_select_sample_fmt(const AVCodec *codec)
     return fmts[0];
 }
 
-static int transcode_mp3_select_channels(const AVCodec *codec, int requested,
-                                         int src_channels) {
+static int transcode_audio_select_channels(const AVCodec *codec, int requested,
+                                           int src_channels) {
     int desired = requested > 0 ? requested : FFMIN(src_channels, 2);
     desired = FFMAX(desired, 1);
 
@@ -490,81 +2037,200 @@ static int transcode_mp3_select_channels(const AVCodec *codec, int requested,
     return max_ch > 0 ? FFMIN(desired, max_ch) : desired;
 }
 
-static int transcode_mp3_convert_to_fifo(SwrContext *swr, AVAudioFifo *fifo,
-                                         int nb_channels, enum AVSampleFormat sample_fmt,
-                                         const AVFrame *frame) {
-    int cap = swr_get_out_samples(swr, frame ? frame->nb_samples : 0);
-    if (cap <= 0) return 0;
-
-    uint8_t **buf = NULL;
-    int linesize;
-    int ret = av_samples_alloc_array_and_samples(&buf, &linesize, nb_channels,
-                                                 cap, sample_fmt, 0);
-    if (ret < 0) return ret;
-
-    int converted = swr_convert(swr, buf, cap,
-                                frame ? (const uint8_t **)frame->extended_data : NULL,
-                                frame ? frame->nb_samples : 0);
-    ret = converted;
-    if (converted > 0 && av_audio_fifo_write(fifo, (void **)buf, converted) < converted) {
-        ret = AVERROR_UNKNOWN;
+// Find an encoder by encoder name ("libmp3lame") or by codec name ("mp3")
+static const AVCodec *transcode_audio_find_encoder(const char *name) {
+    const AVCodec *encoder = avcodec_find_encoder_by_name(name);
+    if (!encoder) {
+        const AVCodecDescriptor *desc = avcodec_descriptor_get_by_name(name);
+        if (desc) encoder = avcodec_find_encoder(desc->id);
     }
+    if (encoder && encoder->type != AVMEDIA_TYPE_AUDIO) return NULL;
+    return encoder;
+}
 
-    av_freep(&buf[0]);
-    av_freep(&buf);
-    return ret < 0 ? ret : 0;
+/* Buffers for one ff_transcode_audio job. They're allocated up front and
+ * reused for every frame, and only grown (never shrunk) if a frame needs more
+ * room. nb_allocs counts every buffer allocation made, including growth. */
+typedef struct TranscodeAudioScratch {
+    uint8_t **conv;     // Resampler output
+    int conv_cap;       // Capacity of conv, in samples
+    AVFrame *enc_frame; // Encoder input, frame_size samples
+    int frame_size;
+    int nb_allocs;
+} TranscodeAudioScratch;
+
+static void transcode_audio_scratch_free(TranscodeAudioScratch *s) {
+    if (s->conv) av_freep(&s->conv[0]);
+    av_freep(&s->conv);
+    s->conv_cap = 0;
+    av_frame_free(&s->enc_frame);
 }
 
-static int transcode_mp3_encode_from_fifo(AVFormatContext *out_fmt, AVStream *out_stream,
-                                          AVCodecContext *enc_ctx, AVAudioFifo *fifo,
-                                          int nb_samples, int64_t *next_pts, AVPacket *pkt) {
-    AVFrame *frame = av_frame_alloc();
+// Allocate the encoder input frame
+static int transcode_audio_scratch_init(TranscodeAudioScratch *s,
+                                        AVCodecContext *enc_ctx) {
     int ret;
-    if (!frame) return AVERROR(ENOMEM);
 
-    frame->nb_samples = nb_samples;
-    frame->format = enc_ctx->sample_fmt;
-    frame->sample_rate = enc_ctx->sample_rate;
-    if ((ret = av_channel_layout_copy(&frame->ch_layout, &enc_ctx->ch_layout)) < 0) goto end;
-    if ((ret = av_frame_get_buffer(frame, 0)) < 0) goto end;
+    /* Encoders with a variable frame size (PCM) take any frame size, so use
+     * the same one as MP3. */
+    s->frame_size = enc_ctx->frame_size > 0 ? enc_ctx->frame_size : 1152;
 
-    if (av_audio_fifo_read(fifo, (void **)frame->data, nb_samples) < nb_samples) {
-        ret = AVERROR_UNKNOWN;
-        goto end;
+    s->enc_frame = av_frame_alloc();
+    if (!s->enc_frame) return AVERROR(ENOMEM);
+    s->enc_frame->nb_samples = s->frame_size;
+    s->enc_frame->format = enc_ctx->sample_fmt;
+    s->enc_frame->sample_rate = enc_ctx->sample_rate;
+    if ((ret = av_channel_layout_copy(&s->enc_frame->ch_layout, &enc_ctx->ch_layout)) < 0)
+        return ret;
+    if ((ret = av_frame_get_buffer(s->enc_frame, 0)) < 0) return ret;
+    s->nb_allocs++;
+    return 0;
+}
+
+// Resample a frame (or flush, if frame is NULL) into s->conv
+static int transcode_audio_convert(SwrContext *swr, int nb_channels,
+                                   enum AVSampleFormat sample_fmt,
+                                   const AVFrame *frame, TranscodeAudioScratch *s) {
+    int cap = swr_get_out_samples(swr, frame ? frame->nb_samples : 0);
+    if (cap <= 0) return 0;
+
+    if (cap > s->conv_cap) {
+        int linesize;
+        int new_cap = FFMAX(cap, s->conv_cap * 2);
+        if (s->conv) av_freep(&s->conv[0]);
+        av_freep(&s->conv);
+        s->conv_cap = 0;
+        int ret = av_samples_alloc_array_and_samples(&s->conv, &linesize, nb_channels,
+                                                     new_cap, sample_fmt, 0);
+        if (ret < 0) return ret;
+        s->conv_cap = new_cap;
+        s->nb_allocs++;
     }
-    frame->pts = *next_pts;
-    *next_pts += nb_samples;
 
-    if ((ret = avcodec_send_frame(enc_ctx, frame)) < 0) goto end;
+    return swr_convert(swr, s->conv, s->conv_cap,
+                       frame ? (const uint8_t **)frame->extended_data : NULL,
+                       frame ? frame->nb_samples : 0);
+}
+
+static int transcode_audio_convert_to_fifo(SwrContext *swr, AVAudioFifo *fifo,
+                                           int nb_channels, enum AVSampleFormat sample_fmt,
+                                           const AVFrame *frame,
+                                           TranscodeAudioScratch *s) {
+    int converted = transcode_audio_convert(swr, nb_channels, sample_fmt, frame, s);
+    if (converted <= 0) return converted;
+
+    // The FIFO reallocates itself if it's full
+    if (av_audio_fifo_space(fifo) < converted) s->nb_allocs++;
+    if (av_audio_fifo_write(fifo, (void **)s->conv, converted) < converted)
+        return AVERROR_UNKNOWN;
+    return 0;
+}
+
+static int transcode_audio_write_packets(AVFormatContext *out_fmt, AVStream *out_stream,
+                                         AVCodecContext *enc_ctx, AVPacket *pkt) {
+    int ret;
     while ((ret = avcodec_receive_packet(enc_ctx, pkt)) >= 0) {
         av_packet_rescale_ts(pkt, enc_ctx->time_base, out_stream->time_base);
         pkt->stream_index = out_stream->index;
-        ret = av_interleaved_write_frame(out_fmt, pkt);
-        if (ret < 0) goto end;
+        if ((ret = av_interleaved_write_frame(out_fmt, pkt)) < 0) return ret;
     }
     if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ret = 0;
-
-end:
-    av_frame_free(&frame);
     return ret;
 }
 
-int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
-                            int out_channels, int bit_rate,
-                            void (*progress_cb)(int current, int total)) {
-    AVFormatContext *in_fmt = NULL, *out_fmt = NULL;
+/* Fill s->enc_frame with nb_samples from the FIFO. A short final frame is
+ * passed as is: libavcodec pads it with silence itself for encoders without
+ * AV_CODEC_CAP_SMALL_LAST_FRAME, and either way the timestamps only cover the
+ * samples really there. */
+static int transcode_audio_frame_from_fifo(AVAudioFifo *fifo, int nb_samples,
+                                           int64_t *next_pts, TranscodeAudioScratch *s) {
+    AVFrame *frame = s->enc_frame;
+    uint8_t *prev = frame->buf[0]->data;
+    int ret;
+
+    /* The encoder may still hold a reference to the last frame; only then
+     * does this have to allocate. */
+    frame->nb_samples = s->frame_size;
+    if ((ret = av_frame_make_writable(frame)) < 0) return ret;
+    if (frame->buf[0]->data != prev) s->nb_allocs++;
+
+    if (av_audio_fifo_read(fifo, (void **)frame->data, nb_samples) < nb_samples)
+        return AVERROR_UNKNOWN;
+    frame->nb_samples = nb_samples;
+    frame->pts = *next_pts;
+    *next_pts += frame->nb_samples;
+    return 0;
+}
+
+static int transcode_audio_encode_from_fifo(AVFormatContext *out_fmt, AVStream *out_stream,
+                                            AVCodecContext *enc_ctx, AVAudioFifo *fifo,
+                                            int nb_samples, int64_t *next_pts, AVPacket *pkt,
+                                            TranscodeAudioScratch *s) {
+    int ret;
+    if ((ret = transcode_audio_frame_from_fifo(fifo, nb_samples, next_pts, s)) < 0)
+        return ret;
+    if ((ret = avcodec_send_frame(enc_ctx, s->enc_frame)) < 0) return ret;
+    return transcode_audio_write_packets(out_fmt, out_stream, enc_ctx, pkt);
+}
+
+static int open_decoder_for_stream(AVStream *in_stream, AVCodecContext **dec_ctx_p) {
+    const AVCodec *decoder = avcodec_find_decoder(in_stream->codecpar->codec_id);
+    AVCodecContext *dec_ctx;
+    int ret;
+    if (!decoder) return AVERROR_DECODER_NOT_FOUND;
+    dec_ctx = *dec_ctx_p = avcodec_alloc_context3(decoder);
+    if (!dec_ctx) return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_to_context(dec_ctx, in_stream->codecpar)) < 0) return ret;
+    dec_ctx->pkt_timebase = in_stream->time_base;
+    return avcodec_open2(dec_ctx, decoder, NULL);
+}
+
+// Allocate (but don't open) an encoder context for audio from dec_ctx
+static int transcode_audio_alloc_encoder(const AVCodec *encoder, const AVCodecContext *dec_ctx,
+                                         int out_channels, int sample_rate, int bit_rate,
+                                         AVCodecContext **enc_ctx_p) {
+    AVCodecContext *enc_ctx = *enc_ctx_p = avcodec_alloc_context3(encoder);
+    if (!enc_ctx) return AVERROR(ENOMEM);
+
+    int nb_channels = transcode_audio_select_channels(
+        encoder, out_channels, dec_ctx->ch_layout.nb_channels);
+    av_channel_layout_default(&enc_ctx->ch_layout, nb_channels);
+    enc_ctx->sample_rate = transcode_audio_select_sample_rate(
+        encoder, sample_rate > 0 ? sample_rate : dec_ctx->sample_rate);
+    enc_ctx->sample_fmt = transcode_audio_select_sample_fmt(encoder);
+    if (bit_rate > 0)
+        enc_ctx->bit_rate = bit_rate;
+    enc_ctx->time_base = (AVRational){1, enc_ctx->sample_rate};
+    if (encoder->capabilities & AV_CODEC_CAP_EXPERIMENTAL)
+        enc_ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    return 0;
+}
+
+/**
+ * Transcode the first audio stream of a file with the named encoder (e.g.
+ * "libmp3lame", "aac", "pcm_s16le", or a codec name such as "mp3" or "opus"),
+ * into a container chosen by out_filename's extension. out_channels,
+ * sample_rate and bit_rate may be 0 to follow the input (at most stereo) and
+ * the encoder's defaults. All sample buffers, frames and packets are
+ * allocated once per job and reused; if nb_allocs is non-NULL, the number of
+ * such buffer allocations is written to it, and stays constant as the input
+ * grows longer.
+ */
+static int transcode_audio(AVFormatContext *in_fmt, const char *out_filename,
+                           const char *encoder_name, int out_channels,
+                           int sample_rate, int bit_rate, int *nb_allocs,
+                           void (*progress_cb)(int current, int total)) {
+    AVFormatContext *out_fmt = NULL;
     AVCodecContext *dec_ctx = NULL, *enc_ctx = NULL;
     SwrContext *swr = NULL;
     AVAudioFifo *fifo = NULL;
     AVPacket *pkt = NULL;
     AVFrame *frame = NULL;
+    TranscodeAudioScratch scratch = {0};
     int audio_stream_index = -1;
     int64_t next_pts = 0;
     int ret = 0;
 
-    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
-    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
-
     for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
         if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
             audio_stream_index < 0) {
@@ -580,39 +2246,17 @@ int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
 
     AVStream *in_stream = in_fmt->streams[audio_stream_index];
 
-    const AVCodec *decoder = avcodec_find_decoder(in_stream->codecpar->codec_id);
-    if (!decoder) {
-        ret = AVERROR_DECODER_NOT_FOUND;
-        goto fail;
-    }
-    dec_ctx = avcodec_alloc_context3(decoder);
-    if (!dec_ctx) {
-        ret = AVERROR(ENOMEM);
-        goto fail;
-    }
-    if ((ret = avcodec_parameters_to_context(dec_ctx, in_stream->codecpar)) < 0) goto fail;
-    dec_ctx->pkt_timebase = in_stream->time_base;
-    if ((ret = avcodec_open2(dec_ctx, decoder, NULL)) < 0) goto fail;
+    if ((ret = open_decoder_for_stream(in_stream, &dec_ctx)) < 0) goto fail;
 
-    const AVCodec *encoder = avcodec_find_encoder_by_name("libmp3lame");
-    if (!encoder) encoder = avcodec_find_encoder(AV_CODEC_ID_MP3);
+    const AVCodec *encoder = encoder_name ? transcode_audio_find_encoder(encoder_name) : NULL;
     if (!encoder) {
         ret = AVERROR_ENCODER_NOT_FOUND;
         goto fail;
     }
-    enc_ctx = avcodec_alloc_context3(encoder);
-    if (!enc_ctx) {
-        ret = AVERROR(ENOMEM);
+    if ((ret = transcode_audio_alloc_encoder(encoder, dec_ctx, out_channels, sample_rate,
+                                             bit_rate, &enc_ctx)) < 0)
         goto fail;
-    }
-
-    int nb_channels = transcode_mp3_select_channels(
-        encoder, out_channels, dec_ctx->ch_layout.nb_channels);
-    av_channel_layout_default(&enc_ctx->ch_layout, nb_channels);
-    enc_ctx->sample_rate = transcode_mp3_select_sample_rate(encoder, dec_ctx->sample_rate);
-    enc_ctx->sample_fmt = transcode_mp3_select_sample_fmt(encoder);
-    enc_ctx->bit_rate = bit_rate > 0 ? bit_rate : 128000;
-    enc_ctx->time_base = (AVRational){1, enc_ctx->sample_rate};
+    int nb_channels = enc_ctx->ch_layout.nb_channels;
 
     if ((ret = avformat_alloc_output_context2(&out_fmt, NULL, NULL, out_filename)) < 0) goto fail;
     if (out_fmt->oformat->flags & AVFMT_GLOBALHEADER)
@@ -634,19 +2278,18 @@ int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
             0, NULL)) < 0) goto fail;
     if ((ret = swr_init(swr)) < 0) goto fail;
 
-    int frame_size = enc_ctx->frame_size > 0 ? enc_ctx->frame_size : 1152;
-    fifo = av_audio_fifo_alloc(enc_ctx->sample_fmt, nb_channels, frame_size);
-    if (!fifo) {
-        ret = AVERROR(ENOMEM);
-        goto fail;
-    }
+    if ((ret = transcode_audio_scratch_init(&scratch, enc_ctx)) < 0) goto fail;
+    int frame_size = scratch.frame_size;
 
+    // Room for a frame plus the input frame that tops it up
+    fifo = av_audio_fifo_alloc(enc_ctx->sample_fmt, nb_channels, frame_size * 4);
     pkt = av_packet_alloc();
     frame = av_frame_alloc();
-    if (!pkt || !frame) {
+    if (!fifo || !pkt || !frame) {
         ret = AVERROR(ENOMEM);
         goto fail;
     }
+    scratch.nb_allocs++;
 
     if (!(out_fmt->oformat->flags & AVFMT_NOFILE)) {
         if ((ret = avio_open(&out_fmt->pb, out_filename, AVIO_FLAG_WRITE)) < 0) goto fail;
@@ -679,16 +2322,17 @@ int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
         if (ret < 0) goto fail;
 
         while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0) {
-            ret = transcode_mp3_convert_to_fifo(swr, fifo, nb_channels,
-                                                enc_ctx->sample_fmt, frame);
+            ret = transcode_audio_convert_to_fifo(swr, fifo, nb_channels,
+                                                  enc_ctx->sample_fmt, frame, &scratch);
             av_frame_unref(frame);
             if (ret < 0) goto fail;
         }
         if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) goto fail;
 
         while (av_audio_fifo_size(fifo) >= frame_size) {
-            if ((ret = transcode_mp3_encode_from_fifo(out_fmt, out_stream, enc_ctx, fifo,
-                                                      frame_size, &next_pts, pkt)) < 0)
+            if ((ret = transcode_audio_encode_from_fifo(out_fmt, out_stream, enc_ctx, fifo,
+                                                        frame_size, &next_pts, pkt,
+                                                        &scratch)) < 0)
                 goto fail;
         }
 
@@ -702,34 +2346,30 @@ int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
     /* Flush the decoder. */
     if ((ret = avcodec_send_packet(dec_ctx, NULL)) < 0) goto fail;
     while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0) {
-        ret = transcode_mp3_convert_to_fifo(swr, fifo, nb_channels,
-                                            enc_ctx->sample_fmt, frame);
+        ret = transcode_audio_convert_to_fifo(swr, fifo, nb_channels,
+                                              enc_ctx->sample_fmt, frame, &scratch);
         av_frame_unref(frame);
         if (ret < 0) goto fail;
     }
     if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) goto fail;
 
     /* Flush the resampler. */
-    if ((ret = transcode_mp3_convert_to_fifo(swr, fifo, nb_channels,
-                                             enc_ctx->sample_fmt, NULL)) < 0) goto fail;
+    if ((ret = transcode_audio_convert_to_fifo(swr, fifo, nb_channels,
+                                               enc_ctx->sample_fmt, NULL, &scratch)) < 0)
+        goto fail;
 
-    /* Drain the FIFO; libmp3lame supports a short final frame
-     * (AV_CODEC_CAP_SMALL_LAST_FRAME). */
+    /* Drain the FIFO. The final frame may be short. */
     while (av_audio_fifo_size(fifo) > 0) {
         int nb = FFMIN(av_audio_fifo_size(fifo), frame_size);
-        if ((ret = transcode_mp3_encode_from_fifo(out_fmt, out_stream, enc_ctx, fifo,
-                                                  nb, &next_pts, pkt)) < 0)
+        if ((ret = transcode_audio_encode_from_fifo(out_fmt, out_stream, enc_ctx, fifo,
+                                                    nb, &next_pts, pkt, &scratch)) < 0)
             goto fail;
     }
 
     /* Flush the encoder. */
     if ((ret = avcodec_send_frame(enc_ctx, NULL)) < 0) goto fail;
-    while ((ret = avcodec_receive_packet(enc_ctx, pkt)) >= 0) {
-        av_packet_rescale_ts(pkt, enc_ctx->time_base, out_stream->time_base);
-        pkt->stream_index = out_stream->index;
-        if ((ret = av_interleaved_write_frame(out_fmt, pkt)) < 0) goto fail;
-    }
-    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) goto fail;
+    if ((ret = transcode_audio_write_packets(out_fmt, out_stream, enc_ctx, pkt)) < 0)
+        goto fail;
 
     if ((ret = av_write_trailer(out_fmt)) < 0) goto fail;
 
@@ -744,125 +2384,2313 @@ fail:
     {
         char errbuf[AV_ERROR_MAX_STRING_SIZE];
         av_strerror(ret, errbuf, sizeof(errbuf));
-        fprintf(stderr, "ff_convert_audio_to_mp3: errorno=%d (%s)\n", ret, errbuf);
+        fprintf(stderr, "ff_transcode_audio: errorno=%d (%s)\n", ret, errbuf);
     }
 end:
+    if (nb_allocs) *nb_allocs = scratch.nb_allocs;
+    transcode_audio_scratch_free(&scratch);
     av_frame_free(&frame);
     av_packet_free(&pkt);
     av_audio_fifo_free(fifo);
     swr_free(&swr);
     avcodec_free_context(&dec_ctx);
     avcodec_free_context(&enc_ctx);
-    cleanup(in_fmt, out_fmt);
+    cleanup(NULL, out_fmt);
     return ret;
 }
 
-int convert_to_hls(const char* in_url, const char* playlist_path) {
-    AVFormatContext *in_fmt = NULL, *ofmt = NULL;
-    AVDictionary *mux_opts = NULL;
-    AVPacket pkt;
-    int ret = 0;
+int ff_transcode_audio(const char *in_filename, const char *out_filename,
+                       const char *encoder_name, int out_channels,
+                       int sample_rate, int bit_rate, int *nb_allocs,
+                       void (*progress_cb)(int current, int total)) {
+    AVFormatContext *in_fmt = NULL;
+    int ret;
+    if ((ret = demuxer_session_open(in_filename, &in_fmt, "ff_transcode_audio")) < 0)
+        return ret;
+    ret = transcode_audio(in_fmt, out_filename, encoder_name, out_channels,
+                          sample_rate, bit_rate, nb_allocs, progress_cb);
+    avformat_close_input(&in_fmt);
+    return ret;
+}
 
-    ret = avformat_open_input(&in_fmt, in_url, NULL, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "avformat_open_input: errorno=%d (%s)\n", ret, av_err2str(ret));
-        goto end;
-    }
-    ret = avformat_find_stream_info(in_fmt, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "avformat_find_stream_info: errorno=%d (%s)\n", ret, av_err2str(ret));
-        goto end;
-    }
+int ff_transcode_audio_ctx(AVFormatContext *in_fmt, const char *out_filename,
+                           const char *encoder_name, int out_channels,
+                           int sample_rate, int bit_rate, int *nb_allocs,
+                           void (*progress_cb)(int current, int total)) {
+    int ret;
+    if ((ret = demuxer_session_rewind(in_fmt, "ff_transcode_audio")) < 0)
+        return ret;
+    ret = transcode_audio(in_fmt, out_filename, encoder_name, out_channels,
+                          sample_rate, bit_rate, nb_allocs, progress_cb);
+    demuxer_session_release(in_fmt);
+    return ret;
+}
 
-    ret = avformat_alloc_output_context2(&ofmt, NULL, "hls", playlist_path);
-    if (ret < 0) {
-        fprintf(stderr, "avformat_alloc_output_context2: errorno=%d (%s)\n", ret, av_err2str(ret));
-        goto end;
-    }
+int ff_convert_audio_to_mp3(const char *in_filename, const char *out_filename,
+                            int out_channels, int bit_rate,
+                            void (*progress_cb)(int current, int total)) {
+    return ff_transcode_audio(in_filename, out_filename, "mp3", out_channels, 0,
+                              bit_rate > 0 ? bit_rate : 128000, NULL, progress_cb);
+}
 
-    av_dict_set(&mux_opts, "hls_segment_type", "fmp4", 0);
-    av_dict_set(&mux_opts, "hls_playlist_type", "vod", 0);
-    av_dict_set(&mux_opts, "hls_fmp4_init_filename", "init.mp4", 0);
+int ff_convert_audio_to_mp3_ctx(AVFormatContext *in_fmt, const char *out_filename,
+                                int out_channels, int bit_rate,
+                                void (*progress_cb)(int current, int total)) {
+    return ff_transcode_audio_ctx(in_fmt, out_filename, "mp3", out_channels, 0,
+                                  bit_rate > 0 ? bit_rate : 128000, NULL, progress_cb);
+}
 
-    const char *last_slash = strrchr(playlist_path, '/');
-    char *seg_tmpl = NULL;
-    if (last_slash) {
-        size_t dir_len = (size_t)(last_slash - playlist_path);
-        const char *seg_name = "seg_%05d.m4s";
+#define FF_MP3_FRAME_SAMPLES 1152
 
-        seg_tmpl = (char *) malloc(dir_len + 1 + strlen(seg_name) + 1);
-        if (!seg_tmpl) { ret = AVERROR(ENOMEM); goto end; }
+/* Extra MP3 frames each parallel segment encodes before its start and after
+ * its end and then throws away, so that both the decoder (after seeking) and
+ * the encoder have settled by the first frame that's kept. */
+#define FF_MP3_PARALLEL_OVERLAP_FRAMES 8
 
-        memcpy(seg_tmpl, playlist_path, dir_len);
-        seg_tmpl[dir_len] = '/';
-        strcpy(seg_tmpl + dir_len + 1, seg_name);
+// Don't split into parallel segments shorter than this, in seconds
+#define FF_MP3_PARALLEL_MIN_SEGMENT 10
 
-    } else {
-        seg_tmpl = strdup("seg_%05d.m4s");
-        if (!seg_tmpl) { ret = AVERROR(ENOMEM); goto end; }
-    }
+#ifdef __EMSCRIPTEN_PTHREADS__
+/* One time segment of a parallel MP3 export. Every segment is encoded by its
+ * own demuxer, decoder, resampler and encoder, with the same MP3 frame grid as
+ * a serial export, so the kept packets can simply be concatenated. */
+typedef struct Mp3Segment {
+    // Shared by all segments
+    const char *in_filename;
+    int audio_stream_index;
+    int64_t origin; // Input pts of output sample 0
+    const AVCodec *encoder;
+    const AVCodecContext *enc_params;
 
-    av_dict_set(&mux_opts, "hls_segment_filename", seg_tmpl, 0);
-    free(seg_tmpl);
+    // Output samples [start, end) belong to this segment; end < 0 means EOF
+    int64_t start, end;
 
-    int v_idx = av_find_best_stream(in_fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
-    if (v_idx < 0) { 
-        ret = AVERROR_STREAM_NOT_FOUND; 
-        goto end; 
-    }
+    // Packets kept, in order
+    AVPacket **pkts;
+    int nb_pkts, pkts_size;
 
-    AVStream *in_vst = in_fmt->streams[v_idx];
-    AVStream *out_vst = avformat_new_stream(ofmt, NULL);
-    if (!out_vst) { ret = AVERROR(ENOMEM); goto end; }
+    int64_t processed; // Output samples encoded so far, updated atomically
+    int done; // Set atomically when the thread finishes
+    int ret;
+} Mp3Segment;
 
-    ret = avcodec_parameters_copy(out_vst->codecpar, in_vst->codecpar);
-    if (ret < 0) {
-        fprintf(stderr, "avcodec_parameters_copy: errorno=%d (%s)\n", ret, av_err2str(ret));
+// Keep the encoder's packets that fall within the segment
+static int mp3_segment_receive(Mp3Segment *seg, AVCodecContext *enc_ctx, AVPacket *pkt) {
+    int ret;
+    while ((ret = avcodec_receive_packet(enc_ctx, pkt)) >= 0) {
+        int64_t t = pkt->pts + enc_ctx->initial_padding;
+        if (t < seg->start || (seg->end >= 0 && t >= seg->end)) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        if (seg->nb_pkts >= seg->pkts_size) {
+            int size = seg->pkts_size ? seg->pkts_size * 2 : 256;
+            AVPacket **pkts = av_realloc_array(seg->pkts, size, sizeof(*pkts));
+            if (!pkts) return AVERROR(ENOMEM);
+            seg->pkts = pkts;
+            seg->pkts_size = size;
+        }
+        AVPacket *kept = av_packet_alloc();
+        if (!kept) return AVERROR(ENOMEM);
+        av_packet_move_ref(kept, pkt);
+        seg->pkts[seg->nb_pkts++] = kept;
+    }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ret = 0;
+    return ret;
+}
+
+/* Resample a decoded frame (or flush, if frame is NULL) into the FIFO,
+ * dropping anything before enc_start. *pos is the output sample position of
+ * the next resampled sample, or AV_NOPTS_VALUE until the first frame. */
+static int mp3_segment_convert(Mp3Segment *seg, AVStream *in_stream,
+                               AVCodecContext *enc_ctx, SwrContext *swr,
+                               AVAudioFifo *fifo, const AVFrame *frame,
+                               int64_t enc_start, int64_t *pos,
+                               TranscodeAudioScratch *s) {
+    if (*pos == AV_NOPTS_VALUE) {
+        if (frame && frame->pts != AV_NOPTS_VALUE) {
+            *pos = av_rescale_q(frame->pts - seg->origin, in_stream->time_base,
+                                enc_ctx->time_base);
+        } else if (seg->start == 0) {
+            *pos = 0;
+        } else {
+            return 0;
+        }
+    }
+
+    int converted = transcode_audio_convert(swr, enc_ctx->ch_layout.nb_channels,
+                                            enc_ctx->sample_fmt, frame, s);
+    if (converted <= 0) return converted;
+    if (av_audio_fifo_write(fifo, (void **)s->conv, converted) < converted)
+        return AVERROR_UNKNOWN;
+    if (*pos < enc_start)
+        av_audio_fifo_drain(fifo, FFMIN(converted, enc_start - *pos));
+    *pos += converted;
+    return 0;
+}
+
+static int mp3_segment_run(Mp3Segment *seg) {
+    AVFormatContext *in_fmt = NULL;
+    AVCodecContext *dec_ctx = NULL, *enc_ctx = NULL;
+    AVDictionary *enc_opts = NULL;
+    SwrContext *swr = NULL;
+    AVAudioFifo *fifo = NULL;
+    AVPacket *pkt = NULL;
+    AVFrame *frame = NULL;
+    TranscodeAudioScratch scratch = {0};
+    const AVCodecContext *params = seg->enc_params;
+    const int64_t overlap = FF_MP3_PARALLEL_OVERLAP_FRAMES * FF_MP3_FRAME_SAMPLES;
+    int64_t enc_start = FFMAX(seg->start - overlap, 0);
+    int64_t read_end = seg->end < 0 ? -1 : seg->end + overlap;
+    int64_t pos = AV_NOPTS_VALUE;
+    int64_t next_pts = enc_start;
+    int eof = 0;
+    int ret;
+
+    if ((ret = avformat_open_input(&in_fmt, seg->in_filename, NULL, NULL)) < 0) goto end;
+    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto end;
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (i != seg->audio_stream_index)
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+    AVStream *in_stream = in_fmt->streams[seg->audio_stream_index];
+
+    if ((ret = open_decoder_for_stream(in_stream, &dec_ctx)) < 0) goto end;
+
+    enc_ctx = avcodec_alloc_context3(seg->encoder);
+    if (!enc_ctx) {
+        ret = AVERROR(ENOMEM);
         goto end;
     }
-    out_vst->codecpar->codec_tag = 0;
-    out_vst->time_base = in_vst->time_base;
+    if ((ret = av_channel_layout_copy(&enc_ctx->ch_layout, &params->ch_layout)) < 0) goto end;
+    enc_ctx->sample_rate = params->sample_rate;
+    enc_ctx->sample_fmt = params->sample_fmt;
+    enc_ctx->bit_rate = params->bit_rate;
+    enc_ctx->time_base = params->time_base;
+    enc_ctx->flags = params->flags;
+    // Each frame must stand alone to be stitched to another segment's
+    av_dict_set(&enc_opts, "reservoir", "0", 0);
+    if ((ret = avcodec_open2(enc_ctx, seg->encoder, &enc_opts)) < 0) goto end;
 
-    if (!(ofmt->oformat->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&ofmt->pb, playlist_path, AVIO_FLAG_WRITE);
-        if (ret < 0) {
-            fprintf(stderr, "avio_open: errorno=%d (%s)\n", ret, av_err2str(ret));
+    if ((ret = swr_alloc_set_opts2(&swr,
+            &enc_ctx->ch_layout, enc_ctx->sample_fmt, enc_ctx->sample_rate,
+            &dec_ctx->ch_layout, dec_ctx->sample_fmt, dec_ctx->sample_rate,
+            0, NULL)) < 0) goto end;
+    if ((ret = swr_init(swr)) < 0) goto end;
+
+    if ((ret = transcode_audio_scratch_init(&scratch, enc_ctx)) < 0) goto end;
+    int frame_size = scratch.frame_size;
+    fifo = av_audio_fifo_alloc(enc_ctx->sample_fmt, enc_ctx->ch_layout.nb_channels,
+                               frame_size * 4);
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!fifo || !pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    if (seg->start > 0) {
+        // Seek a further overlap back, so the decoder settles before enc_start
+        int64_t ts = seg->origin + av_rescale_q(enc_start - overlap, enc_ctx->time_base,
+                                                in_stream->time_base);
+        if ((ret = av_seek_frame(in_fmt, seg->audio_stream_index, ts,
+                                 AVSEEK_FLAG_BACKWARD)) < 0)
+            goto end;
+    }
+
+    while (!eof && (read_end < 0 || pos == AV_NOPTS_VALUE || pos < read_end)) {
+        ret = av_read_frame(in_fmt, pkt);
+        if (ret == AVERROR_EOF) {
+            eof = 1;
+            ret = avcodec_send_packet(dec_ctx, NULL);
+        } else if (ret < 0) {
             goto end;
+        } else if (pkt->stream_index != seg->audio_stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        } else {
+            ret = avcodec_send_packet(dec_ctx, pkt);
+            av_packet_unref(pkt);
+        }
+        if (ret < 0) goto end;
+
+        while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0) {
+            ret = mp3_segment_convert(seg, in_stream, enc_ctx, swr, fifo, frame,
+                                      enc_start, &pos, &scratch);
+            av_frame_unref(frame);
+            if (ret < 0) goto end;
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) goto end;
+
+        while (av_audio_fifo_size(fifo) >= frame_size) {
+            if ((ret = transcode_audio_frame_from_fifo(fifo, frame_size, &next_pts,
+                                                       &scratch)) < 0 ||
+                (ret = avcodec_send_frame(enc_ctx, scratch.enc_frame)) < 0 ||
+                (ret = mp3_segment_receive(seg, enc_ctx, pkt)) < 0)
+                goto end;
         }
+        __atomic_store_n(&seg->processed, next_pts - enc_start, __ATOMIC_RELAXED);
     }
-    ret = avformat_write_header(ofmt, &mux_opts);
-    if (ret < 0) {
-        fprintf(stderr, "avformat_write_header: errorno=%d (%s)\n", ret, av_err2str(ret));
+
+    // Only the last segment really reaches the end, and needs the resampler's tail
+    if (eof && (ret = mp3_segment_convert(seg, in_stream, enc_ctx, swr, fifo, NULL,
+                                          enc_start, &pos, &scratch)) < 0)
         goto end;
+
+    while (av_audio_fifo_size(fifo) > 0) {
+        int nb = FFMIN(av_audio_fifo_size(fifo), frame_size);
+        if ((ret = transcode_audio_frame_from_fifo(fifo, nb, &next_pts, &scratch)) < 0 ||
+            (ret = avcodec_send_frame(enc_ctx, scratch.enc_frame)) < 0 ||
+            (ret = mp3_segment_receive(seg, enc_ctx, pkt)) < 0)
+            goto end;
     }
+    if ((ret = avcodec_send_frame(enc_ctx, NULL)) < 0) goto end;
+    ret = mp3_segment_receive(seg, enc_ctx, pkt);
 
-    av_dict_free(&mux_opts);
+end:
+    transcode_audio_scratch_free(&scratch);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    av_audio_fifo_free(fifo);
+    swr_free(&swr);
+    av_dict_free(&enc_opts);
+    avcodec_free_context(&dec_ctx);
+    avcodec_free_context(&enc_ctx);
+    avformat_close_input(&in_fmt);
+    return ret;
+}
 
-    while (av_read_frame(in_fmt, &pkt) >= 0) {
-        if (pkt.stream_index == v_idx) {
-            av_packet_rescale_ts(&pkt, in_vst->time_base, out_vst->time_base);
-            pkt.stream_index = out_vst->index;
-            ret = av_interleaved_write_frame(ofmt, &pkt);
-            if (ret < 0) {
-                fprintf(stderr, "av_interleaved_write_frame: errorno=%d (%s)\n", ret, av_err2str(ret));
-            }
+static void *mp3_segment_thread(void *arg) {
+    Mp3Segment *seg = arg;
+    seg->ret = mp3_segment_run(seg);
+    __atomic_store_n(&seg->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Find the input pts of the first decoded sample, which is output sample 0
+static int mp3_parallel_find_origin(AVFormatContext *in_fmt, int audio_stream_index,
+                                    AVCodecContext *dec_ctx, int64_t *origin) {
+    AVPacket *pkt = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int ret = AVERROR(ENOMEM);
+    if (!pkt || !frame) goto end;
+
+    while ((ret = av_read_frame(in_fmt, pkt)) >= 0) {
+        if (pkt->stream_index != audio_stream_index) {
+            av_packet_unref(pkt);
+            continue;
         }
-        av_packet_unref(&pkt);
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) goto end;
+        ret = avcodec_receive_frame(dec_ctx, frame);
+        if (ret == AVERROR(EAGAIN)) continue;
+        if (ret < 0) goto end;
+        *origin = frame->pts;
+        ret = frame->pts == AV_NOPTS_VALUE ? AVERROR(ENOSYS) : 0;
+        goto end;
     }
 
-    ret = av_write_trailer(ofmt);
-    if (ret < 0) {
-        fprintf(stderr, "av_write_trailer: errorno=%d (%s)\n", ret, av_err2str(ret));
+end:
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    return ret;
+}
+#endif
+
+/**
+ * Convert the first audio stream of a file to MP3 like ff_convert_audio_to_mp3,
+ * but split the timeline into up to nb_threads segments (0 for one per CPU)
+ * and encode them on their own threads. Each segment starts on the serial
+ * export's MP3 frame grid and encodes some overlap on either side, so the
+ * kept frames are stitched together without gaps, and the encoder delay and
+ * final padding are the same as a serial export. The bit reservoir is
+ * disabled so that frames can be stitched.
+ *
+ * Falls back to the serial path in builds without threads, for short or
+ * unseekable input, or with nb_threads 1. Inputs must be readable without
+ * suspending (i.e., not block reader devices), since the segments are read
+ * on other threads.
+ */
+int ff_convert_audio_to_mp3_parallel(const char *in_filename, const char *out_filename,
+                                     int out_channels, int bit_rate, int nb_threads,
+                                     void (*progress_cb)(int current, int total)) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    AVFormatContext *in_fmt = NULL, *out_fmt = NULL;
+    AVCodecContext *dec_ctx = NULL, *enc_ctx = NULL;
+    AVDictionary *enc_opts = NULL;
+    Mp3Segment *segs = NULL;
+    pthread_t *threads = NULL;
+    int nb_segs = 0, nb_started = 0;
+    int serial = 0;
+    int audio_stream_index = -1;
+    int ret = 0;
+
+    if (nb_threads <= 0)
+        nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nb_threads <= 1) {
+        serial = 1;
+        goto end;
+    }
+
+    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
+    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+            audio_stream_index < 0) {
+            audio_stream_index = i;
+        } else {
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    if (audio_stream_index < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto fail;
+    }
+    AVStream *in_stream = in_fmt->streams[audio_stream_index];
+
+    int64_t total_duration = 0;
+    if (in_stream->duration != AV_NOPTS_VALUE && in_stream->duration > 0) {
+        total_duration = in_stream->duration;
+    } else if (in_fmt->duration != AV_NOPTS_VALUE && in_fmt->duration > 0) {
+        total_duration = av_rescale_q(in_fmt->duration, AV_TIME_BASE_Q, in_stream->time_base);
+    }
+    if (total_duration <= 0 || !in_fmt->pb ||
+        !(in_fmt->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        serial = 1;
+        goto end;
+    }
+
+    if ((ret = open_decoder_for_stream(in_stream, &dec_ctx)) < 0) goto fail;
+
+    const AVCodec *encoder = transcode_audio_find_encoder("mp3");
+    if (!encoder) {
+        ret = AVERROR_ENCODER_NOT_FOUND;
+        goto fail;
+    }
+    if ((ret = transcode_audio_alloc_encoder(encoder, dec_ctx, out_channels, 0,
+                                             bit_rate > 0 ? bit_rate : 128000,
+                                             &enc_ctx)) < 0)
+        goto fail;
+
+    int64_t total_samples = av_rescale_q(total_duration, in_stream->time_base,
+                                         enc_ctx->time_base);
+    nb_segs = FFMIN(nb_threads,
+                    total_samples / ((int64_t) enc_ctx->sample_rate * FF_MP3_PARALLEL_MIN_SEGMENT));
+    if (nb_segs <= 1) {
+        serial = 1;
+        goto end;
+    }
+
+    if ((ret = avformat_alloc_output_context2(&out_fmt, NULL, NULL, out_filename)) < 0) goto fail;
+    if (out_fmt->oformat->flags & AVFMT_GLOBALHEADER)
+        enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    av_dict_set(&enc_opts, "reservoir", "0", 0);
+    if ((ret = avcodec_open2(enc_ctx, encoder, &enc_opts)) < 0) goto fail;
+
+    int64_t origin;
+    if ((ret = mp3_parallel_find_origin(in_fmt, audio_stream_index, dec_ctx, &origin)) < 0)
+        goto fail;
+
+    segs = av_calloc(nb_segs, sizeof(*segs));
+    threads = av_calloc(nb_segs, sizeof(*threads));
+    if (!segs || !threads) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (int i = 0; i < nb_segs; i++) {
+        Mp3Segment *seg = &segs[i];
+        seg->in_filename = in_filename;
+        seg->audio_stream_index = audio_stream_index;
+        seg->origin = origin;
+        seg->encoder = encoder;
+        seg->enc_params = enc_ctx;
+        seg->start = total_samples * i / nb_segs / FF_MP3_FRAME_SAMPLES * FF_MP3_FRAME_SAMPLES;
+        seg->end = (i == nb_segs - 1) ? -1 :
+            total_samples * (i + 1) / nb_segs / FF_MP3_FRAME_SAMPLES * FF_MP3_FRAME_SAMPLES;
+    }
+
+    // Run what we can in parallel, and anything that can't get a thread here
+    for (nb_started = 0; nb_started < nb_segs; nb_started++) {
+        if (pthread_create(&threads[nb_started], NULL, mp3_segment_thread,
+                           &segs[nb_started]))
+            break;
+    }
+    for (int i = nb_started; i < nb_segs; i++)
+        mp3_segment_thread(&segs[i]);
+
+    for (;;) {
+        int done = 1;
+        int64_t processed = 0;
+        for (int i = 0; i < nb_segs; i++) {
+            done = done && __atomic_load_n(&segs[i].done, __ATOMIC_ACQUIRE);
+            processed += __atomic_load_n(&segs[i].processed, __ATOMIC_RELAXED);
+        }
+        if (done) break;
+        if (progress_cb) {
+            progress_cb(av_rescale_q(FFMIN(processed, total_samples), enc_ctx->time_base,
+                                     in_stream->time_base),
+                        total_duration);
+        }
+        usleep(100000);
+    }
+    for (int i = 0; i < nb_started; i++)
+        pthread_join(threads[i], NULL);
+    nb_started = 0;
+
+    for (int i = 0; i < nb_segs; i++) {
+        if ((ret = segs[i].ret) < 0) goto fail;
+    }
+
+    AVStream *out_stream = avformat_new_stream(out_fmt, NULL);
+    if (!out_stream) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = avcodec_parameters_from_context(out_stream->codecpar, enc_ctx)) < 0) goto fail;
+    out_stream->time_base = enc_ctx->time_base;
+
+    if (!(out_fmt->oformat->flags & AVFMT_NOFILE)) {
+        if ((ret = avio_open(&out_fmt->pb, out_filename, AVIO_FLAG_WRITE)) < 0) goto fail;
+    }
+    if ((ret = avformat_write_header(out_fmt, NULL)) < 0) goto fail;
+
+    for (int i = 0; i < nb_segs; i++) {
+        for (int j = 0; j < segs[i].nb_pkts; j++) {
+            AVPacket *pkt = segs[i].pkts[j];
+            av_packet_rescale_ts(pkt, enc_ctx->time_base, out_stream->time_base);
+            pkt->stream_index = out_stream->index;
+            if ((ret = av_interleaved_write_frame(out_fmt, pkt)) < 0) goto fail;
+        }
+    }
+    if ((ret = av_write_trailer(out_fmt)) < 0) goto fail;
+
+    if (progress_cb) {
+        progress_cb(total_duration, total_duration);
     }
 
+    ret = 0;
+    goto end;
+
+fail:
+    {
+        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "ff_convert_audio_to_mp3_parallel: errorno=%d (%s)\n", ret, errbuf);
+    }
 end:
-    if (ofmt && !(ofmt->oformat->flags & AVFMT_NOFILE) && ofmt->pb) avio_closep(&ofmt->pb);
-    if (ofmt) avformat_free_context(ofmt);
-    if (in_fmt) avformat_close_input(&in_fmt);
-    av_dict_free(&mux_opts);
+    for (int i = 0; i < nb_started; i++)
+        pthread_join(threads[i], NULL);
+    if (segs) {
+        for (int i = 0; i < nb_segs; i++) {
+            for (int j = 0; j < segs[i].nb_pkts; j++)
+                av_packet_free(&segs[i].pkts[j]);
+            av_free(segs[i].pkts);
+        }
+    }
+    av_free(segs);
+    av_free(threads);
+    av_dict_free(&enc_opts);
+    avcodec_free_context(&dec_ctx);
+    avcodec_free_context(&enc_ctx);
+    cleanup(in_fmt, out_fmt);
+    if (serial)
+        return ff_convert_audio_to_mp3(in_filename, out_filename, out_channels, bit_rate,
+                                       progress_cb);
+    return ret;
+
+#else
+    (void) nb_threads;
+    return ff_convert_audio_to_mp3(in_filename, out_filename, out_channels, bit_rate,
+                                   progress_cb);
+#endif
+}
+
+// Most levels one ff_audio_peaks call may build
+#define AUDIO_PEAKS_MAX_LEVELS 16
+
+// Samples squared and summed in float before going into the double sum
+#define AUDIO_PEAKS_SQ_CHUNK 4096
+
+// One level of an ff_audio_peaks pyramid, of spp samples per pixel
+typedef struct AudioPeaksLevel {
+    int spp;
+    float *min, *max, *rms; // Finished pixels
+    int count, cap;
+    float acc_min, acc_max; // Pixel in progress
+    double acc_sq;
+    int acc_n;
+} AudioPeaksLevel;
+
+/* Samples are first reduced into base blocks of the largest size that
+ * divides every level, and each level is then built from those blocks, so
+ * every sample is only visited once however many levels there are. */
+typedef struct AudioPeaksState {
+    AudioPeaksLevel levels[AUDIO_PEAKS_MAX_LEVELS];
+    int nb_levels;
+    int block;
+    float blk_min, blk_max;
+    double blk_sq;
+    int blk_n;
+    int64_t total_samples;
+} AudioPeaksState;
+
+// Fold n samples into a running minimum, maximum and sum of squares
+static void audio_peaks_reduce(const float *s, int n, float *min_p, float *max_p,
+                               double *sq_p) {
+    float mn = *min_p, mx = *max_p;
+    double sq = *sq_p;
+    int i = 0;
+
+    while (i < n) {
+        int chunk_end = FFMIN(n, i + AUDIO_PEAKS_SQ_CHUNK);
+        float csq = 0.0f;
+        for (; i < chunk_end; i++) {
+            float v = s[i];
+            if (v < mn) mn = v;
+            if (v > mx) mx = v;
+            csq += v * v;
+        }
+        sq += csq;
+    }
+
+    *min_p = mn;
+    *max_p = mx;
+    *sq_p = sq;
+}
+
+static int audio_peaks_emit(AudioPeaksLevel *level) {
+    if (level->count >= level->cap) {
+        int cap = FFMAX(level->cap * 2, 256);
+        float **arrs[3] = {&level->min, &level->max, &level->rms};
+        for (int i = 0; i < 3; i++) {
+            float *arr = av_realloc_array(*arrs[i], cap, sizeof(float));
+            if (!arr) return AVERROR(ENOMEM);
+            *arrs[i] = arr;
+        }
+        level->cap = cap;
+    }
+    level->min[level->count] = level->acc_min;
+    level->max[level->count] = level->acc_max;
+    level->rms[level->count] = sqrt(level->acc_sq / level->acc_n);
+    level->count++;
+    level->acc_min = FLT_MAX;
+    level->acc_max = -FLT_MAX;
+    level->acc_sq = 0;
+    level->acc_n = 0;
+    return 0;
+}
+
+// Add the current (finished or, at the end, partial) base block to every level
+static int audio_peaks_push_block(AudioPeaksState *st) {
+    for (int i = 0; i < st->nb_levels; i++) {
+        AudioPeaksLevel *level = &st->levels[i];
+        level->acc_min = FFMIN(level->acc_min, st->blk_min);
+        level->acc_max = FFMAX(level->acc_max, st->blk_max);
+        level->acc_sq += st->blk_sq;
+        level->acc_n += st->blk_n;
+        if (level->acc_n >= level->spp) {
+            int ret = audio_peaks_emit(level);
+            if (ret < 0) return ret;
+        }
+    }
+    st->blk_min = FLT_MAX;
+    st->blk_max = -FLT_MAX;
+    st->blk_sq = 0;
+    st->blk_n = 0;
+    return 0;
+}
+
+static int audio_peaks_feed(AudioPeaksState *st, const float *samples, int nb_samples) {
+    st->total_samples += nb_samples;
+    while (nb_samples > 0) {
+        int n = FFMIN(nb_samples, st->block - st->blk_n);
+        audio_peaks_reduce(samples, n, &st->blk_min, &st->blk_max, &st->blk_sq);
+        st->blk_n += n;
+        samples += n;
+        nb_samples -= n;
+        if (st->blk_n == st->block) {
+            int ret = audio_peaks_push_block(st);
+            if (ret < 0) return ret;
+        }
+    }
+    return 0;
+}
+
+// Downmix a frame (or flush, if frame is NULL) and feed it to the pyramid
+static int audio_peaks_convert(SwrContext *swr, const AVFrame *frame,
+                               TranscodeAudioScratch *s, AudioPeaksState *st) {
+    int converted = transcode_audio_convert(swr, 1, AV_SAMPLE_FMT_FLT, frame, s);
+    if (converted <= 0) return converted;
+    return audio_peaks_feed(st, (const float *) s->conv[0], converted);
+}
+
+static int audio_peaks_receive_frames(AVCodecContext *dec_ctx, AVFrame *frame,
+                                      SwrContext *swr, TranscodeAudioScratch *s,
+                                      AudioPeaksState *st) {
+    int ret;
+    while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0) {
+        ret = audio_peaks_convert(swr, frame, s, st);
+        av_frame_unref(frame);
+        if (ret < 0) return ret;
+    }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ret = 0;
     return ret;
 }
 
+// Pack the finished pyramid into the single buffer ff_audio_peaks returns
+static int audio_peaks_pack(const AudioPeaksState *st, int sample_rate, uint8_t **out) {
+    size_t header_size = (8 + 4 * st->nb_levels) * sizeof(int32_t);
+    size_t size = header_size;
+    for (int i = 0; i < st->nb_levels; i++)
+        size += 3 * (size_t) st->levels[i].count * sizeof(float);
+    if (size > INT_MAX) return AVERROR(ERANGE);
+
+    uint8_t *buf = av_malloc(size);
+    if (!buf) return AVERROR(ENOMEM);
+
+    int32_t *header = (int32_t *) buf;
+    size_t offset = header_size;
+    header[0] = size;
+    header[1] = st->nb_levels;
+    header[2] = sample_rate;
+    header[3] = (uint32_t) st->total_samples;
+    header[4] = st->total_samples >> 32;
+    header[5] = header[6] = header[7] = 0;
+    for (int i = 0; i < st->nb_levels; i++) {
+        const AudioPeaksLevel *level = &st->levels[i];
+        size_t bytes = (size_t) level->count * sizeof(float);
+        int32_t *entry = header + 8 + 4 * i;
+        entry[0] = level->spp;
+        entry[1] = level->count;
+        entry[2] = offset;
+        entry[3] = 0;
+        if (bytes) {
+            memcpy(buf + offset, level->min, bytes);
+            memcpy(buf + offset + bytes, level->max, bytes);
+            memcpy(buf + offset + 2 * bytes, level->rms, bytes);
+        }
+        offset += 3 * bytes;
+    }
+
+    *out = buf;
+    return 0;
+}
+
+/**
+ * Build a waveform peak pyramid for an audio stream (the first, if
+ * stream_index is negative) in a single decoding pass. The audio is
+ * downmixed to mono, and for each of the nb_levels samples-per-pixel values
+ * in levels, the minimum, maximum and RMS of every pixel are computed. The
+ * result is written to *out as one buffer, to be freed by the caller (see
+ * ff_copyout_audio_peaks), laid out as:
+ *   int32 header[8]: size in bytes, nb_levels, sample rate, total samples
+ *                    (low and high 32 bits), 0, 0, 0
+ *   int32 level[4], per level: samples per pixel, pixel count, byte offset
+ *                    of the level's data, 0
+ *   then per level: float min[count], max[count], rms[count]
+ * The last pixel of each level may cover fewer samples. progress_cb, if
+ * given, is called like the other helpers' progress callbacks, but may
+ * return non-zero to cancel, in which case AVERROR_EXIT is returned.
+ */
+int ff_audio_peaks(const char *in_filename, int stream_index, const int *levels,
+                   int nb_levels, uint8_t **out,
+                   int (*progress_cb)(int current, int total)) {
+    AVFormatContext *in_fmt = NULL;
+    AVCodecContext *dec_ctx = NULL;
+    SwrContext *swr = NULL;
+    AVPacket *pkt = NULL;
+    AVFrame *frame = NULL;
+    TranscodeAudioScratch scratch = {0};
+    AudioPeaksState st = {0};
+    AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+    int ret = 0;
+
+    *out = NULL;
+    if (!levels || nb_levels <= 0 || nb_levels > AUDIO_PEAKS_MAX_LEVELS) {
+        ret = AVERROR(EINVAL);
+        goto fail;
+    }
+    st.nb_levels = nb_levels;
+    st.blk_min = FLT_MAX;
+    st.blk_max = -FLT_MAX;
+    for (int i = 0; i < nb_levels; i++) {
+        if (levels[i] <= 0) {
+            ret = AVERROR(EINVAL);
+            goto fail;
+        }
+        st.levels[i].spp = levels[i];
+        st.levels[i].acc_min = FLT_MAX;
+        st.levels[i].acc_max = -FLT_MAX;
+        st.block = st.block ? av_gcd(st.block, levels[i]) : levels[i];
+    }
+
+    if ((ret = avformat_open_input(&in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
+    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
+
+    if (stream_index >= (int) in_fmt->nb_streams ||
+        (stream_index >= 0 &&
+         in_fmt->streams[stream_index]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)) {
+        ret = AVERROR(EINVAL);
+        goto fail;
+    }
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (stream_index < 0 &&
+            in_fmt->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            stream_index = i;
+        } else if ((int) i != stream_index) {
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    if (stream_index < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto fail;
+    }
+
+    AVStream *in_stream = in_fmt->streams[stream_index];
+
+    if ((ret = open_decoder_for_stream(in_stream, &dec_ctx)) < 0) goto fail;
+
+    if ((ret = swr_alloc_set_opts2(&swr,
+            &mono, AV_SAMPLE_FMT_FLT, dec_ctx->sample_rate,
+            &dec_ctx->ch_layout, dec_ctx->sample_fmt, dec_ctx->sample_rate,
+            0, NULL)) < 0) goto fail;
+    if ((ret = swr_init(swr)) < 0) goto fail;
+
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    int64_t total_duration = 0;
+    if (in_stream->duration != AV_NOPTS_VALUE && in_stream->duration > 0) {
+        total_duration = in_stream->duration;
+    } else if (in_fmt->duration != AV_NOPTS_VALUE && in_fmt->duration > 0) {
+        total_duration = av_rescale_q(in_fmt->duration, AV_TIME_BASE_Q, in_stream->time_base);
+    }
+
+    int64_t processed_pts = 0;
+    int packet_count = 0;
+    const int progress_update_interval = 100;
+
+    while ((ret = av_read_frame(in_fmt, pkt)) >= 0) {
+        if (pkt->stream_index != stream_index) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        if (pkt->pts != AV_NOPTS_VALUE) {
+            processed_pts = pkt->pts;
+        }
+
+        ret = avcodec_send_packet(dec_ctx, pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) goto fail;
+        if ((ret = audio_peaks_receive_frames(dec_ctx, frame, swr, &scratch, &st)) < 0)
+            goto fail;
+
+        packet_count++;
+        if (progress_cb && packet_count % progress_update_interval == 0) {
+            if (progress_cb(processed_pts, total_duration)) {
+                ret = AVERROR_EXIT;
+                goto end;
+            }
+        }
+    }
+    if (ret != AVERROR_EOF) goto fail;
+
+    /* Flush the decoder and the resampler. */
+    if ((ret = avcodec_send_packet(dec_ctx, NULL)) < 0) goto fail;
+    if ((ret = audio_peaks_receive_frames(dec_ctx, frame, swr, &scratch, &st)) < 0)
+        goto fail;
+    if ((ret = audio_peaks_convert(swr, NULL, &scratch, &st)) < 0) goto fail;
+
+    /* Finish the partial block and pixels at the end. */
+    if (st.blk_n && (ret = audio_peaks_push_block(&st)) < 0) goto fail;
+    for (int i = 0; i < nb_levels; i++) {
+        if (st.levels[i].acc_n && (ret = audio_peaks_emit(&st.levels[i])) < 0) goto fail;
+    }
+
+    if ((ret = audio_peaks_pack(&st, dec_ctx->sample_rate, out)) < 0) goto fail;
+
+    if (progress_cb && total_duration > 0) {
+        progress_cb(total_duration, total_duration);
+    }
+
+    ret = 0;
+    goto end;
+
+fail:
+    {
+        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "ff_audio_peaks: errorno=%d (%s)\n", ret, errbuf);
+    }
+end:
+    for (int i = 0; i < AUDIO_PEAKS_MAX_LEVELS; i++) {
+        av_free(st.levels[i].min);
+        av_free(st.levels[i].max);
+        av_free(st.levels[i].rms);
+    }
+    transcode_audio_scratch_free(&scratch);
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    swr_free(&swr);
+    avcodec_free_context(&dec_ctx);
+    cleanup(in_fmt, NULL);
+    return ret;
+}
+
+// A file the hls muxer has open for writing
+typedef struct HlsStreamFile {
+    AVIOContext *pb;
+    char *url;
+} HlsStreamFile;
+
+/* io_open/io_close2 hooks for convert_to_hls_cb, which report every file the
+ * hls muxer finishes writing. */
+typedef struct HlsStreamState {
+    int (*io_open)(AVFormatContext *s, AVIOContext **pb, const char *url,
+                   int flags, AVDictionary **options);
+    int (*io_close2)(AVFormatContext *s, AVIOContext *pb);
+    int (*segment_cb)(const char *path);
+    HlsStreamFile *open;
+    int nb_open, open_cap;
+    int ret; // First error from segment_cb, which the muxer may not pass on
+} HlsStreamState;
+
+static int hls_stream_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                              int flags, AVDictionary **options) {
+    HlsStreamState *st = s->opaque;
+    HlsStreamFile *file = NULL;
+    int ret = st->io_open(s, pb, url, flags, options);
+    if (ret < 0 || !(flags & AVIO_FLAG_WRITE)) return ret;
+
+    for (int i = 0; i < st->nb_open; i++) {
+        if (!st->open[i].pb) {
+            file = &st->open[i];
+            break;
+        }
+    }
+    if (!file) {
+        if (st->nb_open >= st->open_cap) {
+            int cap = FFMAX(st->open_cap * 2, 8);
+            HlsStreamFile *open = av_realloc_array(st->open, cap, sizeof(HlsStreamFile));
+            if (!open) goto fail;
+            st->open = open;
+            st->open_cap = cap;
+        }
+        file = &st->open[st->nb_open++];
+        file->pb = NULL;
+    }
+    if (!(file->url = av_strdup(url))) goto fail;
+    file->pb = *pb;
+    return ret;
+
+fail:
+    // A file we couldn't track would never be reported, so don't open it
+    st->io_close2(s, *pb);
+    *pb = NULL;
+    return AVERROR(ENOMEM);
+}
+
+static int hls_stream_io_close2(AVFormatContext *s, AVIOContext *pb) {
+    HlsStreamState *st = s->opaque;
+    char *url = NULL;
+    for (int i = 0; i < st->nb_open; i++) {
+        if (pb && st->open[i].pb == pb) {
+            url = st->open[i].url;
+            st->open[i].pb = NULL;
+            st->open[i].url = NULL;
+            break;
+        }
+    }
+
+    int ret = st->io_close2(s, pb);
+    if (url) {
+        // The file is complete, so the callback may take it away
+        if (ret >= 0) {
+            ret = st->segment_cb(url);
+            if (ret < 0 && st->ret >= 0) st->ret = ret;
+        }
+        av_free(url);
+    }
+    return ret;
+}
+
+/**
+ * Convert a file to HLS like convert_to_hls, calling segment_cb with the path
+ * of each file (segment, init segment or playlist) as soon as the hls muxer
+ * finishes writing it, so that it can be handed over and removed while the
+ * conversion continues. A playlist is reported again every time it's
+ * rewritten. If segment_cb returns a negative error, the conversion stops and
+ * returns it.
+ */
+static int hls_convert(AVFormatContext *in_fmt, const char* playlist_path,
+                       int (*segment_cb)(const char *path)) {
+    AVFormatContext *ofmt = NULL;
+    AVDictionary *mux_opts = NULL;
+    HlsStreamState stream_state = {0};
+    AVPacket pkt;
+    int ret = 0;
+
+    ret = avformat_alloc_output_context2(&ofmt, NULL, "hls", playlist_path);
+    if (ret < 0) {
+        fprintf(stderr, "avformat_alloc_output_context2: errorno=%d (%s)\n", ret, av_err2str(ret));
+        goto end;
+    }
+
+    if (segment_cb) {
+        stream_state.io_open = ofmt->io_open;
+        stream_state.io_close2 = ofmt->io_close2;
+        stream_state.segment_cb = segment_cb;
+        ofmt->opaque = &stream_state;
+        ofmt->io_open = hls_stream_io_open;
+        ofmt->io_close2 = hls_stream_io_close2;
+    }
+
+    av_dict_set(&mux_opts, "hls_segment_type", "fmp4", 0);
+    av_dict_set(&mux_opts, "hls_playlist_type", "vod", 0);
+    av_dict_set(&mux_opts, "hls_fmp4_init_filename", "init.mp4", 0);
+
+    const char *last_slash = strrchr(playlist_path, '/');
+    char *seg_tmpl = NULL;
+    if (last_slash) {
+        size_t dir_len = (size_t)(last_slash - playlist_path);
+        const char *seg_name = "seg_%05d.m4s";
+
+        seg_tmpl = (char *) malloc(dir_len + 1 + strlen(seg_name) + 1);
+        if (!seg_tmpl) { ret = AVERROR(ENOMEM); goto end; }
+
+        memcpy(seg_tmpl, playlist_path, dir_len);
+        seg_tmpl[dir_len] = '/';
+        strcpy(seg_tmpl + dir_len + 1, seg_name);
+
+    } else {
+        seg_tmpl = strdup("seg_%05d.m4s");
+        if (!seg_tmpl) { ret = AVERROR(ENOMEM); goto end; }
+    }
+
+    av_dict_set(&mux_opts, "hls_segment_filename", seg_tmpl, 0);
+    free(seg_tmpl);
+
+    int v_idx = av_find_best_stream(in_fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (v_idx < 0) { 
+        ret = AVERROR_STREAM_NOT_FOUND; 
+        goto end; 
+    }
+
+    AVStream *in_vst = in_fmt->streams[v_idx];
+    AVStream *out_vst = avformat_new_stream(ofmt, NULL);
+    if (!out_vst) { ret = AVERROR(ENOMEM); goto end; }
+
+    ret = avcodec_parameters_copy(out_vst->codecpar, in_vst->codecpar);
+    if (ret < 0) {
+        fprintf(stderr, "avcodec_parameters_copy: errorno=%d (%s)\n", ret, av_err2str(ret));
+        goto end;
+    }
+    out_vst->codecpar->codec_tag = 0;
+    out_vst->time_base = in_vst->time_base;
+
+    if (!(ofmt->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&ofmt->pb, playlist_path, AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            fprintf(stderr, "avio_open: errorno=%d (%s)\n", ret, av_err2str(ret));
+            goto end;
+        }
+    }
+    ret = avformat_write_header(ofmt, &mux_opts);
+    if (ret < 0) {
+        fprintf(stderr, "avformat_write_header: errorno=%d (%s)\n", ret, av_err2str(ret));
+        goto end;
+    }
+
+    av_dict_free(&mux_opts);
+
+    while (av_read_frame(in_fmt, &pkt) >= 0) {
+        if (pkt.stream_index == v_idx) {
+            av_packet_rescale_ts(&pkt, in_vst->time_base, out_vst->time_base);
+            pkt.stream_index = out_vst->index;
+            ret = av_interleaved_write_frame(ofmt, &pkt);
+            if (ret < 0) {
+                fprintf(stderr, "av_interleaved_write_frame: errorno=%d (%s)\n", ret, av_err2str(ret));
+            }
+        }
+        av_packet_unref(&pkt);
+        if (stream_state.ret < 0) break;
+    }
+
+    ret = av_write_trailer(ofmt);
+    if (ret < 0) {
+        fprintf(stderr, "av_write_trailer: errorno=%d (%s)\n", ret, av_err2str(ret));
+    }
+    if (stream_state.ret < 0) {
+        ret = stream_state.ret;
+        fprintf(stderr, "segment_cb: errorno=%d (%s)\n", ret, av_err2str(ret));
+    }
+
+end:
+    if (ofmt && !(ofmt->oformat->flags & AVFMT_NOFILE) && ofmt->pb) avio_closep(&ofmt->pb);
+    if (ofmt) avformat_free_context(ofmt);
+    av_dict_free(&mux_opts);
+    for (int i = 0; i < stream_state.nb_open; i++)
+        av_free(stream_state.open[i].url);
+    av_free(stream_state.open);
+    return ret;
+}
+
+int convert_to_hls_cb(const char* in_url, const char* playlist_path,
+                      int (*segment_cb)(const char *path)) {
+    AVFormatContext *in_fmt = NULL;
+    int ret;
+    if ((ret = demuxer_session_open(in_url, &in_fmt, "convert_to_hls")) < 0)
+        return ret;
+    ret = hls_convert(in_fmt, playlist_path, segment_cb);
+    avformat_close_input(&in_fmt);
+    return ret;
+}
+
+int convert_to_hls_cb_ctx(AVFormatContext *in_fmt, const char* playlist_path,
+                          int (*segment_cb)(const char *path)) {
+    int ret;
+    if ((ret = demuxer_session_rewind(in_fmt, "convert_to_hls")) < 0)
+        return ret;
+    ret = hls_convert(in_fmt, playlist_path, segment_cb);
+    demuxer_session_release(in_fmt);
+    return ret;
+}
+
+int convert_to_hls(const char* in_url, const char* playlist_path) {
+    return convert_to_hls_cb(in_url, playlist_path, NULL);
+}
+
+int convert_to_hls_ctx(AVFormatContext *in_fmt, const char* playlist_path) {
+    return convert_to_hls_cb_ctx(in_fmt, playlist_path, NULL);
+}
+
+#if LIBAVJS_WITH_SWSCALE
+#define HLS_ABR_MAX_RENDITIONS 8
+
+// Frames each rendition's encoder thread may fall behind the decoder
+#define HLS_ABR_QUEUE_SIZE 8
+
+// Keyframe interval (and so segment length), in seconds, shared by all renditions
+#define HLS_ABR_SEGMENT_SECONDS 2
+
+#define HLS_ABR_DEFAULT_LADDER "0x720@2800k,0x480@1400k,0x360@800k"
+
+typedef struct HlsAbrJob HlsAbrJob;
+
+// One scaled video encode of an ABR job
+typedef struct HlsRendition {
+    HlsAbrJob *job;
+    int width, height; // 0 to follow the source's aspect ratio
+    int64_t bit_rate;
+    AVCodecContext *enc_ctx;
+    struct SwsContext *sws;
+    AVFrame *scaled;
+    AVPacket *pkt;
+    AVStream *out_stream;
+    int ret;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    pthread_t thread;
+    int started;
+    AVFrame *queue[HLS_ABR_QUEUE_SIZE];
+    int q_head, q_count;
+    int finished; // No more frames are coming
+#endif
+} HlsRendition;
+
+// The single AAC encode of an ABR job
+typedef struct HlsAbrAudio {
+    AVStream *in_stream, *out_stream;
+    AVCodecContext *dec_ctx, *enc_ctx;
+    SwrContext *swr;
+    AVAudioFifo *fifo;
+    TranscodeAudioScratch scratch;
+    AVFrame *frame;
+    AVPacket *pkt;
+    int64_t next_pts; // In the encoder time base
+    int started; // next_pts has been taken from the first decoded frame
+} HlsAbrAudio;
+
+struct HlsAbrJob {
+    AVFormatContext *ofmt;
+    HlsRendition renditions[HLS_ABR_MAX_RENDITIONS];
+    int nb_renditions;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    pthread_mutex_t mux_lock; // Protects ofmt
+    pthread_mutex_t queue_lock; // Protects every rendition's queue
+    pthread_cond_t queue_cond;
+#endif
+};
+
+/* Parse a ladder of the form "1280x720@2800k,640x360@800k". Either dimension
+ * may be 0 to follow the source's aspect ratio. */
+static int hls_abr_parse_ladder(const char *ladder, HlsAbrJob *job) {
+    const char *p = (ladder && *ladder) ? ladder : HLS_ABR_DEFAULT_LADDER;
+    char *endp;
+
+    job->nb_renditions = 0;
+    while (*p) {
+        if (job->nb_renditions >= HLS_ABR_MAX_RENDITIONS) return AVERROR(EINVAL);
+        HlsRendition *r = &job->renditions[job->nb_renditions++];
+
+        r->width = strtol(p, &endp, 10);
+        if (endp == p || *endp != 'x') return AVERROR(EINVAL);
+        p = endp + 1;
+        r->height = strtol(p, &endp, 10);
+        if (endp == p || *endp != '@') return AVERROR(EINVAL);
+        p = endp + 1;
+        r->bit_rate = strtoll(p, &endp, 10);
+        if (endp == p) return AVERROR(EINVAL);
+        p = endp;
+        if (*p == 'k' || *p == 'K') {
+            r->bit_rate *= 1000;
+            p++;
+        } else if (*p == 'm' || *p == 'M') {
+            r->bit_rate *= 1000000;
+            p++;
+        }
+
+        if (r->width < 0 || r->height < 0 || (!r->width && !r->height) ||
+            r->bit_rate <= 0)
+            return AVERROR(EINVAL);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return AVERROR(EINVAL);
+    }
+    return job->nb_renditions ? 0 : AVERROR(EINVAL);
+}
+
+static int hls_abr_write_packets(HlsAbrJob *job, AVCodecContext *enc_ctx,
+                                 AVStream *out_stream, AVPacket *pkt) {
+    int ret;
+    while ((ret = avcodec_receive_packet(enc_ctx, pkt)) >= 0) {
+        av_packet_rescale_ts(pkt, enc_ctx->time_base, out_stream->time_base);
+        pkt->stream_index = out_stream->index;
+#ifdef __EMSCRIPTEN_PTHREADS__
+        pthread_mutex_lock(&job->mux_lock);
+#endif
+        ret = av_interleaved_write_frame(job->ofmt, pkt);
+#ifdef __EMSCRIPTEN_PTHREADS__
+        pthread_mutex_unlock(&job->mux_lock);
+#endif
+        if (ret < 0) return ret;
+    }
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ret = 0;
+    return ret;
+}
+
+static int hls_abr_open_rendition(HlsAbrJob *job, HlsRendition *r, const AVCodec *encoder,
+                                  AVCodecContext *dec_ctx, AVStream *in_stream,
+                                  AVRational framerate, int keyint) {
+    int ret;
+
+    r->job = job;
+    if (!r->width)
+        r->width = av_rescale(r->height, dec_ctx->width, dec_ctx->height);
+    if (!r->height)
+        r->height = av_rescale(r->width, dec_ctx->height, dec_ctx->width);
+    // H.264 4:2:0 needs even dimensions
+    r->width = FFMAX(r->width & ~1, 2);
+    r->height = FFMAX(r->height & ~1, 2);
+
+    AVCodecContext *enc_ctx = r->enc_ctx = avcodec_alloc_context3(encoder);
+    if (!enc_ctx) return AVERROR(ENOMEM);
+    enc_ctx->width = r->width;
+    enc_ctx->height = r->height;
+    enc_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc_ctx->time_base = in_stream->time_base;
+    enc_ctx->framerate = framerate;
+    enc_ctx->bit_rate = r->bit_rate;
+    enc_ctx->gop_size = keyint;
+    enc_ctx->max_b_frames = 0;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // The rendition already has a thread of its own
+    enc_ctx->thread_count = 1;
+#endif
+    if (job->ofmt->oformat->flags & AVFMT_GLOBALHEADER)
+        enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(enc_ctx, encoder, NULL)) < 0) return ret;
+
+    r->out_stream = avformat_new_stream(job->ofmt, NULL);
+    if (!r->out_stream) return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_from_context(r->out_stream->codecpar, enc_ctx)) < 0)
+        return ret;
+    r->out_stream->time_base = enc_ctx->time_base;
+
+    r->scaled = av_frame_alloc();
+    r->pkt = av_packet_alloc();
+    if (!r->scaled || !r->pkt) return AVERROR(ENOMEM);
+    r->scaled->width = r->width;
+    r->scaled->height = r->height;
+    r->scaled->format = AV_PIX_FMT_YUV420P;
+    return av_frame_get_buffer(r->scaled, 0);
+}
+
+// Scale and encode a frame, or flush the encoder if frame is NULL
+static int hls_abr_encode(HlsRendition *r, const AVFrame *frame) {
+    int ret;
+    if (frame) {
+        r->sws = sws_getCachedContext(r->sws,
+            frame->width, frame->height, frame->format,
+            r->width, r->height, AV_PIX_FMT_YUV420P,
+            SWS_BILINEAR, NULL, NULL, NULL);
+        if (!r->sws) return AVERROR(EINVAL);
+        if ((ret = av_frame_make_writable(r->scaled)) < 0) return ret;
+        if ((ret = sws_scale(r->sws, (const uint8_t * const *) frame->data,
+                             frame->linesize, 0, frame->height,
+                             r->scaled->data, r->scaled->linesize)) < 0)
+            return ret;
+        r->scaled->pts = frame->pts;
+        r->scaled->pict_type = frame->pict_type;
+        ret = avcodec_send_frame(r->enc_ctx, r->scaled);
+    } else {
+        ret = avcodec_send_frame(r->enc_ctx, NULL);
+    }
+    if (ret < 0) return ret;
+    return hls_abr_write_packets(r->job, r->enc_ctx, r->out_stream, r->pkt);
+}
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+static void *hls_abr_rendition_thread(void *arg) {
+    HlsRendition *r = arg;
+    HlsAbrJob *job = r->job;
+
+    for (;;) {
+        pthread_mutex_lock(&job->queue_lock);
+        while (!r->q_count && !r->finished)
+            pthread_cond_wait(&job->queue_cond, &job->queue_lock);
+        if (!r->q_count) {
+            pthread_mutex_unlock(&job->queue_lock);
+            break;
+        }
+        AVFrame *frame = r->queue[r->q_head];
+        r->q_head = (r->q_head + 1) % HLS_ABR_QUEUE_SIZE;
+        r->q_count--;
+        pthread_cond_broadcast(&job->queue_cond);
+        pthread_mutex_unlock(&job->queue_lock);
+
+        // After an error, keep draining the queue so the decoder never blocks
+        if (r->ret >= 0)
+            r->ret = hls_abr_encode(r, frame);
+        av_frame_free(&frame);
+    }
+
+    if (r->ret >= 0)
+        r->ret = hls_abr_encode(r, NULL);
+    return NULL;
+}
+#endif
+
+// Hand a decoded frame to a rendition, on its thread if it has one
+static int hls_abr_submit(HlsRendition *r, const AVFrame *frame) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    if (r->started) {
+        HlsAbrJob *job = r->job;
+        AVFrame *ref = av_frame_clone(frame);
+        if (!ref) return AVERROR(ENOMEM);
+        pthread_mutex_lock(&job->queue_lock);
+        while (r->q_count == HLS_ABR_QUEUE_SIZE)
+            pthread_cond_wait(&job->queue_cond, &job->queue_lock);
+        r->queue[(r->q_head + r->q_count) % HLS_ABR_QUEUE_SIZE] = ref;
+        r->q_count++;
+        pthread_cond_broadcast(&job->queue_cond);
+        pthread_mutex_unlock(&job->queue_lock);
+        return 0;
+    }
+#endif
+    if (r->ret >= 0)
+        r->ret = hls_abr_encode(r, frame);
+    return r->ret;
+}
+
+// Flush a rendition, and wait for its thread if it has one
+static int hls_abr_finish(HlsRendition *r) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    if (r->started) {
+        HlsAbrJob *job = r->job;
+        pthread_mutex_lock(&job->queue_lock);
+        r->finished = 1;
+        pthread_cond_broadcast(&job->queue_cond);
+        pthread_mutex_unlock(&job->queue_lock);
+        pthread_join(r->thread, NULL);
+        r->started = 0;
+        return r->ret;
+    }
+#endif
+    if (r->ret >= 0)
+        r->ret = hls_abr_encode(r, NULL);
+    return r->ret;
+}
+
+static void hls_abr_free_rendition(HlsRendition *r) {
+    sws_freeContext(r->sws);
+    r->sws = NULL;
+    av_frame_free(&r->scaled);
+    av_packet_free(&r->pkt);
+    avcodec_free_context(&r->enc_ctx);
+}
+
+static int hls_abr_open_audio(HlsAbrJob *job, HlsAbrAudio *a, int bit_rate) {
+    const AVCodec *encoder;
+    int ret;
+
+    if ((ret = open_decoder_for_stream(a->in_stream, &a->dec_ctx)) < 0) return ret;
+    if (!(encoder = transcode_audio_find_encoder("aac"))) return AVERROR_ENCODER_NOT_FOUND;
+    if ((ret = transcode_audio_alloc_encoder(encoder, a->dec_ctx, 0, 0,
+                                             bit_rate > 0 ? bit_rate : 128000,
+                                             &a->enc_ctx)) < 0)
+        return ret;
+    if (job->ofmt->oformat->flags & AVFMT_GLOBALHEADER)
+        a->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if ((ret = avcodec_open2(a->enc_ctx, encoder, NULL)) < 0) return ret;
+
+    a->out_stream = avformat_new_stream(job->ofmt, NULL);
+    if (!a->out_stream) return AVERROR(ENOMEM);
+    if ((ret = avcodec_parameters_from_context(a->out_stream->codecpar, a->enc_ctx)) < 0)
+        return ret;
+    a->out_stream->time_base = a->enc_ctx->time_base;
+
+    if ((ret = swr_alloc_set_opts2(&a->swr,
+            &a->enc_ctx->ch_layout, a->enc_ctx->sample_fmt, a->enc_ctx->sample_rate,
+            &a->dec_ctx->ch_layout, a->dec_ctx->sample_fmt, a->dec_ctx->sample_rate,
+            0, NULL)) < 0)
+        return ret;
+    if ((ret = swr_init(a->swr)) < 0) return ret;
+
+    if ((ret = transcode_audio_scratch_init(&a->scratch, a->enc_ctx)) < 0) return ret;
+    a->fifo = av_audio_fifo_alloc(a->enc_ctx->sample_fmt, a->enc_ctx->ch_layout.nb_channels,
+                                  a->scratch.frame_size * 4);
+    a->frame = av_frame_alloc();
+    a->pkt = av_packet_alloc();
+    if (!a->fifo || !a->frame || !a->pkt) return AVERROR(ENOMEM);
+    return 0;
+}
+
+// Encode whole frames from the FIFO, or everything that's left if final
+static int hls_abr_audio_drain(HlsAbrJob *job, HlsAbrAudio *a, int final) {
+    int frame_size = a->scratch.frame_size;
+    int ret;
+    while (av_audio_fifo_size(a->fifo) >= (final ? 1 : frame_size)) {
+        int nb = FFMIN(av_audio_fifo_size(a->fifo), frame_size);
+        if ((ret = transcode_audio_frame_from_fifo(a->fifo, nb, &a->next_pts,
+                                                   &a->scratch)) < 0 ||
+            (ret = avcodec_send_frame(a->enc_ctx, a->scratch.enc_frame)) < 0 ||
+            (ret = hls_abr_write_packets(job, a->enc_ctx, a->out_stream, a->pkt)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+// Decode, resample and encode an audio packet, or flush everything if pkt is NULL
+static int hls_abr_audio_packet(HlsAbrJob *job, HlsAbrAudio *a, AVPacket *pkt) {
+    int nb_channels = a->enc_ctx->ch_layout.nb_channels;
+    int ret;
+
+    if ((ret = avcodec_send_packet(a->dec_ctx, pkt)) < 0) return ret;
+    while ((ret = avcodec_receive_frame(a->dec_ctx, a->frame)) >= 0) {
+        /* Start where the input's audio starts, like the video, which keeps
+         * its own timestamps */
+        if (!a->started) {
+            int64_t pts = a->frame->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE)
+                a->next_pts = av_rescale_q(pts, a->in_stream->time_base,
+                                           a->enc_ctx->time_base);
+            a->started = 1;
+        }
+        ret = transcode_audio_convert_to_fifo(a->swr, a->fifo, nb_channels,
+                                              a->enc_ctx->sample_fmt, a->frame,
+                                              &a->scratch);
+        av_frame_unref(a->frame);
+        if (ret < 0) return ret;
+    }
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) return ret;
+    if (pkt) return hls_abr_audio_drain(job, a, 0);
+
+    if ((ret = transcode_audio_convert_to_fifo(a->swr, a->fifo, nb_channels,
+                                               a->enc_ctx->sample_fmt, NULL,
+                                               &a->scratch)) < 0 ||
+        (ret = hls_abr_audio_drain(job, a, 1)) < 0 ||
+        (ret = avcodec_send_frame(a->enc_ctx, NULL)) < 0)
+        return ret;
+    return hls_abr_write_packets(job, a->enc_ctx, a->out_stream, a->pkt);
+}
+
+static void hls_abr_free_audio(HlsAbrAudio *a) {
+    transcode_audio_scratch_free(&a->scratch);
+    av_frame_free(&a->frame);
+    av_packet_free(&a->pkt);
+    av_audio_fifo_free(a->fifo);
+    a->fifo = NULL;
+    swr_free(&a->swr);
+    avcodec_free_context(&a->dec_ctx);
+    avcodec_free_context(&a->enc_ctx);
+}
+#endif
+
+/**
+ * Convert a file to an HLS adaptive bitrate ladder: the best video stream is
+ * decoded once, then scaled and encoded (H.264) to every rendition in ladder
+ * (see hls_abr_parse_ladder; NULL for a default 720p/480p/360p ladder), and
+ * the best audio stream, if any, is encoded once to AAC and shared by all of
+ * them. playlist_path names the master playlist; each variant's playlist and
+ * fMP4 segments are written next to it as stream_<n>.m3u8 and
+ * stream_<n>_<seq>.m4s. On the threaded builds, each rendition is scaled and
+ * encoded on its own thread.
+ */
+int convert_to_hls_abr(const char *in_url, const char *playlist_path, const char *ladder,
+                       int audio_bit_rate, void (*progress_cb)(int current, int total)) {
+#if LIBAVJS_WITH_SWSCALE
+    AVFormatContext *in_fmt = NULL;
+    AVCodecContext *dec_ctx = NULL;
+    AVDictionary *mux_opts = NULL;
+    AVPacket *pkt = NULL;
+    AVFrame *frame = NULL;
+    HlsAbrJob job = {0};
+    HlsAbrAudio audio = {0};
+    char *variant_url = NULL, *seg_tmpl = NULL;
+    char stream_map[HLS_ABR_MAX_RENDITIONS * 24 + 32] = "";
+    int a_idx = -1;
+    int ret = 0;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+    pthread_mutex_init(&job.mux_lock, NULL);
+    pthread_mutex_init(&job.queue_lock, NULL);
+    pthread_cond_init(&job.queue_cond, NULL);
+#endif
+
+    if ((ret = hls_abr_parse_ladder(ladder, &job)) < 0) goto fail;
+
+    if ((ret = avformat_open_input(&in_fmt, in_url, NULL, NULL)) < 0) goto fail;
+    if ((ret = avformat_find_stream_info(in_fmt, NULL)) < 0) goto fail;
+
+    int v_idx = av_find_best_stream(in_fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (v_idx < 0) {
+        ret = AVERROR_STREAM_NOT_FOUND;
+        goto fail;
+    }
+    a_idx = av_find_best_stream(in_fmt, AVMEDIA_TYPE_AUDIO, -1, v_idx, NULL, 0);
+    for (unsigned i = 0; i < in_fmt->nb_streams; i++) {
+        if (i != v_idx && i != a_idx)
+            in_fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+    AVStream *in_vst = in_fmt->streams[v_idx];
+
+    // Variant playlists and segments go next to the master playlist
+    const char *last_slash = strrchr(playlist_path, '/');
+    int dir_len = last_slash ? (int) (last_slash - playlist_path + 1) : 0;
+    variant_url = av_asprintf("%.*sstream_%%v.m3u8", dir_len, playlist_path);
+    seg_tmpl = av_asprintf("%.*sstream_%%v_%%05d.m4s", dir_len, playlist_path);
+    if (!variant_url || !seg_tmpl) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    if ((ret = avformat_alloc_output_context2(&job.ofmt, NULL, "hls", variant_url)) < 0)
+        goto fail;
+
+    if ((ret = open_decoder_for_stream(in_vst, &dec_ctx)) < 0) goto fail;
+
+    const AVCodec *encoder = avcodec_find_encoder_by_name("libopenh264");
+    if (!encoder) encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!encoder) {
+        ret = AVERROR_ENCODER_NOT_FOUND;
+        goto fail;
+    }
+
+    AVRational framerate = av_guess_frame_rate(in_fmt, in_vst, NULL);
+    if (framerate.num <= 0 || framerate.den <= 0)
+        framerate = (AVRational){30, 1};
+    int keyint = FFMAX((int) (av_q2d(framerate) * HLS_ABR_SEGMENT_SECONDS + 0.5), 1);
+
+    for (int i = 0; i < job.nb_renditions; i++) {
+        if ((ret = hls_abr_open_rendition(&job, &job.renditions[i], encoder, dec_ctx,
+                                          in_vst, framerate, keyint)) < 0)
+            goto fail;
+        av_strlcatf(stream_map, sizeof(stream_map), "%sv:%d%s", i ? " " : "", i,
+                    a_idx >= 0 ? ",agroup:aud" : "");
+    }
+
+    if (a_idx >= 0) {
+        audio.in_stream = in_fmt->streams[a_idx];
+        if ((ret = hls_abr_open_audio(&job, &audio, audio_bit_rate)) < 0) goto fail;
+        av_strlcatf(stream_map, sizeof(stream_map), " a:0,agroup:aud");
+    }
+
+    av_dict_set(&mux_opts, "hls_segment_type", "fmp4", 0);
+    av_dict_set(&mux_opts, "hls_playlist_type", "vod", 0);
+    av_dict_set_int(&mux_opts, "hls_time", HLS_ABR_SEGMENT_SECONDS, 0);
+    av_dict_set(&mux_opts, "hls_fmp4_init_filename", "init_%v.mp4", 0);
+    av_dict_set(&mux_opts, "hls_segment_filename", seg_tmpl, 0);
+    av_dict_set(&mux_opts, "master_pl_name", playlist_path + dir_len, 0);
+    av_dict_set(&mux_opts, "var_stream_map", stream_map, 0);
+
+    if ((ret = avformat_write_header(job.ofmt, &mux_opts)) < 0) goto fail;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // Renditions that can't get a thread are encoded on this one
+    for (int i = 0; i < job.nb_renditions; i++) {
+        HlsRendition *r = &job.renditions[i];
+        r->started = !pthread_create(&r->thread, NULL, hls_abr_rendition_thread, r);
+    }
+#endif
+
+    pkt = av_packet_alloc();
+    frame = av_frame_alloc();
+    if (!pkt || !frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    int64_t total_duration = 0;
+    if (in_vst->duration != AV_NOPTS_VALUE && in_vst->duration > 0) {
+        total_duration = in_vst->duration;
+    } else if (in_fmt->duration != AV_NOPTS_VALUE && in_fmt->duration > 0) {
+        total_duration = av_rescale_q(in_fmt->duration, AV_TIME_BASE_Q, in_vst->time_base);
+    }
+
+    int64_t frame_count = 0;
+    int64_t processed_pts = 0;
+    int packet_count = 0;
+    const int progress_update_interval = 100;
+    int eof = 0;
+
+    while (!eof) {
+        ret = av_read_frame(in_fmt, pkt);
+        if (ret == AVERROR_EOF) {
+            eof = 1;
+        } else if (ret < 0) {
+            goto fail;
+        } else if (pkt->stream_index == a_idx) {
+            ret = hls_abr_audio_packet(&job, &audio, pkt);
+            av_packet_unref(pkt);
+            if (ret < 0) goto fail;
+            continue;
+        } else if (pkt->stream_index != v_idx) {
+            av_packet_unref(pkt);
+            continue;
+        }
+
+        if (!eof && pkt->pts != AV_NOPTS_VALUE)
+            processed_pts = pkt->pts;
+        ret = avcodec_send_packet(dec_ctx, eof ? NULL : pkt);
+        av_packet_unref(pkt);
+        if (ret < 0) goto fail;
+
+        while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0) {
+            frame->pts = frame->best_effort_timestamp;
+            // Force keyframes together so every rendition segments alike
+            frame->pict_type = (frame_count++ % keyint) ? AV_PICTURE_TYPE_NONE :
+                                                          AV_PICTURE_TYPE_I;
+            for (int i = 0; i < job.nb_renditions; i++) {
+                if ((ret = hls_abr_submit(&job.renditions[i], frame)) < 0) {
+                    av_frame_unref(frame);
+                    goto fail;
+                }
+            }
+            av_frame_unref(frame);
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) goto fail;
+
+        packet_count++;
+        if (progress_cb && packet_count % progress_update_interval == 0) {
+            progress_cb(processed_pts, total_duration);
+        }
+    }
+
+    if (a_idx >= 0 && (ret = hls_abr_audio_packet(&job, &audio, NULL)) < 0) goto fail;
+    for (int i = 0; i < job.nb_renditions; i++) {
+        if ((ret = hls_abr_finish(&job.renditions[i])) < 0) goto fail;
+    }
+
+    if ((ret = av_write_trailer(job.ofmt)) < 0) goto fail;
+
+    if (progress_cb && total_duration > 0) {
+        progress_cb(total_duration, total_duration);
+    }
+
+    ret = 0;
+    goto end;
+
+fail:
+    {
+        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "convert_to_hls_abr: errorno=%d (%s)\n", ret, errbuf);
+    }
+end:
+    for (int i = 0; i < job.nb_renditions; i++) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+        // Stop any threads still running after a failure
+        if (job.renditions[i].started)
+            hls_abr_finish(&job.renditions[i]);
+#endif
+        hls_abr_free_rendition(&job.renditions[i]);
+    }
+    hls_abr_free_audio(&audio);
+#ifdef __EMSCRIPTEN_PTHREADS__
+    pthread_cond_destroy(&job.queue_cond);
+    pthread_mutex_destroy(&job.queue_lock);
+    pthread_mutex_destroy(&job.mux_lock);
+#endif
+    av_frame_free(&frame);
+    av_packet_free(&pkt);
+    av_dict_free(&mux_opts);
+    av_free(variant_url);
+    av_free(seg_tmpl);
+    avcodec_free_context(&dec_ctx);
+    cleanup(in_fmt, job.ofmt);
+    return ret;
+
+#else
+    (void) in_url; (void) playlist_path; (void) ladder;
+    (void) audio_bit_rate; (void) progress_cb;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+#define FF_THUMBNAILS_EXACT 1
+
+/* Without an index, a target less than this many seconds past the last
+ * decoded frame is reached by decoding forward rather than seeking. */
+#define THUMBNAILS_SEEK_THRESHOLD 5
+
+#if LIBAVJS_WITH_SWSCALE
+typedef struct ThumbnailsState {
+    AVFormatContext *in_fmt;
+    AVCodecContext *dec_ctx;
+    int stream_index;
+    int exact;
+    AVPacket *pkt;
+    AVFrame *held;  // Latest frame at or before the last target
+    AVFrame *peek;  // Decoded frame past the last target, not yet used
+    int have_held, have_peek;
+    int demux_eof, decode_eof;
+} ThumbnailsState;
+
+// Decode the next frame into st->peek
+static int thumbnails_decode_next(ThumbnailsState *st) {
+    int ret;
+    while (1) {
+        ret = avcodec_receive_frame(st->dec_ctx, st->peek);
+        if (ret >= 0) {
+            if (decode_frame_at_pts(st->peek) == AV_NOPTS_VALUE) {
+                av_frame_unref(st->peek);
+                continue;
+            }
+            st->have_peek = 1;
+            return 0;
+        }
+        if (ret == AVERROR_EOF) {
+            st->decode_eof = 1;
+            return ret;
+        }
+        if (ret != AVERROR(EAGAIN)) return ret;
+
+        if (st->demux_eof) {
+            if ((ret = avcodec_send_packet(st->dec_ctx, NULL)) < 0) return ret;
+            continue;
+        }
+        ret = av_read_frame(st->in_fmt, st->pkt);
+        if (ret == AVERROR_EOF) {
+            st->demux_eof = 1;
+            continue;
+        }
+        if (ret < 0) return ret;
+        /* Only keyframes are decoded unless exact frames were asked for, so
+         * don't even feed the decoder the rest. */
+        if (st->pkt->stream_index == st->stream_index &&
+            (st->exact || (st->pkt->flags & AV_PKT_FLAG_KEY))) {
+            ret = avcodec_send_packet(st->dec_ctx, st->pkt);
+            if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+                av_packet_unref(st->pkt);
+                return ret;
+            }
+        }
+        av_packet_unref(st->pkt);
+    }
+}
+
+static int thumbnails_seek(ThumbnailsState *st, int64_t ts) {
+    int ret = avformat_seek_file(st->in_fmt, st->stream_index, INT64_MIN, ts, ts, 0);
+    // Before the first keyframe, take the first one there is
+    if (ret < 0)
+        ret = avformat_seek_file(st->in_fmt, st->stream_index, INT64_MIN, ts, INT64_MAX, 0);
+    if (ret < 0) return ret;
+    avcodec_flush_buffers(st->dec_ctx);
+    av_frame_unref(st->held);
+    av_frame_unref(st->peek);
+    st->have_held = st->have_peek = 0;
+    st->demux_eof = st->decode_eof = 0;
+    return 0;
+}
+
+/* Decode up to target, leaving the frame to show for it in st->held (or, if
+ * target is before the first frame, st->peek). Returns 1 if st->held changed. */
+static int thumbnails_advance(ThumbnailsState *st, int64_t target) {
+    int changed = 0, ret;
+    while (1) {
+        if (!st->have_peek) {
+            if (st->decode_eof) break;
+            ret = thumbnails_decode_next(st);
+            if (ret == AVERROR_EOF) break;
+            if (ret < 0) return ret;
+        }
+        if (decode_frame_at_pts(st->peek) > target) break;
+        av_frame_unref(st->held);
+        av_frame_move_ref(st->held, st->peek);
+        st->have_held = 1;
+        st->have_peek = 0;
+        changed = 1;
+    }
+    return changed;
+}
+#endif
+
+/**
+ * Extract one thumbnail per timestamp (in seconds from the start of the video
+ * stream) from the best video stream of a file, into a single RGBA sprite.
+ * Timestamps are handled in sorted order, so each region is only decoded
+ * once, and a seek is only made when the next target lies past a keyframe
+ * that hasn't been reached yet. Unless flags has FF_THUMBNAILS_EXACT, only
+ * keyframes are decoded, and each thumbnail is the keyframe at or before its
+ * timestamp; otherwise it is the exact frame shown at that time. If width or
+ * height is 0, it follows the aspect ratio of the video (both 0 keeps the
+ * video's size). The result is written to *out as one buffer, to be freed by
+ * the caller (see ff_copyout_thumbnails), laid out as:
+ *   int32 header[8]: size in bytes, count, width, height, 0, 0, 0, 0
+ *   double time[count]: time of the frame used for each thumbnail, in
+ *                       seconds, or -1 if there was none
+ *   uint8 rgba[count][height][width][4]: the thumbnails in the order of the
+ *                       timestamps, stacked into one width x (count * height)
+ *                       image
+ */
+int ff_extract_thumbnails(const char *in_filename, const double *timestamps,
+                          int nb_timestamps, int width, int height, int flags,
+                          uint8_t **out, void (*progress_cb)(int current, int total)) {
+#if LIBAVJS_WITH_SWSCALE
+    ThumbnailsState st = {0};
+    struct SwsContext *sws = NULL;
+    int *order = NULL;
+    uint8_t *buf = NULL;
+    int ret = 0;
+
+    *out = NULL;
+    st.exact = !!(flags & FF_THUMBNAILS_EXACT);
+    if (nb_timestamps <= 0 || !timestamps || width < 0 || height < 0) {
+        ret = AVERROR(EINVAL);
+        goto fail;
+    }
+
+    if ((ret = avformat_open_input(&st.in_fmt, in_filename, NULL, NULL)) < 0) goto fail;
+    if ((ret = avformat_find_stream_info(st.in_fmt, NULL)) < 0) goto fail;
+
+    st.stream_index = av_find_best_stream(st.in_fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+    if (st.stream_index < 0) {
+        ret = st.stream_index;
+        goto fail;
+    }
+    for (unsigned i = 0; i < st.in_fmt->nb_streams; i++) {
+        if ((int) i != st.stream_index)
+            st.in_fmt->streams[i]->discard = AVDISCARD_ALL;
+    }
+    AVStream *in_stream = st.in_fmt->streams[st.stream_index];
+
+    if ((ret = open_decoder_for_stream(in_stream, &st.dec_ctx)) < 0) goto fail;
+    if (!st.exact) st.dec_ctx->skip_frame = AVDISCARD_NONKEY;
+
+    int src_w = st.dec_ctx->width, src_h = st.dec_ctx->height;
+    if (src_w <= 0 || src_h <= 0) {
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+    if (!width && !height) {
+        width = src_w;
+        height = src_h;
+    } else if (!width) {
+        width = FFMAX(1, av_rescale(height, src_w, src_h));
+    } else if (!height) {
+        height = FFMAX(1, av_rescale(width, src_h, src_w));
+    }
+
+    size_t frame_size = (size_t) width * height * 4;
+    size_t pixels_offset = 8 * sizeof(int32_t) + nb_timestamps * sizeof(double);
+    size_t size = pixels_offset + frame_size * nb_timestamps;
+    if (frame_size > INT_MAX || size > INT_MAX) {
+        ret = AVERROR(ERANGE);
+        goto fail;
+    }
+
+    buf = av_mallocz(size);
+    order = av_malloc_array(nb_timestamps, sizeof(int));
+    st.pkt = av_packet_alloc();
+    st.held = av_frame_alloc();
+    st.peek = av_frame_alloc();
+    if (!buf || !order || !st.pkt || !st.held || !st.peek) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    int32_t *header = (int32_t *) buf;
+    double *times = (double *) (buf + 8 * sizeof(int32_t));
+    uint8_t *pixels = buf + pixels_offset;
+    header[0] = size;
+    header[1] = nb_timestamps;
+    header[2] = width;
+    header[3] = height;
+
+    // Sort the targets, but keep the output in the order asked for
+    for (int i = 0; i < nb_timestamps; i++) order[i] = i;
+    for (int i = 1; i < nb_timestamps; i++) {
+        int o = order[i], j = i;
+        for (; j > 0 && timestamps[order[j - 1]] > timestamps[o]; j--)
+            order[j] = order[j - 1];
+        order[j] = o;
+    }
+
+    AVRational tb = in_stream->time_base;
+    int64_t start = in_stream->start_time != AV_NOPTS_VALUE ? in_stream->start_time : 0;
+    int64_t threshold = av_rescale_q(THUMBNAILS_SEEK_THRESHOLD, (AVRational){1, 1}, tb);
+    int held_slot = -1;
+
+    for (int i = 0; i < nb_timestamps; i++) {
+        int slot = order[i];
+        int64_t target = start + av_rescale_q(llrint(timestamps[slot] * AV_TIME_BASE),
+                                              AV_TIME_BASE_Q, tb);
+
+        /* The targets are sorted, so the decoder is never past this one. Seek
+         * only if a keyframe we haven't reached yet lies before it; otherwise
+         * decoding forward is cheaper. */
+        int64_t pos = AV_NOPTS_VALUE;
+        if (st.have_peek)
+            pos = decode_frame_at_pts(st.peek);
+        else if (st.have_held)
+            pos = decode_frame_at_pts(st.held);
+        int need_seek = pos == AV_NOPTS_VALUE;
+        if (!need_seek) {
+            int idx = av_index_search_timestamp(in_stream, target, AVSEEK_FLAG_BACKWARD);
+            const AVIndexEntry *entry = idx >= 0 ? avformat_index_get_entry(in_stream, idx) : NULL;
+            if (entry)
+                need_seek = entry->timestamp > pos;
+            else
+                need_seek = target - pos > threshold;
+        }
+        if (need_seek) {
+            if ((ret = thumbnails_seek(&st, target)) < 0) goto fail;
+            held_slot = -1;
+        }
+
+        if ((ret = thumbnails_advance(&st, target)) < 0) goto fail;
+        if (ret) held_slot = -1;
+
+        uint8_t *dst = pixels + frame_size * slot;
+        AVFrame *frame = st.have_held ? st.held : st.have_peek ? st.peek : NULL;
+        if (!frame) {
+            times[slot] = -1;
+        } else if (frame == st.held && held_slot >= 0) {
+            // Same frame as the previous target
+            memcpy(dst, pixels + frame_size * held_slot, frame_size);
+            times[slot] = times[held_slot];
+        } else {
+            uint8_t *dst_data[4] = {dst, NULL, NULL, NULL};
+            int dst_linesize[4] = {width * 4, 0, 0, 0};
+            sws = sws_getCachedContext(sws, frame->width, frame->height, frame->format,
+                                       width, height, AV_PIX_FMT_RGBA, SWS_BILINEAR,
+                                       NULL, NULL, NULL);
+            if (!sws) {
+                ret = AVERROR(EINVAL);
+                goto fail;
+            }
+            if ((ret = sws_scale(sws, (const uint8_t * const *) frame->data, frame->linesize,
+                                 0, frame->height, dst_data, dst_linesize)) < 0)
+                goto fail;
+            times[slot] = (decode_frame_at_pts(frame) - start) * av_q2d(tb);
+            if (frame == st.held) held_slot = slot;
+        }
+
+        if (progress_cb) progress_cb(i + 1, nb_timestamps);
+    }
+
+    *out = buf;
+    buf = NULL;
+    ret = 0;
+    goto end;
+
+fail:
+    {
+        char errbuf[AV_ERROR_MAX_STRING_SIZE];
+        av_strerror(ret, errbuf, sizeof(errbuf));
+        fprintf(stderr, "ff_extract_thumbnails: errorno=%d (%s)\n", ret, errbuf);
+    }
+end:
+    sws_freeContext(sws);
+    av_free(buf);
+    av_free(order);
+    av_frame_free(&st.held);
+    av_frame_free(&st.peek);
+    av_packet_free(&st.pkt);
+    avcodec_free_context(&st.dec_ctx);
+    cleanup(st.in_fmt, NULL);
+    return ret;
+
+#else
+    (void) in_filename; (void) timestamps; (void) nb_timestamps; (void) width;
+    (void) height; (void) flags; (void) progress_cb;
+    *out = NULL;
+    return AVERROR(ENOSYS);
+#endif
+}
+
+/*
+ * Frame servers. An FFFrameServer answers "the frame shown at pts" for one
+ * stream of an open demuxer and decoder, keeping every frame it decodes in a
+ * memory-bounded LRU cache (as references, not copies), so that scrubbing
+ * back and forth over the same region only decodes it once.
+ */
+
+/* Without an index, a target less than this many seconds past the last
+ * decoded frame is reached by decoding forward rather than seeking. */
+#define FRAME_SERVER_SEEK_THRESHOLD 5
+
+// Indexes of the counters written by ff_frame_server_stats
+enum {
+    FF_FRAME_SERVER_HITS,
+    FF_FRAME_SERVER_MISSES,
+    FF_FRAME_SERVER_DECODED,
+    FF_FRAME_SERVER_PREFETCHED,
+    FF_FRAME_SERVER_EVICTIONS,
+    FF_FRAME_SERVER_FRAMES,
+    FF_FRAME_SERVER_MEMORY,
+    FF_FRAME_SERVER_MEMORY_LIMIT,
+    FF_FRAME_SERVER_NB_STATS
+};
+
+typedef struct FFFrameServerEntry {
+    AVFrame *frame;
+    int64_t pts;
+    int64_t end;        // Shown until here (exclusive)
+    size_t bytes;
+    uint64_t last_use;
+} FFFrameServerEntry;
+
+typedef struct FFFrameServer {
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *dec_ctx;
+    int stream_index;
+    AVPacket *pkt;
+    AVFrame *frame;
+
+    FFFrameServerEntry *entries;
+    int nb_entries, entries_cap;
+    size_t mem_used, mem_limit;
+    uint64_t clock;
+
+    // Decoder position
+    int positioned;
+    int64_t last_pts;   // Last frame decoded since the last seek
+    int demux_eof, decode_eof;
+    int prefetch_done;  // The next keyframe has been reached
+
+    uint64_t stats[FF_FRAME_SERVER_NB_STATS];
+} FFFrameServer;
+
+/**
+ * Create a frame server for stream_index of fmt_ctx, decoded by dec_ctx (which
+ * must be open). Both stay owned by the caller, and must outlive the server.
+ * Decoded frames are cached up to mem_limit bytes.
+ */
+FFFrameServer *ff_frame_server_alloc(AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx,
+                                     int stream_index, int mem_limit) {
+    FFFrameServer *fs;
+    if (stream_index < 0 || stream_index >= (int) fmt_ctx->nb_streams || mem_limit <= 0)
+        return NULL;
+    fs = av_mallocz(sizeof(FFFrameServer));
+    if (!fs) return NULL;
+    fs->fmt_ctx = fmt_ctx;
+    fs->dec_ctx = dec_ctx;
+    fs->stream_index = stream_index;
+    fs->mem_limit = mem_limit;
+    fs->pkt = av_packet_alloc();
+    fs->frame = av_frame_alloc();
+    if (!fs->pkt || !fs->frame) {
+        av_packet_free(&fs->pkt);
+        av_frame_free(&fs->frame);
+        av_free(fs);
+        return NULL;
+    }
+    return fs;
+}
+
+void ff_frame_server_free(FFFrameServer *fs) {
+    if (!fs) return;
+    for (int i = 0; i < fs->nb_entries; i++)
+        av_frame_free(&fs->entries[i].frame);
+    av_free(fs->entries);
+    av_packet_free(&fs->pkt);
+    av_frame_free(&fs->frame);
+    av_free(fs);
+}
+
+static size_t frame_server_frame_bytes(const AVFrame *frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+        bytes += frame->buf[i]->size;
+    for (int i = 0; i < frame->nb_extended_buf; i++)
+        bytes += frame->extended_buf[i]->size;
+    return bytes;
+}
+
+static void frame_server_remove(FFFrameServer *fs, int i) {
+    fs->mem_used -= fs->entries[i].bytes;
+    av_frame_free(&fs->entries[i].frame);
+    fs->entries[i] = fs->entries[--fs->nb_entries];
+}
+
+// Evict least recently used frames until there's room for bytes more
+static void frame_server_evict(FFFrameServer *fs, size_t bytes) {
+    while (fs->nb_entries && fs->mem_used + bytes > fs->mem_limit) {
+        int lru = 0;
+        for (int i = 1; i < fs->nb_entries; i++) {
+            if (fs->entries[i].last_use < fs->entries[lru].last_use)
+                lru = i;
+        }
+        frame_server_remove(fs, lru);
+        fs->stats[FF_FRAME_SERVER_EVICTIONS]++;
+    }
+}
+
+static int frame_server_find(FFFrameServer *fs, int64_t pts) {
+    for (int i = 0; i < fs->nb_entries; i++) {
+        if (fs->entries[i].pts <= pts && pts < fs->entries[i].end)
+            return i;
+    }
+    return -1;
+}
+
+// Cache a reference to the frame just decoded into fs->frame
+static int frame_server_insert(FFFrameServer *fs) {
+    AVFrame *frame = fs->frame;
+    int64_t pts = decode_frame_at_pts(frame);
+    size_t bytes = frame_server_frame_bytes(frame);
+    FFFrameServerEntry *entry;
+    int ret;
+
+    // The frame before this one is shown until this one
+    if (fs->positioned) {
+        for (int i = 0; i < fs->nb_entries; i++) {
+            if (fs->entries[i].pts == fs->last_pts) {
+                fs->entries[i].end = pts;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < fs->nb_entries; i++) {
+        if (fs->entries[i].pts == pts)
+            return 0;
+    }
+
+    frame_server_evict(fs, bytes);
+    if (fs->nb_entries >= fs->entries_cap) {
+        int cap = FFMAX(fs->entries_cap * 2, 32);
+        FFFrameServerEntry *entries = av_realloc_array(fs->entries, cap,
+                                                       sizeof(FFFrameServerEntry));
+        if (!entries) return AVERROR(ENOMEM);
+        fs->entries = entries;
+        fs->entries_cap = cap;
+    }
+
+    entry = &fs->entries[fs->nb_entries];
+    entry->frame = av_frame_alloc();
+    if (!entry->frame) return AVERROR(ENOMEM);
+    if ((ret = av_frame_ref(entry->frame, frame)) < 0) {
+        av_frame_free(&entry->frame);
+        return ret;
+    }
+    entry->pts = pts;
+    entry->end = frame->duration > 0 ? pts + frame->duration : pts + 1;
+    entry->bytes = bytes;
+    entry->last_use = ++fs->clock;
+    fs->nb_entries++;
+    fs->mem_used += bytes;
+    return 0;
+}
+
+// Decode and cache the next frame. Returns AVERROR_EOF at the end of the stream.
+static int frame_server_decode_next(FFFrameServer *fs) {
+    int ret;
+    while (1) {
+        ret = avcodec_receive_frame(fs->dec_ctx, fs->frame);
+        if (ret >= 0) {
+            int64_t pts = decode_frame_at_pts(fs->frame);
+            if (pts == AV_NOPTS_VALUE) {
+                av_frame_unref(fs->frame);
+                continue;
+            }
+            ret = frame_server_insert(fs);
+            av_frame_unref(fs->frame);
+            if (ret < 0) return ret;
+            fs->last_pts = pts;
+            fs->positioned = 1;
+            fs->stats[FF_FRAME_SERVER_DECODED]++;
+            return 0;
+        }
+        if (ret == AVERROR_EOF) {
+            // The last frame is shown from there on
+            int i = fs->positioned ? frame_server_find(fs, fs->last_pts) : -1;
+            if (i >= 0) fs->entries[i].end = INT64_MAX;
+            fs->decode_eof = 1;
+            return ret;
+        }
+        if (ret != AVERROR(EAGAIN)) return ret;
+
+        if (fs->demux_eof) {
+            if ((ret = avcodec_send_packet(fs->dec_ctx, NULL)) < 0) return ret;
+            continue;
+        }
+        ret = av_read_frame(fs->fmt_ctx, fs->pkt);
+        if (ret == AVERROR_EOF) {
+            fs->demux_eof = 1;
+            continue;
+        }
+        if (ret < 0) return ret;
+        ff_seek_index_record(fs->fmt_ctx, fs->pkt);
+        if (fs->pkt->stream_index == fs->stream_index) {
+            ret = avcodec_send_packet(fs->dec_ctx, fs->pkt);
+            if (ret < 0 && ret != AVERROR_INVALIDDATA) {
+                av_packet_unref(fs->pkt);
+                return ret;
+            }
+        }
+        av_packet_unref(fs->pkt);
+    }
+}
+
+static int frame_server_seek(FFFrameServer *fs, int64_t pts) {
+    int ret = avformat_seek_file(fs->fmt_ctx, fs->stream_index, INT64_MIN, pts, pts, 0);
+    if (ret < 0)
+        ret = avformat_seek_file(fs->fmt_ctx, fs->stream_index, INT64_MIN, pts, INT64_MAX, 0);
+    if (ret < 0) return ret;
+    avcodec_flush_buffers(fs->dec_ctx);
+    fs->positioned = 0;
+    fs->demux_eof = fs->decode_eof = 0;
+    fs->prefetch_done = 0;
+    return 0;
+}
+
+/**
+ * Get the frame shown at pts (in the stream's time base) into frame, as a new
+ * reference. It comes from the cache if possible; otherwise the decoder
+ * continues forward to it if no keyframe lies in between, or seeks to the
+ * keyframe before it, and every frame decoded on the way is cached. The last
+ * frame is shown from there on, and the first frame before it. Returns
+ * AVERROR_EOF if the stream has no frames at all.
+ */
+int ff_frame_server_get_frame(FFFrameServer *fs, int64_t pts, AVFrame *frame) {
+    AVStream *st = fs->fmt_ctx->streams[fs->stream_index];
+    int i, ret;
+
+    av_frame_unref(frame);
+    if ((i = frame_server_find(fs, pts)) >= 0) {
+        fs->stats[FF_FRAME_SERVER_HITS]++;
+        fs->entries[i].last_use = ++fs->clock;
+        return av_frame_ref(frame, fs->entries[i].frame);
+    }
+    fs->stats[FF_FRAME_SERVER_MISSES]++;
+
+    int need_seek = !fs->positioned || pts < fs->last_pts ||
+                    (fs->decode_eof && pts >= fs->last_pts);
+    if (!need_seek) {
+        int idx = av_index_search_timestamp(st, pts, AVSEEK_FLAG_BACKWARD);
+        const AVIndexEntry *entry = idx >= 0 ? avformat_index_get_entry(st, idx) : NULL;
+        if (entry)
+            need_seek = entry->timestamp > fs->last_pts;
+        else
+            need_seek = pts - fs->last_pts >
+                av_rescale_q(FRAME_SERVER_SEEK_THRESHOLD, (AVRational){1, 1}, st->time_base);
+    }
+    if (need_seek && (ret = frame_server_seek(fs, pts)) < 0) return ret;
+
+    /* Decode until the frame after the target, which ends the target's. The
+     * latest frame at or before the target is kept in frame as we go, so that
+     * a small cache evicting it doesn't make us return another one. */
+    while (!fs->positioned || fs->last_pts <= pts) {
+        ret = frame_server_decode_next(fs);
+        if (ret == AVERROR_EOF) break;
+        if (ret < 0) return ret;
+        if (fs->last_pts <= pts) {
+            for (i = 0; i < fs->nb_entries; i++) {
+                if (fs->entries[i].pts == fs->last_pts) {
+                    av_frame_unref(frame);
+                    if ((ret = av_frame_ref(frame, fs->entries[i].frame)) < 0)
+                        return ret;
+                    break;
+                }
+            }
+        }
+    }
+    if (frame->buf[0]) {
+        if ((i = frame_server_find(fs, pts)) >= 0)
+            fs->entries[i].last_use = ++fs->clock;
+        return 0;
+    }
+
+    if ((i = frame_server_find(fs, pts)) < 0) {
+        // Before the first frame: show the first frame there is
+        for (int j = 0; j < fs->nb_entries; j++) {
+            if (fs->entries[j].pts > pts &&
+                (i < 0 || fs->entries[j].pts < fs->entries[i].pts))
+                i = j;
+        }
+        if (i < 0) return AVERROR_EOF;
+    }
+    fs->entries[i].last_use = ++fs->clock;
+    return av_frame_ref(frame, fs->entries[i].frame);
+}
+
+/**
+ * Decode up to max_frames more frames ahead of the last one decoded, caching
+ * them, to fill in the rest of the current GOP and the next keyframe. Stops
+ * early once the cache is full. Returns 1 if
+ * there's more to prefetch, 0 if not, or a negative error.
+ */
+int ff_frame_server_prefetch(FFFrameServer *fs, int max_frames) {
+    int ret;
+    if (!fs->positioned || fs->decode_eof || fs->prefetch_done) return 0;
+
+    for (int i = 0; i < max_frames; i++) {
+        if (fs->nb_entries && fs->mem_used >= fs->mem_limit) return 0;
+        ret = frame_server_decode_next(fs);
+        if (ret == AVERROR_EOF) return 0;
+        if (ret < 0) return ret;
+        fs->stats[FF_FRAME_SERVER_PREFETCHED]++;
+
+        int e = frame_server_find(fs, fs->last_pts);
+        if (e >= 0 && (fs->entries[e].frame->flags & AV_FRAME_FLAG_KEY)) {
+            fs->prefetch_done = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Write the counters of a frame server (see the FF_FRAME_SERVER_* indexes) to
+ * stats, which must have room for FF_FRAME_SERVER_NB_STATS doubles.
+ */
+void ff_frame_server_stats(FFFrameServer *fs, double *stats) {
+    fs->stats[FF_FRAME_SERVER_FRAMES] = fs->nb_entries;
+    fs->stats[FF_FRAME_SERVER_MEMORY] = fs->mem_used;
+    fs->stats[FF_FRAME_SERVER_MEMORY_LIMIT] = fs->mem_limit;
+    for (int i = 0; i < FF_FRAME_SERVER_NB_STATS; i++)
+        stats[i] = fs->stats[i];
+}
+
 static const int LIBAVFORMAT_VERSION_INT_V = LIBAVFORMAT_VERSION_INT;
 #undef LIBAVFORMAT_VERSION_INT
 int LIBAVFORMAT_VERSION_INT() { return LIBAVFORMAT_VERSION_INT_V; }
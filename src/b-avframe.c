@@ -74,6 +74,250 @@ void ff_frame_rescale_ts_js(
         frame->pts = av_rescale_q(frame->pts, tb_src, tb_dst);
 }
 
+/* Audio sample conversion, for ff_copyout_frame and ff_copyin_frame with a
+ * format option. Any sample format can be converted to or from packed or
+ * planar float or signed 16-bit. Strides are in bytes, so the same loops
+ * interleave and deinterleave. Conversions follow libswresample's. */
+#define SAMPLE_LOOP(itype, otype, expr) do { \
+    for (int i = 0; i < n; i++) { \
+        itype x = *(const itype *) (src + i * sstride); \
+        *(otype *) (dst + i * dstride) = (expr); \
+    } \
+} while (0)
+
+#define S64_SCALE 9223372036854775808.0
+
+static inline int64_t samples_f32_to_s64(float x) {
+    if (x >= 1.0f)
+        return INT64_MAX;
+    if (x <= -1.0f)
+        return INT64_MIN;
+    return llrint(x * S64_SCALE);
+}
+
+// Convert n samples of (packed) format fmt to float
+static void samples_to_f32(const uint8_t *src, enum AVSampleFormat fmt,
+                           int sstride, uint8_t *dst, int dstride, int n) {
+    if (fmt == AV_SAMPLE_FMT_FLT && sstride == 4 && dstride == 4) {
+        memcpy(dst, src, n * 4);
+        return;
+    }
+
+    switch (fmt) {
+        case AV_SAMPLE_FMT_U8:
+            SAMPLE_LOOP(uint8_t, float, (x - 0x80) * (1.0f / (1 << 7)));
+            break;
+
+        case AV_SAMPLE_FMT_S16:
+            SAMPLE_LOOP(int16_t, float, x * (1.0f / (1 << 15)));
+            break;
+
+        case AV_SAMPLE_FMT_S32:
+            SAMPLE_LOOP(int32_t, float, x * (1.0f / (1U << 31)));
+            break;
+
+        case AV_SAMPLE_FMT_FLT:
+            SAMPLE_LOOP(float, float, x);
+            break;
+
+        case AV_SAMPLE_FMT_DBL:
+            SAMPLE_LOOP(double, float, (float) x);
+            break;
+
+        case AV_SAMPLE_FMT_S64:
+            SAMPLE_LOOP(int64_t, float, (float) (x * (1.0 / S64_SCALE)));
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Convert n samples of (packed) format fmt to signed 16-bit
+static void samples_to_s16(const uint8_t *src, enum AVSampleFormat fmt,
+                           int sstride, uint8_t *dst, int dstride, int n) {
+    if (fmt == AV_SAMPLE_FMT_S16 && sstride == 2 && dstride == 2) {
+        memcpy(dst, src, n * 2);
+        return;
+    }
+
+    switch (fmt) {
+        case AV_SAMPLE_FMT_U8:
+            SAMPLE_LOOP(uint8_t, int16_t, (x - 0x80) * (1 << 8));
+            break;
+
+        case AV_SAMPLE_FMT_S16:
+            SAMPLE_LOOP(int16_t, int16_t, x);
+            break;
+
+        case AV_SAMPLE_FMT_S32:
+            SAMPLE_LOOP(int32_t, int16_t, x >> 16);
+            break;
+
+        case AV_SAMPLE_FMT_FLT:
+            SAMPLE_LOOP(float, int16_t, av_clip_int16(lrintf(x * (1 << 15))));
+            break;
+
+        case AV_SAMPLE_FMT_DBL:
+            SAMPLE_LOOP(double, int16_t, av_clip_int16(lrint(x * (1 << 15))));
+            break;
+
+        case AV_SAMPLE_FMT_S64:
+            SAMPLE_LOOP(int64_t, int16_t, x >> 48);
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Convert n float samples to (packed) format fmt
+static void samples_from_f32(const uint8_t *src, int sstride, uint8_t *dst,
+                             enum AVSampleFormat fmt, int dstride, int n) {
+    switch (fmt) {
+        case AV_SAMPLE_FMT_U8:
+            SAMPLE_LOOP(float, uint8_t, av_clip_uint8(lrintf(x * (1 << 7)) + 0x80));
+            break;
+
+        case AV_SAMPLE_FMT_S16:
+            samples_to_s16(src, AV_SAMPLE_FMT_FLT, sstride, dst, dstride, n);
+            break;
+
+        case AV_SAMPLE_FMT_S32:
+            SAMPLE_LOOP(float, int32_t, av_clipl_int32(llrintf(x * (1U << 31))));
+            break;
+
+        case AV_SAMPLE_FMT_FLT:
+            samples_to_f32(src, AV_SAMPLE_FMT_FLT, sstride, dst, dstride, n);
+            break;
+
+        case AV_SAMPLE_FMT_DBL:
+            SAMPLE_LOOP(float, double, x);
+            break;
+
+        case AV_SAMPLE_FMT_S64:
+            SAMPLE_LOOP(float, int64_t, samples_f32_to_s64(x));
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Convert n signed 16-bit samples to (packed) format fmt
+static void samples_from_s16(const uint8_t *src, int sstride, uint8_t *dst,
+                             enum AVSampleFormat fmt, int dstride, int n) {
+    switch (fmt) {
+        case AV_SAMPLE_FMT_U8:
+            SAMPLE_LOOP(int16_t, uint8_t, (x >> 8) + 0x80);
+            break;
+
+        case AV_SAMPLE_FMT_S16:
+            samples_to_s16(src, AV_SAMPLE_FMT_S16, sstride, dst, dstride, n);
+            break;
+
+        case AV_SAMPLE_FMT_S32:
+            SAMPLE_LOOP(int16_t, int32_t, x * (1 << 16));
+            break;
+
+        case AV_SAMPLE_FMT_FLT:
+            samples_to_f32(src, AV_SAMPLE_FMT_S16, sstride, dst, dstride, n);
+            break;
+
+        case AV_SAMPLE_FMT_DBL:
+            SAMPLE_LOOP(int16_t, double, x * (1.0 / (1 << 15)));
+            break;
+
+        case AV_SAMPLE_FMT_S64:
+            SAMPLE_LOOP(int16_t, int64_t, x * (INT64_C(1) << 48));
+            break;
+
+        default:
+            break;
+    }
+}
+
+#undef SAMPLE_LOOP
+
+// Whether fmt is one of the formats the JS side can hold (F32 or S16)
+static int samples_js_format(int fmt) {
+    switch (fmt) {
+        case AV_SAMPLE_FMT_FLT:
+        case AV_SAMPLE_FMT_FLTP:
+        case AV_SAMPLE_FMT_S16:
+        case AV_SAMPLE_FMT_S16P:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Convert all of a frame's audio between its own format and the JS-side
+ * format js_fmt (packed or planar float or S16), in the buffer buf. Planar
+ * data in buf is channel after channel, nb_samples each. */
+static int samples_convert(AVFrame *frame, int js_fmt, uint8_t *buf, int out) {
+    enum AVSampleFormat fmt = frame->format;
+    int channels = frame->ch_layout.nb_channels;
+    int nb_samples = frame->nb_samples;
+    int bps = av_get_bytes_per_sample(fmt);
+    int js_bps = av_get_bytes_per_sample(js_fmt);
+    int planar = av_sample_fmt_is_planar(fmt);
+    int js_planar = av_sample_fmt_is_planar(js_fmt);
+    enum AVSampleFormat packed = av_get_packed_sample_fmt(fmt);
+    enum AVSampleFormat js_packed = av_get_packed_sample_fmt(js_fmt);
+
+    if (!samples_js_format(js_fmt) || bps <= 0 || channels <= 0)
+        return AVERROR(EINVAL);
+
+    // The same packed layout on both sides is just a copy
+    if (fmt == js_fmt && !planar) {
+        if (out)
+            memcpy(buf, frame->extended_data[0], nb_samples * channels * bps);
+        else
+            memcpy(frame->extended_data[0], buf, nb_samples * channels * bps);
+        return nb_samples * channels * bps;
+    }
+
+    for (int c = 0; c < channels; c++) {
+        uint8_t *data = planar ? frame->extended_data[c] : frame->extended_data[0] + c * bps;
+        int stride = planar ? bps : bps * channels;
+        uint8_t *js_data = js_planar ? buf + c * nb_samples * js_bps : buf + c * js_bps;
+        int js_stride = js_planar ? js_bps : js_bps * channels;
+
+        if (out && js_packed == AV_SAMPLE_FMT_FLT)
+            samples_to_f32(data, packed, stride, js_data, js_stride, nb_samples);
+        else if (out)
+            samples_to_s16(data, packed, stride, js_data, js_stride, nb_samples);
+        else if (js_packed == AV_SAMPLE_FMT_FLT)
+            samples_from_f32(js_data, js_stride, data, packed, stride, nb_samples);
+        else
+            samples_from_s16(js_data, js_stride, data, packed, stride, nb_samples);
+    }
+
+    return nb_samples * channels * js_bps;
+}
+
+/**
+ * Convert a frame's audio, in any sample format, to dst_fmt (which must be
+ * FLT, FLTP, S16 or S16P) in dst. Planar output is channel after channel.
+ * Returns the number of bytes written, or a negative error code.
+ */
+int ff_copyout_samples_js(AVFrame *frame, int dst_fmt, uint8_t *dst)
+{
+    return samples_convert(frame, dst_fmt, dst, 1);
+}
+
+/**
+ * Convert audio in src_fmt (FLT, FLTP, S16 or S16P) from src into a frame,
+ * in the frame's own sample format. The frame must already have its format,
+ * channels and nb_samples set and its buffers allocated. Returns the number
+ * of bytes read, or a negative error code.
+ */
+int ff_copyin_samples_js(AVFrame *frame, int src_fmt, uint8_t *src)
+{
+    return samples_convert(frame, src_fmt, src, 0);
+}
+
 /* AVPixFmtDescriptor */
 #define B(type, field) A(AVPixFmtDescriptor, type, field)
 B(uint64_t, flags)
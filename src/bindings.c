@@ -251,6 +251,14 @@ void sws_scale_frame() {}
 #endif
 
 
+/****************************************************************
+ * Snapshots
+ ***************************************************************/
+/* Struct_snapshot, reading every field of a struct in one call, generated
+ * from funcs.json by tools/mk-snapshots.js for this variant's components */
+#include "snapshots.c"
+
+
 /****************************************************************
  * Threading
  ***************************************************************/
@@ -101,6 +101,13 @@ if (/* We're in a worker */
             postMessage(["onblockread", "onblockread", true, [name, pos, len]]);
         };
 
+        libav.onhlssegment = function(name, data) {
+            postMessage(
+                ["onhlssegment", "onhlssegment", true, [name, data]],
+                data ? [data.buffer] : []
+            );
+        };
+
         postMessage(["onready", "onready", true, null]);
 
     }).catch(function(ex) {
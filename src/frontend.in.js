@@ -315,6 +315,12 @@
     libavStatics.AV_PKT_FLAG_TRUSTED = 0x0008;
     libavStatics.AV_PKT_FLAG_DISPOSABLE = 0x0010;
 
+    // Duration confidences, as given by ff_probe_media_duration
+    libavStatics.FF_DURATION_NONE = 0;
+    libavStatics.FF_DURATION_ESTIMATE = 1;
+    libavStatics.FF_DURATION_TAIL = 2;
+    libavStatics.FF_DURATION_HEADER = 3;
+
     // SWS flags
     libavStatics.SWS_FAST_BILINEAR = 1;
     libavStatics.SWS_BILINEAR = 2;
@@ -449,6 +455,10 @@
                             if (ret.onwrite)
                                 ret.onwrite.apply(ret, args);
                         }, null],
+                        onhlssegment: [function(args) {
+                            if (ret.onhlssegment)
+                                ret.onhlssegment.apply(ret, args);
+                        }, null],
                         onread: [function(args) {
                             try {
                                 var rr = null;
@@ -120,6 +120,30 @@ declare namespace LibAV {
          * Picture type (libav-specific value)
          */
         pict_type?: number;
+
+        /**
+         * Video only. Set if the frame was copied out by
+         * ff_copyout_frame_video_lease, in which case data is a view into the
+         * heap, and the frame must be released with ff_release_frame.
+         */
+        lease?: number;
+    }
+
+    /**
+     * A frame lease that hasn't been released, as listed by ff_leased_frames.
+     */
+    export interface LeasedFrameInfo {
+        lease: number;
+        width: number;
+        height: number;
+        format: number;
+        pts: number;
+        ptshi: number;
+
+        /**
+         * Time since the frame was leased, in milliseconds.
+         */
+        age: number;
     }
 
     /**
@@ -167,6 +191,301 @@ declare namespace LibAV {
         side_data?: any;
     }
 
+    /**
+     * A batch of packets, as returned by ff_copyout_packet_batch. All of the
+     * arrays are views into a single buffer, and are indexed by packet number.
+     * Packets are in input order. Side data is not included.
+     */
+    export interface PacketBatch extends LibAVTransferable {
+        /**
+         * Number of packets in this batch.
+         */
+        count: number;
+
+        /**
+         * The data of all packets, back to back.
+         */
+        data: Uint8Array;
+
+        /**
+         * Timestamps and durations, as (possibly very large) numbers rather
+         * than lo/hi pairs. AV_NOPTS_VALUE is represented exactly.
+         */
+        pts: Float64Array;
+        dts: Float64Array;
+        duration: Float64Array;
+
+        /**
+         * Index of the stream within the demuxer of each packet.
+         */
+        stream_index: Int32Array;
+
+        /**
+         * Packet flags, as defined by ffmpeg.
+         */
+        flags: Int32Array;
+
+        /**
+         * Offset and size of each packet's data within `data`.
+         */
+        offset: Int32Array;
+        size: Int32Array;
+
+        /**
+         * Base for timestamps of each packet.
+         */
+        time_base_num: Int32Array;
+        time_base_den: Int32Array;
+    }
+
+    /**
+     * A waveform peak pyramid, as returned by ff_copyout_audio_peaks. All of
+     * the arrays are views into a single buffer.
+     */
+    export interface AudioPeaks extends LibAVTransferable {
+        /**
+         * Sample rate of the (mono, downmixed) audio the peaks were built
+         * from.
+         */
+        sampleRate: number;
+
+        /**
+         * Total number of samples.
+         */
+        samples: number;
+
+        /**
+         * One entry per requested level, in the order requested. The last
+         * pixel of each level may cover fewer samples.
+         */
+        levels: {
+            samplesPerPixel: number;
+            min: Float32Array;
+            max: Float32Array;
+            rms: Float32Array;
+        }[];
+    }
+
+    /**
+     * What ff_probe_batch found out about one file.
+     */
+    export interface ProbeResult {
+        filename: string;
+
+        /**
+         * 0, or a negative error code if the file couldn't be probed, in
+         * which case nothing else is filled in.
+         */
+        status: number;
+
+        /**
+         * True if the container headers didn't suffice, so the streams were
+         * probed by decoding.
+         */
+        decoded: boolean;
+
+        nbStreams: number;
+
+        /**
+         * Duration in seconds, and overall bit rate, or 0 if unknown.
+         */
+        duration: number;
+        bitRate: number;
+
+        /**
+         * Input format name, and the timecode and major brand, if any.
+         */
+        format: string | null;
+        timecode: string | null;
+        majorBrand: string | null;
+
+        /**
+         * The main video stream, if any. Rotation is in degrees, as from
+         * avformat_get_rotation.
+         */
+        video: {
+            index: number,
+            codecId: number,
+            codec: string,
+            width: number,
+            height: number,
+            rotation: number,
+            frameRate: number
+        } | null;
+
+        /**
+         * The main audio stream, if any.
+         */
+        audio: {
+            index: number,
+            codecId: number,
+            codec: string,
+            sampleRate: number,
+            channels: number
+        } | null;
+    }
+
+    /**
+     * Thumbnails, as returned by ff_copyout_thumbnails.
+     */
+    export interface Thumbnails extends LibAVTransferable {
+        /**
+         * Number of thumbnails, one per requested time, in the order
+         * requested.
+         */
+        count: number;
+
+        /**
+         * Size of each thumbnail.
+         */
+        width: number;
+        height: number;
+
+        /**
+         * Time, in seconds, of the frame used for each thumbnail, or -1 if
+         * there was none.
+         */
+        times: Float64Array;
+
+        /**
+         * RGBA pixels of all the thumbnails, stacked vertically into one
+         * width x (count * height) image.
+         */
+        data: Uint8Array;
+    }
+
+    /**
+     * Cache counters of a readahead file, from readaheadfilestats.
+     */
+    export interface ReadaheadStats {
+        /**
+         * Reads libav made that weren't already in the device's buffer.
+         */
+        requests: number;
+
+        /**
+         * Requests whose block was already cached, and hits / requests.
+         */
+        hits: number;
+        hitRate: number;
+
+        /**
+         * Requests whose block was already being read ahead.
+         */
+        waits: number;
+
+        /**
+         * Reads made from the Blob, and the bytes they returned.
+         */
+        reads: number;
+        bytesRead: number;
+
+        /**
+         * Bytes handed to libav, counting each block every time it's used.
+         */
+        bytesServed: number;
+
+        /**
+         * Bytes read ahead but evicted without ever being used.
+         */
+        bytesWasted: number;
+
+        /**
+         * Bytes currently cached.
+         */
+        cached: number;
+    }
+
+    /**
+     * Options for the jsfetch protocol's block cache, for jsfetchconfig.
+     */
+    export interface JSFetchOptions {
+        /**
+         * Size of the blocks URLs are fetched and cached in. Only applies to
+         * URLs not yet cached.
+         */
+        blockSize?: number;
+
+        /**
+         * Bytes to cache per URL, and how many URLs to keep caches for.
+         */
+        cacheSize?: number;
+        maxUrls?: number;
+
+        /**
+         * Blocks a sequential reader fetches ahead of itself, and the limit of
+         * requests for one URL at once.
+         */
+        prefetch?: number;
+        maxInFlight?: number;
+    }
+
+    /**
+     * Request and cache counters of the jsfetch protocol, from jsfetchstats.
+     */
+    export interface JSFetchStats {
+        /**
+         * Reads libav made, and those whose block was already cached, already
+         * being fetched, or not yet fetched.
+         */
+        reads: number;
+        hits: number;
+        waits: number;
+        misses: number;
+
+        /**
+         * HTTP requests made, and how many of them fetched ahead.
+         */
+        requests: number;
+        prefetches: number;
+
+        /**
+         * Bytes received.
+         */
+        bytesFetched: number;
+
+        /**
+         * Milliseconds from sending a request to receiving its block (or, for
+         * servers without Range support, its headers).
+         */
+        averageLatency: number;
+        maxLatency: number;
+
+        /**
+         * Bytes currently cached.
+         */
+        cached: number;
+    }
+
+    /**
+     * Cache counters of a frame server, from ff_frame_server_stats_js.
+     */
+    export interface FrameServerStats {
+        /**
+         * Frames answered from the cache, and not.
+         */
+        hits: number;
+        misses: number;
+
+        /**
+         * Frames decoded in all, and how many of them by prefetching.
+         */
+        decoded: number;
+        prefetched: number;
+
+        /**
+         * Frames dropped to stay under the memory limit.
+         */
+        evictions: number;
+
+        /**
+         * Frames currently cached, and the bytes they use.
+         */
+        frames: number;
+        memory: number;
+        memoryLimit: number;
+    }
+
     /**
      * Stream information, as returned by ff_init_demuxer_file.
      */
@@ -618,6 +937,10 @@ declare namespace LibAV {
         AV_PKT_FLAG_DISCARD: number;
         AV_PKT_FLAG_TRUSTED: number;
         AV_PKT_FLAG_DISPOSABLE: number;
+        FF_DURATION_NONE: number;
+        FF_DURATION_ESTIMATE: number;
+        FF_DURATION_TAIL: number;
+        FF_DURATION_HEADER: number;
         SWS_FAST_BILINEAR: number;
         SWS_BILINEAR: number;
         SWS_BICUBIC: number;
@@ -729,6 +1052,30 @@ declare namespace LibAV {
             flags: number
         ): Promise<number>;
 
+        /**
+         * Seek and decode up to the frame at the given timestamp (exact: 0,
+         * keyframe: 1, next: 2), leaving only that frame in frame.
+         */
+        ff_decode_frame_at(
+            fmt_ctx: number, dec_ctx: number, stream_index: number,
+            tslo: number, tshi: number, mode: number, frame: number
+        ): Promise<number>;
+
+        /**
+         * Seek to the last keyframe at or before ts using a seek index.
+         */
+        ff_seek_index_seek(
+            fmt_ctx: number, idx: number, stream_index: number,
+            tslo: number, tshi: number
+        ): Promise<number>;
+
+        /**
+         * Get the frame shown at pts from a frame server, as a new reference.
+         */
+        ff_frame_server_get_frame(
+            fs: number, ptslo: number, ptshi: number, frame: number
+        ): Promise<number>;
+
         /**
          * Seek to the keyframe at timestamp 'timestamp' in 'stream_index'.
          */
@@ -749,6 +1096,13 @@ declare namespace LibAV {
          */
         onwrite?: (filename: string, position: number, buffer: Uint8Array | Int8Array) => void;
 
+        /**
+         * Callback when convert_to_hls_streaming finishes a file (segment,
+         * init segment or playlist). data is the file's content, or null if
+         * it was written to a mkfsdhdir mount. Set by the user.
+         */
+        onhlssegment?: (filename: string, data: Uint8Array | null) => void;
+
         /**
          * Callback for stream reader devices. Set by the user.
          */
@@ -841,6 +1195,17 @@ declare namespace LibAV {
         LibAV(opts?: LibAVOpts & {noworker?: false}): Promise<LibAV>;
         LibAV(opts: LibAVOpts & {noworker: true}): Promise<LibAV & LibAVSync>;
         LibAV(opts: LibAVOpts): Promise<LibAV | LibAV & LibAVSync>;
+
+        /**
+         * Is WebAssembly supported in this environment?
+         */
+        isWebAssemblySupported(): boolean;
+
+        /**
+         * Are threads (shared WebAssembly memory) supported in this
+         * environment?
+         */
+        isThreadingSupported(): boolean;
     }
 }
 
@@ -156,6 +156,10 @@ var ff_init_decoder = Module.ff_init_decoder = function(name, config) {
  * ): @promise@void@
  */
 var ff_free_encoder = Module.ff_free_encoder = function(c, frame, pkt) {
+    if (ff_encode_slots[c]) {
+        ff_encode_slots[c].forEach(av_frame_free_js);
+        delete ff_encode_slots[c];
+    }
     av_frame_free_js(frame);
     av_packet_free_js(pkt);
     avcodec_free_context_js(c);
@@ -173,6 +177,14 @@ var ff_free_encoder = Module.ff_free_encoder = function(c, frame, pkt) {
  * ): @promise@void@
  */
 var ff_free_decoder = Module.ff_free_decoder = function(c, pkt, frame) {
+    if (ff_decode_scalers[c]) {
+        ff_video_scaler_free(ff_decode_scalers[c].scaler);
+        delete ff_decode_scalers[c];
+    }
+    if (ff_decode_pools[c]) {
+        ff_frame_pool_free(ff_decode_pools[c]);
+        delete ff_decode_pools[c];
+    }
     ff_free_encoder(c, frame, pkt);
 };
 
@@ -281,9 +293,86 @@ var ff_encode_multi = Module.ff_encode_multi = function(ctx, frame, pkt, inFrame
     return outPackets;
 };
 
+// Video scalers used by ff_decode_multi's scale option, by AVCodecContext
+var ff_decode_scalers = {};
+
+/* Get (or make) the scaler for this decoder and these scale settings. Used
+ * internally by ff_decode_multi. */
+function ff_decode_scaler(ctx, scale, imageData) {
+    var width = scale.width || 0;
+    var height = scale.height || 0;
+    var format = (typeof scale.format === "number") ? scale.format :
+        (imageData ? 26 /* RGBA */ : -1);
+    var flags = scale.flags || 0;
+    var key = width + "x" + height + ":" + format + ":" + flags;
+
+    var cur = ff_decode_scalers[ctx];
+    if (cur && cur.key === key)
+        return cur.scaler;
+    if (cur)
+        ff_video_scaler_free(cur.scaler);
+    delete ff_decode_scalers[ctx];
+
+    var scaler = ff_video_scaler_alloc(width, height, format, flags);
+    if (!scaler)
+        throw new Error("Failed to allocate scaler");
+    ff_decode_scalers[ctx] = {key: key, scaler: scaler};
+    return scaler;
+}
+
+/* Copy out the frame last scaled by a scaler, as a packed Frame (or an
+ * ImageData). Used internally by ff_decode_multi. */
+function ff_copyout_scaled_frame(scaler, imageData) {
+    // See FFVideoScaler in b-avcodec.c for this layout
+    var info = new Int32Array(Module.HEAPU8.buffer, scaler, 23);
+    var width = info[0], height = info[1];
+    var ptr = info[22] >>> 0;
+    var data = Module.HEAPU8.slice(ptr, ptr + info[3]);
+
+    if (imageData) {
+        var id = new ImageData(
+            new Uint8ClampedArray(data.buffer), width, height);
+        id.libavjsTransfer = [data.buffer];
+        return id;
+    }
+
+    var layout = [];
+    for (var p = 0; p < info[4]; p++) {
+        layout.push({
+            offset: info[5 + p],
+            stride: info[9 + p]
+        });
+    }
+
+    return {
+        data: data,
+        layout: layout,
+        libavjsTransfer: [data.buffer],
+        width: width,
+        height: height,
+        format: info[2],
+        pts: info[13],
+        ptshi: info[14],
+        flags: info[15],
+        key_frame: info[16],
+        pict_type: info[17],
+        time_base_num: info[18],
+        time_base_den: info[19],
+        sample_aspect_ratio: [info[20], info[21]]
+    };
+}
+
 /**
  * Decode some number of packets at once. Done in one go to avoid excess
- * message passing.
+ * message passing. If the packets are all Packets without side data, and
+ * aren't to be scaled, they're decoded as a batch by ff_decode_batch, with the
+ * send/receive loop in C; otherwise, they're sent one at a time. If
+ * config.scale is set, video frames are scaled and converted (with a
+ * SwsContext cached for the decoder until ff_free_decoder) as they're
+ * received, and copied out packed, in one call per frame. Without a format,
+ * frames keep their own pixel format, or are converted to RGBA with
+ * copyoutFrame: "ImageData". Scaling can't be combined with copyoutFrame:
+ * "ptr" or "video_lease".
  * @param ctx  AVCodecContext
  * @param pkt  AVPacket
  * @param frame  AVFrame
@@ -296,7 +385,13 @@ var ff_encode_multi = Module.ff_encode_multi = function(ctx, frame, pkt, inFrame
  *     config?: boolean | {
  *         fin?: boolean,
  *         ignoreErrors?: boolean,
- *         copyoutFrame?: "default" | "video" | "video_packed"
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed",
+ *         scale?: {
+ *             width?: number, // Output width, or 0 to follow the source (default 0)
+ *             height?: number, // Output height, or 0 to follow the source (default 0)
+ *             format?: number, // Output pixel format (default: the source's)
+ *             flags?: number // SwsContext flags (default SWS_BILINEAR)
+ *         }
  *     }
  * ): @promise@Frame[]@
  * ff_decode_multi@sync(
@@ -312,7 +407,13 @@ var ff_encode_multi = Module.ff_encode_multi = function(ctx, frame, pkt, inFrame
  *     config: {
  *         fin?: boolean,
  *         ignoreErrors?: boolean,
- *         copyoutFrame: "ImageData"
+ *         copyoutFrame: "ImageData",
+ *         scale?: {
+ *             width?: number,
+ *             height?: number,
+ *             format?: number, // Must be RGBA, if set
+ *             flags?: number
+ *         }
  *     }
  * ): @promise@ImageData[]@
  */
@@ -348,6 +449,22 @@ var ff_decode_multi = Module.ff_decode_multi = function(ctx, pkt, frame, inPacke
         };
     }
 
+    /* Without scaling, packets that ff_pack_packet_batch can carry whole go
+     * through ff_decode_batch's C loop */
+    if (!config.scale && inPackets.every(ff_decode_batchable))
+        return ff_decode_batch(ctx, pkt, frame, inPackets, config);
+
+    var scaler = 0;
+    var imageData = (config.copyoutFrame === "ImageData");
+    if (config.scale) {
+        if (typeof ff_decode_receive_scaled_js === "undefined")
+            throw new Error("Scaling requires swscale");
+        // Scaled frames are always copied out packed, from the scaler's buffer
+        if (config.copyoutFrame === "ptr" || config.copyoutFrame === "video_lease")
+            throw new Error("scale can't be used with copyoutFrame: \"" + config.copyoutFrame + "\"");
+        scaler = ff_decode_scaler(ctx, config.scale, imageData);
+    }
+
     function handlePacket(inPacket) {
         var ret;
 
@@ -395,12 +512,26 @@ var ff_decode_multi = Module.ff_decode_multi = function(ctx, pkt, frame, inPacke
         av_packet_unref(pkt);
 
         while (true) {
-            ret = avcodec_receive_frame(ctx, frame);
+            if (scaler)
+                ret = ff_decode_receive_scaled_js(ctx, frame, scaler);
+            else
+                ret = avcodec_receive_frame(ctx, frame);
             if (ret === -6 /* EAGAIN */ || ret === -0x20464f45 /* AVERROR_EOF */)
                 return;
             else if (ret < 0)
                 throw new Error("Error decoding audio frame: " + ff_error(ret));
 
+            if (scaler) {
+                var outFrame = ff_copyout_scaled_frame(scaler, imageData);
+                if (!imageData && !outFrame.time_base_num) {
+                    outFrame.time_base_num = tbNum;
+                    outFrame.time_base_den = tbDen;
+                }
+                transfer.push.apply(transfer, outFrame.libavjsTransfer);
+                outFrames.push(outFrame);
+                continue;
+            }
+
             var outFrame = copyoutFrame(frame);
             if (outFrame && outFrame.libavjsTransfer && outFrame.libavjsTransfer.length)
                 transfer.push.apply(transfer, outFrame.libavjsTransfer);
@@ -418,3 +549,304 @@ var ff_decode_multi = Module.ff_decode_multi = function(ctx, pkt, frame, inPacke
     return outFrames;
 };
 
+/* Whether a packet can be decoded from a packet batch: a Packet (not an
+ * AVPacket pointer) with no side data. Used internally by ff_decode_multi. */
+function ff_decode_batchable(packet) {
+    return typeof packet === "object" && packet !== null &&
+        !(packet.side_data && packet.side_data.length);
+}
+
+/* Take a copied-out frame's timing and flags from its row of a frame pool's
+ * metadata table, rather than from the AVFrame. An ImageData only gets the
+ * time base. Used internally by ff_decode_batch. */
+function ff_frame_info_apply(outFrame, row) {
+    // See FFFrameInfo in b-avcodec.c for this layout
+    var dinfo = new Float64Array(Module.HEAPU8.buffer, row, 2);
+    var info = new Int32Array(Module.HEAPU8.buffer, row, 16);
+
+    outFrame.time_base_num = info[14];
+    outFrame.time_base_den = info[15];
+    if (!("pts" in outFrame))
+        return;
+
+    outFrame.pts = ~~dinfo[0];
+    outFrame.ptshi = Math.floor(dinfo[0] / 0x100000000);
+    if (info[8] /* nb_samples */) {
+        outFrame.duration = ~~dinfo[1];
+        outFrame.durationhi = Math.floor(dinfo[1] / 0x100000000);
+    } else {
+        outFrame.flags = info[11];
+        outFrame.key_frame = info[12];
+        outFrame.pict_type = info[13];
+    }
+}
+
+// Frame pools used by ff_decode_batch, by AVCodecContext
+var ff_decode_pools = {};
+
+// Extra AVFrames used by ff_encode_batch, by AVCodecContext
+var ff_encode_slots = {};
+
+/* Pack an array of packets into a packet batch, as described at
+ * FFPacketBatchBuilder in b-avcodec.c. Side data is dropped. Used internally
+ * by ff_decode_batch. */
+function ff_pack_packet_batch(packets) {
+    var count = packets.length;
+    var dataSize = 0;
+    packets.forEach(function(p) { dataSize += p.data.length; });
+    var indexOffset = (32 + dataSize + 7) & ~7;
+    var size = indexOffset + count * 48;
+    var buf = new ArrayBuffer(size);
+    var u8 = new Uint8Array(buf);
+    var header = new Int32Array(buf, 0, 8);
+    var dindex = new Float64Array(buf, indexOffset, count * 3);
+    var iindex = new Int32Array(buf, indexOffset + count * 24, count * 6);
+
+    // lo/hi pair to a double, with no hi meaning lo is the whole number
+    function ts(lo, hi, def) {
+        if (typeof lo !== "number")
+            return def;
+        if (typeof hi !== "number")
+            return lo;
+        return (lo >>> 0) + hi * 0x100000000;
+    }
+
+    header[0] = size;
+    header[2] = count;
+    header[3] = 32;
+    header[4] = dataSize;
+    header[5] = indexOffset;
+
+    var offset = 0;
+    for (var i = 0; i < count; i++) {
+        var p = packets[i];
+        u8.set(p.data, 32 + offset);
+        dindex[i] = ts(p.pts, p.ptshi, -0x8000000000000000 /* AV_NOPTS_VALUE */);
+        dindex[count + i] = ts(p.dts, p.dtshi, -0x8000000000000000);
+        dindex[2 * count + i] = ts(p.duration, p.durationhi, 0);
+        iindex[i] = p.stream_index || 0;
+        iindex[count + i] = p.flags || 0;
+        iindex[2 * count + i] = offset;
+        iindex[3 * count + i] = p.data.length;
+        iindex[4 * count + i] = p.time_base_num || 0;
+        iindex[5 * count + i] = p.time_base_den || 0;
+        offset += p.data.length;
+    }
+
+    return u8;
+}
+
+/* The packed layout of a PacketBatch. One copied out by
+ * ff_copyout_packet_batch is still a set of views into that layout, and is
+ * used as is; any other is packed again from its fields. */
+function ff_packet_batch_arena(batch) {
+    var count = batch.count;
+    var buf = batch.data.buffer;
+    if (batch.data.byteOffset === 32 && buf.byteLength >= 32) {
+        var h = new Int32Array(buf, 0, 8);
+        if (h[0] === buf.byteLength && h[2] === count &&
+            h[3] === 32 && h[4] === batch.data.length &&
+            batch.pts.buffer === buf && batch.pts.byteOffset === h[5] &&
+            batch.time_base_den.buffer === buf &&
+            batch.time_base_den.byteOffset === h[5] + count * 44)
+            return new Uint8Array(buf);
+    }
+
+    var dataSize = 0;
+    for (var i = 0; i < count; i++)
+        dataSize += batch.size[i];
+    var indexOffset = (32 + dataSize + 7) & ~7;
+    var size = indexOffset + count * 48;
+    var out = new ArrayBuffer(size);
+    var u8 = new Uint8Array(out);
+    var header = new Int32Array(out, 0, 8);
+    var dindex = new Float64Array(out, indexOffset, count * 3);
+    var iindex = new Int32Array(out, indexOffset + count * 24, count * 6);
+
+    header[0] = size;
+    header[2] = count;
+    header[3] = 32;
+    header[4] = dataSize;
+    header[5] = indexOffset;
+
+    var offset = 0;
+    for (i = 0; i < count; i++) {
+        var len = batch.size[i];
+        u8.set(batch.data.subarray(batch.offset[i], batch.offset[i] + len), 32 + offset);
+        iindex[2 * count + i] = offset;
+        iindex[3 * count + i] = len;
+        offset += len;
+    }
+    dindex.set(batch.pts.subarray(0, count), 0);
+    dindex.set(batch.dts.subarray(0, count), count);
+    dindex.set(batch.duration.subarray(0, count), 2 * count);
+    iindex.set(batch.stream_index.subarray(0, count), 0);
+    iindex.set(batch.flags.subarray(0, count), count);
+    iindex.set(batch.time_base_num.subarray(0, count), 4 * count);
+    iindex.set(batch.time_base_den.subarray(0, count), 5 * count);
+    return u8;
+}
+
+/**
+ * Decode a batch of packets at once, with the whole send/receive loop in C.
+ * Frames are received into a pool of AVFrames kept for the decoder until
+ * ff_free_decoder, whose buffers are reused by the decoder from batch to
+ * batch, and are then copied out as with ff_decode_multi. The packets should
+ * all be for this decoder, and their side data is ignored.
+ * @param ctx  AVCodecContext
+ * @param pkt  AVPacket
+ * @param frame  AVFrame (unused, for symmetry with ff_decode_multi)
+ * @param inPackets  Incoming packets to decode, as a PacketBatch (e.g. from
+ *                   ff_read_frame_multi) or an array of packets
+ * @param config  Decoding options. May be "true" to indicate end of stream.
+ */
+/* @types
+ * ff_decode_batch@sync(
+ *     ctx: number, pkt: number, frame: number, inPackets: PacketBatch | Packet[],
+ *     config?: boolean | {
+ *         fin?: boolean,
+ *         ignoreErrors?: boolean,
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
+ *     }
+ * ): @promise@Frame[]@
+ * ff_decode_batch@sync(
+ *     ctx: number, pkt: number, frame: number, inPackets: PacketBatch | Packet[],
+ *     config: {
+ *         fin?: boolean,
+ *         ignoreErrors?: boolean,
+ *         copyoutFrame: "ptr"
+ *     }
+ * ): @promise@number[]@
+ * ff_decode_batch@sync(
+ *     ctx: number, pkt: number, frame: number, inPackets: PacketBatch | Packet[],
+ *     config: {
+ *         fin?: boolean,
+ *         ignoreErrors?: boolean,
+ *         copyoutFrame: "ImageData"
+ *     }
+ * ): @promise@ImageData[]@
+ */
+var ff_decode_batch = Module.ff_decode_batch = function(ctx, pkt, frame, inPackets, config) {
+    var outFrames = [];
+    var transfer = [];
+    if (typeof config === "boolean") {
+        config = {fin: config};
+    } else {
+        config = config || {};
+    }
+
+    var copyoutFrame = ff_copyout_frame;
+    if (config.copyoutFrame)
+        copyoutFrame = ff_copyout_frame_versions[config.copyoutFrame];
+
+    var pool = ff_decode_pools[ctx];
+    if (!pool) {
+        pool = ff_frame_pool_alloc();
+        if (!pool)
+            throw new Error("Failed to allocate frame pool");
+        ff_decode_pools[ctx] = pool;
+    }
+
+    // Get the batch into the heap
+    var arena = Array.isArray(inPackets) ?
+        ff_pack_packet_batch(inPackets) :
+        ff_packet_batch_arena(inPackets);
+    var batch = malloc(arena.length);
+    if (batch === 0)
+        throw new Error("Failed to malloc");
+    Module.HEAPU8.set(arena, batch);
+
+    var ret = ff_decode_batch_js(
+        ctx, pkt, batch,
+        (config.fin ? 1 : 0) | (config.ignoreErrors ? 2 : 0),
+        pool
+    );
+    free(batch);
+    if (ret < 0) {
+        ff_frame_pool_reset(pool);
+        throw new Error("Error decoding batch: " + ff_error(ret));
+    }
+
+    try {
+        // See FFFramePool and FFFrameInfo in b-avcodec.c for these layouts
+        var infoPtr = (new Int32Array(Module.HEAPU8.buffer, pool, 2))[1];
+        for (var i = 0; i < ret; i++) {
+            var row = infoPtr + i * 64;
+            var outFrame = copyoutFrame((new Int32Array(Module.HEAPU8.buffer, row, 16))[4]);
+            if (config.copyoutFrame !== "ptr") {
+                ff_frame_info_apply(outFrame, row);
+                if (outFrame.libavjsTransfer && outFrame.libavjsTransfer.length)
+                    transfer.push.apply(transfer, outFrame.libavjsTransfer);
+            }
+            outFrames.push(outFrame);
+        }
+    } finally {
+        ff_frame_pool_reset(pool);
+    }
+
+    outFrames.libavjsTransfer = transfer;
+    return outFrames;
+};
+
+/**
+ * Encode a batch of frames at once, with the whole send/receive loop in C,
+ * returning the packets as a PacketBatch. frame is used for the first input
+ * frame, and more AVFrames are kept for the encoder until ff_free_encoder.
+ * @param ctx  AVCodecContext
+ * @param frame  AVFrame
+ * @param pkt  AVPacket
+ * @param inFrames  Array of frames in libav.js format
+ * @param config  Encoding options. May be "true" to indicate end of stream.
+ */
+/* @types
+ * ff_encode_batch@sync(
+ *     ctx: number, frame: number, pkt: number, inFrames: (Frame | number)[],
+ *     config?: boolean | {
+ *         fin?: boolean
+ *     }
+ * ): @promise@PacketBatch@
+ */
+var ff_encode_batch = Module.ff_encode_batch = function(ctx, frame, pkt, inFrames, config) {
+    if (typeof config === "boolean") {
+        config = {fin: config};
+    } else {
+        config = config || {};
+    }
+    if (typeof ff_copyout_packet_batch === "undefined")
+        throw new Error("Batch encoding requires a variant with avformat");
+
+    var slots = ff_encode_slots[ctx];
+    if (!slots)
+        slots = ff_encode_slots[ctx] = [];
+    while (slots.length < inFrames.length - 1) {
+        var slot = av_frame_alloc();
+        if (!slot)
+            throw new Error("Failed to allocate frame");
+        slots.push(slot);
+    }
+    var frames = [frame].concat(slots).slice(0, inFrames.length);
+
+    try {
+        inFrames.forEach(function(inFrame, i) {
+            ff_copyin_frame(frames[i], inFrame);
+        });
+    } catch (ex) {
+        frames.forEach(av_frame_unref);
+        throw ex;
+    }
+
+    var framesPtr = frames.length ? ff_malloc_int32_list(frames) : 0;
+    var batch = ff_encode_batch_js(
+        ctx, framesPtr, frames.length, pkt, config.fin ? 1 : 0);
+    if (framesPtr)
+        free(framesPtr);
+    if (!batch)
+        throw new Error("Failed to allocate packet batch");
+
+    var ret = Module.HEAP32[(batch >> 2) + 1];
+    if (ret < 0) {
+        free(batch);
+        throw new Error("Error encoding batch: " + ff_error(ret));
+    }
+    return ff_copyout_packet_batch(batch);
+};
@@ -36,26 +36,22 @@ var ff_set_packet = Module.ff_set_packet = function(pkt, data) {
  */
 /// @types ff_copyout_packet@sync(pkt: number): @promise@Packet@
 var ff_copyout_packet = Module.ff_copyout_packet = function(pkt) {
-    var data = AVPacket_data(pkt);
-    var size = AVPacket_size(pkt);
-    var data = copyout_u8(data, size);
+    var s = AVPacket_snapshot_js(pkt);
+    var data = copyout_u8(s.data, s.size);
     return {
         data: data,
         libavjsTransfer: [data.buffer],
-        pts: AVPacket_pts(pkt),
-        ptshi: AVPacket_ptshi(pkt),
-        dts: AVPacket_dts(pkt),
-        dtshi: AVPacket_dtshi(pkt),
-        time_base_num: AVPacket_time_base_num(pkt),
-        time_base_den: AVPacket_time_base_den(pkt),
-        stream_index: AVPacket_stream_index(pkt),
-        flags: AVPacket_flags(pkt),
-        duration: AVPacket_duration(pkt),
-        durationhi: AVPacket_durationhi(pkt),
-        side_data: ff_copyout_side_data(
-            AVPacket_side_data(pkt),
-            AVPacket_side_data_elems(pkt)
-        )
+        pts: s.pts,
+        ptshi: s.ptshi,
+        dts: s.dts,
+        dtshi: s.dtshi,
+        time_base_num: s.time_base_num,
+        time_base_den: s.time_base_den,
+        stream_index: s.stream_index,
+        flags: s.flags,
+        duration: s.duration,
+        durationhi: s.durationhi,
+        side_data: ff_copyout_side_data(s.side_data, s.side_data_elems)
     };
 };
 
@@ -88,6 +84,46 @@ var ff_copyout_packet_ptr = Module.ff_copyout_packet_ptr = function(pkt) {
     return ret;
 };
 
+/**
+ * Copy out a packet batch, as made by ff_read_frame_batch, and free it. The
+ * whole batch is copied out at once, and every field of the returned
+ * PacketBatch is a view into the same (transferable) buffer.
+ * @param batch  Packet batch pointer
+ */
+/// @types ff_copyout_packet_batch@sync(batch: number): @promise@PacketBatch@
+var ff_copyout_packet_batch = Module.ff_copyout_packet_batch = function(batch) {
+    var header = new Int32Array(Module.HEAPU8.buffer, batch, 8);
+    var size = header[0];
+    var count = header[2];
+    var dataOffset = header[3];
+    var dataSize = header[4];
+    var indexOffset = header[5];
+    var buf = Module.HEAPU8.slice(batch, batch + size).buffer;
+    free(batch);
+
+    function f64s(i) {
+        return new Float64Array(buf, indexOffset + i * count * 8, count);
+    }
+    function i32s(i) {
+        return new Int32Array(buf, indexOffset + count * 24 + i * count * 4, count);
+    }
+
+    return {
+        count: count,
+        data: new Uint8Array(buf, dataOffset, dataSize),
+        libavjsTransfer: [buf],
+        pts: f64s(0),
+        dts: f64s(1),
+        duration: f64s(2),
+        stream_index: i32s(0),
+        flags: i32s(1),
+        offset: i32s(2),
+        size: i32s(3),
+        time_base_num: i32s(4),
+        time_base_den: i32s(5)
+    };
+};
+
 // Versions of ff_copyout_packet
 var ff_copyout_packet_versions = {
     default: ff_copyout_packet,
@@ -144,36 +180,37 @@ var ff_copyin_side_data = Module.ff_copyin_side_data = function(pktPtr, side_dat
  */
 /// @types ff_copyout_codecpar@sync(codecpar: number): @promise@CodecParameters@
 var ff_copyout_codecpar = Module.ff_copyout_codecpar = function(codecpar) {
+    var s = AVCodecParameters_snapshot_js(codecpar);
     return {
-        bit_rate: AVCodecParameters_bit_rate(codecpar),
-        channel_layoutmask: AVCodecParameters_channel_layoutmask(codecpar),
-        channels: AVCodecParameters_channels(codecpar),
-        chroma_location: AVCodecParameters_chroma_location(codecpar),
-        codec_id: AVCodecParameters_codec_id(codecpar),
-        codec_tag: AVCodecParameters_codec_tag(codecpar),
-        codec_type: AVCodecParameters_codec_type(codecpar),
-        color_primaries: AVCodecParameters_color_primaries(codecpar),
-        color_range: AVCodecParameters_color_range(codecpar),
-        color_space: AVCodecParameters_color_space(codecpar),
-        color_trc: AVCodecParameters_color_trc(codecpar),
-        format: AVCodecParameters_format(codecpar),
-        height: AVCodecParameters_height(codecpar),
-        level: AVCodecParameters_level(codecpar),
-        profile: AVCodecParameters_profile(codecpar),
-        sample_rate: AVCodecParameters_sample_rate(codecpar),
-        width: AVCodecParameters_width(codecpar),
-        extradata: ff_copyout_codecpar_extradata(codecpar),
+        bit_rate: s.bit_rate,
+        channel_layoutmask: s.channel_layoutmask,
+        channels: s.channels,
+        chroma_location: s.chroma_location,
+        codec_id: s.codec_id,
+        codec_tag: s.codec_tag,
+        codec_type: s.codec_type,
+        color_primaries: s.color_primaries,
+        color_range: s.color_range,
+        color_space: s.color_space,
+        color_trc: s.color_trc,
+        format: s.format,
+        height: s.height,
+        level: s.level,
+        profile: s.profile,
+        sample_rate: s.sample_rate,
+        width: s.width,
+        extradata: ff_copyout_codecpar_extradata(codecpar, s),
         coded_side_data: ff_copyout_side_data(
-            AVCodecParameters_coded_side_data(codecpar),
-            AVCodecParameters_nb_coded_side_data(codecpar)
-        )
+            s.coded_side_data, s.nb_coded_side_data)
     };
 };
 
-// Copy out codec parameter extradata. Used internally by ff_copyout_codecpar.
-var ff_copyout_codecpar_extradata = Module.ff_copyout_codecpar_extradata = function(codecpar) {
-    var extradata = AVCodecParameters_extradata(codecpar);
-    var extradata_size = AVCodecParameters_extradata_size(codecpar);
+/* Copy out codec parameter extradata. s is the codecpar's snapshot, if already
+ * taken. Used internally by ff_copyout_codecpar. */
+var ff_copyout_codecpar_extradata = Module.ff_copyout_codecpar_extradata = function(codecpar, s) {
+    s = s || AVCodecParameters_snapshot_js(codecpar);
+    var extradata = s.extradata;
+    var extradata_size = s.extradata_size;
     if (!extradata || !extradata_size) return null;
     return copyout_u8(extradata, extradata_size);
 };
@@ -243,7 +243,7 @@ var ff_init_filter_graph = Module.ff_init_filter_graph = function(filters_descr,
  *     inFrames: (Frame | number)[], config?: boolean | {
  *         fin?: boolean,
  *         ignoreSinkTimebase?: boolean,
- *         copyoutFrame?: "default" | "video" | "video_packed"
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
  *     }
  * ): @promise@Frame[]@;
  * ff_filter_multi@sync(
@@ -251,7 +251,7 @@ var ff_init_filter_graph = Module.ff_init_filter_graph = function(filters_descr,
  *     inFrames: (Frame | number)[][], config?: boolean[] | {
  *         fin?: boolean,
  *         ignoreSinkTimebase?: boolean,
- *         copyoutFrame?: "default" | "video" | "video_packed"
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
  *     }[]
  * ): @promise@Frame[]@
  * ff_filter_multi@sync(
@@ -391,7 +391,7 @@ var ff_filter_multi = Module.ff_filter_multi = function(srcs, buffersink_ctx, fr
  *     config?: boolean | {
  *         fin?: boolean,
  *         ignoreErrors?: boolean,
- *         copyoutFrame?: "default" | "video" | "video_packed"
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
  *     }
  * ): @promise@Frame[]@
  * ff_decode_filter_multi@sync(
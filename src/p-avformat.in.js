@@ -27,7 +27,7 @@ var readerCallbacks = {
     read: function(stream, buffer, offset, length, position) {
         var data = Module.readBuffers[stream.node.name];
 
-        if (!data || (data.buf.length === 0 && !data.eof)) {
+        if (!data || (data.length === 0 && !data.eof)) {
             if (Module.onread) {
                 try {
                     var rr = Module.onread(stream.node.name, position, length);
@@ -51,7 +51,7 @@ var readerCallbacks = {
         }
         if (data.errorCode)
             throw new FS.ErrnoError(data.errorCode);
-        if (data.buf.length === 0) {
+        if (data.length === 0) {
             if (data.eof) {
                 return 0;
             } else {
@@ -60,19 +60,32 @@ var readerCallbacks = {
             }
         }
 
-        var ret;
-        if (length < data.buf.length) {
-            // Cut a slice
-            ret = data.buf.subarray(0, length);
-            data.buf = data.buf.slice(length);
-        } else {
-            // Get the beginning
-            ret = data.buf;
-            data.buf = new Uint8Array(0);
+        /* Copy straight out of the queued chunks, dropping each one once it's
+         * used up, so nothing is ever concatenated */
+        var heap = new Uint8Array(buffer.buffer);
+        var ret = 0;
+        while (ret < length && data.chunks.length) {
+            var chunk = data.chunks[0];
+            var part = Math.min(chunk.length - data.head, length - ret);
+            heap.set(chunk.subarray(data.head, data.head + part), offset + ret);
+            ret += part;
+            data.head += part;
+            if (data.head >= chunk.length) {
+                data.chunks.shift();
+                data.head = 0;
+            }
+        }
+        data.length -= ret;
+
+        // Release producers waiting for the buffer to drain
+        if (data.drainWaiters.length && data.length < data.highWaterMark) {
+            var drainWaiters = data.drainWaiters;
+            data.drainWaiters = [];
+            for (var i = 0; i < drainWaiters.length; i++)
+                drainWaiters[i]();
         }
 
-        (new Uint8Array(buffer.buffer)).set(ret, offset);
-        return ret.length;
+        return ret;
     },
 
     write: function() {
@@ -302,12 +315,25 @@ fsBinding("createLazyFile");
  * @param name  Filename to create.
  * @param mode  Unix permissions (pointless since this is an in-memory
  *              filesystem)
+ * @param opts  Optional device options.
  */
-/// @types mkreaderdev@sync(name: string, mode?: number): @promise@void@
-Module.mkreaderdev = function(loc, mode) {
+/* @types
+ * mkreaderdev@sync(
+ *     name: string, mode?: number,
+ *     opts?: {
+ *         highWaterMark?: number // Buffered bytes past which ff_reader_dev_send waits to resolve (default: no limit)
+ *     }
+ * ): @promise@void@
+ */
+Module.mkreaderdev = function(loc, mode, opts) {
+    opts = opts || {};
     FS.mkdev(loc, mode?mode:0x1FF, readerDev);
     Module.readBuffers[loc] = {
-        buf: new Uint8Array(0),
+        chunks: [],
+        head: 0,
+        length: 0,
+        highWaterMark: opts.highWaterMark || Infinity,
+        drainWaiters: [],
         eof: false,
         errorCode: 0,
         error: null
@@ -356,6 +382,133 @@ var readaheads = {};
 // Original onblockread
 var preReadaheadOnBlockRead = null;
 
+/* Default readahead options. Reads are cached in aligned blocks of blockSize
+ * bytes, up to cacheSize bytes in all. Up to maxStreams interleaved sequential
+ * readers (e.g. the audio and video chunks of an MP4) are tracked, each reading
+ * ahead up to maxDepth blocks as it proves sequential, with at most maxInFlight
+ * blocks being read at once. */
+var readaheadDefaults = {
+    blockSize: 262144,
+    cacheSize: 16777216,
+    maxStreams: 4,
+    maxDepth: 8,
+    maxInFlight: 8
+};
+
+// Mark a block as used, and evict the least recently used blocks over budget
+function readaheadTouch(ra, block) {
+    block.lastUse = ++ra.clock;
+    while (ra.cached > ra.opts.cacheSize) {
+        var lru = null;
+        for (var k in ra.blocks) {
+            var b = ra.blocks[k];
+            if (b.buf && b !== block && (!lru || b.lastUse < lru.lastUse))
+                lru = b;
+        }
+        if (!lru)
+            break;
+        if (!lru.used)
+            ra.stats.bytesWasted += lru.buf.byteLength;
+        ra.cached -= lru.buf.byteLength;
+        delete ra.blocks[lru.index];
+    }
+}
+
+/* Read blocks [from, to) that aren't already cached or being read, merging
+ * runs of adjacent blocks into one read. Unless demand is set, this stops at
+ * the in-flight limit. A block's promise never rejects; a failed read sets
+ * its error instead. */
+function readaheadFetch(ra, from, to, demand) {
+    var bs = ra.opts.blockSize;
+    var last = Math.ceil(ra.file.size / bs);
+    if (to > last)
+        to = last;
+
+    var i = from;
+    while (i < to) {
+        if (ra.blocks[i]) {
+            i++;
+            continue;
+        }
+        if (!demand && ra.inFlight >= ra.opts.maxInFlight)
+            break;
+
+        var start = i;
+        var run = [];
+        while (i < to && !ra.blocks[i] &&
+               ((demand && i === start) || ra.inFlight < ra.opts.maxInFlight)) {
+            var block = ra.blocks[i] = {
+                index: i,
+                buf: null,
+                error: null,
+                promise: null,
+                used: false,
+                lastUse: ++ra.clock
+            };
+            run.push(block);
+            ra.inFlight++;
+            i++;
+        }
+
+        var promise = ra.file.slice(start * bs, i * bs).arrayBuffer();
+        ra.stats.reads++;
+        run.forEach(function(block, ri) {
+            block.promise = promise.then(function(buf) {
+                ra.inFlight--;
+                block.buf = (run.length === 1) ? buf :
+                    buf.slice(ri * bs, (ri + 1) * bs);
+                ra.stats.bytesRead += block.buf.byteLength;
+                if (ra.blocks[block.index] !== block)
+                    return;
+                ra.cached += block.buf.byteLength;
+                readaheadTouch(ra, block);
+            }, function(ex) {
+                ra.inFlight--;
+                block.error = ex;
+                if (ra.blocks[block.index] === block)
+                    delete ra.blocks[block.index];
+            });
+        });
+    }
+}
+
+/* Find (or start) the sequential reader that this read continues, and read
+ * ahead of it. A reader that keeps reading sequentially reads further ahead. */
+function readaheadPredict(ra, index) {
+    var streams = ra.streams;
+    var stream = null;
+    for (var i = 0; i < streams.length; i++) {
+        var s = streams[i];
+        if (index === s.next) {
+            stream = s;
+            s.depth = Math.min(s.depth * 2, ra.opts.maxDepth);
+            break;
+        } else if (index === s.next - 1) {
+            // Still in the same block
+            stream = s;
+            break;
+        }
+    }
+
+    if (!stream) {
+        stream = {next: 0, depth: 1, lastUse: 0};
+        if (streams.length < ra.opts.maxStreams) {
+            streams.push(stream);
+        } else {
+            var lru = 0;
+            for (var i = 1; i < streams.length; i++) {
+                if (streams[i].lastUse < streams[lru].lastUse)
+                    lru = i;
+            }
+            streams[lru] = stream;
+        }
+    }
+
+    stream.next = index + 1;
+    stream.lastUse = ++ra.clock;
+    readaheadFetch(ra, index + 1, index + 1 + stream.depth, false);
+}
+
 // Passthru for readahead.
 function readaheadOnBlockRead(name, position, length) {
     if (!(name in readaheads)) {
@@ -365,40 +518,40 @@ function readaheadOnBlockRead(name, position, length) {
     }
 
     var ra = readaheads[name];
+    var bs = ra.opts.blockSize;
+    var index = Math.floor(position / bs);
+    ra.demand = position;
+    ra.stats.requests++;
+
+    var block = ra.blocks[index];
+    if (block && block.buf)
+        ra.stats.hits++;
+    else if (block)
+        ra.stats.waits++;
+    else
+        readaheadFetch(ra, index, index + 1, true);
+    block = ra.blocks[index];
+    readaheadPredict(ra, index);
 
-    function then() {
-        if (ra.position !== position) {
-            ra.position = position;
-            ra.buf = null;
-            ra.bufPromise = ra.file.slice(position, position + length).arrayBuffer()
-                .then(function(ret) {
-                    ra.buf = ret;
-                }).catch(function(ex) {
-                    console.error(ex + "\n" + ex.stack);
-                    ra.buf = new Uint8Array(0);
-                }).then(then);
+    function send() {
+        if (ra.demand !== position || readaheads[name] !== ra)
             return;
-        }
-
-        ff_block_reader_dev_send(name, position, new Uint8Array(ra.buf));
-
-        // Attempt to predict the next read
-        position += length;
-        ra.position = position;
-        ra.buf = null;
-        ra.bufPromise = ra.file.slice(position, position + length).arrayBuffer()
-            .then(function(ret) {
-                ra.buf = ret;
-            }).catch(function(ex) {
-                console.error(ex + "\n" + ex.stack);
-                ra.buf = new Uint8Array(0);
-            });
+        block.used = true;
+        readaheadTouch(ra, block);
+        ra.stats.bytesServed += block.buf.byteLength;
+        ff_block_reader_dev_send(name, index * bs, new Uint8Array(block.buf));
     }
 
-    if (!ra.buf && ra.bufPromise)
-        ra.bufPromise.then(then);
-    else
-        then();
+    if (block.buf) {
+        send();
+        return;
+    }
+    block.promise.then(function() {
+        if (!block.error)
+            send();
+        else if (ra.demand === position && readaheads[name] === ra)
+            ff_block_reader_dev_send(name, position, null, {error: block.error});
+    });
 }
 
 /**
@@ -408,23 +561,73 @@ function readaheadOnBlockRead(name, position, length) {
  * onblockread before calling this.
  * @param name  Filename to create.
  * @param file  Blob or file to read.
+ * @param opts  Optional cache options.
  */
-/// @types mkreadaheadfile@sync(name: string, file: Blob): @promise@void@
-Module.mkreadaheadfile = function(name, file) {
+/* @types
+ * mkreadaheadfile@sync(
+ *     name: string, file: Blob,
+ *     opts?: {
+ *         blockSize?: number, // Size of each cached block (default 256KiB)
+ *         cacheSize?: number, // Bytes to cache in all (default 16MiB)
+ *         maxStreams?: number, // Interleaved sequential readers to track (default 4)
+ *         maxDepth?: number, // Blocks to read ahead of each reader (default 8)
+ *         maxInFlight?: number // Blocks to read at once (default 8)
+ *     }
+ * ): @promise@void@
+ */
+Module.mkreadaheadfile = function(name, file, opts) {
     if (Module.onblockread !== readaheadOnBlockRead) {
         preReadaheadOnBlockRead = Module.onblockread;
         Module.onblockread = readaheadOnBlockRead;
     }
 
+    var raOpts = {};
+    opts = opts || {};
+    for (var k in readaheadDefaults)
+        raOpts[k] = Math.max(opts[k] || readaheadDefaults[k], 1);
+    raOpts.cacheSize = Math.max(raOpts.cacheSize, raOpts.blockSize);
+
     mkblockreaderdev(name, file.size);
     readaheads[name] = {
         file: file,
-        position: -1,
-        bufPromise: null,
-        buf: null
+        opts: raOpts,
+        blocks: Object.create(null),
+        cached: 0,
+        inFlight: 0,
+        clock: 0,
+        streams: [],
+        demand: -1,
+        stats: {
+            requests: 0,
+            hits: 0,
+            waits: 0,
+            reads: 0,
+            bytesRead: 0,
+            bytesServed: 0,
+            bytesWasted: 0
+        }
     };
 };
 
+/**
+ * Get the cache counters of a readahead file. A read that finds its block
+ * already cached is a hit, and one that finds it already being read ahead is
+ * a wait. Bytes read ahead but evicted before any use are wasted.
+ * @param name  Readahead filename.
+ */
+/// @types readaheadfilestats@sync(name: string): @promise@ReadaheadStats@
+Module.readaheadfilestats = function(name) {
+    var ra = readaheads[name];
+    if (!ra)
+        throw new Error("No such readahead file " + name);
+    var ret = {};
+    for (var k in ra.stats)
+        ret[k] = ra.stats[k];
+    ret.hitRate = ra.stats.requests ? ra.stats.hits / ra.stats.requests : 0;
+    ret.cached = ra.cached;
+    return ret;
+};
+
 /**
  * Unlink a readahead file. Also gets rid of the File reference.
  * @param name  Filename to unlink.
@@ -435,6 +638,587 @@ Module.unlinkreadaheadfile = function(name) {
     delete readaheads[name];
 };
 
+// AVIO sources, by ID
+var avioSources = Object.create(null);
+var avioSourceNextId = 1;
+
+/**
+ * Make an AVIO source, to be opened with ff_init_demuxer_source. Unlike the
+ * device files, an AVIO source bypasses the filesystem entirely: reads are
+ * copied from it straight into libavformat's buffer. The source may be a Blob
+ * (or File), an ArrayBuffer or typed array, or (without a worker) an object
+ * with a size and a read(position, length) function returning a Uint8Array
+ * (or a promise of one). Returns the source's ID.
+ * @param source  Data to read.
+ */
+/* @types
+ * mkaviosource@sync(
+ *     source: Blob | ArrayBuffer | ArrayBufferView | {
+ *         size: number,
+ *         read: (position: number, length: number) => Uint8Array | Promise<Uint8Array>
+ *     }
+ * ): @promise@number@
+ */
+Module.mkaviosource = function(source) {
+    var src;
+    if (source instanceof ArrayBuffer) {
+        src = {u8: new Uint8Array(source)};
+    } else if (ArrayBuffer.isView(source)) {
+        src = {u8: new Uint8Array(source.buffer, source.byteOffset, source.byteLength)};
+    } else if (typeof source.read === "function") {
+        src = {reader: source};
+    } else {
+        src = {blob: source};
+    }
+    src.size = src.u8 ? src.u8.length : source.size;
+
+    var id = avioSourceNextId++;
+    avioSources[id] = src;
+    return id;
+};
+
+/**
+ * Forget an AVIO source. Any demuxer using it must already be closed.
+ * @param id  Source ID, from mkaviosource.
+ */
+/// @types unlinkaviosource@sync(id: number): @promise@void@
+Module.unlinkaviosource = function(id) {
+    delete avioSources[id];
+};
+
+/* Read callback for AVIO sources (see libavjs_avio_source_read). Returns the
+ * number of bytes read, or a promise of it if the source is asynchronous. */
+Module.avioSourceRead = function(id, buf, size, pos) {
+    var src = avioSources[id];
+    if (!src)
+        return -5 /* EIO */;
+
+    function copy(data) {
+        if (!data)
+            return 0;
+        if (data instanceof ArrayBuffer)
+            data = new Uint8Array(data);
+        if (data.length > size)
+            data = data.subarray(0, size);
+        // The heap may have grown while waiting, so get it fresh
+        Module.HEAPU8.set(data, buf);
+        return data.length;
+    }
+
+    function fail(ex) {
+        Module.fsThrownError = ex;
+        return -11 /* ECANCELED */;
+    }
+
+    try {
+        if (src.u8)
+            return copy(src.u8.subarray(pos, pos + size));
+        var data = src.blob ?
+            src.blob.slice(pos, pos + size).arrayBuffer() :
+            src.reader.read(pos, size);
+        if (data && data.then)
+            return data.then(copy).catch(fail);
+        return copy(data);
+    } catch (ex) {
+        return fail(ex);
+    }
+};
+
+// jsfetch block caches, by URL
+var jsfetchCaches = Object.create(null);
+var jsfetchClock = 0;
+
+/* Default jsfetch options. URLs whose server honors Range requests are read in
+ * aligned blocks of blockSize bytes, cached up to cacheSize bytes per URL, for
+ * up to maxUrls URLs. A sequential reader fetches up to prefetch blocks ahead,
+ * each with its own Range request, with at most maxInFlight requests per URL
+ * at once. */
+var jsfetchDefaults = {
+    blockSize: 1048576,
+    cacheSize: 67108864,
+    maxUrls: 8,
+    prefetch: 4,
+    maxInFlight: 6
+};
+
+// Get (or make) the cache for this URL, evicting unused URLs over the limit
+function jsfetchCache(url) {
+    var cache = jsfetchCaches[url];
+    if (!cache) {
+        var urls = Object.keys(jsfetchCaches);
+        while (urls.length >= jsfetchDefaults.maxUrls) {
+            var lru = null;
+            urls.forEach(function(u) {
+                var c = jsfetchCaches[u];
+                if (!c.open && !c.probe && (!lru || c.lastUse < lru.lastUse))
+                    lru = c;
+            });
+            if (!lru)
+                break;
+            delete jsfetchCaches[lru.url];
+            urls = Object.keys(jsfetchCaches);
+        }
+
+        cache = jsfetchCaches[url] = {
+            url: url,
+            // null until the first open tells us whether Range requests work
+            ranged: null,
+            probe: null,
+            size: 0,
+            blockSize: jsfetchDefaults.blockSize,
+            blocks: {},
+            cached: 0,
+            inFlight: 0,
+            open: 0,
+            lastUse: 0,
+            stats: {
+                reads: 0,
+                hits: 0,
+                waits: 0,
+                misses: 0,
+                requests: 0,
+                prefetches: 0,
+                bytesFetched: 0,
+                latencyTotal: 0,
+                latencyMax: 0
+            }
+        };
+    }
+    cache.lastUse = ++jsfetchClock;
+    return cache;
+}
+
+// Count a request's latency, from when it was sent
+function jsfetchLatency(cache, sent) {
+    var latency = performance.now() - sent;
+    cache.stats.latencyTotal += latency;
+    if (latency > cache.stats.latencyMax)
+        cache.stats.latencyMax = latency;
+}
+
+// Mark a block as used, and evict the least recently used blocks over budget
+function jsfetchTouch(cache, block) {
+    block.lastUse = ++jsfetchClock;
+    while (cache.cached > jsfetchDefaults.cacheSize) {
+        var lru = null;
+        for (var k in cache.blocks) {
+            var b = cache.blocks[k];
+            if (b.buf && b !== block && (!lru || b.lastUse < lru.lastUse))
+                lru = b;
+        }
+        if (!lru)
+            break;
+        cache.cached -= lru.buf.length;
+        delete cache.blocks[lru.index];
+    }
+}
+
+// Store a fetched block in the cache
+function jsfetchStore(cache, block, buf) {
+    block.buf = new Uint8Array(buf);
+    cache.stats.bytesFetched += block.buf.length;
+    if (cache.blocks[block.index] !== block)
+        return;
+    cache.cached += block.buf.length;
+    jsfetchTouch(cache, block);
+}
+
+/* Fetch a block with a Range request of its own. The block's promise never
+ * rejects; a failed request sets its error instead. */
+function jsfetchFetch(cache, index) {
+    var bs = cache.blockSize;
+    var start = index * bs;
+    var end = Math.min(start + bs, cache.size);
+    var block = cache.blocks[index] = {
+        index: index,
+        buf: null,
+        error: null,
+        promise: null,
+        lastUse: ++jsfetchClock
+    };
+
+    var sent = performance.now();
+    cache.inFlight++;
+    cache.stats.requests++;
+    block.promise = fetch(cache.url, {
+        headers: {Range: "bytes=" + start + "-" + (end - 1)}
+    }).then(function(response) {
+        if (response.status !== 206)
+            throw new Error("jsfetch: Range request for " + cache.url + " failed with status " + response.status);
+        return response.arrayBuffer();
+    }).then(function(buf) {
+        cache.inFlight--;
+        jsfetchLatency(cache, sent);
+        jsfetchStore(cache, block, buf);
+    }, function(ex) {
+        cache.inFlight--;
+        block.error = ex;
+        if (cache.blocks[index] === block)
+            delete cache.blocks[index];
+    });
+    return block;
+}
+
+/* Fetch ahead of a connection that just moved into block index. A reader that
+ * keeps reading sequentially fetches further ahead, up to the prefetch limit;
+ * one that jumps around (e.g. seeking for thumbnails) doesn't fetch ahead. */
+function jsfetchPrefetch(jsfo, index) {
+    if (index === jsfo.block)
+        return;
+    if (index === jsfo.block + 1)
+        jsfo.depth = Math.min(jsfo.depth ? jsfo.depth * 2 : 1, jsfetchDefaults.prefetch);
+    else
+        jsfo.depth = 0;
+    jsfo.block = index;
+
+    var cache = jsfo.cache;
+    var last = Math.ceil(cache.size / cache.blockSize);
+    for (var i = index + 1; i <= index + jsfo.depth && i < last; i++) {
+        if (cache.inFlight >= jsfetchDefaults.maxInFlight)
+            break;
+        if (!cache.blocks[i]) {
+            cache.stats.prefetches++;
+            jsfetchFetch(cache, i);
+        }
+    }
+}
+
+// Register a connection, returning its index
+function jsfetchConnection(cache, jsfo) {
+    if (!Module.libavjsJSFetch)
+        Module.libavjsJSFetch = {ctr: 1, fetches: {}};
+    var jsf = Module.libavjsJSFetch;
+    var idx = jsf.ctr++;
+    jsfo.cache = cache;
+    jsf.fetches[idx] = jsfo;
+    cache.open++;
+    return idx;
+}
+
+// Make a streaming connection from a response
+function jsfetchStreamConnection(cache, response, abortController, pos) {
+    if (!response.ok)
+        throw new Error("jsfetch: Fetching " + cache.url + " failed with status " + response.status);
+    if (pos > 0 && response.status !== 206)
+        throw new Error("jsfetch: " + cache.url + " does not support seeking");
+    var filesize = 0;
+    var range = /\/(\d+)$/.exec(response.headers.get("Content-Range") || "");
+    var length = response.headers.get("Content-Length");
+    if (range)
+        filesize = +range[1];
+    else if (length && pos === 0)
+        filesize = +length;
+    return jsfetchConnection(cache, {
+        reader: response.body.getReader(),
+        abortController: abortController,
+        buf: null,
+        filesize: filesize
+    });
+}
+
+// Open a streaming connection, for servers that don't honor Range requests
+function jsfetchOpenStream(cache, pos) {
+    var abortController = new AbortController();
+    var opts = {signal: abortController.signal};
+    if (pos > 0)
+        opts.headers = {Range: "bytes=" + pos + "-"};
+    var sent = performance.now();
+    cache.stats.requests++;
+    return fetch(cache.url, opts).then(function(response) {
+        jsfetchLatency(cache, sent);
+        return jsfetchStreamConnection(cache, response, abortController, pos);
+    });
+}
+
+// Read from a streaming connection
+function jsfetchStreamRead(jsfo, buf, size) {
+    function copy(chunk) {
+        var len = Math.min(size, chunk.length);
+        Module.HEAPU8.set(chunk.subarray(0, len), buf);
+        jsfo.buf = (chunk.length > len) ? chunk.subarray(len) : null;
+        return len;
+    }
+
+    if (jsfo.buf)
+        return copy(jsfo.buf);
+    return jsfo.reader.read().then(function(res) {
+        if (res.done)
+            return -0x20464f45 /* AVERROR_EOF */;
+        jsfo.cache.stats.bytesFetched += res.value.length;
+        if (!res.value.length)
+            return jsfetchStreamRead(jsfo, buf, size);
+        return copy(res.value);
+    });
+}
+
+function jsfetchFail(ex) {
+    Module.fsThrownError = ex;
+    return -11 /* ECANCELED */;
+}
+
+/* Open a jsfetch connection at pos (see jsfetch_open_js). The first open of a
+ * URL asks for just the block at pos; if the server honors that Range request,
+ * the URL is read through its block cache from then on, and later opens need
+ * no request at all. Otherwise, it's streamed, as a plain fetch. Returns the
+ * connection index, or a promise of it. */
+Module.jsfetchOpen = function(url, pos) {
+    if (url.slice(0, 8) === "jsfetch:")
+        url = url.slice(8);
+    var cache = jsfetchCache(url);
+
+    try {
+        if (cache.probe) {
+            return cache.probe.then(function() {
+                return Module.jsfetchOpen(url, pos);
+            });
+        }
+        if (cache.ranged)
+            return jsfetchConnection(cache, {pos: pos, block: -1, depth: 0});
+        if (cache.ranged === false)
+            return jsfetchOpenStream(cache, pos).catch(jsfetchFail);
+
+        var bs = cache.blockSize;
+        var index = Math.floor(pos / bs);
+        var abortController = new AbortController();
+        var sent = performance.now();
+        cache.stats.requests++;
+        var probe = fetch(url, {
+            headers: {Range: "bytes=" + (index * bs) + "-" + (index * bs + bs - 1)},
+            signal: abortController.signal
+        }).then(function(response) {
+            /* A failed request says nothing about Range support, so leave
+             * ranged unset and let the next open probe again */
+            if (!response.ok) {
+                abortController.abort();
+                throw new Error("jsfetch: Fetching " + url + " failed with status " + response.status);
+            }
+            var range = (response.status === 206) ?
+                /\/(\d+)$/.exec(response.headers.get("Content-Range") || "") :
+                null;
+            if (!range) {
+                cache.ranged = false;
+                if (response.status === 200 && pos === 0) {
+                    jsfetchLatency(cache, sent);
+                    return jsfetchStreamConnection(cache, response, abortController, 0);
+                }
+                abortController.abort();
+                return jsfetchOpenStream(cache, pos);
+            }
+
+            cache.size = +range[1];
+            return response.arrayBuffer().then(function(buf) {
+                jsfetchLatency(cache, sent);
+                cache.ranged = true;
+                var block = cache.blocks[index] = {
+                    index: index,
+                    buf: null,
+                    error: null,
+                    promise: null,
+                    lastUse: 0
+                };
+                jsfetchStore(cache, block, buf);
+                return jsfetchConnection(cache, {pos: pos, block: -1, depth: 0});
+            });
+        });
+        cache.probe = probe.then(function() {}, function() {});
+        return probe.then(function(idx) {
+            cache.probe = null;
+            return idx;
+        }, function(ex) {
+            cache.probe = null;
+            return jsfetchFail(ex);
+        });
+    } catch (ex) {
+        return jsfetchFail(ex);
+    }
+};
+
+/* Size of the file behind a jsfetch connection, or 0 if unknown (see
+ * jsfetch_get_filesize_js). */
+Module.jsfetchSize = function(idx) {
+    var jsfo = Module.libavjsJSFetch.fetches[idx];
+    if (!jsfo)
+        return 0;
+    return jsfo.reader ? jsfo.filesize : jsfo.cache.size;
+};
+
+/* Read from a jsfetch connection (see jsfetch_read_js). Returns the number of
+ * bytes read, or a promise of it if the block isn't cached yet. */
+Module.jsfetchRead = function(idx, buf, size) {
+    var jsfo = Module.libavjsJSFetch.fetches[idx];
+    if (!jsfo)
+        return -5 /* EIO */;
+
+    if (jsfo.reader) {
+        var ret = jsfetchStreamRead(jsfo, buf, size);
+        return (typeof ret === "number") ? ret : ret.catch(jsfetchFail);
+    }
+
+    var cache = jsfo.cache;
+    if (jsfo.pos >= cache.size)
+        return -0x20464f45 /* AVERROR_EOF */;
+    var bs = cache.blockSize;
+    var index = Math.floor(jsfo.pos / bs);
+    var block = cache.blocks[index];
+    cache.stats.reads++;
+    if (block && block.buf) {
+        cache.stats.hits++;
+    } else if (block) {
+        cache.stats.waits++;
+    } else {
+        cache.stats.misses++;
+        block = jsfetchFetch(cache, index);
+    }
+    jsfetchPrefetch(jsfo, index);
+
+    function copy() {
+        if (block.error)
+            return jsfetchFail(block.error);
+        var off = jsfo.pos - index * bs;
+        var len = Math.min(size, block.buf.length - off);
+        if (len <= 0)
+            return -0x20464f45 /* AVERROR_EOF */;
+        // The heap may have grown while waiting, so get it fresh
+        Module.HEAPU8.set(block.buf.subarray(off, off + len), buf);
+        jsfo.pos += len;
+        jsfetchTouch(cache, block);
+        return len;
+    }
+
+    if (block.buf)
+        return copy();
+    return block.promise.then(copy);
+};
+
+/* Seek a jsfetch connection (see jsfetch_seek_js). A cached connection just
+ * moves; a streaming one is replaced by a new fetch from pos, if the server
+ * allows it. Returns the connection index, or a promise of it. */
+Module.jsfetchSeek = function(idx, pos) {
+    var jsfo = Module.libavjsJSFetch.fetches[idx];
+    if (!jsfo)
+        return -5 /* EIO */;
+    if (!jsfo.reader) {
+        jsfo.pos = pos;
+        return idx;
+    }
+
+    return jsfetchOpenStream(jsfo.cache, pos).then(function(newIdx) {
+        Module.jsfetchClose(idx);
+        return newIdx;
+    }).catch(jsfetchFail);
+};
+
+/* Close a jsfetch connection (see jsfetch_close_js). The URL's cached blocks
+ * are kept for the next open. */
+Module.jsfetchClose = function(idx) {
+    var jsf = Module.libavjsJSFetch;
+    var jsfo = jsf ? jsf.fetches[idx] : null;
+    if (!jsfo)
+        return;
+    if (jsfo.reader) {
+        try {
+            jsfo.reader.cancel();
+            jsfo.abortController.abort();
+        } catch (ex) {}
+    }
+    jsfo.cache.open--;
+    delete jsf.fetches[idx];
+};
+
+/**
+ * Set jsfetch options (see JSFetchOptions). The block size only applies to
+ * URLs that aren't cached yet. Returns the options now in effect.
+ * @param opts  Options to change.
+ */
+/// @types jsfetchconfig@sync(opts?: JSFetchOptions): @promise@JSFetchOptions@
+Module.jsfetchconfig = function(opts) {
+    opts = opts || {};
+    var ret = {};
+    for (var k in jsfetchDefaults) {
+        if (typeof opts[k] === "number" && opts[k] > 0)
+            jsfetchDefaults[k] = opts[k];
+        ret[k] = jsfetchDefaults[k];
+    }
+    return ret;
+};
+
+/**
+ * Get the request and cache counters of jsfetch, for one URL or summed over
+ * all cached URLs. A read that finds its block cached is a hit, one that finds
+ * it already being fetched is a wait, and one that must fetch it is a miss.
+ * @param url  URL to get counters of, with or without the "jsfetch:" prefix.
+ */
+/// @types jsfetchstats@sync(url?: string): @promise@JSFetchStats@
+Module.jsfetchstats = function(url) {
+    var caches;
+    if (url) {
+        if (url.slice(0, 8) === "jsfetch:")
+            url = url.slice(8);
+        caches = jsfetchCaches[url] ? [jsfetchCaches[url]] : [];
+    } else {
+        caches = Object.keys(jsfetchCaches).map(function(u) {
+            return jsfetchCaches[u];
+        });
+    }
+
+    var ret = {
+        reads: 0,
+        hits: 0,
+        waits: 0,
+        misses: 0,
+        requests: 0,
+        prefetches: 0,
+        bytesFetched: 0,
+        averageLatency: 0,
+        maxLatency: 0,
+        cached: 0
+    };
+    var latencyTotal = 0;
+    caches.forEach(function(cache) {
+        var s = cache.stats;
+        ret.reads += s.reads;
+        ret.hits += s.hits;
+        ret.waits += s.waits;
+        ret.misses += s.misses;
+        ret.requests += s.requests;
+        ret.prefetches += s.prefetches;
+        ret.bytesFetched += s.bytesFetched;
+        ret.maxLatency = Math.max(ret.maxLatency, s.latencyMax);
+        ret.cached += cache.cached;
+        latencyTotal += s.latencyTotal;
+    });
+    if (ret.requests)
+        ret.averageLatency = latencyTotal / ret.requests;
+    return ret;
+};
+
+/**
+ * Drop the jsfetch cache of one URL, or of all URLs. URLs with no open
+ * connection are forgotten entirely, counters included; the others only lose
+ * their cached blocks.
+ * @param url  URL to drop, with or without the "jsfetch:" prefix.
+ */
+/// @types jsfetchclearcache@sync(url?: string): @promise@void@
+Module.jsfetchclearcache = function(url) {
+    var urls = Object.keys(jsfetchCaches);
+    if (url)
+        urls = [(url.slice(0, 8) === "jsfetch:") ? url.slice(8) : url];
+    urls.forEach(function(u) {
+        var cache = jsfetchCaches[u];
+        if (!cache)
+            return;
+        if (!cache.open && !cache.probe) {
+            delete jsfetchCaches[u];
+            return;
+        }
+        for (var k in cache.blocks) {
+            if (cache.blocks[k].buf)
+                delete cache.blocks[k];
+        }
+        cache.cached = 0;
+    });
+};
+
 /**
  * Make a writer device.
  * @param name  Filename to create
@@ -592,17 +1376,54 @@ Module.unlinkfsfhfile = function(name) {
 var __fsdhMounts = Object.create(null);
 var __fsdhOpen = Object.create(null);
 
+// Mounts by root ("/" + name), to resolve paths without scanning every mount
+var __fsdhRoots = Object.create(null);
+
+// Users waiting for write-behind buffers to drain
+Module.ff_writer_dev_waiters = Object.create(null);
+
+/* Default write-behind options. Contiguous or overlapping writes to a file are
+ * merged into blocks of up to blockSize bytes before they're written out, and
+ * at most maxMemory bytes per mount are held before the muxer has to wait. */
+var fsdhDefaults = {
+    blockSize: 1048576,
+    maxMemory: 16777216
+};
+
 /**
  * 
  * @param {*} mountPoint 
  * @param {*} dirHandle 
+ * @param {*} opts { blockSize?: number, maxMemory?: number }
+ */
+/* @types
+ * mkfsdhdir@sync(
+ *     mountPoint: string, dirHandle: FileSystemDirectoryHandle,
+ *     opts?: {
+ *         blockSize?: number, // Merge writes into blocks of up to this many bytes (default 1MiB)
+ *         maxMemory?: number // Buffered bytes past which writes wait for the disk (default 16MiB)
+ *     }
+ * ): @promise@void@
  */
-/// @types mkfsdhdir@sync(mountPoint: string, dirHandle: FileSystemDirectoryHandle): @promise@void@
-Module.mkfsdhdir = async function(name, dirHandle) {
+Module.mkfsdhdir = async function(name, dirHandle, opts) {
+    opts = opts || {};
     const root = ("/" + name);
-    __fsdhMounts[name] = {
+    const blockSize = opts.blockSize || fsdhDefaults.blockSize;
+    __fsdhMounts[name] = __fsdhRoots[root] = {
       root,
       dirHandle,
+      blockSize,
+      maxMemory: Math.max(opts.maxMemory || fsdhDefaults.maxMemory, blockSize),
+      buffered: 0,
+      stats: {
+        writes: 0,
+        bytesWritten: 0,
+        merged: 0,
+        flushes: 0,
+        bytesFlushed: 0,
+        stalls: 0,
+        peakBuffered: 0
+      }
     };
   
     await fsdhEnsureDir(dirHandle, "", true);
@@ -638,8 +1459,55 @@ Module.unlinkfsdhdir = async function(name, opts) {
     FS.unmount(m.root);
     FS.rmdir(m.root);
     delete __fsdhMounts[name];
+    delete __fsdhRoots[m.root];
   };
 
+/**
+ * Write out everything buffered for the files open in an fsdh mount, without
+ * closing them.
+ * @param name  Mount name, as given to mkfsdhdir.
+ */
+/// @types syncfsdhdir(name: string): Promise<void>
+Module.syncfsdhdir = async function(name) {
+    const m = __fsdhMounts[name];
+    if (!m) throw new Error(`mount "${name}" not found`);
+
+    const paths = Object.keys(__fsdhOpen).filter(path => path.startsWith(m.root + "/"));
+    for (const path of paths) {
+      const fileState = __fsdhOpen[path];
+      if (fileState.closing) {
+        // Closing writes everything out anyway
+        await fileState.closing;
+        continue;
+      }
+      fsdhFlushBlock(fileState);
+      await fileState.init;
+      flushQueue(fileState);
+      if (fileState.handle) await fileState.last;
+      if (fileState.syncHandle) fileState.syncHandle.flush();
+    }
+};
+
+/**
+ * Get the write-behind counters of an fsdh mount: writes from libav and the
+ * bytes in them, how many of those were merged into an earlier write's block,
+ * the writes (flushes) actually made and their bytes, how many times the
+ * muxer had to wait for the memory cap, and the most bytes ever buffered.
+ * @param name  Mount name, as given to mkfsdhdir.
+ */
+/* @types
+ * fsdhstats(name: string): Promise<{
+ *     writes: number, bytesWritten: number, merged: number,
+ *     flushes: number, bytesFlushed: number, stalls: number,
+ *     peakBuffered: number, buffered: number
+ * }>
+ */
+Module.fsdhstats = async function(name) {
+    const m = __fsdhMounts[name];
+    if (!m) throw new Error(`mount "${name}" not found`);
+    return Object.assign({ buffered: m.buffered }, m.stats);
+};
+
 /**
  * 
  * @param name  Filename to get blobs from.
@@ -679,29 +1547,44 @@ Module.getfsdhblobs = async function(name) {
     return results;
   };
 
-async function fsdhOnWrite(_, path, position, buf) {
+// The mount a path is in, if any, by looking up each of its parents
+function fsdhMountOf(path) {
+    for (let i = path.indexOf("/", 1); i > 0; i = path.indexOf("/", i + 1)) {
+        const m = __fsdhRoots[path.slice(0, i)];
+        if (m) return m;
+    }
+    return null;
+}
+
+function fsdhOnWrite(_, path, position, buf) {
     return fsdhWrite(path, position, buf);
   }
   
-async function fsdhWrite(path, position, u8) {
-    let mount = null;
-    for (const k in __fsdhMounts) {
-        const m = __fsdhMounts[k];
-        if (path.startsWith(m.root + "/")) { mount = m; break; }
-    }
+function fsdhWrite(path, position, u8) {
+    const mount = fsdhMountOf(path);
     if (!mount) return; 
 
     let fileState = __fsdhOpen[path];
-    if (!fileState) {
+    if (!fileState || fileState.closing) {
+        // A file reopened while it's being closed gets a new state
+        const prev = fileState;
         fileState = __fsdhOpen[path] = {
+          path,
+          mount,
           init: null,
+          closing: null,
           ready: false,
           syncHandle: null,
           handle: null,
           last: Promise.resolve(),
+          block: null,
           q: []
         };
         fileState.init = (async () => {
+          // Don't open a second writable on the file until the first is closed
+          if (prev) {
+            try { await prev.closing; } catch {}
+          }
           const fh = await fsdhGetFileHandle(mount.root, mount.dirHandle, path);
           try {
             fileState.syncHandle = await fh.createSyncAccessHandle();
@@ -712,52 +1595,156 @@ async function fsdhWrite(path, position, u8) {
           fileState.ready = true;
         })().catch(e => {
           console.error("open failed", path, e);
-        }).then(() => flushQueue(path));
+          fileState.ready = true;
+        }).then(() => flushQueue(fileState));
     }
-    
-    fileState.q.push({ pos: position, u8: u8.slice(0) });
-    if (fileState.ready) flushQueue(path);
-}
 
-function flushQueue(path) {
-    const fileState = __fsdhOpen[path];
-    if (!fileState || !fileState.ready || fileState.flushing) return;
-    fileState.flushing = true;
+    /* Over the memory cap, start writing out everything buffered. If that
+     * can't free enough right away, make the muxer wait for it (see
+     * libavjs_wait_writer); the write is retried when the buffers drain. */
+    if (mount.buffered + u8.length > mount.maxMemory) {
+        fsdhFlushMount(mount);
+        if (mount.buffered && mount.buffered + u8.length > mount.maxMemory &&
+            !Module.PThread) {
+          mount.stats.stalls++;
+          throw new FS.ErrnoError(ERRNO_CODES.EAGAIN);
+        }
+    }
 
-    if (fileState.syncHandle) {
-      for (let i = 0; i < fileState.q.length; i++) {
-        const { pos, u8 } = fileState.q[i];
-        fileState.syncHandle.write(u8, { at: pos });
+    mount.stats.writes++;
+    mount.stats.bytesWritten += u8.length;
+    fsdhBuffer(fileState, position, u8);
+    if (mount.buffered > mount.stats.peakBuffered)
+      mount.stats.peakBuffered = mount.buffered;
+    if (fileState.ready) flushQueue(fileState);
+}
+
+/* Add a write to a file's current block if it starts within or right after
+ * it and still fits, or else queue the block and start a new one */
+function fsdhBuffer(fileState, position, u8) {
+    const mount = fileState.mount;
+    const blockSize = mount.blockSize;
+    let block = fileState.block;
+
+    if (block) {
+      const off = position - block.pos;
+      if (off >= 0 && off <= block.len && off + u8.length <= blockSize) {
+        const end = off + u8.length;
+        if (end > block.buf.length) {
+          const buf = new Uint8Array(Math.min(Math.max(block.buf.length * 2, end), blockSize));
+          buf.set(block.buf.subarray(0, block.len));
+          block.buf = buf;
+        }
+        block.buf.set(u8, off);
+        if (end > block.len) {
+          mount.buffered += end - block.len;
+          block.len = end;
+        }
+        mount.stats.merged++;
+        return;
       }
-      fileState.q.length = 0;
-      fileState.flushing = false;
-      return;
+      fsdhFlushBlock(fileState);
     }
-  
-    while (fileState.q.length) {
-      const { pos, u8 } = fileState.q.shift();
-      fileState.last = fileState.last.then(() =>
-        fileState.handle.write({ type: "write", position: pos, data: u8 })
-      );
+
+    if (u8.length >= blockSize) {
+      // Too big to merge with anything
+      fileState.q.push({ pos: position, u8: u8.slice(0) });
+      mount.buffered += u8.length;
+      return;
     }
+
+    block = fileState.block = {
+      pos: position,
+      len: u8.length,
+      buf: new Uint8Array(Math.min(Math.max(65536, u8.length), blockSize))
+    };
+    block.buf.set(u8);
+    mount.buffered += u8.length;
 }
 
-async function fsdhClose(path, removeEntry) {
-    let mount = null;
-    for (const k in __fsdhMounts) {
-      const m = __fsdhMounts[k];
-      if (path.startsWith(m.root + "/")) { 
-        mount = m; 
-        break; 
-      }
+// Move a file's current block to its write queue
+function fsdhFlushBlock(fileState) {
+    const block = fileState.block;
+    if (!block) return;
+    fileState.q.push({ pos: block.pos, u8: block.buf.subarray(0, block.len) });
+    fileState.block = null;
+}
+
+// Queue and start writing every open file's current block in a mount
+function fsdhFlushMount(mount) {
+    for (const path in __fsdhOpen) {
+      const fileState = __fsdhOpen[path];
+      if (fileState.mount !== mount) continue;
+      fsdhFlushBlock(fileState);
+      flushQueue(fileState);
     }
+}
+
+// Account for a finished write, and wake the muxer if it was waiting on it
+function fsdhWritten(mount, length) {
+    mount.stats.flushes++;
+    mount.stats.bytesFlushed += length;
+    fsdhRelease(mount, length);
+}
+
+function fsdhRelease(mount, length) {
+    mount.buffered -= length;
+    if (mount.buffered + mount.blockSize > mount.maxMemory) return;
+
+    const waiters = Module.ff_writer_dev_waiters;
+    Module.ff_writer_dev_waiters = Object.create(null);
+    for (const name in waiters) {
+      for (const res of waiters[name]) res();
+    }
+}
+
+function flushQueue(fileState) {
+    if (!fileState.ready || fileState.flushing) return;
+    fileState.flushing = true;
+    const mount = fileState.mount;
+
+    if (!fileState.syncHandle && !fileState.handle) {
+      // Failed to open, so drop the data rather than hold it forever
+      for (const { u8 } of fileState.q) fsdhRelease(mount, u8.length);
+      fileState.q.length = 0;
+      fileState.flushing = false;
+      return;
+    }
+
+    if (fileState.syncHandle) {
+      for (let i = 0; i < fileState.q.length; i++) {
+        const { pos, u8 } = fileState.q[i];
+        fileState.syncHandle.write(u8, { at: pos });
+        fsdhWritten(mount, u8.length);
+      }
+      fileState.q.length = 0;
+      fileState.flushing = false;
+      return;
+    }
+  
+    while (fileState.q.length) {
+      const { pos, u8 } = fileState.q.shift();
+      fileState.last = fileState.last.then(() =>
+        fileState.handle.write({ type: "write", position: pos, data: u8 })
+      ).catch(e => {
+        console.error("write failed", fileState.path, e);
+      }).then(() => fsdhWritten(mount, u8.length));
+    }
+    fileState.flushing = false;
+}
+
+/* Close a file, writing out everything buffered for it. The muxer may reopen
+ * the file before this finishes, so only its own state is removed. */
+async function fsdhClose(path, removeEntry) {
+    const mount = fsdhMountOf(path);
     const fileState = __fsdhOpen[path];
     if (fileState) {
-        await fileState.init;
-        flushQueue(path);
-        if (fileState.handle) { await fileState.last; await fileState.handle.close(); }
-        if (fileState.syncHandle) { fileState.syncHandle.close(); }
-      delete __fsdhOpen[path];
+        if (!fileState.closing) fileState.closing = fsdhCloseFile(fileState);
+        try {
+          await fileState.closing;
+        } finally {
+          if (__fsdhOpen[path] === fileState) delete __fsdhOpen[path];
+        }
     }
   
     if (removeEntry && mount) {
@@ -766,6 +1753,14 @@ async function fsdhClose(path, removeEntry) {
     }
 }
   
+async function fsdhCloseFile(fileState) {
+    fsdhFlushBlock(fileState);
+    await fileState.init;
+    flushQueue(fileState);
+    if (fileState.handle) { await fileState.last; await fileState.handle.close(); }
+    if (fileState.syncHandle) { fileState.syncHandle.close(); }
+}
+
 async function fsdhEnsureDir(rootDirHandle, relativePath, create) {
     let currentDir = rootDirHandle;
     if (!relativePath) return currentDir;
@@ -813,7 +1808,10 @@ async function fsdhRemoveTree(dirHandle, relativePath) {
 
 /**
  * Send some data to a reader device. To indicate EOF, send null. To indicate an
- * error, send EOF and include an error code in the options.
+ * error, send EOF and include an error code in the options. The data is copied
+ * as it's queued, so the caller may reuse its buffer right away. The returned
+ * promise resolves once the device has less than its high-water mark (see
+ * mkreaderdev) buffered, so producers can await it to apply backpressure.
  * @param name  Filename of the reader device.
  * @param data  Data to send.
  * @param opts  Optional send options, such as an error code.
@@ -835,11 +1833,11 @@ var ff_reader_dev_send = Module.ff_reader_dev_send = function(name, data, opts)
         // EOF or error
         idata.eof = true;
 
-    } else {
-        var newbuf = new Uint8Array(idata.buf.length + data.length);
-        newbuf.set(idata.buf);
-        newbuf.set(data, idata.buf.length);
-        idata.buf = newbuf;
+    } else if (data.length) {
+        /* Copy each chunk once, so the caller may reuse its buffer; the reads
+         * take from the chunk list, so nothing is copied again */
+        idata.chunks.push(data.slice(0));
+        idata.length += data.length;
 
     }
 
@@ -857,6 +1855,21 @@ var ff_reader_dev_send = Module.ff_reader_dev_send = function(name, data, opts)
     delete Module.ff_reader_dev_waiters[name];
     for (var i = 0; i < waiters.length; i++)
         waiters[i]();
+
+    /* Nothing more will be read after EOF or an error, so only wait for the
+     * buffer to drain while it's still being read */
+    if (idata.eof || idata.error || idata.errorCode) {
+        var drainWaiters = idata.drainWaiters;
+        idata.drainWaiters = [];
+        for (var i = 0; i < drainWaiters.length; i++)
+            drainWaiters[i]();
+        return;
+    }
+    if (idata.length < idata.highWaterMark)
+        return;
+    return new Promise(function(res) {
+        idata.drainWaiters.push(res);
+    });
 };
 
 /**
@@ -1008,26 +2021,74 @@ var ff_init_muxer = Module.ff_init_muxer = function(opts, streamCtxs) {
  * @param oc  AVFormatContext
  * @param pb  AVIOContext
  */
-/// @types ff_free_muxer@sync(oc: number, pb: number): @promise@void@
-var ff_free_muxer = Module.ff_free_muxer = function(oc, pb) {
+/// @types ff_free_muxer@sync(oc: number, pb: number): @promsync@void@
+function ff_free_muxer(oc, pb) {
     avformat_free_context(oc);
-    if (pb)
-        avio_close(pb);
+    // Closing flushes, which may have to wait for the writer (see mkfsdhdir)
+    return Promise.all([pb ? avio_close(pb) : 0]).then(function() {});
+}
+Module.ff_free_muxer = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_free_muxer.apply(void 0, args);
+    });
 };
 
+// Describe the streams of an opened demuxer, for ff_init_demuxer_*
+function ff_demuxer_streams(fmt_ctx) {
+    var nb_streams = AVFormatContext_nb_streams(fmt_ctx);
+    var streams = [];
+    for (var i = 0; i < nb_streams; i++) {
+        var inStream = AVFormatContext_streams_a(fmt_ctx, i);
+        var outStream = {
+            ptr: inStream,
+            index: i
+        };
+
+        // Codec info
+        var codecpar = AVStream_codecpar(inStream);
+        outStream.codecpar = codecpar;
+        outStream.codec_type = AVCodecParameters_codec_type(codecpar);
+        outStream.codec_id = AVCodecParameters_codec_id(codecpar);
+
+        // Duration and related
+        outStream.start_time = AVStream_start_time(inStream);
+        outStream.start_timehi = AVStream_start_timehi(inStream);
+        outStream.time_base_num = AVStream_time_base_num(inStream);
+        outStream.time_base_den = AVStream_time_base_den(inStream);
+
+        const durationlo = AVStream_duration(inStream) >>> 0;
+        const durationhi = AVStream_durationhi(inStream);
+        outStream.duration_time_base = durationlo + (durationhi*0x100000000);
+        outStream.duration = outStream.duration_time_base * outStream.time_base_num / outStream.time_base_den;
+        outStream.rotation = avformat_get_rotation(inStream);
+
+        streams.push(outStream);
+    }
+    return streams;
+}
+
 /**
  * Initialize a demuxer from a file and format context, and get the list of
- * codecs/types.
+ * codecs/types. The AVFormatContext can be passed to the *_ctx versions of the
+ * file helpers (ff_transcode_audio_ctx, convert_to_hls_ctx, etc.), so that
+ * several jobs on the same file share one demuxer. To reopen a file without
+ * probing it again, take a snapshot of the first demuxer with
+ * ff_stream_info_snapshot, and pass it as streamInfo.
  * Returns [AVFormatContext, Stream[]]
  * @param filename  Filename to open
  * @param fmt  Format to use (optional)
+ * @param opts  Options
  */
 /* @types
  * ff_init_demuxer_file@sync(
- *     filename: string, fmt?: string
+ *     filename: string, fmt?: string, opts?: {
+ *         streamInfo?: number // Stream info snapshot of the same file, from ff_stream_info_snapshot, to restore rather than probe
+ *     }
  * ): @promsync@[number, Stream[]]@
  */
-function ff_init_demuxer_file(filename, fmt) {
+function ff_init_demuxer_file(filename, fmt, opts) {
+    opts = opts || {};
     var fmt_ctx;
 
     return avformat_open_input_js(filename, fmt?fmt:null, null).then(function(ret) {
@@ -1035,39 +2096,12 @@ function ff_init_demuxer_file(filename, fmt) {
         if (fmt_ctx === 0)
             throw new Error("Could not open source file");
 
+        if (opts.streamInfo)
+            return ff_stream_info_restore(fmt_ctx, opts.streamInfo);
         return avformat_find_stream_info(fmt_ctx, 0);
 
     }).then(function() {
-        var nb_streams = AVFormatContext_nb_streams(fmt_ctx);
-        var streams = [];
-        for (var i = 0; i < nb_streams; i++) {
-            var inStream = AVFormatContext_streams_a(fmt_ctx, i);
-            var outStream = {
-                ptr: inStream,
-                index: i
-            };
-
-            // Codec info
-            var codecpar = AVStream_codecpar(inStream);
-            outStream.codecpar = codecpar;
-            outStream.codec_type = AVCodecParameters_codec_type(codecpar);
-            outStream.codec_id = AVCodecParameters_codec_id(codecpar);
-
-            // Duration and related
-            outStream.start_time = AVStream_start_time(inStream);
-            outStream.start_timehi = AVStream_start_timehi(inStream);
-            outStream.time_base_num = AVStream_time_base_num(inStream);
-            outStream.time_base_den = AVStream_time_base_den(inStream);
-
-            const durationlo = AVStream_duration(inStream) >>> 0;
-            const durationhi = AVStream_durationhi(inStream);
-            outStream.duration_time_base = durationlo + (durationhi*0x100000000);
-            outStream.duration = outStream.duration_time_base * outStream.time_base_num / outStream.time_base_den;
-            outStream.rotation = avformat_get_rotation(inStream);
-
-            streams.push(outStream);
-        }
-        return [fmt_ctx, streams];
+        return [fmt_ctx, ff_demuxer_streams(fmt_ctx)];
 
     });
 }
@@ -1078,6 +2112,69 @@ Module.ff_init_demuxer_file = function() {
     });
 };
 
+/**
+ * Initialize a demuxer reading straight from an AVIO source (see
+ * mkaviosource), without going through the filesystem, and get the list of
+ * codecs/types. Close it with ff_close_demuxer_source.
+ * Returns [AVFormatContext, Stream[]]
+ * @param source  AVIO source ID
+ * @param opts  Options
+ */
+/* @types
+ * ff_init_demuxer_source@sync(
+ *     source: number, opts?: {
+ *         fmt?: string, // Input format name (default: probe)
+ *         bufferSize?: number // Size of each read from the source (default 256KiB)
+ *     }
+ * ): @promsync@[number, Stream[]]@
+ */
+function ff_init_demuxer_source(source, opts) {
+    opts = opts || {};
+    var src = avioSources[source];
+    if (!src)
+        throw new Error("No such AVIO source " + source);
+    var fmt = 0;
+    if (opts.fmt) {
+        fmt = av_find_input_format(opts.fmt);
+        if (!fmt)
+            throw new Error("Unknown input format " + opts.fmt);
+    }
+    var fmt_ctx;
+
+    return ff_avio_source_open(source, src.size, opts.bufferSize || 0, fmt).then(function(ret) {
+        fmt_ctx = ret;
+        if (fmt_ctx === 0) {
+            if (Module.fsThrownError) {
+                var ex = Module.fsThrownError;
+                Module.fsThrownError = null;
+                throw ex;
+            }
+            throw new Error("Could not open source");
+        }
+
+        return avformat_find_stream_info(fmt_ctx, 0);
+
+    }).then(function() {
+        return [fmt_ctx, ff_demuxer_streams(fmt_ctx)];
+
+    });
+}
+Module.ff_init_demuxer_source = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_init_demuxer_source.apply(void 0, args);
+    });
+};
+
+/**
+ * Close a demuxer opened with ff_init_demuxer_source.
+ * @param fmt_ctx  AVFormatContext
+ */
+/// @types ff_close_demuxer_source@sync(fmt_ctx: number): @promise@void@
+var ff_close_demuxer_source = Module.ff_close_demuxer_source = function(fmt_ctx) {
+    ff_avio_source_close(fmt_ctx);
+};
+
 /**
  * Write some number of packets at once.
  * @param oc  AVFormatContext
@@ -1089,14 +2186,22 @@ Module.ff_init_demuxer_file = function() {
 /* @types
  * ff_write_multi@sync(
  *     oc: number, pkt: number, inPackets: (Packet | number)[], interleave?: boolean
- * ): @promise@void@
+ * ): @promsync@void@
  */
-var ff_write_multi = Module.ff_write_multi = function(oc, pkt, inPackets, interleave) {
-    var step = av_interleaved_write_frame;
-    if (interleave === false) step = av_write_frame;
+function ff_write_multi(oc, pkt, inPackets, interleave) {
+    var write = av_interleaved_write_frame;
+    if (interleave === false) write = av_write_frame;
     var tbs = {};
+    var i = 0;
+
+    // Writing may have to wait for the writer (see mkfsdhdir), so go one at a time
+    function step() {
+        if (i >= inPackets.length) {
+            av_packet_unref(pkt);
+            return;
+        }
+        var inPacket = inPackets[i++];
 
-    inPackets.forEach(function(inPacket) {
         var ret = av_packet_make_writable(pkt);
         if (ret < 0)
             throw new Error("Error making packet writable: " + ff_error(ret));
@@ -1130,10 +2235,19 @@ var ff_write_multi = Module.ff_write_multi = function(oc, pkt, inPackets, interl
             }
         }
 
-        step(oc, pkt);
-        av_packet_unref(pkt);
+        return write(oc, pkt).then(function() {
+            av_packet_unref(pkt);
+            return step();
+        });
+    }
+
+    return Promise.all([]).then(step);
+}
+Module.ff_write_multi = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_write_multi.apply(void 0, args);
     });
-    av_packet_unref(pkt);
 };
 
 /**
@@ -1166,6 +2280,14 @@ var ff_write_multi = Module.ff_write_multi = function(oc, pkt, inPackets, interl
  *         copyoutPacket: "ptr" // Version of ff_copyout_packet to use
  *     }
  * ): @promsync@[number, Record<number, number[]>]@
+ * ff_read_frame_multi@sync(
+ *     fmt_ctx: number, pkt: number, opts: {
+ *         index?: number, // INPUT stream index
+ *         limit?: number, // OUTPUT limit, in bytes
+ *         maxPackets?: number, // OUTPUT limit, in number of packets (default: 1000). Set to 0 or Infinity to disable.
+ *         copyoutPacket: "batch" // Read in C, and copy out all packets as one PacketBatch
+ *     }
+ * ): @promsync@[number, PacketBatch]@
  */
 function ff_read_frame_multi(fmt_ctx, pkt, opts) {
     var sz = 0;
@@ -1179,6 +2301,28 @@ function ff_read_frame_multi(fmt_ctx, pkt, opts) {
         opts = {};
     var unify = !!opts.unify;
     var maxPackets = opts.maxPackets !== undefined ? opts.maxPackets : 1000;
+
+    if (opts.copyoutPacket === "batch") {
+        // The whole read loop happens in C
+        return ff_read_frame_batch(
+            fmt_ctx, pkt,
+            (opts.index !== undefined) ? opts.index : -1,
+            opts.limit || 0,
+            isFinite(maxPackets) ? maxPackets : 0
+        ).then(function(batch) {
+            if (!batch)
+                throw new Error("Failed to allocate packet batch");
+            var ret = Module.HEAP32[(batch >> 2) + 1];
+            var packets = ff_copyout_packet_batch(batch);
+            if (ret === -11 /* ECANCELED */) {
+                var ex = Module.fsThrownError;
+                Module.fsThrownError = null;
+                throw ex || new Error("Reading was cancelled");
+            }
+            return [ret, packets];
+        });
+    }
+
     var copyoutPacket = ff_copyout_packet;
     if (opts.copyoutPacket)
         copyoutPacket = ff_copyout_packet_versions[opts.copyoutPacket];
@@ -1188,6 +2332,7 @@ function ff_read_frame_multi(fmt_ctx, pkt, opts) {
         return av_read_frame(fmt_ctx, pkt).then(function(ret) {
             if (ret < 0)
                 return [ret, outPackets];
+            ff_seek_index_record(fmt_ctx, pkt);
 
             if(opts.index !== undefined && AVPacket_stream_index(pkt) !== opts.index) {
                 av_packet_unref(pkt);
@@ -1250,6 +2395,108 @@ Module.ff_read_frame_multi = function() {
     });
 };
 
+/**
+ * Seek to a timestamp and decode the frame there with ff_decode_frame_at,
+ * copying out only that frame. Frames before it are decoded and dropped
+ * without leaving wasm. Resolves to null if the stream has no such frame.
+ * @param fmt_ctx  AVFormatContext
+ * @param dec_ctx  Opened AVCodecContext for the stream
+ * @param frame  AVFrame
+ * @param streamIndex  Stream to decode
+ * @param ts  Timestamp, in the stream's time base
+ * @param config  Options
+ */
+/* @types
+ * ff_decode_frame_at_js@sync(
+ *     fmt_ctx: number, dec_ctx: number, frame: number, streamIndex: number,
+ *     ts: number, config?: {
+ *         mode?: "exact" | "keyframe" | "next", // The frame shown at ts (default), the keyframe at or before it, or the first frame at or after it
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
+ *     }
+ * ): @promsync@Frame | null@
+ * ff_decode_frame_at_js@sync(
+ *     fmt_ctx: number, dec_ctx: number, frame: number, streamIndex: number,
+ *     ts: number, config: {
+ *         mode?: "exact" | "keyframe" | "next",
+ *         copyoutFrame: "ptr"
+ *     }
+ * ): @promsync@number | null@
+ * ff_decode_frame_at_js@sync(
+ *     fmt_ctx: number, dec_ctx: number, frame: number, streamIndex: number,
+ *     ts: number, config: {
+ *         mode?: "exact" | "keyframe" | "next",
+ *         copyoutFrame: "ImageData"
+ *     }
+ * ): @promsync@ImageData | null@
+ */
+function ff_decode_frame_at_js(fmt_ctx, dec_ctx, frame, streamIndex, ts, config) {
+    config = config || {};
+    var mode = {
+        exact: 0 /* FF_DECODE_FRAME_AT_EXACT */,
+        keyframe: 1 /* FF_DECODE_FRAME_AT_KEYFRAME */,
+        next: 2 /* FF_DECODE_FRAME_AT_NEXT */
+    }[config.mode || "exact"];
+    if (typeof mode !== "number")
+        throw new Error("Invalid mode " + config.mode);
+    var copyoutFrame = ff_copyout_frame_versions[config.copyoutFrame || "default"];
+
+    return ff_decode_frame_at(
+        fmt_ctx, dec_ctx, streamIndex, ~~ts, Math.floor(ts / 0x100000000),
+        mode, frame
+    ).then(function(ret) {
+        if (ret === -0x20464f45 /* AVERROR_EOF */)
+            return null;
+        if (ret < 0)
+            throw new Error("Error decoding frame: " + ff_error(ret));
+        var out = copyoutFrame(frame);
+        av_frame_unref(frame);
+        return out;
+    });
+}
+Module.ff_decode_frame_at_js = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_decode_frame_at_js.apply(void 0, args);
+    });
+};
+
+/**
+ * Serialize a seek index (see ff_seek_index_alloc) to a blob that can be
+ * stored and later loaded with ff_seek_index_from_blob.
+ * @param idx  Seek index
+ */
+/// @types ff_seek_index_to_blob@sync(idx: number): @promise@Uint8Array@
+var ff_seek_index_to_blob = Module.ff_seek_index_to_blob = function(idx) {
+    var outPtr = malloc(4);
+    var size = ff_seek_index_serialize(idx, outPtr);
+    var blob = Module.HEAPU32[outPtr >> 2];
+    free(outPtr);
+    if (size < 0)
+        throw new Error("Error serializing seek index: " + ff_error(size));
+    var ret = copyout_u8(blob, size);
+    free(blob);
+    return ret;
+};
+
+/**
+ * Load a seek index from a blob made by ff_seek_index_to_blob. The result
+ * must be freed with ff_seek_index_free.
+ * @param blob  Serialized seek index
+ */
+/// @types ff_seek_index_from_blob@sync(blob: Uint8Array): @promise@number@
+var ff_seek_index_from_blob = Module.ff_seek_index_from_blob = function(blob) {
+    var data = malloc(blob.length || 1);
+    var outPtr = malloc(4);
+    copyin_u8(data, blob);
+    var ret = ff_seek_index_load(data, blob.length, outPtr);
+    var idx = Module.HEAPU32[outPtr >> 2];
+    free(outPtr);
+    free(data);
+    if (ret < 0)
+        throw new Error("Error loading seek index: " + ff_error(ret));
+    return idx;
+};
+
 /**
  * @deprecated
  * DEPRECATED. Use `ff_read_frame_multi`.
@@ -1283,3 +2530,681 @@ Module.ff_read_multi = function(fmt_ctx, pkt, devfile, opts) {
     console.log("[libav.js] ff_read_multi is deprecated. Use ff_read_frame_multi.");
     return Module.ff_read_frame_multi(fmt_ctx, pkt, opts);
 };
+
+/**
+ * Probe the duration of an open media file, with bounded effort. If the
+ * headers don't give a duration, only a tail window of the file is read, and
+ * if that fails, the duration is estimated from the bitrate. Results are
+ * cached per file and limits (by path, size, mtime, tailBytes and
+ * tailPackets), so probing the same file again is free. Returns the
+ * duration in seconds and the confidence of that duration, as one of the
+ * FF_DURATION_* constants.
+ * @param fmt_ctx  AVFormatContext
+ * @param opts  Probing options
+ */
+/* @types
+ * ff_probe_media_duration@sync(
+ *     fmt_ctx: number, opts?: {
+ *         tailBytes?: number, // Maximum bytes to read from the tail (default 4MiB). 0 for no limit.
+ *         tailPackets?: number // Maximum packets to read from the tail (default 4096). 0 for no limit.
+ *     }
+ * ): @promsync@{duration: number, confidence: number}@
+ */
+function ff_probe_media_duration(fmt_ctx, opts) {
+    opts = opts || {};
+    var tailBytes = (opts.tailBytes !== undefined) ? opts.tailBytes : 4194304;
+    var tailPackets = (opts.tailPackets !== undefined) ? opts.tailPackets : 4096;
+    var confidence = malloc(4);
+    if (confidence === 0)
+        throw new Error("Could not malloc");
+
+    return ff_get_media_duration_probe(
+        fmt_ctx, tailBytes, tailPackets, confidence
+    ).then(function(duration) {
+        var ret = {
+            duration: duration,
+            confidence: Module.HEAP32[confidence >> 2]
+        };
+        free(confidence);
+        return ret;
+    }).catch(function(ex) {
+        free(confidence);
+        throw ex;
+    });
+}
+Module.ff_probe_media_duration = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_probe_media_duration.apply(void 0, args);
+    });
+};
+
+/**
+ * Probe many files for import in one call, with ff_probe_batch_js. Each file
+ * is opened with a small probesize and analyzeduration, and its streams are
+ * only probed (which decodes frames) if the container headers leave something
+ * out. A file that can't be probed gets a negative status rather than failing
+ * the batch.
+ * @param filenames  Files to probe
+ * @param opts  Probing options
+ */
+/* @types
+ * ff_probe_batch@sync(
+ *     filenames: string[], opts?: {
+ *         probesize?: number, // Bytes to read if streams must be probed (default 256KiB)
+ *         analyzeDuration?: number, // Seconds to analyze if streams must be probed (default 0.5)
+ *         full?: boolean // Always probe streams, even if the headers suffice
+ *     }
+ * ): @promsync@ProbeResult[]@
+ */
+function ff_probe_batch(filenames, opts) {
+    opts = opts || {};
+    var probesize = (opts.probesize !== undefined) ? opts.probesize : 262144;
+    var analyzeDuration = (opts.analyzeDuration !== undefined) ? opts.analyzeDuration : 0.5;
+    var recordSize = 128; // sizeof(FFProbeResult)
+
+    var filenamesPtr = ff_malloc_string_array(filenames);
+    var out = malloc(filenames.length * recordSize || 1);
+    if (out === 0) {
+        ff_free_string_array(filenamesPtr);
+        throw new Error("Could not malloc");
+    }
+
+    function cleanup() {
+        ff_free_string_array(filenamesPtr);
+        free(out);
+    }
+
+    function string(ptr, size) {
+        return UTF8ToString(ptr, size) || null;
+    }
+
+    return ff_probe_batch_js(
+        filenamesPtr, filenames.length, probesize, analyzeDuration,
+        opts.full ? 1 /* FF_PROBE_BATCH_FULL */ : 0, out
+    ).then(function() {
+        var ret = [];
+        for (var i = 0; i < filenames.length; i++) {
+            var rec = out + i * recordSize;
+            var i32 = new Int32Array(Module.HEAPU8.buffer, rec, 12);
+            var f64 = new Float64Array(Module.HEAPU8.buffer, rec + 48, 3);
+            var res = {
+                filename: filenames[i],
+                status: i32[0],
+                decoded: !!(i32[1] & 1 /* FF_PROBE_DECODED */),
+                nbStreams: i32[2],
+                duration: f64[0],
+                bitRate: f64[2],
+                timecode: string(rec + 72, 16),
+                format: string(rec + 88, 32),
+                majorBrand: string(rec + 120, 8),
+                video: null,
+                audio: null
+            };
+            if (i32[3] >= 0) {
+                res.video = {
+                    index: i32[3],
+                    codecId: i32[5],
+                    codec: avcodec_get_name(i32[5]),
+                    width: i32[6],
+                    height: i32[7],
+                    rotation: i32[8],
+                    frameRate: f64[1]
+                };
+            }
+            if (i32[4] >= 0) {
+                res.audio = {
+                    index: i32[4],
+                    codecId: i32[9],
+                    codec: avcodec_get_name(i32[9]),
+                    sampleRate: i32[10],
+                    channels: i32[11]
+                };
+            }
+            ret.push(res);
+        }
+        cleanup();
+        return ret;
+    }).catch(function(ex) {
+        cleanup();
+        throw ex;
+    });
+}
+Module.ff_probe_batch = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_probe_batch.apply(void 0, args);
+    });
+};
+
+/**
+ * Cut many slices out of the first audio stream of a file, keeping one
+ * demuxer open and reading forward rather than seeking when slices are close
+ * together. Each slice is copied (not re-encoded) to its own output file.
+ * With exact, PCM slices are cut at exact samples, and other codecs are only
+ * accepted for mp4/mov outputs, whose edit lists trim the edge packets; other
+ * outputs fail with EINVAL before anything is written.
+ * Returns 0 or a negative error code, like ff_slice_audio.
+ * @param inFilename  Input file
+ * @param ranges  Slices to cut, in seconds
+ * @param opts  Slicing options
+ */
+/* @types
+ * ff_slice_audio_multi@sync(
+ *     inFilename: string,
+ *     ranges: {start: number, duration: number, output: string}[],
+ *     opts?: {
+ *         exact?: boolean, // Trim each slice to exact sample boundaries (PCM, or mp4/mov outputs)
+ *         seekThreshold?: number // Read forward rather than seeking across gaps shorter than this, in seconds (default 10)
+ *     }
+ * ): @promsync@number@
+ */
+function ff_slice_audio_multi(inFilename, ranges, opts) {
+    opts = opts || {};
+    var seekThreshold = (opts.seekThreshold !== undefined) ? opts.seekThreshold : 10;
+
+    ranges = ranges.slice(0).sort(function(a, b) {
+        return a.start - b.start;
+    });
+    var times = [];
+    var outputs = [];
+    ranges.forEach(function(range) {
+        times.push(range.start, range.duration);
+        outputs.push(range.output);
+    });
+
+    var timesPtr = ff_malloc_float64_list(times);
+    var outputsPtr = ff_malloc_string_array(outputs);
+
+    function cleanup() {
+        free(timesPtr);
+        ff_free_string_array(outputsPtr);
+    }
+
+    return ff_slice_audio_ranges(
+        inFilename, timesPtr, outputsPtr, ranges.length,
+        opts.exact ? 1 /* FF_SLICE_AUDIO_EXACT */ : 0, seekThreshold
+    ).then(function(ret) {
+        cleanup();
+        return ret;
+    }).catch(function(ex) {
+        cleanup();
+        throw ex;
+    });
+}
+Module.ff_slice_audio_multi = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_slice_audio_multi.apply(void 0, args);
+    });
+};
+
+/**
+ * Extract several audio streams from a file in a single pass, each copied (not
+ * re-encoded) to its own output file. Returns 0 or a negative error code, like
+ * ff_extract_audio.
+ * @param inFilename  Input file, or an AVFormatContext from
+ *                    ff_init_demuxer_file to share
+ * @param outputs  Output file for each extracted stream
+ * @param opts  Extraction options
+ */
+/* @types
+ * ff_extract_audio_multi@sync(
+ *     inFilename: string | number,
+ *     outputs: string[],
+ *     opts?: {
+ *         streams?: number[], // Input stream index for each output (default: the first outputs.length audio streams)
+ *         progress?: number // Progress callback, as a function pointer taking (current, total)
+ *     }
+ * ): @promsync@number@
+ */
+function ff_extract_audio_multi(inFilename, outputs, opts) {
+    opts = opts || {};
+    if (opts.streams && opts.streams.length !== outputs.length)
+        throw new Error("ff_extract_audio_multi: streams and outputs differ in length");
+
+    var outputsPtr = ff_malloc_string_array(outputs);
+    var streamsPtr = opts.streams ? ff_malloc_int32_list(opts.streams) : 0;
+
+    function cleanup() {
+        ff_free_string_array(outputsPtr);
+        if (streamsPtr)
+            free(streamsPtr);
+    }
+
+    var extract = (typeof inFilename === "number") ?
+        ff_extract_audio_streams_ctx : ff_extract_audio_streams;
+    return extract(
+        inFilename, outputsPtr, streamsPtr, outputs.length, opts.progress || 0
+    ).then(function(ret) {
+        cleanup();
+        return ret;
+    }).catch(function(ex) {
+        cleanup();
+        throw ex;
+    });
+}
+Module.ff_extract_audio_multi = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_extract_audio_multi.apply(void 0, args);
+    });
+};
+
+/**
+ * Transcode the first audio stream of a file, with options in an object.
+ * Returns the result of ff_transcode_audio, and the number of buffer
+ * allocations the job made.
+ * @param inFilename  Input file, or an AVFormatContext from
+ *                    ff_init_demuxer_file to share
+ * @param outFilename  Output file; its extension picks the container
+ * @param opts  Transcoding options
+ */
+/* @types
+ * ff_transcode_audio_js@sync(
+ *     inFilename: string | number, outFilename: string,
+ *     opts?: {
+ *         encoder?: string, // Encoder or codec name (default "mp3")
+ *         channels?: number, // Output channels (default: input, at most 2)
+ *         sampleRate?: number, // Output sample rate (default: input, if the encoder supports it)
+ *         bitRate?: number, // Output bit rate (default: encoder's default)
+ *         progress?: number // Progress callback, as a function pointer taking (current, total)
+ *     }
+ * ): @promsync@{ret: number, allocations: number}@
+ */
+function ff_transcode_audio_js(inFilename, outFilename, opts) {
+    opts = opts || {};
+    var allocs = malloc(4);
+    if (allocs === 0)
+        throw new Error("Could not malloc");
+    Module.HEAP32[allocs >> 2] = 0;
+
+    var transcode = (typeof inFilename === "number") ?
+        ff_transcode_audio_ctx : ff_transcode_audio;
+    return transcode(
+        inFilename, outFilename, opts.encoder || "mp3", opts.channels || 0,
+        opts.sampleRate || 0, opts.bitRate || 0, allocs, opts.progress || 0
+    ).then(function(ret) {
+        var res = {
+            ret: ret,
+            allocations: Module.HEAP32[allocs >> 2]
+        };
+        free(allocs);
+        return res;
+    }).catch(function(ex) {
+        free(allocs);
+        throw ex;
+    });
+}
+Module.ff_transcode_audio_js = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_transcode_audio_js.apply(void 0, args);
+    });
+};
+
+/**
+ * Copy out a waveform peak pyramid, as made by ff_audio_peaks, and free it.
+ * Every array of the returned AudioPeaks is a view into the same
+ * (transferable) buffer.
+ * @param peaks  Peak pyramid pointer
+ */
+/// @types ff_copyout_audio_peaks@sync(peaks: number): @promise@AudioPeaks@
+var ff_copyout_audio_peaks = Module.ff_copyout_audio_peaks = function(peaks) {
+    var size = Module.HEAP32[peaks >> 2];
+    var buf = Module.HEAPU8.slice(peaks, peaks + size).buffer;
+    free(peaks);
+
+    var header = new Int32Array(buf, 0, 8);
+    var nbLevels = header[1];
+    var entries = new Int32Array(buf, 32, nbLevels * 4);
+    var levels = [];
+    for (var i = 0; i < nbLevels; i++) {
+        var count = entries[i * 4 + 1];
+        var offset = entries[i * 4 + 2];
+        levels.push({
+            samplesPerPixel: entries[i * 4],
+            min: new Float32Array(buf, offset, count),
+            max: new Float32Array(buf, offset + count * 4, count),
+            rms: new Float32Array(buf, offset + count * 8, count)
+        });
+    }
+
+    return {
+        sampleRate: header[2],
+        samples: (header[3] >>> 0) + header[4] * 0x100000000,
+        levels: levels,
+        libavjsTransfer: [buf]
+    };
+};
+
+/**
+ * Build a waveform peak pyramid for an audio file with ff_audio_peaks, and
+ * copy it out. The audio is decoded and downmixed to mono in one pass, and
+ * each level holds the minimum, maximum and RMS of every pixel. If the
+ * progress callback returns true, the job is cancelled and the promise is
+ * rejected. A progress function (rather than a function pointer) can't be
+ * passed to a worker, so it only works with noworker.
+ * @param inFilename  Input file
+ * @param opts  Options
+ */
+/* @types
+ * ff_audio_peaks_js@sync(
+ *     inFilename: string,
+ *     opts?: {
+ *         levels?: number[], // Samples per pixel of each level (default [256, 1024, 4096, 16384])
+ *         stream?: number, // Audio stream index (default: the first audio stream)
+ *         progress?: number | ((current: number, total: number) => boolean) // Progress callback; return true to cancel. A function pointer must return int.
+ *     }
+ * ): @promsync@AudioPeaks@
+ */
+function ff_audio_peaks_js(inFilename, opts) {
+    opts = opts || {};
+    var levels = opts.levels || [256, 1024, 4096, 16384];
+    var levelsPtr = ff_malloc_int32_list(levels);
+    var outPtr = malloc(4);
+    Module.HEAP32[outPtr >> 2] = 0;
+    var progress = opts.progress || 0;
+    var progressFn = 0;
+    if (typeof progress === "function") {
+        progressFn = progress = Module.addFunction(function(current, total) {
+            return opts.progress(current, total) ? 1 : 0;
+        }, "iii");
+    }
+
+    function cleanup() {
+        free(levelsPtr);
+        free(outPtr);
+        if (progressFn)
+            Module.removeFunction(progressFn);
+    }
+
+    return ff_audio_peaks(
+        inFilename, typeof opts.stream === "number" ? opts.stream : -1,
+        levelsPtr, levels.length, outPtr, progress
+    ).then(function(ret) {
+        var peaks = Module.HEAP32[outPtr >> 2];
+        cleanup();
+        if (ret < 0)
+            throw new Error("Error building audio peaks: " + ff_error(ret));
+        return ff_copyout_audio_peaks(peaks);
+    }, function(ex) {
+        cleanup();
+        throw ex;
+    });
+}
+Module.ff_audio_peaks_js = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_audio_peaks_js.apply(void 0, args);
+    });
+};
+
+/**
+ * Copy out a thumbnail sprite, as made by ff_extract_thumbnails, and free it.
+ * @param thumbs  Thumbnail sprite pointer
+ */
+/// @types ff_copyout_thumbnails@sync(thumbs: number): @promise@Thumbnails@
+var ff_copyout_thumbnails = Module.ff_copyout_thumbnails = function(thumbs) {
+    var size = Module.HEAP32[thumbs >> 2];
+    var buf = Module.HEAPU8.slice(thumbs, thumbs + size).buffer;
+    free(thumbs);
+
+    var header = new Int32Array(buf, 0, 8);
+    var count = header[1];
+    return {
+        count: count,
+        width: header[2],
+        height: header[3],
+        times: new Float64Array(buf, 32, count),
+        data: new Uint8Array(buf, 32 + count * 8),
+        libavjsTransfer: [buf]
+    };
+};
+
+/**
+ * Extract thumbnails of the best video stream of a file at the given times
+ * with ff_extract_thumbnails, and copy them out as one RGBA sprite. Only
+ * keyframes are decoded unless opts.exact is set.
+ * @param inFilename  Input file
+ * @param timestamps  Times, in seconds
+ * @param opts  Options
+ */
+/* @types
+ * ff_extract_thumbnails_js@sync(
+ *     inFilename: string, timestamps: number[],
+ *     opts?: {
+ *         width?: number, // Thumbnail width (default: from height and the aspect ratio)
+ *         height?: number, // Thumbnail height (default: from width and the aspect ratio)
+ *         exact?: boolean, // Use the exact frame at each time, not the keyframe before it
+ *         progress?: number // Progress callback, as a function pointer taking (current, total)
+ *     }
+ * ): @promsync@Thumbnails@
+ */
+function ff_extract_thumbnails_js(inFilename, timestamps, opts) {
+    opts = opts || {};
+    var tsPtr = ff_malloc_float64_list(timestamps);
+    var outPtr = malloc(4);
+    Module.HEAP32[outPtr >> 2] = 0;
+
+    function cleanup() {
+        free(tsPtr);
+        free(outPtr);
+    }
+
+    return ff_extract_thumbnails(
+        inFilename, tsPtr, timestamps.length, opts.width || 0, opts.height || 0,
+        opts.exact ? 1 /* FF_THUMBNAILS_EXACT */ : 0, outPtr, opts.progress || 0
+    ).then(function(ret) {
+        var thumbs = Module.HEAP32[outPtr >> 2];
+        cleanup();
+        if (ret < 0)
+            throw new Error("Error extracting thumbnails: " + ff_error(ret));
+        return ff_copyout_thumbnails(thumbs);
+    }, function(ex) {
+        cleanup();
+        throw ex;
+    });
+}
+Module.ff_extract_thumbnails_js = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_extract_thumbnails_js.apply(void 0, args);
+    });
+};
+
+/* Frame servers with a background prefetch running, by pointer, and the
+ * generation of that prefetch. Closing or querying a new frame bumps the
+ * generation, which stops the old prefetch at its next step. */
+var ff_frame_server_prefetching = {};
+var ff_frame_server_generation = 0;
+
+/* Errors from background prefetches, by frame server pointer, thrown by the
+ * next ff_frame_server_get_frame_js */
+var ff_frame_server_errors = {};
+
+/**
+ * Get the frame shown at a timestamp from a frame server (see
+ * ff_frame_server_alloc), and copy it out. Unless opts.prefetch is 0, the
+ * rest of the GOP and the next keyframe are then decoded into the server's
+ * cache in the background, a few frames at a time, between other calls.
+ * Resolves to null if the stream has no frame there.
+ * @param fs  Frame server
+ * @param frame  AVFrame
+ * @param pts  Timestamp, in the stream's time base
+ * @param opts  Options
+ */
+/* @types
+ * ff_frame_server_get_frame_js@sync(
+ *     fs: number, frame: number, pts: number, opts?: {
+ *         prefetch?: number, // Frames to prefetch per step, or 0 for none (default 4)
+ *         copyoutFrame?: "default" | "video" | "video_lease" | "video_packed"
+ *     }
+ * ): @promsync@Frame | null@
+ * ff_frame_server_get_frame_js@sync(
+ *     fs: number, frame: number, pts: number, opts: {
+ *         prefetch?: number,
+ *         copyoutFrame: "ptr"
+ *     }
+ * ): @promsync@number | null@
+ * ff_frame_server_get_frame_js@sync(
+ *     fs: number, frame: number, pts: number, opts: {
+ *         prefetch?: number,
+ *         copyoutFrame: "ImageData"
+ *     }
+ * ): @promsync@ImageData | null@
+ */
+function ff_frame_server_get_frame_js(fs, frame, pts, opts) {
+    opts = opts || {};
+    var copyoutFrame = ff_copyout_frame_versions[opts.copyoutFrame || "default"];
+    var prefetch = (typeof opts.prefetch === "number") ? opts.prefetch : 4;
+    var gen = ++ff_frame_server_generation;
+    ff_frame_server_prefetching[fs] = gen;
+
+    var error = ff_frame_server_errors[fs];
+    if (error) {
+        delete ff_frame_server_errors[fs];
+        throw error;
+    }
+
+    function step() {
+        if (ff_frame_server_prefetching[fs] !== gen)
+            return;
+        return ff_frame_server_prefetch(fs, prefetch).then(function(more) {
+            if (more < 0)
+                throw new Error("Error prefetching frames: " + ff_error(more));
+            /* Queue the next step behind whatever is waiting, rather than
+             * returning it, which would wait on ourselves */
+            if (more > 0)
+                serially(step);
+        }).catch(function(ex) {
+            if (ff_frame_server_prefetching[fs] === gen)
+                ff_frame_server_errors[fs] = ex;
+        });
+    }
+
+    return ff_frame_server_get_frame(
+        fs, ~~pts, Math.floor(pts / 0x100000000), frame
+    ).then(function(ret) {
+        if (ret === -0x20464f45 /* AVERROR_EOF */)
+            return null;
+        if (ret < 0)
+            throw new Error("Error getting frame: " + ff_error(ret));
+        var out = copyoutFrame(frame);
+        av_frame_unref(frame);
+        if (prefetch > 0)
+            serially(step);
+        return out;
+    });
+}
+Module.ff_frame_server_get_frame_js = function() {
+    var args = arguments;
+    return serially(function() {
+        return ff_frame_server_get_frame_js.apply(void 0, args);
+    });
+};
+
+/**
+ * Stop any background prefetch of a frame server and free it, once the
+ * prefetch step in progress (if any) has finished.
+ * @param fs  Frame server
+ */
+/// @types ff_frame_server_close@sync(fs: number): @promise@void@
+var ff_frame_server_close = Module.ff_frame_server_close = function(fs) {
+    delete ff_frame_server_prefetching[fs];
+    return serially(function() {
+        delete ff_frame_server_errors[fs];
+        ff_frame_server_free(fs);
+        return Promise.all([]);
+    });
+};
+
+/**
+ * Get the cache counters of a frame server.
+ * @param fs  Frame server
+ */
+/// @types ff_frame_server_stats_js@sync(fs: number): @promise@FrameServerStats@
+var ff_frame_server_stats_js = Module.ff_frame_server_stats_js = function(fs) {
+    var ptr = malloc(8 /* FF_FRAME_SERVER_NB_STATS */ * 8);
+    ff_frame_server_stats(fs, ptr);
+    var s = new Float64Array(Module.HEAPU8.buffer, ptr, 8).slice();
+    free(ptr);
+    return {
+        hits: s[0],
+        misses: s[1],
+        decoded: s[2],
+        prefetched: s[3],
+        evictions: s[4],
+        frames: s[5],
+        memory: s[6],
+        memoryLimit: s[7]
+    };
+};
+
+/**
+ * Convert a file to HLS like convert_to_hls, but hand over every file as soon
+ * as the muxer finishes writing it, through `onhlssegment`, rather than
+ * keeping the whole rendition in memory. Files in MEMFS are read, removed,
+ * and passed with their content. Files on a mkfsdhdir mount are already
+ * streamed out, so they're only closed and passed with null content. A
+ * playlist is passed again every time it's rewritten. If a file can't be read,
+ * or onhlssegment throws, the conversion stops and that error is thrown.
+ * Returns the result of convert_to_hls.
+ * @param inUrl  Input file, or an AVFormatContext from ff_init_demuxer_file to
+ *               share
+ * @param playlistPath  Output playlist; segments are written next to it
+ */
+/// @types convert_to_hls_streaming@sync(inUrl: string | number, playlistPath: string): @promsync@number@
+function convert_to_hls_streaming(inUrl, playlistPath) {
+    var pending = [];
+    // The first error reading or handing over a file, which stops the conversion
+    var error = null;
+
+    function emit(path, data) {
+        if (Module.onhlssegment)
+            Module.onhlssegment(path, data);
+    }
+
+    var cb = Module.addFunction(function(pathPtr) {
+        var path = UTF8ToString(pathPtr).replace(/^file:/, "");
+        if (fsdhMountOf(path)) {
+            pending.push(fsdhClose(path, false).then(function() {
+                emit(path, null);
+            }));
+            return 0;
+        }
+
+        try {
+            var data = FS.readFile(path);
+            FS.unlink(path);
+            emit(path, data);
+        } catch (ex) {
+            if (!error)
+                error = ex;
+            return -5 /* EIO */;
+        }
+        return 0;
+    }, "ii");
+
+    function cleanup() {
+        Module.removeFunction(cb);
+        return Promise.all(pending);
+    }
+
+    var convert = (typeof inUrl === "number") ? convert_to_hls_cb_ctx : convert_to_hls_cb;
+    return convert(inUrl, playlistPath, cb).then(function(ret) {
+        return cleanup().then(function() {
+            if (error)
+                throw error;
+            return ret;
+        });
+    }).catch(function(ex) {
+        return cleanup().then(function() { throw ex; });
+    });
+}
+Module.convert_to_hls_streaming = function() {
+    var args = arguments;
+    return serially(function() {
+        return convert_to_hls_streaming.apply(void 0, args);
+    });
+};
@@ -14,35 +14,51 @@
  */
 
 /**
- * Copy out a frame.
+ * Copy out a frame. For audio, opts.format may be a sample format (FLT, FLTP,
+ * S16 or S16P) to convert to, from whatever format the frame is in. Audio in
+ * a format with no typed array copier (e.g. DBL or S64) is converted to FLT
+ * or FLTP.
  * @param frame  AVFrame
+ * @param opts  Options
  */
-/// @types ff_copyout_frame@sync(frame: number): @promise@Frame@
-var ff_copyout_frame = Module.ff_copyout_frame = function(frame) {
-    var nb_samples = AVFrame_nb_samples(frame);
+/* @types
+ * ff_copyout_frame@sync(
+ *     frame: number, opts?: {
+ *         format?: number // Sample format to convert audio to
+ *     }
+ * ): @promise@Frame@
+ */
+var ff_copyout_frame = Module.ff_copyout_frame = function(frame, opts) {
+    var s = AVFrame_snapshot_js(frame);
+    var nb_samples = s.nb_samples;
     if (nb_samples === 0) {
         // Maybe a video frame?
-        var width = AVFrame_width(frame);
-        if (width)
-            return ff_copyout_frame_video_width(frame, width);
+        if (s.width)
+            return ff_copyout_frame_video_width(frame, s.width, false, s);
     }
-    var channels = AVFrame_channels(frame);
-    var format = AVFrame_format(frame);
+    var channels = s.channels;
+    var format = s.format;
+    if (opts && typeof opts.format === "number")
+        return ff_copyout_frame_samples(frame, opts.format, s);
+    if (format === 4 /* DBL */ || format === 10 /* S64 */)
+        return ff_copyout_frame_samples(frame, 3 /* FLT */, s);
+    if (format > 8 /* FLTP */)
+        return ff_copyout_frame_samples(frame, 8 /* FLTP */, s);
     var transfer = [];
     var outFrame = {
         data: null,
         libavjsTransfer: transfer,
-        channel_layout: AVFrame_channel_layout(frame),
+        channel_layout: s.channel_layout,
         channels: channels,
         format: format,
         nb_samples: nb_samples,
-        pts: AVFrame_pts(frame),
-        ptshi: AVFrame_ptshi(frame),
-        time_base_num: AVFrame_time_base_num(frame),
-        time_base_den: AVFrame_time_base_den(frame),
-        sample_rate: AVFrame_sample_rate(frame),
-        duration: AVFrame_duration(frame),
-        durationhi: AVFrame_durationhi(frame)
+        pts: s.pts,
+        ptshi: s.ptshi,
+        time_base_num: s.time_base_num,
+        time_base_den: s.time_base_den,
+        sample_rate: s.sample_rate,
+        duration: s.duration,
+        durationhi: s.durationhi
     };
 
     // FIXME: Need to support *every* format here
@@ -50,7 +66,7 @@ var ff_copyout_frame = Module.ff_copyout_frame = function(frame) {
         // Planar format, multiple data pointers
         var data = [];
         for (var ci = 0; ci < channels; ci++) {
-            var inData = AVFrame_data_a(frame, ci);
+            var inData = (ci < 8) ? s.data[ci] : AVFrame_data_a(frame, ci);
             var outData = null;
             switch (format) {
                 case 5: // U8P
@@ -79,7 +95,7 @@ var ff_copyout_frame = Module.ff_copyout_frame = function(frame) {
 
     } else {
         var ct = channels*nb_samples;
-        var inData = AVFrame_data_a(frame, 0);
+        var inData = s.data[0];
         var outData = null;
         switch (format) {
             case 0: // U8
@@ -109,6 +125,60 @@ var ff_copyout_frame = Module.ff_copyout_frame = function(frame) {
     return outFrame;
 };
 
+/* Copy out an audio frame, converted to the sample format format (FLT, FLTP,
+ * S16 or S16P) by ff_copyout_samples_js. s is the frame's snapshot, if already
+ * taken. Used internally by ff_copyout_frame. */
+function ff_copyout_frame_samples(frame, format, s) {
+    s = s || AVFrame_snapshot_js(frame);
+    var channels = s.channels;
+    var nb_samples = s.nb_samples;
+    var planar = (format >= 5 /* U8P */);
+    var bps = (format === 1 /* S16 */ || format === 6 /* S16P */) ? 2 : 4;
+    var copyout = (bps === 2) ? copyout_s16 : copyout_f32;
+    var transfer = [];
+    var outFrame = {
+        data: null,
+        libavjsTransfer: transfer,
+        channel_layout: s.channel_layout,
+        channels: channels,
+        format: format,
+        nb_samples: nb_samples,
+        pts: s.pts,
+        ptshi: s.ptshi,
+        time_base_num: s.time_base_num,
+        time_base_den: s.time_base_den,
+        sample_rate: s.sample_rate,
+        duration: s.duration,
+        durationhi: s.durationhi
+    };
+
+    var buf = malloc(channels * nb_samples * bps || 1);
+    if (buf === 0)
+        throw new Error("Could not malloc");
+    try {
+        var ret = ff_copyout_samples_js(frame, format, buf);
+        if (ret < 0)
+            throw new Error("Failed to convert samples: " + ff_error(ret));
+
+        if (planar) {
+            var data = [];
+            for (var ci = 0; ci < channels; ci++) {
+                var outData = copyout(buf + ci * nb_samples * bps, nb_samples);
+                data.push(outData);
+                transfer.push(outData.buffer);
+            }
+            outFrame.data = data;
+        } else {
+            outFrame.data = copyout(buf, channels * nb_samples);
+            transfer.push(outFrame.data.buffer);
+        }
+    } finally {
+        free(buf);
+    }
+
+    return outFrame;
+}
+
 /**
  * Copy out a video frame. `ff_copyout_frame` will copy out a video frame if a
  * video frame is found, but this may be faster if you know it's a video frame.
@@ -116,13 +186,17 @@ var ff_copyout_frame = Module.ff_copyout_frame = function(frame) {
  */
 /// @types ff_copyout_frame_video@sync(frame: number): @promise@Frame@
 var ff_copyout_frame_video = Module.ff_copyout_frame_video = function(frame) {
-    return ff_copyout_frame_video_width(frame, AVFrame_width(frame));
+    var s = AVFrame_snapshot_js(frame);
+    return ff_copyout_frame_video_width(frame, s.width, false, s);
 };
 
-// Copy out a video frame. Used internally by ff_copyout_frame.
-var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(frame, width) {
-    var height = AVFrame_height(frame);
-    var format = AVFrame_format(frame);
+/* Copy out a video frame. Used internally by ff_copyout_frame. If view is set,
+ * the data is a view into the heap instead of a copy, as used by
+ * ff_copyout_frame_video_lease. s is the frame's snapshot, if already taken. */
+var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(frame, width, view, s) {
+    s = s || AVFrame_snapshot_js(frame);
+    var height = s.height;
+    var format = s.format;
     var desc = av_pix_fmt_desc_get(format);
     var log2ch = AVPixFmtDescriptor_log2_chroma_h(desc);
     var layout = [];
@@ -134,22 +208,22 @@ var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(fram
         width: width,
         height: height,
         crop: {
-            top: AVFrame_crop_top(frame),
-            bottom: AVFrame_crop_bottom(frame),
-            left: AVFrame_crop_left(frame),
-            right: AVFrame_crop_right(frame)
+            top: s.crop_top,
+            bottom: s.crop_bottom,
+            left: s.crop_left,
+            right: s.crop_right
         },
-        format: AVFrame_format(frame),
-        flags: AVFrame_flags(frame),
-        key_frame: AVFrame_key_frame(frame),
-        pict_type: AVFrame_pict_type(frame),
-        pts: AVFrame_pts(frame),
-        ptshi: AVFrame_ptshi(frame),
-        time_base_num: AVFrame_time_base_num(frame),
-        time_base_den: AVFrame_time_base_den(frame),
+        format: format,
+        flags: s.flags,
+        key_frame: s.key_frame,
+        pict_type: s.pict_type,
+        pts: s.pts,
+        ptshi: s.ptshi,
+        time_base_num: s.time_base_num,
+        time_base_den: s.time_base_den,
         sample_aspect_ratio: [
-            AVFrame_sample_aspect_ratio_num(frame),
-            AVFrame_sample_aspect_ratio_den(frame)
+            s.sample_aspect_ratio_num,
+            s.sample_aspect_ratio_den
         ]
     };
 
@@ -157,10 +231,10 @@ var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(fram
     var dataLo = 1/0;
     var dataHi = 0;
     for (var p = 0; p < 8 /* AV_NUM_DATA_POINTERS */; p++) {
-        var linesize = AVFrame_linesize_a(frame, p);
+        var linesize = s.linesize[p];
         if (!linesize)
             break;
-        var plane = AVFrame_data_a(frame, p);
+        var plane = s.data[p];
         if (plane < dataLo)
             dataLo = plane;
         var h = height;
@@ -172,15 +246,19 @@ var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(fram
     }
 
     // Copy out that segment of data
-    outFrame.data = Module.HEAPU8.slice(dataLo, dataHi);
-    transfer.push(outFrame.data.buffer);
+    if (view) {
+        outFrame.data = Module.HEAPU8.subarray(dataLo, dataHi);
+    } else {
+        outFrame.data = Module.HEAPU8.slice(dataLo, dataHi);
+        transfer.push(outFrame.data.buffer);
+    }
 
     // And describe the layout
     for (var p = 0; p < 8; p++) {
-        var linesize = AVFrame_linesize_a(frame, p);
+        var linesize = s.linesize[p];
         if (!linesize)
             break;
-        var plane = AVFrame_data_a(frame, p);
+        var plane = s.data[p];
         layout.push({
             offset: plane - dataLo,
             stride: linesize
@@ -190,70 +268,73 @@ var ff_copyout_frame_video_width = Module.ff_copyout_frame_video = function(fram
     return outFrame;
 };
 
+/* Bytes per line and number of lines of a plane of a packed video frame, or
+ * null if the format has no such plane. Used internally. */
+function ff_frame_video_plane_dims(format, desc, width, height, plane) {
+    var w = av_image_get_linesize(format, width, plane);
+    if (w <= 0)
+        return null;
+    var h = height;
+    if (plane === 1 || plane === 2)
+        h = -((-h) >> AVPixFmtDescriptor_log2_chroma_h(desc));
+    return [w, h];
+}
+
 /**
  * Get the size of a packed video frame in its native format.
  * @param frame  AVFrame
  */
 /// @types ff_frame_video_packed_size@sync(frame: number): @promise@Frame@
-var ff_frame_video_packed_size = Module.ff_frame_video_packed_size = function(frame) {
-    // FIXME: duplication
-    var width = AVFrame_width(frame);
-    var height = AVFrame_height(frame);
-    var format = AVFrame_format(frame);
+var ff_frame_video_packed_size = Module.ff_frame_video_packed_size = function(frame, s) {
+    s = s || AVFrame_snapshot_js(frame);
+    var width = s.width;
+    var height = s.height;
+    var format = s.format;
     var desc = av_pix_fmt_desc_get(format);
 
-    // VERY simple bpp, assuming all components are 8-bit
-    var bpp = 1;
-    if (!(AVPixFmtDescriptor_flags(desc) & 0x10) /* planar */)
-        bpp *= AVPixFmtDescriptor_nb_components(desc);
-
     var dataSz = 0;
     for (var i = 0; i < 8 /* AV_NUM_DATA_POINTERS */; i++) {
-        var linesize = AVFrame_linesize_a(frame, i);
-        if (!linesize)
+        if (!s.linesize[i])
             break;
-        var w = width * bpp;
-        var h = height;
-        if (i === 1 || i === 2) {
-            w >>= AVPixFmtDescriptor_log2_chroma_w(desc);
-            h >>= AVPixFmtDescriptor_log2_chroma_h(desc);
-        }
-        dataSz += w * h;
+        var dims = ff_frame_video_plane_dims(format, desc, width, height, i);
+        if (!dims)
+            break;
+        dataSz += dims[0] * dims[1];
     }
 
     return dataSz;
 };
 
-/* Copy out just the packed data from this frame, into the given buffer. Used
- * internally. */
-function ff_copyout_frame_data_packed(data, layout, frame) {
-    var width = AVFrame_width(frame);
-    var height = AVFrame_height(frame);
-    var format = AVFrame_format(frame);
+/* Copy out just the packed data from this frame (with snapshot s), into the
+ * given buffer. Used internally. */
+function ff_copyout_frame_data_packed(data, layout, s) {
+    var width = s.width;
+    var height = s.height;
+    var format = s.format;
     var desc = av_pix_fmt_desc_get(format);
 
-    // VERY simple bpp, assuming all components are 8-bit
-    var bpp = 1;
-    if (!(AVPixFmtDescriptor_flags(desc) & 0x10) /* planar */)
-        bpp *= AVPixFmtDescriptor_nb_components(desc);
-
     // Copy it out
     var dIdx = 0;
     for (var i = 0; i < 8 /* AV_NUM_DATA_POINTERS */; i++) {
-        var linesize = AVFrame_linesize_a(frame, i);
+        var linesize = s.linesize[i];
         if (!linesize)
             break;
-        var inData = AVFrame_data_a(frame, i);
-        var w = width * bpp;
-        var h = height;
-        if (i === 1 || i === 2) {
-            w >>= AVPixFmtDescriptor_log2_chroma_w(desc);
-            h >>= AVPixFmtDescriptor_log2_chroma_h(desc);
-        }
+        var dims = ff_frame_video_plane_dims(format, desc, width, height, i);
+        if (!dims)
+            break;
+        var inData = s.data[i];
+        var w = dims[0];
+        var h = dims[1];
         layout.push({
             offset: dIdx,
             stride: w
         });
+        if (linesize === w) {
+            // Already packed, so copy the whole plane at once
+            data.set(Module.HEAPU8.subarray(inData, inData + w * h), dIdx);
+            dIdx += w * h;
+            continue;
+        }
         for (var y = 0; y < h; y++) {
             var line = inData + y * linesize;
             data.set(
@@ -271,26 +352,27 @@ function ff_copyout_frame_data_packed(data, layout, frame) {
  */
 /// @types ff_copyout_frame_video_packed@sync(frame: number): @promise@Frame@
 var ff_copyout_frame_video_packed = Module.ff_copyout_frame_video_packed = function(frame) {
-    var data = new Uint8Array(ff_frame_video_packed_size(frame));
+    var s = AVFrame_snapshot_js(frame);
+    var data = new Uint8Array(ff_frame_video_packed_size(frame, s));
     var layout = [];
-    ff_copyout_frame_data_packed(data, layout, frame);
+    ff_copyout_frame_data_packed(data, layout, s);
 
     var outFrame = {
         data: data,
         libavjsTransfer: [data.buffer],
-        width: AVFrame_width(frame),
-        height: AVFrame_height(frame),
-        format: AVFrame_format(frame),
-        flags: AVFrame_flags(frame),
-        key_frame: AVFrame_key_frame(frame),
-        pict_type: AVFrame_pict_type(frame),
-        pts: AVFrame_pts(frame),
-        ptshi: AVFrame_ptshi(frame),
-        time_base_num: AVFrame_time_base_num(frame),
-        time_base_den: AVFrame_time_base_den(frame),
+        width: s.width,
+        height: s.height,
+        format: s.format,
+        flags: s.flags,
+        key_frame: s.key_frame,
+        pict_type: s.pict_type,
+        pts: s.pts,
+        ptshi: s.ptshi,
+        time_base_num: s.time_base_num,
+        time_base_den: s.time_base_den,
         sample_aspect_ratio: [
-            AVFrame_sample_aspect_ratio_num(frame),
-            AVFrame_sample_aspect_ratio_den(frame)
+            s.sample_aspect_ratio_num,
+            s.sample_aspect_ratio_den
         ]
     };
 
@@ -309,11 +391,10 @@ var ff_copyout_frame_video_packed = Module.ff_copyout_frame_video_packed = funct
  * ): @promise@ImageData@
  */
 var ff_copyout_frame_video_imagedata = Module.ff_copyout_frame_video_imagedata = function(frame) {
-    var width = AVFrame_width(frame);
-    var height = AVFrame_height(frame);
-    var id = new ImageData(width, height);
+    var s = AVFrame_snapshot_js(frame);
+    var id = new ImageData(s.width, s.height);
     var layout = [];
-    ff_copyout_frame_data_packed(id.data, layout, frame);
+    ff_copyout_frame_data_packed(id.data, layout, s);
     id.libavjsTransfer = [id.data.buffer];
     return id;
 };
@@ -329,22 +410,121 @@ var ff_copyout_frame_ptr = Module.ff_copyout_frame_ptr = function(frame) {
     return ret;
 };
 
+// Outstanding frame leases, by lease ID
+var ff_frame_leases = {};
+var ff_frame_lease_next = 1;
+
+/**
+ * Copy out a video frame without copying its data. The frame's data is a view
+ * directly into libav.js's heap, and the frame is kept alive (by reference)
+ * until ff_release_frame is called with its `lease`. This is only useful when
+ * the caller is in the same realm as libav.js (e.g. noworker mode, or code
+ * running in libav.js's own worker), since sending the view to another thread
+ * would copy the entire heap. If the heap grows while the frame is leased, its
+ * data is no longer valid, and reading `data` throws.
+ * @param frame  AVFrame
+ */
+/// @types ff_copyout_frame_video_lease@sync(frame: number): @promise@Frame@
+var ff_copyout_frame_video_lease = Module.ff_copyout_frame_video_lease = function(frame) {
+    var ref = av_frame_clone(frame);
+    if (!ref)
+        throw new Error("Failed to reference frame");
+
+    var s = AVFrame_snapshot_js(ref);
+    var outFrame = ff_copyout_frame_video_width(ref, s.width, true, s);
+    var data = outFrame.data;
+    var size = data.length;
+    var id = ff_frame_lease_next++;
+    ff_frame_leases[id] = {
+        frame: ref,
+        width: outFrame.width,
+        height: outFrame.height,
+        format: outFrame.format,
+        pts: outFrame.pts,
+        ptshi: outFrame.ptshi,
+        time: Date.now()
+    };
+
+    outFrame.lease = id;
+    Object.defineProperty(outFrame, "data", {
+        enumerable: true,
+        get: function() {
+            if (!ff_frame_leases[id])
+                throw new Error("Frame lease " + id + " has been released");
+            /* Growing an unshared heap detaches the old buffer, leaving our
+             * view empty. A shared heap's old views stay valid. */
+            if (data.length !== size)
+                throw new Error("Frame lease " + id + " was invalidated by heap growth");
+            return data;
+        }
+    });
+
+    return outFrame;
+};
+
+/**
+ * Release a frame leased by ff_copyout_frame_video_lease. Its data may not be
+ * used after this.
+ * @param lease  The lease ID, or the leased frame itself
+ */
+/// @types ff_release_frame@sync(lease: number | Frame): @promise@void@
+var ff_release_frame = Module.ff_release_frame = function(lease) {
+    if (typeof lease === "object")
+        lease = lease.lease;
+    var l = ff_frame_leases[lease];
+    if (!l)
+        throw new Error("Unknown frame lease " + lease);
+    delete ff_frame_leases[lease];
+    av_frame_free_js(l.frame);
+};
+
+/**
+ * List the frame leases that haven't been released, to find leaks.
+ */
+/// @types ff_leased_frames@sync(): @promise@LeasedFrameInfo[]@
+var ff_leased_frames = Module.ff_leased_frames = function() {
+    var now = Date.now();
+    var ret = [];
+    for (var id in ff_frame_leases) {
+        var l = ff_frame_leases[id];
+        ret.push({
+            lease: +id,
+            width: l.width,
+            height: l.height,
+            format: l.format,
+            pts: l.pts,
+            ptshi: l.ptshi,
+            age: now - l.time
+        });
+    }
+    return ret;
+};
+
 // All of the versions of ff_copyout_frame
 var ff_copyout_frame_versions = {
     default: ff_copyout_frame,
     video: ff_copyout_frame_video,
+    video_lease: ff_copyout_frame_video_lease,
     video_packed: ff_copyout_frame_video_packed,
     ImageData: ff_copyout_frame_video_imagedata,
     ptr: ff_copyout_frame_ptr
 };
 
 /**
- * Copy in a frame.
+ * Copy in a frame. For audio in FLT, FLTP, S16 or S16P, opts.format may be
+ * another sample format to convert the AVFrame to as it's copied in.
  * @param framePtr  AVFrame
  * @param frame  Frame to copy in, as either a Frame or an AVFrame pointer
+ * @param opts  Options
  */
-/// @types ff_copyin_frame@sync(framePtr: number, frame: Frame | number): @promise@void@
-var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame) {
+/* @types
+ * ff_copyin_frame@sync(
+ *     framePtr: number, frame: Frame | number, opts?: {
+ *         format?: number // Sample format to convert audio to
+ *     }
+ * ): @promise@void@
+ */
+var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame, opts) {
     if (typeof frame === "number") {
         // This is a frame pointer, not a libav.js Frame
         av_frame_unref(framePtr);
@@ -390,6 +570,10 @@ var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame) {
 
     AVFrame_nb_samples_s(framePtr, nb_samples);
 
+    var convert = opts && typeof opts.format === "number" && opts.format !== format;
+    if (convert)
+        AVFrame_format_s(framePtr, opts.format);
+
     // We may or may not need to actually allocate
     if (av_frame_make_writable(framePtr) < 0) {
         var ret = av_frame_get_buffer(framePtr, 0);
@@ -397,10 +581,14 @@ var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame) {
             throw new Error("Failed to allocate frame buffers: " + ff_error(ret));
     }
 
+    if (convert)
+        return ff_copyin_frame_samples(framePtr, frame, channels, nb_samples);
+
+    var s = AVFrame_snapshot_js(framePtr);
     if (format >= 5 /* U8P */) {
         // A planar format
         for (var ci = 0; ci < channels; ci++) {
-            var data = AVFrame_data_a(framePtr, ci);
+            var data = (ci < 8) ? s.data[ci] : AVFrame_data_a(framePtr, ci);
             var inData = frame.data[ci];
             switch (format) {
                 case 5: // U8P
@@ -422,7 +610,7 @@ var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame) {
         }
 
     } else {
-        var data = AVFrame_data_a(framePtr, 0);
+        var data = s.data[0];
         var inData = frame.data;
 
         // FIXME: Need to support *every* format here
@@ -447,6 +635,34 @@ var ff_copyin_frame = Module.ff_copyin_frame = function(framePtr, frame) {
     }
 };
 
+/* Copy in audio in FLT, FLTP, S16 or S16P, converting it to the (allocated)
+ * AVFrame's own sample format with ff_copyin_samples_js. Used internally by
+ * ff_copyin_frame. */
+function ff_copyin_frame_samples(framePtr, frame, channels, nb_samples) {
+    var format = frame.format;
+    var planar = (format >= 5 /* U8P */);
+    var bps = (format === 1 /* S16 */ || format === 6 /* S16P */) ? 2 : 4;
+    var copyin = (bps === 2) ? copyin_s16 : copyin_f32;
+
+    var buf = malloc(channels * nb_samples * bps || 1);
+    if (buf === 0)
+        throw new Error("Could not malloc");
+    try {
+        if (planar) {
+            for (var ci = 0; ci < channels; ci++)
+                copyin(buf + ci * nb_samples * bps, frame.data[ci]);
+        } else {
+            copyin(buf, frame.data);
+        }
+
+        var ret = ff_copyin_samples_js(framePtr, format, buf);
+        if (ret < 0)
+            throw new Error("Failed to convert samples: " + ff_error(ret));
+    } finally {
+        free(buf);
+    }
+}
+
 // Copy in a video frame. Used internally by ff_copyin_frame.
 var ff_copyin_frame_video = Module.ff_copyin_frame_video = function(framePtr, frame) {
     [
@@ -469,7 +685,6 @@ var ff_copyin_frame_video = Module.ff_copyin_frame_video = function(framePtr, fr
     AVFrame_crop_right_s(framePtr, crop.right);
 
     var desc = av_pix_fmt_desc_get(frame.format);
-    var log2cw = AVPixFmtDescriptor_log2_chroma_w(desc);
     var log2ch = AVPixFmtDescriptor_log2_chroma_h(desc);
 
     // We may or may not need to actually allocate
@@ -479,43 +694,37 @@ var ff_copyin_frame_video = Module.ff_copyin_frame_video = function(framePtr, fr
             throw new Error("Failed to allocate frame buffers: " + ff_error(ret));
     }
 
+    // Where the planes were allocated
+    var s = AVFrame_snapshot_js(framePtr);
+
     // If layout is not provided, assume packed
     var layout = frame.layout;
     if (!layout) {
         layout = [];
-
-        // VERY simple bpp, assuming all components are 8-bit
-        var bpp = 1;
-        if (!(AVPixFmtDescriptor_flags(desc) & 0x10) /* planar */)
-            bpp *= AVPixFmtDescriptor_nb_components(desc);
-
         var off = 0;
         for (var p = 0; p < 8 /* AV_NUM_DATA_POINTERS */; p++) {
-            var linesize = AVFrame_linesize_a(framePtr, p);
-            if (!linesize)
+            if (!s.linesize[p])
+                break;
+            var dims = ff_frame_video_plane_dims(
+                frame.format, desc, frame.width, frame.height, p);
+            if (!dims)
                 break;
-            var w = frame.width;
-            var h = frame.height;
-            if (p === 1 || p === 2) {
-                w >>= log2cw;
-                h >>= log2ch;
-            }
             layout.push({
                 offset: off,
-                stride: w * bpp
+                stride: dims[0]
             });
-            off += w * h * bpp;
+            off += dims[0] * dims[1];
         }
     }
 
     // Copy it in
     for (var p = 0; p < layout.length; p++) {
         var lplane = layout[p];
-        var linesize = AVFrame_linesize_a(framePtr, p);
-        var data = AVFrame_data_a(framePtr, p);
+        var linesize = s.linesize[p];
+        var data = s.data[p];
         var h = frame.height;
         if (p === 1 || p === 2)
-            h >>= log2ch;
+            h = -((-h) >> log2ch);
         var ioff = lplane.offset;
         var ooff = 0;
         var stride = Math.min(lplane.stride, linesize);
@@ -79,6 +79,21 @@ var ff_malloc_int64_list = Module.ff_malloc_int64_list = function(list) {
     return ptr;
 };
 
+/**
+ * Allocate and copy in a 64-bit float list.
+ * @param list  List of numbers to copy in
+ */
+/// @types ff_malloc_float64_list@sync(list: number[]): @promise@number@
+var ff_malloc_float64_list = Module.ff_malloc_float64_list = function(list) {
+    var ptr = malloc(list.length * 8);
+    if (ptr === 0)
+        throw new Error("Failed to malloc");
+    var arr = new Float64Array(Module.HEAPU8.buffer, ptr, list.length);
+    for (var i = 0; i < list.length; i++)
+        arr[i] = list[i];
+    return ptr;
+};
+
 /**
  * Allocate and copy in a string array. The resulting array will be
  * NULL-terminated.
@@ -113,4 +128,40 @@ var ff_free_string_array = Module.ff_free_string_array = function(ptr) {
     free(ptr);
 };
 
+// Scratch record for Struct_snapshot_js, allocated on first use
+var ff_snapshot_buf = 0;
+
+/* Read a whole struct in one call with its generated Struct_snapshot function
+ * (see tools/mk-snapshots.js), and unpack the record into an object keyed by
+ * accessor name. Rational fields become name_num and name_den, and counted
+ * array fields become arrays. Used internally by the Struct_snapshot_js
+ * functions. */
+function ff_snapshot(snapshot, fields, ptr) {
+    if (!ff_snapshot_buf) {
+        // Room for 128 fields, as in tools/mk-snapshots.js
+        ff_snapshot_buf = malloc(128 * 4);
+        if (ff_snapshot_buf === 0)
+            throw new Error("Failed to malloc");
+    }
+    snapshot(ptr, ff_snapshot_buf);
+
+    var rec = new Int32Array(Module.HEAPU8.buffer, ff_snapshot_buf, 128);
+    var ret = {};
+    var idx = 0;
+    for (var i = 0; i < fields.length; i++) {
+        var field = fields[i];
+        if (typeof field === "string") {
+            ret[field] = rec[idx++];
+        } else if (field.rational) {
+            ret[field.name + "_num"] = rec[idx++];
+            ret[field.name + "_den"] = rec[idx++];
+        } else {
+            ret[field.name] = Array.prototype.slice.call(
+                rec, idx, idx + field.count);
+            idx += field.count;
+        }
+    }
+    return ret;
+}
+
 @FUNCS
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 Yahweasel and contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Batch reading must give the same packets as reading one at a time
+
+const libav = await h.LibAV();
+
+async function readAll(opts) {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file("bbb.webm");
+    const pkt = await libav.av_packet_alloc();
+    const out = [];
+    while (true) {
+        const [res, packets] =
+            await libav.ff_read_frame_multi(fmt_ctx, pkt, opts);
+        out.push(packets);
+        if (res === libav.AVERROR_EOF)
+            break;
+        else if (res !== -libav.EAGAIN)
+            throw new Error("Error reading: " + res);
+    }
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+    return out;
+}
+
+const single = [].concat.apply([],
+    (await readAll({unify: true, maxPackets: 100})).map(x => x[0] || []));
+const batches = await readAll({copyoutPacket: "batch", maxPackets: 100});
+
+let pi = 0;
+for (const batch of batches) {
+    if (batch.count > 100)
+        throw new Error("Batch exceeded packet limit");
+    for (let bi = 0; bi < batch.count; bi++, pi++) {
+        const packet = single[pi];
+        if (!packet)
+            throw new Error("Too many packets in batches");
+        const data = batch.data.subarray(
+            batch.offset[bi], batch.offset[bi] + batch.size[bi]);
+        if (data.length !== packet.data.length ||
+            data.some((x, i) => x !== packet.data[i]))
+            throw new Error(`Packet ${pi} data mismatch`);
+        if (batch.pts[bi] !== libav.i64tof64(packet.pts, packet.ptshi) ||
+            batch.dts[bi] !== libav.i64tof64(packet.dts, packet.dtshi))
+            throw new Error(`Packet ${pi} timestamp mismatch`);
+        if (batch.stream_index[bi] !== packet.stream_index ||
+            batch.flags[bi] !== packet.flags ||
+            batch.time_base_num[bi] !== packet.time_base_num ||
+            batch.time_base_den[bi] !== packet.time_base_den)
+            throw new Error(`Packet ${pi} metadata mismatch`);
+    }
+}
+if (pi !== single.length)
+    throw new Error("Too few packets in batches");
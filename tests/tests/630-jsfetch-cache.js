@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2026 Yahweasel and contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Test of the jsfetch block cache. Needs a server that honors Range requests,
+// such as tools/cors-server.py.
+
+// This test requires fetch, so only works with the web test framework
+if (typeof document === "undefined")
+    return;
+
+const libav = await h.LibAV();
+
+const testLoc = new URL(document.location.href);
+testLoc.pathname = testLoc.pathname.replace(/\/[^\/]*$/, "/");
+const url = `jsfetch:${testLoc.toString()}/files/bbb_bitrate.webm`;
+
+// Small blocks, so that the file takes many requests
+await libav.jsfetchclearcache(url);
+const oldOpts = await libav.jsfetchconfig();
+await libav.jsfetchconfig({blockSize: 65536});
+
+async function readAll(filename) {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file(filename);
+    const pkt = await libav.av_packet_alloc();
+    const sizes = [];
+    while (true) {
+        const [res, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+        for (const idx in packets) {
+            for (const packet of packets[idx])
+                sizes.push(packet.data.length);
+        }
+        if (res === libav.AVERROR_EOF)
+            break;
+        else if (res !== -libav.EAGAIN)
+            throw new Error(`Error reading: ${res}`);
+    }
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+    return sizes;
+}
+
+try {
+    // Must give the same packets as reading the file locally
+    const file = await fetch(url.slice(8));
+    await libav.writeFile("jsfetch-cache.webm",
+        new Uint8Array(await file.arrayBuffer()));
+    const expected = await readAll("jsfetch-cache.webm");
+    await libav.unlink("jsfetch-cache.webm");
+
+    let start = performance.now();
+    const cold = await readAll(url);
+    const coldTime = performance.now() - start;
+    const coldStats = await libav.jsfetchstats(url);
+    if (cold.join(",") !== expected.join(","))
+        throw new Error("jsfetch packets differ from local packets");
+    if (coldStats.requests < 2 || !coldStats.prefetches)
+        throw new Error("jsfetch did not read by blocks; does the server honor Range requests?");
+
+    // Reopening must be served from the cache
+    start = performance.now();
+    const warm = await readAll(url);
+    const warmTime = performance.now() - start;
+    const warmStats = await libav.jsfetchstats(url);
+    if (warm.join(",") !== expected.join(","))
+        throw new Error("Cached jsfetch packets differ from local packets");
+    if (warmStats.requests !== coldStats.requests)
+        throw new Error(`Reopening made ${warmStats.requests - coldStats.requests} requests`);
+
+    h.print(`jsfetch: cold ${coldTime.toFixed(0)}ms, ${coldStats.requests} requests ` +
+        `(${coldStats.prefetches} prefetches), ` +
+        `${coldStats.averageLatency.toFixed(1)}ms average latency; ` +
+        `warm ${warmTime.toFixed(0)}ms`);
+} finally {
+    await libav.jsfetchconfig(oldOpts);
+    await libav.jsfetchclearcache(url);
+}
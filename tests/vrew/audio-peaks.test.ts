@@ -0,0 +1,178 @@
+/*
+ * ff_audio_peaks_js / ff_copyout_audio_peaks (src/p-avformat.in.js) 및
+ * ff_audio_peaks (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 알려진 샘플로 만든 float WAV 에 대해 각 레벨의 min/max/RMS 가 JS 로 직접
+ * 계산한 값과 일치하는지, 실제 파일(AAC 스테레오)의 다운믹스 결과가
+ * 레벨끼리 일관적인지, 그리고 progress 콜백으로 취소할 수 있는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const SAMPLE_RATE = 48000;
+
+// 포락선이 변하는 사인파 (32-bit float mono WAV). 레벨 경계에서 끝나지 않도록
+// 길이를 일부러 어중간하게 잡는다.
+function makeSamples() {
+  const n = SAMPLE_RATE * 3 + 777;
+  const samples = new Float32Array(n);
+  for (let i = 0; i < n; i++) {
+    const t = i / SAMPLE_RATE;
+    samples[i] = (0.2 + 0.7 * Math.abs(Math.sin(t))) * Math.sin(2 * Math.PI * 440 * t);
+  }
+  return samples;
+}
+
+function makeFloatWav(samples: Float32Array) {
+  const dataLen = samples.length * 4;
+  const buf = new ArrayBuffer(44 + dataLen);
+  const dv = new DataView(buf);
+  let o = 0;
+  const wStr = (s: string) => {
+    for (let i = 0; i < s.length; i++) dv.setUint8(o++, s.charCodeAt(i));
+  };
+  const w32 = (v: number) => {
+    dv.setUint32(o, v, true);
+    o += 4;
+  };
+  const w16 = (v: number) => {
+    dv.setUint16(o, v, true);
+    o += 2;
+  };
+  wStr("RIFF");
+  w32(36 + dataLen);
+  wStr("WAVE");
+  wStr("fmt ");
+  w32(16);
+  w16(3); // IEEE float
+  w16(1);
+  w32(SAMPLE_RATE);
+  w32(SAMPLE_RATE * 4);
+  w16(4);
+  w16(32);
+  wStr("data");
+  w32(dataLen);
+  for (let i = 0; i < samples.length; i++) {
+    dv.setFloat32(o, samples[i], true);
+    o += 4;
+  }
+  return new Uint8Array(buf);
+}
+
+function referencePeaks(samples: Float32Array, spp: number) {
+  const count = Math.ceil(samples.length / spp);
+  const min = new Float32Array(count);
+  const max = new Float32Array(count);
+  const rms = new Float32Array(count);
+  for (let p = 0; p < count; p++) {
+    const end = Math.min(samples.length, (p + 1) * spp);
+    let mn = Infinity;
+    let mx = -Infinity;
+    let sq = 0;
+    for (let i = p * spp; i < end; i++) {
+      mn = Math.min(mn, samples[i]);
+      mx = Math.max(mx, samples[i]);
+      sq += samples[i] * samples[i];
+    }
+    min[p] = mn;
+    max[p] = mx;
+    rms[p] = Math.sqrt(sq / (end - p * spp));
+  }
+  return { min, max, rms };
+}
+
+describe("ff_audio_peaks_js", () => {
+  let libav: LibAVJS.LibAV;
+  const samples = makeSamples();
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    await libav.writeFile("tone.wav", makeFloatWav(samples));
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("각 레벨의 min/max/RMS 가 직접 계산한 값과 일치한다", async () => {
+    // 공약수가 작은 레벨(300, 1000)도 섞어 기본 블록 크기를 검증한다
+    const levels = [256, 300, 1000, 4096];
+    const peaks = await libav.ff_audio_peaks_js("tone.wav", { levels });
+
+    expect(peaks.sampleRate).toBe(SAMPLE_RATE);
+    expect(peaks.samples).toBe(samples.length);
+    expect(peaks.levels.map((l) => l.samplesPerPixel)).toEqual(levels);
+
+    for (const level of peaks.levels) {
+      const ref = referencePeaks(samples, level.samplesPerPixel);
+      expect(level.min.length).toBe(ref.min.length);
+      expect(Array.from(level.min)).toEqual(Array.from(ref.min));
+      expect(Array.from(level.max)).toEqual(Array.from(ref.max));
+      for (let i = 0; i < ref.rms.length; i++)
+        expect(level.rms[i]).toBeCloseTo(ref.rms[i], 5);
+    }
+  });
+
+  it("실제 파일을 다운믹스해도 레벨끼리 일관적이다", async () => {
+    const peaks = await libav.ff_audio_peaks_js("in.mp4", {
+      levels: [512, 2048],
+    });
+    const [fine, coarse] = peaks.levels;
+
+    // bbb_input.mp4 는 10초 길이
+    expect(peaks.samples / peaks.sampleRate).toBeGreaterThan(9.5);
+    expect(peaks.samples / peaks.sampleRate).toBeLessThan(10.5);
+    expect(fine.min.length).toBe(Math.ceil(peaks.samples / 512));
+    expect(coarse.min.length).toBe(Math.ceil(peaks.samples / 2048));
+
+    // 거친 레벨의 한 픽셀은 세밀한 레벨의 네 픽셀을 합친 것이다
+    for (let p = 0; p < coarse.min.length; p++) {
+      const from = p * 4;
+      const to = Math.min(fine.min.length, from + 4);
+      expect(coarse.min[p]).toBe(Math.min(...fine.min.subarray(from, to)));
+      expect(coarse.max[p]).toBe(Math.max(...fine.max.subarray(from, to)));
+      expect(coarse.min[p]).toBeLessThanOrEqual(coarse.max[p]);
+      expect(coarse.rms[p]).toBeGreaterThanOrEqual(0);
+      expect(coarse.rms[p]).toBeLessThanOrEqual(
+        Math.max(Math.abs(coarse.min[p]), Math.abs(coarse.max[p])) + 1e-6,
+      );
+    }
+  });
+
+  it("progress 콜백이 true 를 돌려주면 취소된다", async () => {
+    let calls = 0;
+    await expect(
+      libav.ff_audio_peaks_js("in.mp4", {
+        progress: () => {
+          calls++;
+          return true;
+        },
+      }),
+    ).rejects.toThrow();
+    expect(calls).toBe(1);
+  });
+
+  it("잘못된 레벨은 거부한다", async () => {
+    await expect(
+      libav.ff_audio_peaks_js("in.mp4", { levels: [1024, 0] }),
+    ).rejects.toThrow();
+  });
+});
@@ -0,0 +1,180 @@
+/*
+ * mkaviosource / ff_init_demuxer_source / ff_close_demuxer_source
+ * (src/p-avformat.in.js) 및 ff_avio_source_open (src/b-avformat.c)에 대한
+ * vitest 테스트 및 벤치마크.
+ *
+ * 파일 시스템을 거치지 않는 AVIO 소스(Blob, ArrayBuffer, read 객체)에서 읽은
+ * 패킷이 MEMFS 파일에서 읽은 것과 같은지 확인하고, 큰 파일을
+ * mkreadaheadfile 과 AVIO 소스로 각각 끝까지 읽는 시간을 비교한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+// 8-bit mono PCM WAV 헤더
+function wavHeader(dataLen: number) {
+  const dv = new DataView(new ArrayBuffer(44));
+  const str = (o: number, s: string) => {
+    for (let i = 0; i < s.length; i++) dv.setUint8(o + i, s.charCodeAt(i));
+  };
+  str(0, "RIFF");
+  dv.setUint32(4, 36 + dataLen, true);
+  str(8, "WAVE");
+  str(12, "fmt ");
+  dv.setUint32(16, 16, true);
+  dv.setUint16(20, 1, true);
+  dv.setUint16(22, 1, true);
+  dv.setUint32(24, 48000, true);
+  dv.setUint32(28, 48000, true);
+  dv.setUint16(32, 1, true);
+  dv.setUint16(34, 8, true);
+  str(36, "data");
+  dv.setUint32(40, dataLen, true);
+  return new Uint8Array(dv.buffer);
+}
+
+describe("AVIO 소스", () => {
+  let libav: LibAVJS.LibAV;
+  let input: Uint8Array;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+    input = new Uint8Array(
+      fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4")),
+    );
+    await libav.writeFile("in.mp4", input);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // 열린 디먹서의 모든 패킷을 읽어 (스트림, 크기, pts) 목록과 총 바이트를 낸다
+  async function readAll(fmt_ctx: number) {
+    const pkt = await libav.av_packet_alloc();
+    const out: [number, number, number][] = [];
+    let bytes = 0;
+    try {
+      let ret = 0;
+      while (ret !== libav.AVERROR_EOF) {
+        let batch: LibAVJS.PacketBatch;
+        [ret, batch] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+          limit: 16 * 1024 * 1024,
+          maxPackets: Infinity,
+          copyoutPacket: "batch",
+        });
+        if (ret < 0 && ret !== libav.AVERROR_EOF) throw new Error(`${ret}`);
+        for (let i = 0; i < batch.count; i++)
+          out.push([batch.stream_index[i], batch.size[i], batch.pts[i]]);
+        bytes += batch.data.length;
+      }
+    } finally {
+      await libav.av_packet_free_js(pkt);
+    }
+    return { packets: out, bytes };
+  }
+
+  async function readSource(content: Parameters<LibAVJS.LibAV["mkaviosource"]>[0]) {
+    const source = await libav.mkaviosource(content);
+    try {
+      const [fmt_ctx, streams] = await libav.ff_init_demuxer_source(source);
+      try {
+        expect(streams.length).toBeGreaterThan(0);
+        return await readAll(fmt_ctx);
+      } finally {
+        await libav.ff_close_demuxer_source(fmt_ctx);
+      }
+    } finally {
+      await libav.unlinkaviosource(source);
+    }
+  }
+
+  it.each(["Blob", "ArrayBuffer", "read"])(
+    "%s 소스는 MEMFS 파일과 같은 패킷을 낸다",
+    async (kind) => {
+      const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+      let expected;
+      try {
+        expected = await readAll(fmt_ctx);
+      } finally {
+        await libav.avformat_close_input_js(fmt_ctx);
+      }
+
+      const content =
+        kind === "Blob"
+          ? new Blob([input])
+          : kind === "ArrayBuffer"
+            ? input.slice().buffer
+            : {
+                size: input.length,
+                read: async (pos: number, len: number) =>
+                  input.subarray(pos, pos + len),
+              };
+      expect(await readSource(content)).toEqual(expected);
+    },
+  );
+
+  it("읽기 오류는 그대로 전달된다", async () => {
+    await expect(
+      readSource({
+        size: input.length,
+        read: () => {
+          throw new Error("boom");
+        },
+      }),
+    ).rejects.toThrow();
+  });
+
+  it(
+    "큰 파일: mkreadaheadfile 과 비교",
+    async () => {
+      const dataLen = 256 * 1024 * 1024;
+      const chunk = new Uint8Array(1024 * 1024).fill(0x80);
+      const blob = new Blob([
+        wavHeader(dataLen),
+        ...Array.from({ length: dataLen / chunk.length }, () => chunk),
+      ]);
+
+      let start = performance.now();
+      await libav.mkreadaheadfile("big.wav", blob);
+      let viaFile;
+      try {
+        const [fmt_ctx] = await libav.ff_init_demuxer_file("big.wav");
+        try {
+          viaFile = await readAll(fmt_ctx);
+        } finally {
+          await libav.avformat_close_input_js(fmt_ctx);
+        }
+      } finally {
+        await libav.unlinkreadaheadfile("big.wav");
+      }
+      const fileTime = performance.now() - start;
+
+      start = performance.now();
+      const viaSource = await readSource(blob);
+      const sourceTime = performance.now() - start;
+
+      expect(viaSource.bytes).toBe(dataLen);
+      expect(viaSource.bytes).toBe(viaFile.bytes);
+      console.log(
+        `[avio-source] 256MB: mkreadaheadfile ${fileTime.toFixed(0)}ms, ` +
+          `AVIO source ${sourceTime.toFixed(0)}ms`,
+      );
+    },
+    300000,
+  );
+});
@@ -0,0 +1,233 @@
+/*
+ * ff_convert_audio_to_mp3_parallel (src/b-avformat.c)에 대한 vitest 테스트 및
+ * 스레드 수에 따른 처리량 벤치마크.
+ *
+ * 구간 병렬 인코딩은 스레드 빌드(.thr)가 있어야만 돌므로, 로드할 수 없으면
+ * 그 테스트는 건너뛴다. 병렬 결과는 직렬 변환과 같은 길이로 디코딩되고
+ * (gapless), 샘플 단위로 정렬되어 있어야 하며, 구간을 이어 붙일 수 있도록
+ * 비트 저장소(bit reservoir)를 쓰지 않아야 한다. 직렬 경로는 저장소를 쓰고,
+ * 스레드가 1개일 때의 fallback 은 직렬 변환과 바이트 단위로 같아야 한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const SAMPLE_RATE = 44100;
+const SECONDS = 45;
+
+// 200Hz → 2kHz 처프 (32-bit float mono WAV). 구간 경계가 어긋나면 바로 드러난다.
+function makeChirpWav() {
+  const numSamples = SAMPLE_RATE * SECONDS;
+  const dataLen = numSamples * 4;
+  const buf = new ArrayBuffer(44 + dataLen);
+  const dv = new DataView(buf);
+  let o = 0;
+  const wStr = (s: string) => {
+    for (let i = 0; i < s.length; i++) dv.setUint8(o++, s.charCodeAt(i));
+  };
+  const w32 = (v: number) => {
+    dv.setUint32(o, v, true);
+    o += 4;
+  };
+  const w16 = (v: number) => {
+    dv.setUint16(o, v, true);
+    o += 2;
+  };
+  wStr("RIFF");
+  w32(36 + dataLen);
+  wStr("WAVE");
+  wStr("fmt ");
+  w32(16);
+  w16(3); // IEEE float
+  w16(1);
+  w32(SAMPLE_RATE);
+  w32(SAMPLE_RATE * 4);
+  w16(4);
+  w16(32);
+  wStr("data");
+  w32(dataLen);
+  const k = (2000 - 200) / SECONDS;
+  for (let i = 0; i < numSamples; i++) {
+    const t = i / SAMPLE_RATE;
+    const phase = 2 * Math.PI * (200 * t + (k / 2) * t * t);
+    dv.setFloat32(o, 0.5 * Math.sin(phase), true);
+    o += 4;
+  }
+  return new Uint8Array(buf);
+}
+
+// MP3 를 디코딩해 첫 채널의 샘플을 이어 붙인다.
+async function decodeMp3(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, [stream]] = await libav.ff_init_demuxer_file(filename);
+  const [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+    codecpar: stream.codecpar,
+  });
+  try {
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+    const frames = await libav.ff_decode_multi(
+      c,
+      pkt,
+      frame,
+      packets[stream.index] || [],
+      true,
+    );
+    const planes = frames.map((f) => (f.data as Float32Array[])[0]);
+    const out = new Float32Array(planes.reduce((n, p) => n + p.length, 0));
+    let off = 0;
+    for (const p of planes) {
+      out.set(p, off);
+      off += p.length;
+    }
+    return out;
+  } finally {
+    await libav.ff_free_decoder(c, pkt, frame);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+function rmsDiff(a: Float32Array, b: Float32Array, start: number, len: number, lag: number) {
+  let sum = 0;
+  for (let i = start; i < start + len; i++) {
+    const d = a[i] - b[i + lag];
+    sum += d * d;
+  }
+  return Math.sqrt(sum / len);
+}
+
+// MP3 파일의 각 프레임 main_data_begin (비트 저장소에서 빌려 쓴 바이트 수)
+async function mainDataBegins(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, [stream]] = await libav.ff_init_demuxer_file(filename);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+    return (packets[stream.index] || []).map((p) => {
+      const d = p.data;
+      // MPEG-1 Layer III: 헤더 4바이트(+ CRC 2바이트) 뒤 side info 의 첫 9비트
+      const o = d[1] & 1 ? 4 : 6;
+      return (d[o] << 1) | (d[o + 1] >> 7);
+    });
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+describe("ff_convert_audio_to_mp3_parallel", () => {
+  let libav: LibAVJS.LibAV;
+  let threaded = false;
+
+  beforeAll(async () => {
+    if (LibAVFactory.isThreadingSupported()) {
+      try {
+        libav = await LibAVFactory.LibAV({ base: DIST, yesthreads: true });
+        threaded = true;
+      } catch (ex) {
+        // .thr 빌드가 없으면 병렬 경로 테스트는 건너뛴다.
+      }
+    }
+    if (!libav)
+      libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    await libav.writeFile("chirp.wav", makeChirpWav());
+    expect(
+      await libav.ff_convert_audio_to_mp3("chirp.wav", "serial.mp3", 0, 0, 0),
+    ).toBe(0);
+  }, 120000);
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("직렬 변환과 같은 길이로, 샘플 단위로 정렬되어 디코딩된다", async ({ skip }) => {
+    if (!threaded) skip();
+    const ret = await libav.ff_convert_audio_to_mp3_parallel(
+      "chirp.wav",
+      "parallel.mp3",
+      0,
+      0,
+      4,
+      0,
+    );
+    expect(ret).toBe(0);
+
+    const serial = await decodeMp3(libav, "serial.mp3");
+    const parallel = await decodeMp3(libav, "parallel.mp3");
+
+    // 인코더 지연(priming)과 마지막 패딩이 같다면 디코딩 결과의 길이도 같다.
+    expect(parallel.length).toBe(serial.length);
+    expect(Math.abs(parallel.length - SAMPLE_RATE * SECONDS)).toBeLessThan(1152);
+
+    // 1초 창마다, 어긋남이 없을 때(lag 0)의 차이가 ±1 샘플 어긋났을 때보다 작아야 한다.
+    const win = SAMPLE_RATE;
+    for (let start = 1; start + win + 1 < serial.length; start += win) {
+      const aligned = rmsDiff(parallel, serial, start, win, 0);
+      expect(aligned).toBeLessThan(0.05);
+      expect(aligned).toBeLessThan(rmsDiff(parallel, serial, start, win, -1));
+      expect(aligned).toBeLessThan(rmsDiff(parallel, serial, start, win, 1));
+    }
+
+    await libav.unlink("parallel.mp3");
+  }, 120000);
+
+  it("병렬 경로는 비트 저장소를 쓰지 않는다", async ({ skip }) => {
+    if (!threaded) skip();
+    expect(
+      await libav.ff_convert_audio_to_mp3_parallel("chirp.wav", "parallel.mp3", 0, 0, 4, 0),
+    ).toBe(0);
+    const begins = await mainDataBegins(libav, "parallel.mp3");
+    expect(begins.length).toBeGreaterThan(0);
+    expect(begins.every((b) => b === 0)).toBe(true);
+    await libav.unlink("parallel.mp3");
+  }, 120000);
+
+  it("직렬 경로는 비트 저장소를 쓰고, 스레드 1개면 직렬 변환과 같다", async () => {
+    const serialBegins = await mainDataBegins(libav, "serial.mp3");
+    expect(serialBegins.some((b) => b > 0)).toBe(true);
+
+    expect(
+      await libav.ff_convert_audio_to_mp3_parallel("chirp.wav", "one.mp3", 0, 0, 1, 0),
+    ).toBe(0);
+    const one = await libav.readFile("one.mp3");
+    const serial = await libav.readFile("serial.mp3");
+    expect(Buffer.from(one).equals(Buffer.from(serial))).toBe(true);
+    await libav.unlink("one.mp3");
+  }, 120000);
+
+  it("스레드 수에 따른 처리량 (벤치마크)", async () => {
+    const rows: { threads: number; ms: number; realtime: string }[] = [];
+    for (const threads of [1, 2, 4, 8]) {
+      const t0 = performance.now();
+      const ret = await libav.ff_convert_audio_to_mp3_parallel(
+        "chirp.wav",
+        "bench.mp3",
+        0,
+        0,
+        threads,
+        0,
+      );
+      const ms = performance.now() - t0;
+      expect(ret).toBe(0);
+      rows.push({
+        threads,
+        ms: Math.round(ms),
+        realtime: `${((SECONDS * 1000) / ms).toFixed(1)}x`,
+      });
+      await libav.unlink("bench.mp3");
+    }
+    console.log(threaded ? "threaded build" : "non-threaded build (serial fallback)");
+    console.table(rows);
+  }, 300000);
+});
@@ -1,7 +1,7 @@
 /*
- * ff_convert_audio_to_mp3 (src/b-avformat.c) 및 이 함수가 구동하는 static
- * 헬퍼들(transcode_mp3_select_sample_rate / _select_sample_fmt /
- * _convert_to_fifo / _encode_from_fifo)에 대한 vitest 테스트.
+ * ff_convert_audio_to_mp3 (src/b-avformat.c) 및 이 함수가 감싸는
+ * ff_transcode_audio 의 static 헬퍼들(transcode_audio_select_sample_rate /
+ * _select_sample_fmt / _convert_to_fifo / _encode_from_fifo)에 대한 vitest 테스트.
  *
  * tests/tests 아래 스위트와 달리 dist/의 prebuilt `vrew` 빌드를 직접 로드하므로
  * `all` 빌드도, ffmpeg CLI도 필요 없다. tests/files/bbb_input.mp4 안의
@@ -0,0 +1,324 @@
+/*
+ * ff_decode_batch / ff_encode_batch (src/p-avcodec.in.js) 및
+ * ff_decode_batch_js / ff_encode_batch_js (src/b-avcodec.c)에 대한 vitest 테스트.
+ *
+ * C 안에서 send/receive 루프를 도는 배치 버전이 패킷을 하나씩 보내는
+ * ff_decode_multi / ff_encode_multi 와 같은 프레임과 패킷을 내는지, Packet 만
+ * 받은 ff_decode_multi 가 배치 버전을 타도 결과가 같은지 확인하고, 여러 배치에
+ * 걸쳐 프레임 풀을 다시 써도 결과가 같은지 본 뒤, 두 방식의 시간을 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("ff_decode_batch / ff_encode_batch", () => {
+  let libav: LibAVJS.LibAV;
+  let streams: LibAVJS.Stream[];
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    const [fmt_ctx, s] = await libav.ff_init_demuxer_file("in.mp4");
+    streams = s;
+    await libav.avformat_close_input_js(fmt_ctx);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  const streamOf = (type: number) => streams.find((s) => s.codec_type === type)!;
+
+  // 한 스트림의 패킷을 Packet[] 과 PacketBatch 로 읽는다
+  async function readPackets(stream: LibAVJS.Stream, maxPackets: number) {
+    const pkt = await libav.av_packet_alloc();
+    try {
+      const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+      const [, all] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+        index: stream.index,
+        maxPackets,
+      });
+      await libav.avformat_close_input_js(fmt_ctx);
+
+      const [fmt_ctx2] = await libav.ff_init_demuxer_file("in.mp4");
+      const [, batch] = await libav.ff_read_frame_multi(fmt_ctx2, pkt, {
+        index: stream.index,
+        maxPackets,
+        copyoutPacket: "batch",
+      });
+      await libav.avformat_close_input_js(fmt_ctx2);
+
+      return { packets: all[stream.index], batch };
+    } finally {
+      await libav.av_packet_free_js(pkt);
+    }
+  }
+
+  async function withDecoder<T>(
+    stream: LibAVJS.Stream,
+    cb: (c: number, pkt: number, frame: number) => Promise<T>,
+  ) {
+    const [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+    try {
+      return await cb(c, pkt, frame);
+    } finally {
+      await libav.ff_free_decoder(c, pkt, frame);
+    }
+  }
+
+  // AVPacket 포인터로 넘기면 ff_decode_multi 는 패킷을 하나씩 보낸다
+  const asPointers = (packets: LibAVJS.Packet[]) =>
+    Promise.all(
+      packets.map(async (p) => {
+        const ptr = await libav.av_packet_alloc();
+        await libav.ff_copyin_packet(ptr, p);
+        return ptr;
+      }),
+    );
+
+  const summary = (frames: LibAVJS.Frame[]) =>
+    frames.map((f) => ({
+      pts: f.pts,
+      ptshi: f.ptshi,
+      duration: f.duration,
+      key_frame: f.key_frame,
+      pict_type: f.pict_type,
+      width: f.width,
+      height: f.height,
+      nb_samples: f.nb_samples,
+      format: f.format,
+      time_base: [f.time_base_num, f.time_base_den],
+    }));
+
+  const planes = (f: LibAVJS.Frame) =>
+    Array.isArray(f.data)
+      ? (f.data as any[]).map((p: any) =>
+          p instanceof Uint8Array || ArrayBuffer.isView(p)
+            ? Array.from(p as any)
+            : (p as any[]).map((row) => Array.from(row)),
+        )
+      : Array.from(f.data as any);
+
+  it.each([
+    ["video", "video"],
+    ["audio", "default"],
+  ] as const)("%s: ff_decode_multi 와 같은 프레임을 낸다", async (type, copyoutFrame) => {
+    const stream = streamOf(
+      type === "video" ? libav.AVMEDIA_TYPE_VIDEO : libav.AVMEDIA_TYPE_AUDIO,
+    );
+    const { packets, batch } = await readPackets(stream, 60);
+    expect(batch.count).toBe(packets.length);
+
+    const ptrs = await asPointers(packets);
+    let start = performance.now();
+    const ref = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, ptrs, { fin: true, copyoutFrame }),
+    );
+    const multiTime = performance.now() - start;
+
+    const fromMulti = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, packets, { fin: true, copyoutFrame }),
+    );
+
+    start = performance.now();
+    const fromBatch = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_batch(c, pkt, frame, batch, { fin: true, copyoutFrame }),
+    );
+    const batchTime = performance.now() - start;
+
+    const fromArray = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_batch(c, pkt, frame, packets, { fin: true, copyoutFrame }),
+    );
+
+    console.log(
+      `[decode-batch] ${type}: ${ref.length} frames, ` +
+        `ff_decode_multi ${multiTime.toFixed(1)}ms, ` +
+        `ff_decode_batch ${batchTime.toFixed(1)}ms`,
+    );
+
+    expect(ref.length).toBeGreaterThan(0);
+    expect(summary(fromBatch)).toEqual(summary(ref));
+    expect(summary(fromArray)).toEqual(summary(ref));
+    expect(summary(fromMulti)).toEqual(summary(ref));
+    for (const i of [0, ref.length >> 1, ref.length - 1]) {
+      expect(planes(fromMulti[i])).toEqual(planes(ref[i]));
+      expect(planes(fromBatch[i])).toEqual(planes(ref[i]));
+      expect(planes(fromArray[i])).toEqual(planes(ref[i]));
+    }
+  });
+
+  it("여러 배치에 걸쳐 풀을 다시 써도 결과가 같다", async () => {
+    const stream = streamOf(libav.AVMEDIA_TYPE_VIDEO);
+    const { packets } = await readPackets(stream, 60);
+
+    const ptrs = await asPointers(packets);
+    const ref = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, ptrs, {
+        fin: true,
+        copyoutFrame: "video",
+      }),
+    );
+
+    const split = await withDecoder(stream, async (c, pkt, frame) => {
+      const out: LibAVJS.Frame[] = [];
+      for (let i = 0; i < packets.length; i += 7) {
+        out.push(
+          ...(await libav.ff_decode_batch(c, pkt, frame, packets.slice(i, i + 7), {
+            copyoutFrame: "video",
+          })),
+        );
+      }
+      out.push(...(await libav.ff_decode_batch(c, pkt, frame, [], true)));
+      return out;
+    });
+
+    expect(summary(split)).toEqual(summary(ref));
+    expect(planes(split[split.length - 1])).toEqual(planes(ref[ref.length - 1]));
+  });
+
+  it('copyoutFrame: "ptr" 는 풀과 따로 사는 참조를 준다', async () => {
+    const stream = streamOf(libav.AVMEDIA_TYPE_VIDEO);
+    const { batch } = await readPackets(stream, 10);
+
+    await withDecoder(stream, async (c, pkt, frame) => {
+      const ptrs = await libav.ff_decode_batch(c, pkt, frame, batch, {
+        fin: true,
+        copyoutFrame: "ptr",
+      });
+      expect(ptrs.length).toBeGreaterThan(0);
+      expect(new Set(ptrs).size).toBe(ptrs.length);
+      for (const p of ptrs) {
+        expect(await libav.AVFrame_width(p)).toBeGreaterThan(0);
+        expect(await libav.AVFrame_time_base_den(p)).toBeGreaterThan(0);
+        await libav.av_frame_free_js(p);
+      }
+    });
+  });
+
+  it("직접 만든 PacketBatch 도 받는다", async () => {
+    const stream = streamOf(libav.AVMEDIA_TYPE_AUDIO);
+    const { batch } = await readPackets(stream, 30);
+
+    // 필드마다 따로 된 버퍼에, 데이터는 거꾸로 쌓아 오프셋이 뒤섞이게 만든다
+    const sizes = Array.from(batch.size);
+    const data = new Uint8Array(sizes.reduce((n, s) => n + s, 0));
+    const offset = new Int32Array(batch.count);
+    let pos = data.length;
+    for (let i = 0; i < batch.count; i++) {
+      pos -= sizes[i];
+      offset[i] = pos;
+      data.set(batch.data.subarray(batch.offset[i], batch.offset[i] + sizes[i]), pos);
+    }
+    const custom: LibAVJS.PacketBatch = {
+      count: batch.count,
+      data,
+      pts: batch.pts.slice(),
+      dts: batch.dts.slice(),
+      duration: batch.duration.slice(),
+      stream_index: batch.stream_index.slice(),
+      flags: batch.flags.slice(),
+      offset,
+      size: batch.size.slice(),
+      time_base_num: batch.time_base_num.slice(),
+      time_base_den: batch.time_base_den.slice(),
+    };
+
+    const ref = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_batch(c, pkt, frame, batch, true),
+    );
+    const fromCustom = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_batch(c, pkt, frame, custom, true),
+    );
+    expect(summary(fromCustom)).toEqual(summary(ref));
+    expect(fromCustom.map(planes)).toEqual(ref.map(planes));
+  });
+
+  it("ff_encode_batch 는 ff_encode_multi 와 같은 패킷을 낸다", async () => {
+    const stream = streamOf(libav.AVMEDIA_TYPE_AUDIO);
+    const { packets } = await readPackets(stream, 100);
+    const frames = await withDecoder(stream, (c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, packets, true),
+    );
+    const sampleRate = frames[0].sample_rate!;
+
+    async function withEncoder<T>(
+      cb: (c: number, frame: number, pkt: number) => Promise<T>,
+    ) {
+      const [, c, frame, pkt] = await libav.ff_init_encoder("aac", {
+        ctx: {
+          bit_rate: 128000,
+          sample_fmt: libav.AV_SAMPLE_FMT_FLTP,
+          sample_rate: sampleRate,
+          channel_layout: frames[0].channel_layout,
+          channels: frames[0].channels,
+        },
+        time_base: [1, sampleRate],
+      });
+      try {
+        return await cb(c, frame, pkt);
+      } finally {
+        await libav.ff_free_encoder(c, frame, pkt);
+      }
+    }
+
+    let start = performance.now();
+    const ref = await withEncoder((c, frame, pkt) =>
+      libav.ff_encode_multi(c, frame, pkt, frames, true),
+    );
+    const multiTime = performance.now() - start;
+
+    start = performance.now();
+    const batch = await withEncoder(async (c, frame, pkt) => {
+      // 두 번에 나눠 넣어 여분 AVFrame 을 다시 쓴다
+      const half = frames.length >> 1;
+      const first = await libav.ff_encode_batch(c, frame, pkt, frames.slice(0, half));
+      const rest = await libav.ff_encode_batch(c, frame, pkt, frames.slice(half), {
+        fin: true,
+      });
+      return [first, rest];
+    });
+    const batchTime = performance.now() - start;
+
+    console.log(
+      `[decode-batch] encode ${frames.length} frames: ` +
+        `ff_encode_multi ${multiTime.toFixed(1)}ms, ` +
+        `ff_encode_batch ${batchTime.toFixed(1)}ms`,
+    );
+
+    const unpacked = batch.flatMap((b) =>
+      Array.from({ length: b.count }, (_, i) => ({
+        data: Array.from(b.data.subarray(b.offset[i], b.offset[i] + b.size[i])),
+        pts: b.pts[i],
+        time_base: [b.time_base_num[i], b.time_base_den[i]],
+      })),
+    );
+    expect(unpacked.length).toBe(ref.length);
+    expect(unpacked).toEqual(
+      ref.map((p) => ({
+        data: Array.from(p.data),
+        pts: libav.i64tof64(p.pts!, p.ptshi!),
+        time_base: [p.time_base_num, p.time_base_den],
+      })),
+    );
+  });
+});
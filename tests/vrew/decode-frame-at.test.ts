@@ -0,0 +1,138 @@
+/*
+ * ff_decode_frame_at_js (src/p-avformat.in.js) 및 ff_decode_frame_at
+ * (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 전체 스트림을 디코딩해 얻은 프레임 시각과 비교해, exact / keyframe /
+ * next 모드가 각각 올바른 프레임 하나만 돌려주는지 확인하고, 탐색 지연을
+ * 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+interface RefFrame {
+  time: number;
+  key: boolean;
+}
+
+describe("ff_decode_frame_at_js", () => {
+  let libav: LibAVJS.LibAV;
+  let fmt_ctx: number;
+  let stream: LibAVJS.Stream;
+  let c: number, pkt: number, frame: number;
+  // 전체 디코딩으로 얻은 프레임 시각(초), 표시 순서
+  let ref: RefFrame[];
+
+  const toTicks = (t: number) =>
+    Math.round((t * stream.time_base_den) / stream.time_base_num);
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    let streams: LibAVJS.Stream[];
+    [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO)!;
+    [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+    const frames = await libav.ff_decode_multi(
+      c,
+      pkt,
+      frame,
+      packets[stream.index],
+      { fin: true, copyoutFrame: "ptr" },
+    );
+    ref = [];
+    for (const f of frames) {
+      const pts = await libav.AVFrame_pts(f);
+      const num = await libav.AVFrame_time_base_num(f);
+      const den = await libav.AVFrame_time_base_den(f);
+      const key = await libav.AVFrame_key_frame(f);
+      ref.push({ time: (pts * num) / den, key: !!key });
+      await libav.av_frame_free_js(f);
+    }
+    ref.sort((a, b) => a.time - b.time);
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.ff_free_decoder(c, pkt, frame);
+      await libav.avformat_close_input_js(fmt_ctx);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  async function frameTimeAt(t: number, mode: "exact" | "keyframe" | "next") {
+    const f = await libav.ff_decode_frame_at_js(
+      fmt_ctx,
+      c,
+      frame,
+      stream.index,
+      toTicks(t),
+      { mode },
+    );
+    expect(f).not.toBeNull();
+    expect(f!.width).toBeGreaterThan(0);
+    return (f!.pts! * f!.time_base_num!) / f!.time_base_den!;
+  }
+
+  // 기준 프레임 중 t 에서 보이는 것 / t 이전의 키프레임 / t 이후 첫 프레임
+  const shownAt = (t: number) => ref.filter((f) => f.time <= t + 1e-6).pop()!;
+  const keyAt = (t: number) =>
+    ref.filter((f) => f.key && f.time <= t + 1e-6).pop()!;
+  const nextAt = (t: number) => ref.find((f) => f.time >= t - 1e-6)!;
+
+  it.each([0.5, 3.3, 6.01, 9.5])("exact 모드: %s초에 보이는 프레임", async (t) => {
+    expect(await frameTimeAt(t, "exact")).toBeCloseTo(shownAt(t).time, 5);
+  });
+
+  it.each([3.3, 9.5])("keyframe 모드: %s초 이전의 키프레임", async (t) => {
+    expect(await frameTimeAt(t, "keyframe")).toBeCloseTo(keyAt(t).time, 5);
+  });
+
+  it.each([3.3, 6.01])("next 모드: %s초 이후 첫 프레임", async (t) => {
+    expect(await frameTimeAt(t, "next")).toBeCloseTo(nextAt(t).time, 5);
+  });
+
+  it("스트림 끝 너머의 next 는 null 이다", async () => {
+    const f = await libav.ff_decode_frame_at_js(
+      fmt_ctx,
+      c,
+      frame,
+      stream.index,
+      toTicks(60),
+      { mode: "next" },
+    );
+    expect(f).toBeNull();
+  });
+
+  it("탐색 지연", async () => {
+    const times = Array.from({ length: 20 }, (_, i) => (i * 9.7) / 20);
+    const start = performance.now();
+    for (const t of times) await frameTimeAt(t, "exact");
+    const elapsed = performance.now() - start;
+    console.log(
+      `[decode-frame-at] ${(elapsed / times.length).toFixed(1)}ms per exact seek`,
+    );
+  });
+});
@@ -0,0 +1,193 @@
+/*
+ * ff_decode_multi 의 scale 옵션 (src/p-avcodec.in.js)과
+ * ff_decode_receive_scaled_js (src/b-avcodec.c)에 대한 vitest 테스트.
+ *
+ * 디코딩하면서 바로 스케일/픽셀 형식 변환한 결과가, 디코딩 후 JS 에서
+ * sws_scale_frame 을 따로 부르고 packed 로 꺼낸 결과와 같은지 확인하고
+ * (16비트 성분 형식 포함), 두 방식의 시간을 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const WIDTH = 320;
+
+describe("ff_decode_multi scale", () => {
+  let libav: LibAVJS.LibAV;
+  let fmt_ctx: number;
+  let stream: LibAVJS.Stream;
+  let packets: LibAVJS.Packet[];
+  let srcWidth: number, srcHeight: number;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    let streams: LibAVJS.Stream[];
+    [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO)!;
+    srcWidth = await libav.AVCodecParameters_width(stream.codecpar);
+    srcHeight = await libav.AVCodecParameters_height(stream.codecpar);
+    const pkt = await libav.av_packet_alloc();
+    const [, all] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+      index: stream.index,
+      maxPackets: 30,
+    });
+    await libav.av_packet_free_js(pkt);
+    packets = all[stream.index];
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.avformat_close_input_js(fmt_ctx);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  async function withDecoder<T>(cb: (c: number, pkt: number, frame: number) => Promise<T>) {
+    const [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+    try {
+      return await cb(c, pkt, frame);
+    } finally {
+      await libav.ff_free_decoder(c, pkt, frame);
+    }
+  }
+
+  // 기존 방식: 프레임 포인터로 받아 JS 에서 sws_scale_frame 후 packed 로 꺼낸다
+  async function decodeThenScale(format: number, height: number) {
+    return withDecoder(async (c, pkt, frame) => {
+      const ptrs = await libav.ff_decode_multi(c, pkt, frame, packets, {
+        fin: true,
+        copyoutFrame: "ptr",
+      });
+      const sws = await libav.sws_getContext(
+        srcWidth, srcHeight, await libav.AVFrame_format(ptrs[0]),
+        WIDTH, height, format, libav.SWS_BILINEAR, 0, 0, 0,
+      );
+      const dst = await libav.av_frame_alloc();
+      const out: LibAVJS.Frame[] = [];
+      try {
+        for (const p of ptrs) {
+          await libav.av_frame_unref(dst);
+          await libav.AVFrame_width_s(dst, WIDTH);
+          await libav.AVFrame_height_s(dst, height);
+          await libav.AVFrame_format_s(dst, format);
+          expect(await libav.sws_scale_frame(sws, dst, p)).toBeGreaterThanOrEqual(0);
+          out.push(await libav.ff_copyout_frame_video_packed(dst));
+          await libav.av_frame_free_js(p);
+        }
+      } finally {
+        await libav.av_frame_free_js(dst);
+        await libav.sws_freeContext(sws);
+      }
+      return out;
+    });
+  }
+
+  async function decodeScaled(format: number) {
+    return withDecoder((c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, packets, {
+        fin: true,
+        scale: { width: WIDTH, format },
+      }),
+    );
+  }
+
+  it.each([
+    ["RGBA", 4],
+    ["RGB48LE", 6],
+  ])("%s: 따로 스케일한 결과와 같다", async (name, bytesPerPixel) => {
+    const format = (libav as any)[`AV_PIX_FMT_${name}`] as number;
+    const height = Math.round((WIDTH * srcHeight) / srcWidth);
+
+    const fused = await decodeScaled(format);
+    const separate = await decodeThenScale(format, height);
+    expect(fused.length).toBe(separate.length);
+    expect(fused.length).toBeGreaterThan(0);
+
+    for (let i = 0; i < fused.length; i++) {
+      const f = fused[i];
+      expect(f.width).toBe(WIDTH);
+      expect(f.height).toBe(height);
+      expect(f.format).toBe(format);
+      expect(f.layout).toEqual([{ offset: 0, stride: WIDTH * bytesPerPixel }]);
+      expect(f.data.length).toBe(WIDTH * height * bytesPerPixel);
+      // 16비트 성분 형식도 packed 크기를 제대로 계산한다
+      expect(separate[i].data.length).toBe(f.data.length);
+      expect(Buffer.from(f.data).equals(Buffer.from(separate[i].data))).toBe(true);
+      expect(f.pts).toBe(separate[i].pts);
+    }
+  });
+
+  it("형식을 주지 않으면 원래 형식 그대로 packed 로 꺼낸다", async () => {
+    const frames = await withDecoder((c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, packets.slice(0, 5), {
+        fin: true,
+        scale: {},
+      }),
+    );
+    const packed = await withDecoder(async (c, pkt, frame) =>
+      libav.ff_decode_multi(c, pkt, frame, packets.slice(0, 5), {
+        fin: true,
+        copyoutFrame: "video_packed",
+      }),
+    );
+    expect(frames.map((f) => [f.width, f.height, f.format])).toEqual(
+      packed.map((f) => [f.width, f.height, f.format]),
+    );
+    expect(frames[0].layout).toEqual(packed[0].layout);
+    expect(Buffer.from(frames[0].data).equals(Buffer.from(packed[0].data))).toBe(true);
+  });
+
+  it.each(["ptr", "video_lease"] as const)(
+    "copyoutFrame: %s 와 같이 쓰면 에러를 던진다",
+    async (copyoutFrame) => {
+      await expect(
+        withDecoder((c, pkt, frame) =>
+          libav.ff_decode_multi(c, pkt, frame, packets.slice(0, 1), {
+            fin: true,
+            copyoutFrame,
+            scale: {},
+          } as any),
+        ),
+      ).rejects.toThrow(/scale/);
+    },
+  );
+
+  it("시간", async () => {
+    const format = libav.AV_PIX_FMT_RGBA;
+    const height = Math.round((WIDTH * srcHeight) / srcWidth);
+
+    let start = performance.now();
+    await decodeThenScale(format, height);
+    const separateTime = performance.now() - start;
+
+    start = performance.now();
+    const frames = await decodeScaled(format);
+    const fusedTime = performance.now() - start;
+
+    console.log(
+      `[decode-scale] ${frames.length} frames: decode+sws_scale_frame+copyout ` +
+        `${separateTime.toFixed(1)}ms, fused ${fusedTime.toFixed(1)}ms`,
+    );
+  });
+});
@@ -0,0 +1,172 @@
+/*
+ * 파일 도우미의 *_ctx 버전 (src/b-avformat.c) 과 ff_stream_info_snapshot /
+ * ff_stream_info_restore, ff_init_demuxer_file 의 streamInfo 옵션
+ * (src/p-avformat.in.js)에 대한 vitest 테스트.
+ *
+ * 한 번 연 AVFormatContext 하나로 여러 작업을 차례로 돌려도 파일 이름으로
+ * 매번 새로 여는 것과 같은 결과가 나오는지, 스냅샷으로 다시 열면 프로빙 없이
+ * 같은 스트림 정보를 얻는지 확인하고, 열기 시간을 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("demuxer sessions", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  async function readAndUnlink(filename: string) {
+    const data = await libav.readFile(filename);
+    await libav.unlink(filename);
+    return Array.from(data);
+  }
+
+  it("한 컨텍스트로 여러 작업을 돌려도 파일 이름 버전과 같다", async () => {
+    expect(await libav.ff_extract_audio("in.mp4", "file.m4a", 0)).toBe(0);
+    expect(await libav.ff_convert_audio_to_mp3("in.mp4", "file.mp3", 2, 128000, 0)).toBe(0);
+    expect(await libav.ff_slice_audio("in.mp4", "file-slice.mp4", 2, 3)).toBe(0);
+
+    const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+    try {
+      // 길이 측정이 파일 끝에 남겨 둔 위치에서도 처음부터 다시 읽는다
+      expect(await libav.ff_get_media_duration(fmt_ctx)).toBeGreaterThan(9.5);
+      expect(await libav.ff_extract_audio_ctx(fmt_ctx, "ctx.m4a", 0)).toBe(0);
+      expect(await libav.ff_slice_audio_ctx(fmt_ctx, "ctx-slice.mp4", 2, 3)).toBe(0);
+      expect(await libav.ff_convert_audio_to_mp3_ctx(fmt_ctx, "ctx.mp3", 2, 128000, 0)).toBe(0);
+      // 같은 작업을 두 번 해도 같다
+      expect(await libav.ff_extract_audio_ctx(fmt_ctx, "ctx2.m4a", 0)).toBe(0);
+    } finally {
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+
+    const extracted = await readAndUnlink("file.m4a");
+    expect(await readAndUnlink("ctx.m4a")).toEqual(extracted);
+    expect(await readAndUnlink("ctx2.m4a")).toEqual(extracted);
+    expect(await readAndUnlink("ctx.mp3")).toEqual(await readAndUnlink("file.mp3"));
+    expect(await readAndUnlink("ctx-slice.mp4")).toEqual(
+      await readAndUnlink("file-slice.mp4"),
+    );
+  });
+
+  it("JS 도우미도 컨텍스트를 받는다", async () => {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+    try {
+      const { ret } = await libav.ff_transcode_audio_js(fmt_ctx, "ctx.wav", {
+        encoder: "pcm_s16le",
+      });
+      expect(ret).toBe(0);
+      expect(
+        await libav.ff_extract_audio_multi(fmt_ctx, ["ctx-multi.mp4"]),
+      ).toBe(0);
+      expect(await libav.convert_to_hls_ctx(fmt_ctx, "ctx.m3u8")).toBe(0);
+    } finally {
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+
+    const { ret } = await libav.ff_transcode_audio_js("in.mp4", "file.wav", {
+      encoder: "pcm_s16le",
+    });
+    expect(ret).toBe(0);
+    expect(await readAndUnlink("ctx.wav")).toEqual(await readAndUnlink("file.wav"));
+    expect((await readAndUnlink("ctx-multi.mp4")).length).toBeGreaterThan(0);
+    const playlist = new TextDecoder().decode(
+      new Uint8Array(await readAndUnlink("ctx.m3u8")),
+    );
+    expect(playlist).toContain("#EXT-X-ENDLIST");
+  });
+
+  it("스냅샷으로 다시 열면 프로빙 없이 같은 스트림 정보를 얻는다", async () => {
+    let start = performance.now();
+    const [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    const probeTime = performance.now() - start;
+    const info = await libav.ff_stream_info_snapshot(fmt_ctx);
+    expect(info).not.toBe(0);
+    const duration = await libav.ff_get_media_duration(fmt_ctx);
+    await libav.avformat_close_input_js(fmt_ctx);
+
+    try {
+      start = performance.now();
+      const fmt_ctx2 = await libav.avformat_open_input_js("in.mp4", 0, 0);
+      expect(await libav.ff_stream_info_restore(fmt_ctx2, info)).toBe(1);
+      const restoreTime = performance.now() - start;
+      console.log(
+        `[demuxer-session] open+probe ${probeTime.toFixed(1)}ms, ` +
+          `open+restore ${restoreTime.toFixed(1)}ms`,
+      );
+      await libav.avformat_close_input_js(fmt_ctx2);
+
+      const [fmt_ctx3, streams3] = await libav.ff_init_demuxer_file(
+        "in.mp4",
+        undefined,
+        { streamInfo: info },
+      );
+      try {
+        expect(streams3.map((s) => [s.codec_type, s.codec_id, s.duration])).toEqual(
+          streams.map((s) => [s.codec_type, s.codec_id, s.duration]),
+        );
+        for (let i = 0; i < streams.length; i++) {
+          const [a, b] = [streams[i].codecpar, streams3[i].codecpar];
+          expect(await libav.AVCodecParameters_sample_rate(b)).toBe(
+            await libav.AVCodecParameters_sample_rate(a),
+          );
+          expect(await libav.AVCodecParameters_width(b)).toBe(
+            await libav.AVCodecParameters_width(a),
+          );
+          expect(await libav.AVCodecParameters_height(b)).toBe(
+            await libav.AVCodecParameters_height(a),
+          );
+        }
+        expect(await libav.ff_get_media_duration(fmt_ctx3)).toBe(duration);
+        expect(await libav.ff_convert_audio_to_mp3_ctx(fmt_ctx3, "restored.mp3", 2, 128000, 0)).toBe(0);
+        expect((await readAndUnlink("restored.mp3")).length).toBeGreaterThan(0);
+      } finally {
+        await libav.avformat_close_input_js(fmt_ctx3);
+      }
+    } finally {
+      await libav.ff_stream_info_free(info);
+    }
+  });
+
+  it("다른 파일의 스냅샷은 쓰지 않고 프로빙한다", async () => {
+    expect(await libav.ff_convert_audio_to_mp3("in.mp4", "other.mp3", 2, 128000, 0)).toBe(0);
+    const [mp3_ctx] = await libav.ff_init_demuxer_file("other.mp3");
+    const [mp4_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    await libav.avformat_close_input_js(mp4_ctx);
+    const info = await libav.ff_stream_info_snapshot(mp3_ctx);
+    await libav.avformat_close_input_js(mp3_ctx);
+
+    try {
+      const fmt_ctx = await libav.avformat_open_input_js("in.mp4", 0, 0);
+      expect(await libav.ff_stream_info_restore(fmt_ctx, info)).toBe(0);
+      expect(await libav.AVFormatContext_nb_streams(fmt_ctx)).toBe(streams.length);
+      await libav.avformat_close_input_js(fmt_ctx);
+    } finally {
+      await libav.ff_stream_info_free(info);
+      await libav.unlink("other.mp3");
+    }
+  });
+});
@@ -0,0 +1,97 @@
+/*
+ * ff_extract_audio_multi (src/p-avformat.in.js) 및 이 함수가 구동하는
+ * ff_extract_audio_streams (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * tests/files/bbb_input.mp4 (10초, 비디오 + AAC 오디오)에서 한 번의 읽기로
+ * 오디오 스트림을 추출한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+// 파일의 스트림 종류 목록과 전체 패킷 수
+async function probe(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const [, batch] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+      copyoutPacket: "batch",
+      maxPackets: Infinity,
+    });
+    return {
+      types: streams.map((s) => s.codec_type),
+      packets: batch.count,
+    };
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+describe("ff_extract_audio_multi", () => {
+  let libav: LibAVJS.LibAV;
+  let audioIndex: number;
+  let videoIndex: number;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    const { types } = await probe(libav, "in.mp4");
+    audioIndex = types.indexOf(libav.AVMEDIA_TYPE_AUDIO);
+    videoIndex = types.indexOf(libav.AVMEDIA_TYPE_VIDEO);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("ff_extract_audio와 같은 결과를 출력한다", async () => {
+    expect(await libav.ff_extract_audio("in.mp4", "single.mp4", 0)).toBe(0);
+    expect(
+      await libav.ff_extract_audio_multi("in.mp4", ["multi.mp4"], {
+        streams: [audioIndex],
+      }),
+    ).toBe(0);
+
+    const single = await probe(libav, "single.mp4");
+    const multi = await probe(libav, "multi.mp4");
+    expect(multi.types).toEqual([libav.AVMEDIA_TYPE_AUDIO]);
+    expect(multi.packets).toBeGreaterThan(0);
+    expect(multi.packets).toBe(single.packets);
+
+    await libav.unlink("single.mp4");
+    await libav.unlink("multi.mp4");
+  });
+
+  it("오디오가 아닌 스트림을 지정하면 음수 에러를 반환한다", async () => {
+    const ret = await libav.ff_extract_audio_multi("in.mp4", ["video.mp4"], {
+      streams: [videoIndex],
+    });
+    expect(ret).toBeLessThan(0);
+  });
+
+  it("오디오 스트림보다 출력이 많으면 음수 에러를 반환한다", async () => {
+    const ret = await libav.ff_extract_audio_multi("in.mp4", [
+      "a0.mp4",
+      "a1.mp4",
+    ]);
+    expect(ret).toBeLessThan(0);
+  });
+});
@@ -0,0 +1,132 @@
+/*
+ * ff_copyout_frame_video_lease / ff_release_frame / ff_leased_frames
+ * (src/p-avframe.in.js)에 대한 vitest 테스트.
+ *
+ * 빌린 프레임이 복사본과 같은 픽셀을 힙에서 바로 보여 주는지, 반납하기
+ * 전까지 목록에 남는지, 반납하거나 힙이 커진 뒤에는 data 를 읽을 때 오류가
+ * 나는지 확인하고, 복사 방식과 시간을 비교한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("frame leases", () => {
+  let libav: LibAVJS.LibAV;
+  let fmt_ctx: number;
+  let stream: LibAVJS.Stream;
+  let packets: LibAVJS.Packet[];
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    let streams: LibAVJS.Stream[];
+    [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO)!;
+    const pkt = await libav.av_packet_alloc();
+    const [, all] = await libav.ff_read_frame_multi(fmt_ctx, pkt, { limit: 2 * 1024 * 1024 });
+    await libav.av_packet_free_js(pkt);
+    packets = all[stream.index];
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.avformat_close_input_js(fmt_ctx);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  async function decode(copyoutFrame: "video" | "video_lease") {
+    const [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+    try {
+      return await libav.ff_decode_multi(c, pkt, frame, packets, {
+        fin: true,
+        copyoutFrame,
+      });
+    } finally {
+      await libav.ff_free_decoder(c, pkt, frame);
+    }
+  }
+
+  it("빌린 프레임은 복사본과 같은 픽셀을 보여 주고, 반납하면 목록에서 빠진다", async () => {
+    const copied = await decode("video");
+    const leased = await decode("video_lease");
+    try {
+      expect(leased.length).toBe(copied.length);
+      expect(leased.length).toBeGreaterThan(0);
+      for (let i = 0; i < leased.length; i++) {
+        expect(leased[i].lease).toBeGreaterThan(0);
+        expect(leased[i].libavjsTransfer).toEqual([]);
+        expect(leased[i].pts).toBe(copied[i].pts);
+        // 레이아웃이 같으면 바이트도 같다
+        expect(leased[i].layout).toEqual(copied[i].layout);
+        expect(Buffer.from(leased[i].data).equals(Buffer.from(copied[i].data))).toBe(true);
+      }
+
+      const outstanding = await libav.ff_leased_frames();
+      expect(outstanding.map((l) => l.lease).sort((a, b) => a - b)).toEqual(
+        leased.map((f) => f.lease!).sort((a, b) => a - b),
+      );
+      expect(outstanding[0].width).toBe(leased[0].width);
+    } finally {
+      for (const f of leased) await libav.ff_release_frame(f);
+    }
+
+    expect(await libav.ff_leased_frames()).toEqual([]);
+    expect(() => leased[0].data).toThrow(/released/);
+    await expect(async () => libav.ff_release_frame(leased[0].lease!)).rejects.toThrow();
+  });
+
+  it("힙이 커지면 data 를 읽을 때 오류가 난다", async () => {
+    const [f] = await decode("video_lease");
+    const view = f.data as Uint8Array;
+    // 힙을 키우도록 큰 블록을 잡는다
+    const big = await libav.malloc(256 * 1024 * 1024);
+    try {
+      if (view.length === 0) {
+        expect(() => f.data).toThrow(/heap growth/);
+      } else {
+        // 공유 힙이거나 이미 충분히 커서 뷰가 그대로 유효하다
+        expect(f.data).toBe(view);
+      }
+    } finally {
+      if (big) await libav.free(big);
+      await libav.ff_release_frame(f.lease!);
+    }
+  });
+
+  it("복사 시간", async () => {
+    let start = performance.now();
+    await decode("video");
+    const copyTime = performance.now() - start;
+
+    start = performance.now();
+    const leased = await decode("video_lease");
+    const leaseTime = performance.now() - start;
+    for (const f of leased) await libav.ff_release_frame(f);
+
+    console.log(
+      `[frame-lease] ${leased.length} frames: copy ${copyTime.toFixed(1)}ms, ` +
+        `lease ${leaseTime.toFixed(1)}ms`,
+    );
+  });
+});
@@ -0,0 +1,180 @@
+/*
+ * ff_frame_server_* (src/b-avformat.c) 및 ff_frame_server_get_frame_js /
+ * ff_frame_server_stats_js (src/p-avformat.in.js)에 대한 vitest 테스트.
+ *
+ * 같은 구간을 앞뒤로 오가며 프레임을 요청할 때 캐시에서 답하는지, 고른
+ * 프레임이 전체 디코딩 결과와 같은지, 메모리 한도를 넘지 않고 밀어내는지,
+ * 그리고 백그라운드 프리페치가 다음 프레임들을 미리 채우는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("ff_frame_server", () => {
+  let libav: LibAVJS.LibAV;
+  let fmt_ctx: number;
+  let stream: LibAVJS.Stream;
+  let c: number, pkt: number, frame: number;
+  // 전체 디코딩으로 얻은 프레임 시각(초), 표시 순서
+  let ref: number[];
+
+  const toTicks = (t: number) =>
+    Math.round((t * stream.time_base_den) / stream.time_base_num);
+  const shownAt = (t: number) => ref.filter((f) => f <= t + 1e-6).pop()!;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    let streams: LibAVJS.Stream[];
+    [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO)!;
+    [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+    const frames = await libav.ff_decode_multi(
+      c,
+      pkt,
+      frame,
+      packets[stream.index],
+      { fin: true },
+    );
+    ref = frames
+      .map((f) => (f.pts! * f.time_base_num!) / f.time_base_den!)
+      .sort((a, b) => a - b);
+    await libav.avcodec_flush_buffers(c);
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.ff_free_decoder(c, pkt, frame);
+      await libav.avformat_close_input_js(fmt_ctx);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  async function timeAt(fsrv: number, t: number, prefetch = 0) {
+    const f = await libav.ff_frame_server_get_frame_js(fsrv, frame, toTicks(t), {
+      prefetch,
+    });
+    expect(f).not.toBeNull();
+    expect(f!.width).toBeGreaterThan(0);
+    return (f!.pts! * f!.time_base_num!) / f!.time_base_den!;
+  }
+
+  it("앞뒤로 오가는 요청은 캐시에서 답한다", async () => {
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 256 << 20);
+    try {
+      const times = [2.0, 2.1, 2.3, 2.05, 2.2, 2.0, 2.3];
+      for (const t of times) expect(await timeAt(fsrv, t)).toBeCloseTo(shownAt(t), 5);
+
+      const stats = await libav.ff_frame_server_stats_js(fsrv);
+      expect(stats.hits + stats.misses).toBe(times.length);
+      // 처음 2.0 과 그 뒤로 처음 가는 2.1, 2.3 만 디코딩이 필요하다
+      expect(stats.misses).toBeLessThanOrEqual(3);
+      expect(stats.frames).toBeGreaterThan(0);
+      expect(stats.memory).toBeLessThanOrEqual(stats.memoryLimit);
+    } finally {
+      await libav.ff_frame_server_close(fsrv);
+    }
+  });
+
+  it("메모리 한도를 넘지 않고 오래된 프레임을 밀어낸다", async () => {
+    // 프레임 몇 장 분량만
+    const limit = 4 * 1024 * 1024;
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, limit);
+    try {
+      for (const t of [1, 3, 5, 7, 9, 0.5]) {
+        expect(await timeAt(fsrv, t)).toBeCloseTo(shownAt(t), 5);
+        const stats = await libav.ff_frame_server_stats_js(fsrv);
+        expect(stats.memory).toBeLessThanOrEqual(limit);
+      }
+      expect((await libav.ff_frame_server_stats_js(fsrv)).evictions).toBeGreaterThan(0);
+    } finally {
+      await libav.ff_frame_server_close(fsrv);
+    }
+  });
+
+  it("캐시가 한 장도 못 담아도 요청한 프레임을 돌려준다", async () => {
+    // 프레임 한 장보다 작은 한도: 다음 프레임을 넣을 때마다 앞 프레임이 밀려난다
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 1);
+    try {
+      for (const t of [2.0, 2.1, 0.5, 6.3]) expect(await timeAt(fsrv, t)).toBeCloseTo(shownAt(t), 5);
+    } finally {
+      await libav.ff_frame_server_close(fsrv);
+    }
+  });
+
+  it("프리페치 도중에 닫아도 프리페치가 끝난 뒤에 해제한다", async () => {
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 256 << 20);
+    await timeAt(fsrv, 4, 1);
+    // 프리페치 단계가 큐에 있는 채로 바로 닫는다
+    await libav.ff_frame_server_close(fsrv);
+
+    // 디코더는 그대로 쓸 수 있어야 한다
+    const fsrv2 = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 256 << 20);
+    try {
+      expect(await timeAt(fsrv2, 1)).toBeCloseTo(shownAt(1), 5);
+    } finally {
+      await libav.ff_frame_server_close(fsrv2);
+    }
+  });
+
+  it("프리페치가 다음 프레임을 미리 채운다", async () => {
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 256 << 20);
+    try {
+      await timeAt(fsrv, 4, 4);
+      // 백그라운드 프리페치가 돌 때까지 기다린다
+      let before = await libav.ff_frame_server_stats_js(fsrv);
+      for (let i = 0; i < 100 && before.prefetched < 3; i++) {
+        await new Promise((resolve) => setTimeout(resolve, 10));
+        before = await libav.ff_frame_server_stats_js(fsrv);
+      }
+      expect(before.prefetched).toBeGreaterThan(0);
+
+      // 요청한 프레임 바로 다음 것은 요청 중에 이미 디코딩되므로 그 뒤를 본다
+      const next = ref[ref.findIndex((f) => f > 4 + 1e-6) + 2];
+      expect(await timeAt(fsrv, next)).toBeCloseTo(next, 5);
+      const after = await libav.ff_frame_server_stats_js(fsrv);
+      expect(after.hits).toBe(before.hits + 1);
+    } finally {
+      await libav.ff_frame_server_close(fsrv);
+    }
+  });
+
+  it("반복 조회 지연", async () => {
+    const fsrv = await libav.ff_frame_server_alloc(fmt_ctx, c, stream.index, 256 << 20);
+    try {
+      const times = Array.from({ length: 40 }, (_, i) => 3 + ((i * 7) % 20) / 20);
+      const start = performance.now();
+      for (const t of times) await timeAt(fsrv, t);
+      const elapsed = performance.now() - start;
+      const stats = await libav.ff_frame_server_stats_js(fsrv);
+      console.log(
+        `[frame-server] ${(elapsed / times.length).toFixed(1)}ms per frame, ` +
+          `${stats.hits} hits / ${stats.misses} misses`,
+      );
+    } finally {
+      await libav.ff_frame_server_close(fsrv);
+    }
+  });
+});
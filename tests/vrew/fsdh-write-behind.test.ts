@@ -0,0 +1,175 @@
+/*
+ * mkfsdhdir 의 write-behind 버퍼 (src/p-avformat.in.js)와
+ * libavjs_wait_writer 역압 (patches/ffmpeg/13-blocking-writer.diff)에 대한
+ * vitest 테스트.
+ *
+ * 쓰기가 느린 가짜 FileSystemDirectoryHandle 에 maxMemory 보다 큰 파일을
+ * 먹싱해, 버퍼가 한도를 넘으면 먹서가 EAGAIN 으로 멈췄다가 쓰기가 끝나면
+ * 다시 이어 가는지, 버퍼가 한도를 넘지 않는지, syncfsdhdir 가 남은 데이터를
+ * 모두 써서 결과가 MEMFS 에 쓴 것과 같은지 확인한다. C 헬퍼
+ * (ff_transcode_audio_js)와 공개 먹싱 API (ff_init_muxer + ff_write_multi +
+ * av_write_trailer) 양쪽을 본다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const delay = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+/* 파일 하나짜리 가짜 디렉터리 핸들. createSyncAccessHandle 은 없으므로
+ * createWritable 경로를 타고, 쓰기마다 조금씩 기다려 디스크를 흉내 낸다. */
+function mockDirHandle() {
+  const files: Record<string, Uint8Array> = {};
+  const fileHandle = (name: string) => ({
+    kind: "file",
+    name,
+    async createSyncAccessHandle(): Promise<never> {
+      throw new Error("not supported");
+    },
+    async createWritable() {
+      return {
+        async write(op: { position: number; data: Uint8Array }) {
+          await delay(2);
+          const end = op.position + op.data.length;
+          let buf = files[name];
+          if (end > buf.length) {
+            const grown = new Uint8Array(end);
+            grown.set(buf);
+            buf = files[name] = grown;
+          }
+          buf.set(op.data, op.position);
+        },
+        async close() {},
+      };
+    },
+  });
+  const dir = {
+    kind: "directory",
+    files,
+    async getDirectoryHandle(): Promise<typeof dir> {
+      return dir;
+    },
+    async getFileHandle(name: string) {
+      if (!files[name]) files[name] = new Uint8Array(0);
+      return fileHandle(name);
+    },
+    async removeEntry(name: string) {
+      delete files[name];
+    },
+    async *values() {},
+  };
+  return dir;
+}
+
+describe("mkfsdhdir write-behind", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // in.mp4 의 모든 패킷을 공개 먹싱 API 로 filename 에 그대로 다시 먹싱한다
+  async function remux(filename: string) {
+    const [ifmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    const pkt = await libav.av_packet_alloc();
+    try {
+      const [, packets] = await libav.ff_read_frame_multi(ifmt_ctx, pkt, {
+        unify: true,
+        maxPackets: Infinity,
+      });
+      const [oc, , pb] = await libav.ff_init_muxer(
+        { filename, open: true, codecpars: true },
+        streams.map((s) => [s.codecpar, s.time_base_num, s.time_base_den]),
+      );
+      expect(await libav.avformat_write_header(oc, 0)).toBeGreaterThanOrEqual(0);
+      await libav.ff_write_multi(oc, pkt, packets[0]);
+      expect(await libav.av_write_trailer(oc)).toBe(0);
+      await libav.ff_free_muxer(oc, pb);
+    } finally {
+      await libav.av_packet_free_js(pkt);
+      await libav.avformat_close_input_js(ifmt_ctx);
+    }
+  }
+
+  it("공개 먹싱 API 로 한도를 넘겨 써도 기다렸다 이어 간다", async () => {
+    await remux("ref.mp4");
+    const ref = await libav.readFile("ref.mp4");
+    await libav.unlink("ref.mp4");
+
+    const maxMemory = 256 * 1024;
+    expect(ref.length).toBeGreaterThan(4 * maxMemory);
+
+    const dir = mockDirHandle();
+    await libav.mkfsdhdir("mux", dir as unknown as FileSystemDirectoryHandle, {
+      blockSize: 64 * 1024,
+      maxMemory,
+    });
+    try {
+      await remux("/mux/out.mp4");
+
+      const stats = await libav.fsdhstats("mux");
+      expect(stats.stalls).toBeGreaterThan(0);
+      expect(stats.peakBuffered).toBeLessThanOrEqual(maxMemory);
+
+      await libav.syncfsdhdir("mux");
+      expect(dir.files["out.mp4"]).toEqual(ref);
+    } finally {
+      await libav.unlinkfsdhdir("mux");
+    }
+  });
+
+  it("한도를 넘으면 먹서가 기다렸다 이어 가고, syncfsdhdir 가 다 쓴다", async () => {
+    const opts = { encoder: "pcm_s16le" };
+    expect((await libav.ff_transcode_audio_js("in.mp4", "ref.wav", opts)).ret).toBe(0);
+    const ref = await libav.readFile("ref.wav");
+    await libav.unlink("ref.wav");
+
+    const maxMemory = 256 * 1024;
+    // 출력이 한도의 몇 배는 되어야 역압이 걸린다
+    expect(ref.length).toBeGreaterThan(4 * maxMemory);
+
+    const dir = mockDirHandle();
+    await libav.mkfsdhdir("fsdh", dir as unknown as FileSystemDirectoryHandle, {
+      blockSize: 64 * 1024,
+      maxMemory,
+    });
+    try {
+      expect((await libav.ff_transcode_audio_js("in.mp4", "/fsdh/out.wav", opts)).ret).toBe(0);
+
+      const stats = await libav.fsdhstats("fsdh");
+      expect(stats.stalls).toBeGreaterThan(0);
+      expect(stats.peakBuffered).toBeLessThanOrEqual(maxMemory);
+      expect(stats.bytesWritten).toBeGreaterThanOrEqual(ref.length);
+      // 이어 붙는 쓰기는 블록 하나로 합쳐진다
+      expect(stats.merged).toBeGreaterThan(0);
+      expect(stats.flushes).toBeLessThan(stats.writes);
+
+      await libav.syncfsdhdir("fsdh");
+      expect((await libav.fsdhstats("fsdh")).buffered).toBe(0);
+      expect(dir.files["out.wav"]).toEqual(ref);
+    } finally {
+      await libav.unlinkfsdhdir("fsdh");
+    }
+  });
+});
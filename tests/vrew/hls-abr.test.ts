@@ -0,0 +1,156 @@
+/*
+ * convert_to_hls_abr (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * tests/files/bbb_input.mp4 (10초, 비디오 + AAC 오디오)를 한 번 디코딩해
+ * 여러 해상도의 H.264 렌디션과 하나의 AAC 렌디션으로 이루어진 HLS ABR
+ * 래더를 만든다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+async function readText(libav: LibAVJS.LibAV, filename: string) {
+  return new TextDecoder().decode(await libav.readFile(filename));
+}
+
+// 모든 패킷의 타임스탬프를 shift 초만큼 미뤄 start_time 이 0 이 아닌 파일을 만든다
+async function writeShifted(
+  libav: LibAVJS.LibAV,
+  inFilename: string,
+  outFilename: string,
+  shift: number,
+) {
+  const [ifmt_ctx, streams] = await libav.ff_init_demuxer_file(inFilename);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const [, packets] = await libav.ff_read_frame_multi(ifmt_ctx, pkt, {
+      unify: true,
+      maxPackets: Infinity,
+    });
+    const [oc, , pb] = await libav.ff_init_muxer(
+      { filename: outFilename, open: true, codecpars: true },
+      streams.map((s) => [s.codecpar, s.time_base_num, s.time_base_den]),
+    );
+    await libav.avformat_write_header(oc, 0);
+    for (const p of packets[0]) {
+      const offset = Math.round((shift * p.time_base_den!) / p.time_base_num!);
+      [p.pts, p.ptshi] = libav.f64toi64(libav.i64tof64(p.pts!, p.ptshi!) + offset);
+      [p.dts, p.dtshi] = libav.f64toi64(libav.i64tof64(p.dts!, p.dtshi!) + offset);
+    }
+    await libav.ff_write_multi(oc, pkt, packets[0]);
+    await libav.av_write_trailer(oc);
+    await libav.ff_free_muxer(oc, pb);
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(ifmt_ctx);
+  }
+}
+
+// 렌디션의 init 세그먼트와 첫 미디어 세그먼트로 첫 패킷의 시각(초)을 얻는다
+async function firstPacketTime(libav: LibAVJS.LibAV, v: number) {
+  const init = await libav.readFile(`init_${v}.mp4`);
+  const seg = await libav.readFile(`stream_${v}_00000.m4s`);
+  const joined = new Uint8Array(init.length + seg.length);
+  joined.set(init);
+  joined.set(seg, init.length);
+  await libav.writeFile(`first_${v}.mp4`, joined);
+
+  const [fmt_ctx] = await libav.ff_init_demuxer_file(`first_${v}.mp4`);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+      unify: true,
+      maxPackets: 1,
+    });
+    const p = packets[0][0];
+    return (libav.i64tof64(p.pts!, p.ptshi!) * p.time_base_num!) / p.time_base_den!;
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+    await libav.unlink(`first_${v}.mp4`);
+  }
+}
+
+describe("convert_to_hls_abr", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("렌디션마다 variant 플레이리스트를, 전체로 마스터 플레이리스트를 쓴다", async () => {
+    const ret = await libav.convert_to_hls_abr(
+      "in.mp4",
+      "master.m3u8",
+      "320x180@300k,0x144@150k",
+      96000,
+      0,
+    );
+    expect(ret).toBe(0);
+
+    const master = await readText(libav, "master.m3u8");
+    const variants = master.match(/#EXT-X-STREAM-INF:[^\n]*/g) || [];
+    expect(variants.length).toBe(2);
+    expect(master).toContain("RESOLUTION=320x180");
+    expect(master).toMatch(/RESOLUTION=\d+x144/);
+    // 오디오는 하나의 렌디션으로 모든 비디오 렌디션이 공유한다.
+    expect(master).toMatch(/#EXT-X-MEDIA:TYPE=AUDIO[^\n]*GROUP-ID="aud"/);
+
+    for (const v of [0, 1, 2]) {
+      const playlist = await readText(libav, `stream_${v}.m3u8`);
+      expect(playlist).toContain("#EXT-X-ENDLIST");
+      expect(playlist).toContain(`init_${v}.mp4`);
+      expect(playlist).toMatch(new RegExp(`stream_${v}_\\d{5}\\.m4s`));
+    }
+  }, 120000);
+
+  it("start_time 이 0 이 아닌 입력도 오디오와 비디오가 맞는다", async () => {
+    await writeShifted(libav, "in.mp4", "shifted.mkv", 5);
+    const ret = await libav.convert_to_hls_abr(
+      "shifted.mkv",
+      "shifted.m3u8",
+      "320x180@300k",
+      96000,
+      0,
+    );
+    expect(ret).toBe(0);
+
+    // 렌디션 0 은 비디오, 1 은 오디오
+    const video = await firstPacketTime(libav, 0);
+    const audio = await firstPacketTime(libav, 1);
+    expect(Math.abs(audio - video)).toBeLessThan(0.1);
+    await libav.unlink("shifted.mkv");
+  }, 120000);
+
+  it("잘못된 래더는 음수 에러를 반환한다", async () => {
+    const ret = await libav.convert_to_hls_abr(
+      "in.mp4",
+      "bad.m3u8",
+      "320by180",
+      0,
+      0,
+    );
+    expect(ret).toBeLessThan(0);
+  });
+});
@@ -0,0 +1,168 @@
+/*
+ * convert_to_hls_streaming (src/p-avformat.in.js) 및 이 함수가 구동하는
+ * convert_to_hls_cb (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 세그먼트가 완성될 때마다 onhlssegment 로 전달되고 MEMFS 에서 지워지는지,
+ * mkfsdhdir 마운트에서 닫히는 중인 플레이리스트를 먹서가 다시 열어도 파일
+ * 하나에 쓰기 핸들이 둘 열리지 않고 최종본이 남는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const delay = (ms: number) => new Promise((resolve) => setTimeout(resolve, ms));
+
+/* 쓰기와 닫기가 느린 가짜 디렉터리 핸들. 파일마다 동시에 열린 쓰기 핸들의
+ * 최대 개수를 기록한다. */
+function mockDirHandle() {
+  const files: Record<string, Uint8Array> = {};
+  const open: Record<string, number> = {};
+  let maxOpen = 0;
+  const fileHandle = (name: string) => ({
+    kind: "file",
+    name,
+    async createSyncAccessHandle(): Promise<never> {
+      throw new Error("not supported");
+    },
+    async createWritable() {
+      open[name] = (open[name] || 0) + 1;
+      maxOpen = Math.max(maxOpen, open[name]);
+      return {
+        async write(op: { position: number; data: Uint8Array }) {
+          await delay(1);
+          const end = op.position + op.data.length;
+          let buf = files[name];
+          if (end > buf.length) {
+            const grown = new Uint8Array(end);
+            grown.set(buf);
+            buf = files[name] = grown;
+          }
+          buf.set(op.data, op.position);
+        },
+        async close() {
+          await delay(5);
+          open[name]--;
+        },
+      };
+    },
+  });
+  const dir = {
+    kind: "directory",
+    files,
+    open,
+    get maxOpen() {
+      return maxOpen;
+    },
+    async getDirectoryHandle(): Promise<typeof dir> {
+      return dir;
+    },
+    async getFileHandle(name: string) {
+      if (!files[name]) files[name] = new Uint8Array(0);
+      return fileHandle(name);
+    },
+    async removeEntry(name: string) {
+      delete files[name];
+    },
+    async *values() {},
+  };
+  return dir;
+}
+
+describe("convert_to_hls_streaming", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("완성된 파일을 즉시 전달하고 메모리에서 지운다", async () => {
+    const received: { name: string; size: number }[] = [];
+    let lastPlaylist = "";
+    libav.onhlssegment = (name, data) => {
+      expect(data).not.toBeNull();
+      received.push({ name, size: data!.length });
+      if (name.endsWith(".m3u8"))
+        lastPlaylist = new TextDecoder().decode(data!);
+    };
+
+    const ret = await libav.convert_to_hls_streaming("in.mp4", "out.m3u8");
+    libav.onhlssegment = undefined;
+    expect(ret).toBe(0);
+
+    const segments = received.filter((r) => r.name.endsWith(".m4s"));
+    expect(segments.length).toBeGreaterThan(1);
+    expect(segments.every((s) => s.size > 0)).toBe(true);
+    expect(received.some((r) => r.name.endsWith("init.mp4"))).toBe(true);
+    // 전달된 파일은 MEMFS 에 남아 있지 않아야 한다.
+    for (const name of new Set(received.map((r) => r.name)))
+      await expect(libav.readFile(name)).rejects.toBeDefined();
+
+    // 마지막으로 받은 플레이리스트가 최종본이며, 모든 세그먼트를 가리킨다.
+    expect(lastPlaylist).toContain("#EXT-X-ENDLIST");
+    for (const s of segments)
+      expect(lastPlaylist).toContain(path.basename(s.name));
+  }, 60000);
+
+  it("fsdh 마운트에서 다시 열린 플레이리스트를 잃지 않는다", async () => {
+    const dir = mockDirHandle();
+    await libav.mkfsdhdir("hls", dir as unknown as FileSystemDirectoryHandle);
+    const received: string[] = [];
+    libav.onhlssegment = (name, data) => {
+      expect(data).toBeNull();
+      received.push(name);
+    };
+    try {
+      expect(await libav.convert_to_hls_streaming("in.mp4", "/hls/live.m3u8")).toBe(0);
+    } finally {
+      libav.onhlssegment = undefined;
+    }
+
+    // 플레이리스트는 여러 번 다시 쓰였지만, 쓰기 핸들은 한 번에 하나씩 열렸다
+    expect(received.filter((name) => name.endsWith(".m3u8")).length).toBeGreaterThan(1);
+    expect(dir.maxOpen).toBe(1);
+    expect(Object.values(dir.open).every((n) => n === 0)).toBe(true);
+
+    const playlist = new TextDecoder().decode(dir.files["live.m3u8"]);
+    expect(playlist).toContain("#EXT-X-ENDLIST");
+    for (const name of received.filter((name) => name.endsWith(".m4s")))
+      expect(playlist).toContain(path.basename(name));
+    await libav.unlinkfsdhdir("hls");
+  }, 60000);
+
+  it("파일을 넘기다 실패하면 변환을 멈추고 그 에러를 던진다", async () => {
+    let segments = 0;
+    libav.onhlssegment = (name) => {
+      if (name.endsWith(".m4s") && ++segments === 2) throw new Error("handover failed");
+    };
+    try {
+      await expect(libav.convert_to_hls_streaming("in.mp4", "fail.m3u8")).rejects.toThrow(
+        "handover failed",
+      );
+    } finally {
+      libav.onhlssegment = undefined;
+    }
+    // 실패한 뒤로는 더 이상 세그먼트를 만들지 않는다
+    expect(segments).toBeLessThanOrEqual(3);
+  }, 60000);
+});
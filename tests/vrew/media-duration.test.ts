@@ -0,0 +1,102 @@
+/*
+ * ff_probe_media_duration (src/p-avformat.in.js) 및
+ * ff_get_media_duration_probe (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 헤더의 길이를 지워 꼬리 구간 스캔을 타게 한 뒤, 제한 없이 스캔하면 헤더와
+ * 같은 길이를 TAIL 로 얻고, 제한이 빠듯하면 ESTIMATE 로 떨어지는지, 캐시가
+ * 다른 제한으로 얻은 결과를 돌려주지 않는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("ff_probe_media_duration", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // 헤더의 길이를 모두 0 으로 지워 꼬리 스캔을 타게 한다
+  async function openWithoutHeaderDuration(filename: string) {
+    const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+    await libav.AVFormatContext_duration_s(fmt_ctx, 0);
+    for (const s of streams) {
+      const st = await libav.AVFormatContext_streams_a(fmt_ctx, s.index);
+      await libav.AVStream_duration_s(st, 0);
+    }
+    return fmt_ctx;
+  }
+
+  it("헤더에 길이가 있으면 그대로 쓴다", async () => {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+    try {
+      const res = await libav.ff_probe_media_duration(fmt_ctx);
+      expect(res.confidence).toBe(libav.FF_DURATION_HEADER);
+      expect(res.duration).toBeCloseTo(await libav.ff_get_media_duration(fmt_ctx), 6);
+    } finally {
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+  });
+
+  it("제한에 따라 TAIL 과 ESTIMATE 가 갈리고, 캐시는 제한별로 따로 둔다", async () => {
+    const [ref_ctx] = await libav.ff_init_demuxer_file("in.mp4");
+    const header = (await libav.ff_probe_media_duration(ref_ctx)).duration;
+    await libav.avformat_close_input_js(ref_ctx);
+
+    const unlimited = { tailBytes: 0, tailPackets: 0 };
+    const tight = { tailBytes: 0, tailPackets: 1 };
+
+    const fmt_ctx = await openWithoutHeaderDuration("in.mp4");
+    try {
+      const full = await libav.ff_probe_media_duration(fmt_ctx, unlimited);
+      expect(full.confidence).toBe(libav.FF_DURATION_TAIL);
+      expect(full.duration).toBeCloseTo(header, 1);
+
+      // 캐시에 TAIL 결과가 있어도, 다른 제한으로는 그 결과를 받지 않는다
+      const short = await libav.ff_probe_media_duration(fmt_ctx, tight);
+      expect(short.confidence).toBe(libav.FF_DURATION_ESTIMATE);
+      expect(short.duration).toBeGreaterThan(0);
+
+      // 같은 제한으로 다시 물으면 같은 결과를 받는다
+      expect(await libav.ff_probe_media_duration(fmt_ctx, unlimited)).toEqual(full);
+      expect(await libav.ff_probe_media_duration(fmt_ctx, tight)).toEqual(short);
+    } finally {
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+
+    // 다시 연 파일도 캐시에서 같은 결과를 받는다
+    const reopened = await openWithoutHeaderDuration("in.mp4");
+    try {
+      expect(await libav.ff_probe_media_duration(reopened, tight)).toEqual(
+        await libav.ff_probe_media_duration(reopened, tight),
+      );
+      expect((await libav.ff_probe_media_duration(reopened, unlimited)).confidence).toBe(
+        libav.FF_DURATION_TAIL,
+      );
+    } finally {
+      await libav.avformat_close_input_js(reopened);
+    }
+  });
+});
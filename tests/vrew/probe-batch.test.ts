@@ -0,0 +1,139 @@
+/*
+ * ff_probe_batch (src/p-avformat.in.js) 및 ff_probe_batch_js
+ * (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 헤더만으로 얻은 정보가 ff_init_demuxer_file 의 전체 프로빙 결과와 같은지,
+ * 열 수 없는 파일이 배치 전체를 실패시키지 않는지 확인하고, 파일 여러 개를
+ * 가져올 때의 프로빙 시간을 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("ff_probe_batch", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+    expect(await libav.ff_convert_audio_to_mp3("in.mp4", "in.mp3", 2, 128000, 0)).toBe(0);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // 전체 프로빙으로 얻은 기준 값
+  async function reference(filename: string) {
+    const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+    try {
+      const video = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO);
+      const audio = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_AUDIO);
+      return {
+        nbStreams: streams.length,
+        duration: await libav.ff_get_media_duration(fmt_ctx),
+        video: video && {
+          index: video.index,
+          codecId: video.codec_id,
+          width: await libav.AVCodecParameters_width(video.codecpar),
+          height: await libav.AVCodecParameters_height(video.codecpar),
+        },
+        audio: audio && {
+          index: audio.index,
+          codecId: audio.codec_id,
+          sampleRate: await libav.AVCodecParameters_sample_rate(audio.codecpar),
+        },
+      };
+    } finally {
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+  }
+
+  it.each(["in.mp4", "in.mp3"])("%s: 전체 프로빙과 같은 정보를 준다", async (filename) => {
+    const ref = await reference(filename);
+    const [res] = await libav.ff_probe_batch([filename]);
+
+    expect(res.status).toBe(0);
+    expect(res.filename).toBe(filename);
+    expect(res.nbStreams).toBe(ref.nbStreams);
+    expect(res.duration).toBeCloseTo(ref.duration, 1);
+    expect(res.format).toBeTruthy();
+    if (ref.video) {
+      expect(res.video).toMatchObject(ref.video);
+      expect(res.video!.frameRate).toBeGreaterThan(0);
+    } else {
+      expect(res.video).toBeNull();
+    }
+    expect(res.audio).toMatchObject(ref.audio!);
+    expect(res.audio!.channels).toBeGreaterThan(0);
+  });
+
+  it("MP4 는 헤더만으로 충분하다", async () => {
+    const [res] = await libav.ff_probe_batch(["in.mp4"]);
+    expect(res.decoded).toBe(false);
+    expect(res.video!.codec).toBe("h264");
+    expect(res.majorBrand).toBeTruthy();
+  });
+
+  it("full 옵션을 줘도 같은 값이 나온다", async () => {
+    const [fast] = await libav.ff_probe_batch(["in.mp4"]);
+    const [full] = await libav.ff_probe_batch(["in.mp4"], { full: true });
+    expect(full.decoded).toBe(true);
+    expect(full.nbStreams).toBe(fast.nbStreams);
+    expect(full.duration).toBeCloseTo(fast.duration, 1);
+    expect(full.video).toEqual(fast.video);
+    expect(full.audio).toEqual(fast.audio);
+  });
+
+  it("열 수 없는 파일은 그 파일만 실패한다", async () => {
+    await libav.writeFile("garbage.bin", new Uint8Array(4096).fill(7));
+    const res = await libav.ff_probe_batch(["in.mp4", "missing.mp4", "garbage.bin", "in.mp3"]);
+    await libav.unlink("garbage.bin");
+
+    expect(res.map((r) => r.status < 0)).toEqual([false, true, true, false]);
+    expect(res[1].video).toBeNull();
+    expect(res[1].audio).toBeNull();
+    expect(res[3].audio).not.toBeNull();
+  });
+
+  it("프로빙 시간", async () => {
+    const files = Array.from({ length: 100 }, (_, i) => (i % 2 ? "in.mp3" : "in.mp4"));
+
+    let start = performance.now();
+    const res = await libav.ff_probe_batch(files);
+    const batchTime = performance.now() - start;
+    expect(res.every((r) => r.status === 0)).toBe(true);
+
+    start = performance.now();
+    await libav.ff_probe_batch(files, { full: true });
+    const fullTime = performance.now() - start;
+
+    start = performance.now();
+    for (const f of files) {
+      const [fmt_ctx] = await libav.ff_init_demuxer_file(f);
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+    const initTime = performance.now() - start;
+
+    console.log(
+      `[probe-batch] ${files.length} files: batch ${batchTime.toFixed(1)}ms, ` +
+        `batch full ${fullTime.toFixed(1)}ms, ff_init_demuxer_file ${initTime.toFixed(1)}ms`,
+    );
+  });
+});
@@ -0,0 +1,101 @@
+/*
+ * mkreadaheadfile / readaheadfilestats (src/p-avformat.in.js)의 블록 캐시에
+ * 대한 vitest 테스트.
+ *
+ * Blob 으로 연 파일에서 읽은 패킷이 MEMFS 에 쓴 같은 파일에서 읽은 것과
+ * 같은지, 오디오와 비디오가 번갈아 나오는 MP4 를 읽을 때 미리 읽기가 적중하는지,
+ * 그리고 캐시 크기 한도를 지키는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+describe("mkreadaheadfile", () => {
+  let libav: LibAVJS.LibAV;
+  let input: Uint8Array;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+    input = new Uint8Array(
+      fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4")),
+    );
+    await libav.writeFile("memfs.mp4", input);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // 모든 패킷의 (스트림, 크기, pts) 목록
+  async function readAll(filename: string) {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file(filename);
+    const pkt = await libav.av_packet_alloc();
+    const out: [number, number, number][] = [];
+    try {
+      const [ret, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+      expect(ret).toBe(libav.AVERROR_EOF);
+      for (const idx in packets)
+        for (const p of packets[idx]) out.push([+idx, p.data.length, p.pts!]);
+    } finally {
+      await libav.av_packet_free_js(pkt);
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+    return out;
+  }
+
+  it("MEMFS 와 같은 패킷을 읽고, 순차 읽기는 캐시에서 답한다", async () => {
+    const expected = await readAll("memfs.mp4");
+
+    await libav.mkreadaheadfile("ra.mp4", new Blob([input]), {
+      blockSize: 16384,
+    });
+    try {
+      const start = performance.now();
+      expect(await readAll("ra.mp4")).toEqual(expected);
+      const elapsed = performance.now() - start;
+
+      const stats = await libav.readaheadfilestats("ra.mp4");
+      console.log(
+        `[readahead] ${elapsed.toFixed(0)}ms, hit rate ${(stats.hitRate * 100).toFixed(0)}%, ` +
+          `${stats.reads} reads, ${stats.bytesWasted} bytes wasted`,
+      );
+      expect(stats.requests).toBeGreaterThan(0);
+      expect(stats.hits + stats.waits).toBeGreaterThan(stats.requests / 2);
+      // 인접 블록은 한 번에 읽는다
+      expect(stats.reads).toBeLessThan(Math.ceil(input.length / 16384));
+      expect(stats.bytesRead).toBeGreaterThanOrEqual(input.length);
+    } finally {
+      await libav.unlinkreadaheadfile("ra.mp4");
+    }
+  });
+
+  it("캐시 크기 한도를 넘지 않는다", async () => {
+    const cacheSize = 65536;
+    await libav.mkreadaheadfile("small.mp4", new Blob([input]), {
+      blockSize: 16384,
+      cacheSize,
+    });
+    try {
+      expect(await readAll("small.mp4")).toEqual(await readAll("memfs.mp4"));
+      const stats = await libav.readaheadfilestats("small.mp4");
+      expect(stats.cached).toBeLessThanOrEqual(cacheSize);
+      expect(stats.bytesWasted).toBeLessThanOrEqual(stats.bytesRead);
+    } finally {
+      await libav.unlinkreadaheadfile("small.mp4");
+    }
+  });
+});
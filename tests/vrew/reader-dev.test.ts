@@ -0,0 +1,214 @@
+/*
+ * mkreaderdev / ff_reader_dev_send (src/p-avformat.in.js)의 청크 목록 버퍼와
+ * highWaterMark 역압(backpressure)에 대한 vitest 테스트 및 벤치마크.
+ *
+ * 작은 청크로 나눠 보낸 스트림을 디먹싱한 결과가 원본과 같은지, 버퍼가
+ * highWaterMark 를 넘으면 ff_reader_dev_send 가 읽힐 때까지 기다리는지
+ * 확인하고, 1GB 를 16KB 청크로 흘려 보내는 처리량을 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+// 8-bit mono PCM WAV 헤더. 데이터는 따로 보낸다.
+function wavHeader(dataLen: number) {
+  const dv = new DataView(new ArrayBuffer(44));
+  const str = (o: number, s: string) => {
+    for (let i = 0; i < s.length; i++) dv.setUint8(o + i, s.charCodeAt(i));
+  };
+  str(0, "RIFF");
+  dv.setUint32(4, 36 + dataLen, true);
+  str(8, "WAVE");
+  str(12, "fmt ");
+  dv.setUint32(16, 16, true);
+  dv.setUint16(20, 1, true); // PCM
+  dv.setUint16(22, 1, true);
+  dv.setUint32(24, 48000, true);
+  dv.setUint32(28, 48000, true);
+  dv.setUint16(32, 1, true);
+  dv.setUint16(34, 8, true);
+  str(36, "data");
+  dv.setUint32(40, dataLen, true);
+  return new Uint8Array(dv.buffer);
+}
+
+const tick = () => new Promise((resolve) => setTimeout(resolve, 0));
+
+describe("mkreaderdev", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  /* name 장치에서 WAV 를 끝까지 디먹싱하며, 패킷 데이터마다 onData 를
+   * 부른다 */
+  async function demux(name: string, onData: (data: Uint8Array) => void) {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file(name);
+    const pkt = await libav.av_packet_alloc();
+    try {
+      let ret = 0;
+      while (ret !== libav.AVERROR_EOF) {
+        let batch: LibAVJS.PacketBatch;
+        [ret, batch] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+          limit: 16 * 1024 * 1024,
+          maxPackets: Infinity,
+          copyoutPacket: "batch",
+        });
+        if (ret < 0 && ret !== libav.AVERROR_EOF) throw new Error(`${ret}`);
+        onData(batch.data);
+      }
+    } finally {
+      await libav.av_packet_free_js(pkt);
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+  }
+
+  /* 헤더와 dataLen 바이트를 chunkSize 씩 보내고 EOF 를 보낸다. 각 전송의
+   * promise 를 기다리므로 highWaterMark 를 지킨다. */
+  async function produce(
+    name: string,
+    dataLen: number,
+    chunk: (offset: number, size: number) => Uint8Array,
+    chunkSize: number,
+  ) {
+    await libav.ff_reader_dev_send(name, wavHeader(dataLen));
+    for (let o = 0; o < dataLen; o += chunkSize)
+      await libav.ff_reader_dev_send(name, chunk(o, Math.min(chunkSize, dataLen - o)));
+    await libav.ff_reader_dev_send(name, null);
+  }
+
+  it("작은 청크로 나눠 보낸 스트림을 그대로 읽는다", async () => {
+    const dataLen = 300000;
+    const data = new Uint8Array(dataLen);
+    for (let i = 0; i < dataLen; i++) data[i] = (i * 7 + (i >> 9)) & 0xff;
+
+    await libav.mkreaderdev("small.wav", 0, { highWaterMark: 8192 });
+    try {
+      // 청크 경계가 읽기 크기와 맞지 않도록 어중간한 크기로 보낸다
+      const producing = produce("small.wav", dataLen, (o, n) => data.slice(o, o + n), 1000);
+      const got: Uint8Array[] = [];
+      await demux("small.wav", (d) => got.push(d));
+      await producing;
+
+      const out = new Uint8Array(got.reduce((a, d) => a + d.length, 0));
+      let o = 0;
+      for (const d of got) {
+        out.set(d, o);
+        o += d.length;
+      }
+      expect(out.length).toBe(dataLen);
+      expect(out.every((v, i) => v === data[i])).toBe(true);
+    } finally {
+      await libav.unlink("small.wav");
+    }
+  });
+
+  it("보낸 뒤 덮어쓴 버퍼도 보낸 때의 내용으로 읽는다", async () => {
+    const dataLen = 100000;
+    const data = new Uint8Array(dataLen);
+    for (let i = 0; i < dataLen; i++) data[i] = (i * 13 + (i >> 7)) & 0xff;
+
+    await libav.mkreaderdev("reuse.wav", 0);
+    try {
+      // 스트림 리더처럼 읽기 버퍼 하나를 계속 다시 쓴다
+      const reuse = new Uint8Array(4096);
+      const producing = produce(
+        "reuse.wav",
+        dataLen,
+        (o, n) => {
+          reuse.set(data.subarray(o, o + n));
+          return reuse.subarray(0, n);
+        },
+        reuse.length,
+      );
+      const got: Uint8Array[] = [];
+      await demux("reuse.wav", (d) => got.push(d));
+      await producing;
+
+      const out = new Uint8Array(got.reduce((a, d) => a + d.length, 0));
+      let o = 0;
+      for (const d of got) {
+        out.set(d, o);
+        o += d.length;
+      }
+      expect(out.length).toBe(dataLen);
+      expect(out.every((v, i) => v === data[i])).toBe(true);
+    } finally {
+      await libav.unlink("reuse.wav");
+    }
+  });
+
+  it("highWaterMark 를 넘으면 읽힐 때까지 전송이 끝나지 않는다", async () => {
+    await libav.mkreaderdev("bp.wav", 0, { highWaterMark: 65536 });
+    try {
+      await libav.ff_reader_dev_send("bp.wav", wavHeader(1 << 20));
+      let drained = false;
+      libav
+        .ff_reader_dev_send("bp.wav", new Uint8Array(65536))
+        .then(() => (drained = true));
+      for (let i = 0; i < 5; i++) await tick();
+      expect(drained).toBe(false);
+
+      // 읽기 시작하면 버퍼가 비면서 풀린다
+      const reading = demux("bp.wav", () => {});
+      for (let i = 0; i < 100 && !drained; i++) await tick();
+      expect(drained).toBe(true);
+      await libav.ff_reader_dev_send("bp.wav", null);
+      await reading;
+    } finally {
+      await libav.unlink("bp.wav");
+    }
+  });
+
+  it(
+    "1GB 를 16KB 청크로 흘려 보낸다",
+    async () => {
+      const dataLen = 1024 * 1024 * 1024;
+      const chunkSize = 16 * 1024;
+      const block = new Uint8Array(chunkSize).fill(0x80);
+
+      await libav.mkreaderdev("big.wav", 0, { highWaterMark: 4 * 1024 * 1024 });
+      try {
+        const start = performance.now();
+        const producing = produce(
+          "big.wav",
+          dataLen,
+          // 보낸 데이터는 큐에 넣을 때 복사되므로 같은 버퍼를 재사용해도 된다
+          (o, n) => (n === chunkSize ? block : block.subarray(0, n)),
+          chunkSize,
+        );
+        let total = 0;
+        await demux("big.wav", (d) => (total += d.length));
+        await producing;
+        const elapsed = (performance.now() - start) / 1000;
+
+        expect(total).toBe(dataLen);
+        console.log(
+          `[reader-dev] 1GB in 16KB chunks: ${elapsed.toFixed(1)}s, ` +
+            `${(dataLen / 1024 / 1024 / elapsed).toFixed(0)}MB/s`,
+        );
+      } finally {
+        await libav.unlink("big.wav");
+      }
+    },
+    600000,
+  );
+});
@@ -0,0 +1,176 @@
+/*
+ * ff_copyout_frame / ff_copyin_frame 의 format 옵션 (src/p-avframe.in.js)과
+ * ff_copyout_samples_js / ff_copyin_samples_js (src/b-avframe.c)에 대한
+ * vitest 테스트.
+ *
+ * 모든 AVSampleFormat 으로 프레임을 만들었다가 packed/planar F32/S16 으로
+ * 꺼내 원래 값과 비교하고, 기존 방식(그대로 꺼낸 뒤 JS 에서 변환)과 처리량을
+ * 비교한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const CHANNELS = 2;
+const SAMPLES = 1023;
+
+// 채널마다 다른, [-1, 1) 범위의 신호 (끝 값 포함)
+function signal(c: number) {
+  const ret = new Float32Array(SAMPLES);
+  for (let i = 0; i < SAMPLES; i++) ret[i] = Math.sin(i * 0.05 + c) * 0.95;
+  ret[0] = -1;
+  ret[1] = 0.999;
+  return ret;
+}
+
+describe("sample format conversion", () => {
+  let libav: LibAVJS.LibAV;
+  let formats: [string, number][];
+  let frame: number;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+    formats = [
+      "AV_SAMPLE_FMT_U8", "AV_SAMPLE_FMT_S16", "AV_SAMPLE_FMT_S32",
+      "AV_SAMPLE_FMT_FLT", "AV_SAMPLE_FMT_DBL", "AV_SAMPLE_FMT_U8P",
+      "AV_SAMPLE_FMT_S16P", "AV_SAMPLE_FMT_S32P", "AV_SAMPLE_FMT_FLTP",
+      "AV_SAMPLE_FMT_DBLP", "AV_SAMPLE_FMT_S64", "AV_SAMPLE_FMT_S64P",
+    ].map((name) => [name, (libav as any)[name] as number]);
+    frame = await libav.av_frame_alloc();
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.av_frame_free_js(frame);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  // 평면 float 신호를 fmt 형식의 AVFrame 으로 넣는다
+  async function makeFrame(fmt: number) {
+    await libav.av_frame_unref(frame);
+    await libav.ff_copyin_frame(
+      frame,
+      {
+        format: libav.AV_SAMPLE_FMT_FLTP,
+        channel_layout: 3,
+        sample_rate: 48000,
+        data: Array.from({ length: CHANNELS }, (_, c) => signal(c)),
+      },
+      { format: fmt },
+    );
+    expect(await libav.AVFrame_format(frame)).toBe(fmt);
+  }
+
+  // 출력을 채널별 float 로 되돌린다
+  function planes(out: LibAVJS.Frame) {
+    const s16 = out.format === libav.AV_SAMPLE_FMT_S16 || out.format === libav.AV_SAMPLE_FMT_S16P;
+    const scale = s16 ? 1 / 32768 : 1;
+    return Array.from({ length: CHANNELS }, (_, c) =>
+      Array.from({ length: SAMPLES }, (_, i) =>
+        Array.isArray(out.data)
+          ? out.data[c][i] * scale
+          : out.data[i * CHANNELS + c] * scale,
+      ),
+    );
+  }
+
+  it("모든 형식에서 F32/S16, packed/planar 로 꺼낸다", async () => {
+    const targets = [
+      libav.AV_SAMPLE_FMT_FLT, libav.AV_SAMPLE_FMT_FLTP,
+      libav.AV_SAMPLE_FMT_S16, libav.AV_SAMPLE_FMT_S16P,
+    ];
+    for (const [name, fmt] of formats) {
+      await makeFrame(fmt);
+      // U8 은 8비트, S16 은 16비트만큼의 오차를 허용한다
+      const bits = name.includes("U8") ? 8 : 16;
+      for (const target of targets) {
+        const out = await libav.ff_copyout_frame(frame, { format: target });
+        expect(out.format).toBe(target);
+        expect(out.nb_samples).toBe(SAMPLES);
+        expect(out.channels).toBe(CHANNELS);
+        const tol = Math.pow(2, 1 - bits);
+        const got = planes(out);
+        for (let c = 0; c < CHANNELS; c++) {
+          const want = signal(c);
+          for (let i = 0; i < SAMPLES; i++) {
+            if (Math.abs(got[c][i] - want[i]) > tol)
+              throw new Error(`${name} -> ${target}: channel ${c} sample ${i}: ${got[c][i]} != ${want[i]}`);
+          }
+        }
+      }
+    }
+  });
+
+  it("같은 형식끼리는 비트 단위로 그대로다", async () => {
+    await makeFrame(libav.AV_SAMPLE_FMT_S16);
+    const native = await libav.ff_copyout_frame(frame);
+    const converted = await libav.ff_copyout_frame(frame, { format: libav.AV_SAMPLE_FMT_S16 });
+    expect(Array.from(converted.data)).toEqual(Array.from(native.data));
+
+    // S16P 를 거쳐 다시 넣어도 같다
+    const planar = await libav.ff_copyout_frame(frame, { format: libav.AV_SAMPLE_FMT_S16P });
+    await libav.av_frame_unref(frame);
+    await libav.ff_copyin_frame(frame, planar, {
+      format: libav.AV_SAMPLE_FMT_S16,
+    });
+    expect(Array.from((await libav.ff_copyout_frame(frame)).data)).toEqual(
+      Array.from(native.data),
+    );
+  });
+
+  it("DBL 과 S64 는 기본값으로도 null 이 아닌 float 로 꺼낸다", async () => {
+    for (const [fmt, want] of [
+      [libav.AV_SAMPLE_FMT_DBL, libav.AV_SAMPLE_FMT_FLT],
+      [libav.AV_SAMPLE_FMT_DBLP, libav.AV_SAMPLE_FMT_FLTP],
+      [libav.AV_SAMPLE_FMT_S64, libav.AV_SAMPLE_FMT_FLT],
+      [libav.AV_SAMPLE_FMT_S64P, libav.AV_SAMPLE_FMT_FLTP],
+    ]) {
+      await makeFrame(fmt);
+      const out = await libav.ff_copyout_frame(frame);
+      expect(out.format).toBe(want);
+      expect(out.data).not.toBeNull();
+    }
+  });
+
+  it("처리량: S16 interleaved 를 planar float 로", async () => {
+    await makeFrame(libav.AV_SAMPLE_FMT_S16);
+    const rounds = 500;
+
+    // 기존 방식: 그대로 꺼내 JS 에서 deinterleave 하고 스케일한다
+    let start = performance.now();
+    for (let r = 0; r < rounds; r++) {
+      const out = await libav.ff_copyout_frame(frame);
+      const data = out.data as Int16Array;
+      const planar = Array.from({ length: CHANNELS }, () => new Float32Array(SAMPLES));
+      for (let i = 0; i < SAMPLES; i++)
+        for (let c = 0; c < CHANNELS; c++)
+          planar[c][i] = data[i * CHANNELS + c] / 32768;
+    }
+    const jsTime = performance.now() - start;
+
+    start = performance.now();
+    for (let r = 0; r < rounds; r++)
+      await libav.ff_copyout_frame(frame, { format: libav.AV_SAMPLE_FMT_FLTP });
+    const kernelTime = performance.now() - start;
+
+    const msamples = (rounds * SAMPLES * CHANNELS) / 1e6;
+    console.log(
+      `[sample-format] S16 -> FLTP: JS ${(msamples / (jsTime / 1000)).toFixed(1)} Msamples/s, ` +
+        `kernel ${(msamples / (kernelTime / 1000)).toFixed(1)} Msamples/s`,
+    );
+  });
+});
@@ -0,0 +1,148 @@
+/*
+ * ff_seek_index_* (src/b-avformat.c) 및 ff_seek_index_to_blob /
+ * ff_seek_index_from_blob (src/p-avformat.in.js)에 대한 vitest 테스트.
+ *
+ * 자체 인덱스가 없는 MP3 와 인덱스가 있는 MP4 에 대해 키프레임 인덱스를
+ * 만들고, 바이너리로 저장했다가 새 AVFormatContext 에 다시 불러와 탐색이
+ * 목표 시각 바로 앞의 키프레임에 떨어지는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const MIN_INTERVAL_MS = 500;
+
+describe("ff_seek_index", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+    expect(await libav.ff_convert_audio_to_mp3("in.mp4", "in.mp3", 2, 128000, 0)).toBe(0);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  // 파일 전체를 스캔해 인덱스를 만들고 blob 으로 직렬화한다
+  async function scanToBlob(filename: string) {
+    const [fmt_ctx] = await libav.ff_init_demuxer_file(filename);
+    const idx = await libav.ff_seek_index_alloc(MIN_INTERVAL_MS);
+    try {
+      expect(await libav.ff_seek_index_scan(fmt_ctx, idx)).toBe(0);
+      return {
+        count: await libav.ff_seek_index_count(idx, 0),
+        blob: await libav.ff_seek_index_to_blob(idx),
+      };
+    } finally {
+      await libav.ff_seek_index_free(idx);
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+  }
+
+  it("blob 은 LAVI 로 시작하고, 불러와 다시 저장해도 같다", async () => {
+    const { count, blob } = await scanToBlob("in.mp3");
+    expect(count).toBeGreaterThan(10);
+    expect(String.fromCharCode(...blob.subarray(0, 4))).toBe("LAVI");
+
+    const idx = await libav.ff_seek_index_from_blob(blob);
+    try {
+      expect(await libav.ff_seek_index_count(idx, 0)).toBe(count);
+      expect(Array.from(await libav.ff_seek_index_to_blob(idx))).toEqual(
+        Array.from(blob),
+      );
+    } finally {
+      await libav.ff_seek_index_free(idx);
+    }
+  });
+
+  it("손상된 blob 은 거부한다", async () => {
+    const { blob } = await scanToBlob("in.mp3");
+    await expect(
+      libav.ff_seek_index_from_blob(blob.subarray(0, blob.length - 7)),
+    ).rejects.toThrow();
+    await expect(
+      libav.ff_seek_index_from_blob(new Uint8Array([1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12])),
+    ).rejects.toThrow();
+  });
+
+  it("읽기 중에 붙여 둔 인덱스는 스캔과 같은 결과를 낸다", async () => {
+    const { blob } = await scanToBlob("in.mp3");
+
+    const [fmt_ctx] = await libav.ff_init_demuxer_file("in.mp3");
+    const pkt = await libav.av_packet_alloc();
+    const idx = await libav.ff_seek_index_alloc(MIN_INTERVAL_MS);
+    try {
+      await libav.ff_seek_index_attach(fmt_ctx, idx);
+      let ret = 0;
+      while (ret !== libav.AVERROR_EOF) {
+        [ret] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+          maxPackets: 200,
+        });
+      }
+      await libav.ff_seek_index_attach(fmt_ctx, 0);
+      expect(Array.from(await libav.ff_seek_index_to_blob(idx))).toEqual(
+        Array.from(blob),
+      );
+    } finally {
+      await libav.ff_seek_index_free(idx);
+      await libav.av_packet_free_js(pkt);
+      await libav.avformat_close_input_js(fmt_ctx);
+    }
+  });
+
+  it.each(["in.mp3", "in.mp4"])(
+    "%s: 저장한 인덱스로 새 컨텍스트에서 탐색한다",
+    async (filename) => {
+      const { blob } = await scanToBlob(filename);
+
+      const [fmt_ctx, [stream]] = await libav.ff_init_demuxer_file(filename);
+      const pkt = await libav.av_packet_alloc();
+      const idx = await libav.ff_seek_index_from_blob(blob);
+      try {
+        expect(await libav.ff_seek_index_apply(fmt_ctx, idx)).toBe(0);
+
+        const tb = stream.time_base_num / stream.time_base_den;
+        for (const t of [7.2, 1.5, 4.05]) {
+          const ts = Math.round(t / tb);
+          expect(
+            await libav.ff_seek_index_seek(fmt_ctx, idx, stream.index, ts, 0),
+          ).toBeGreaterThanOrEqual(0);
+          const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+            index: stream.index,
+            maxPackets: 1,
+          });
+          const p = packets[stream.index][0];
+          const landed = libav.i64tof64(p.pts!, p.ptshi!) * tb;
+          // 목표 이전의 키프레임에 떨어진다. 모든 패킷이 키프레임인 MP3 는
+          // 인덱스 간격(+ 프레임 하나) 이내여야 한다.
+          expect(landed).toBeLessThanOrEqual(t + 1e-6);
+          expect(p.flags! & libav.AV_PKT_FLAG_KEY).toBeTruthy();
+          if (filename === "in.mp3")
+            expect(t - landed).toBeLessThan(MIN_INTERVAL_MS / 1000 + 0.1);
+        }
+      } finally {
+        await libav.ff_seek_index_free(idx);
+        await libav.av_packet_free_js(pkt);
+        await libav.avformat_close_input_js(fmt_ctx);
+      }
+    },
+  );
+});
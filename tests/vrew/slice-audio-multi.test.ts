@@ -0,0 +1,163 @@
+/*
+ * ff_slice_audio_multi (src/p-avformat.in.js) 및 이 함수가 구동하는
+ * ff_slice_audio_ranges (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * tests/files/bbb_input.mp4 (10초, 비디오 + AAC 오디오)의 오디오를 한 번의
+ * 열기/탐색으로 여러 구간으로 잘라낸다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+// 출력 파일의 모든 패킷 duration 합 (초 단위)
+async function audioSeconds(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx] = await libav.ff_init_demuxer_file(filename);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const [, batch] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+      copyoutPacket: "batch",
+      maxPackets: Infinity,
+    });
+    let total = 0;
+    for (let i = 0; i < batch.count; i++) {
+      total +=
+        (batch.duration[i] * batch.time_base_num[i]) / batch.time_base_den[i];
+    }
+    return { packets: batch.count, seconds: total };
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+// PCM 출력의 샘플 수 (패킷 크기 합 / 샘플 하나의 바이트 수)
+async function pcmSamples(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+  const pkt = await libav.av_packet_alloc();
+  try {
+    const channels = await libav.AVCodecParameters_ch_layout_nb_channels(
+      streams[0].codecpar,
+    );
+    const sampleRate = await libav.AVCodecParameters_sample_rate(streams[0].codecpar);
+    const [, batch] = await libav.ff_read_frame_multi(fmt_ctx, pkt, {
+      copyoutPacket: "batch",
+      maxPackets: Infinity,
+    });
+    let bytes = 0;
+    for (let i = 0; i < batch.count; i++) bytes += batch.size[i];
+    return { samples: bytes / (2 * channels), sampleRate };
+  } finally {
+    await libav.av_packet_free_js(pkt);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+describe("ff_slice_audio_multi", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("여러 구간을 한 번에 잘라 각각의 파일로 출력한다", async () => {
+    // 정렬되지 않은 입력, 겹치는 구간, 멀리 떨어진(탐색이 필요한) 구간을 섞는다.
+    const ranges = [
+      { start: 8, duration: 1, output: "far.mp4" },
+      { start: 0, duration: 1, output: "first.mp4" },
+      { start: 1, duration: 1.5, output: "adjacent.mp4" },
+      { start: 2, duration: 0.5, output: "overlap.mp4" },
+    ];
+    const ret = await libav.ff_slice_audio_multi("in.mp4", ranges);
+    expect(ret).toBe(0);
+
+    for (const range of ranges) {
+      const { packets, seconds } = await audioSeconds(libav, range.output);
+      expect(packets).toBeGreaterThan(0);
+      // 패킷 단위로 자르므로 AAC 프레임(약 21ms) 두 개 정도의 오차를 허용한다.
+      expect(Math.abs(seconds - range.duration)).toBeLessThan(0.05);
+      await libav.unlink(range.output);
+    }
+  });
+
+  it("exact 옵션으로도 모든 구간을 출력한다", async () => {
+    const ranges = [
+      { start: 0.5, duration: 0.77, output: "exact0.mp4" },
+      { start: 3.33, duration: 1.11, output: "exact1.mp4" },
+    ];
+    const ret = await libav.ff_slice_audio_multi("in.mp4", ranges, {
+      exact: true,
+    });
+    expect(ret).toBe(0);
+
+    for (const range of ranges) {
+      const { packets, seconds } = await audioSeconds(libav, range.output);
+      expect(packets).toBeGreaterThan(0);
+      expect(Math.abs(seconds - range.duration)).toBeLessThan(0.05);
+      await libav.unlink(range.output);
+    }
+  });
+
+  it("exact 옵션은 PCM 을 샘플 단위로 자른다", async () => {
+    const opts = { encoder: "pcm_s16le" };
+    expect((await libav.ff_transcode_audio_js("in.mp4", "pcm.wav", opts)).ret).toBe(0);
+
+    const ranges = [
+      { start: 0.5, duration: 0.77, output: "pcm0.wav" },
+      { start: 3.33, duration: 1.11, output: "pcm1.wav" },
+    ];
+    const ret = await libav.ff_slice_audio_multi("pcm.wav", ranges, {
+      exact: true,
+    });
+    expect(ret).toBe(0);
+
+    for (const range of ranges) {
+      const { samples, sampleRate } = await pcmSamples(libav, range.output);
+      expect(Math.abs(samples - range.duration * sampleRate)).toBeLessThanOrEqual(1);
+      await libav.unlink(range.output);
+    }
+    await libav.unlink("pcm.wav");
+  });
+
+  it("exact 옵션은 가장자리를 다듬을 수 없는 출력을 거부한다", async () => {
+    const ret = await libav.ff_slice_audio_multi(
+      "in.mp4",
+      [
+        { start: 0.5, duration: 0.77, output: "ok.mp4" },
+        { start: 3.33, duration: 1.11, output: "aac.mp3" },
+      ],
+      { exact: true },
+    );
+    expect(ret).toBeLessThan(0);
+    // 아무것도 쓰기 전에 거부한다
+    await expect(libav.readFile("ok.mp4")).rejects.toBeDefined();
+    await expect(libav.readFile("aac.mp3")).rejects.toBeDefined();
+  });
+
+  it("입력 파일이 없으면 음수 에러를 반환한다", async () => {
+    const ret = await libav.ff_slice_audio_multi("does-not-exist.mp4", [
+      { start: 0, duration: 1, output: "missing.mp4" },
+    ]);
+    expect(ret).toBeLessThan(0);
+  });
+});
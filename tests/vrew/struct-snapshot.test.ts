@@ -0,0 +1,175 @@
+/*
+ * tools/mk-snapshots.js 가 만드는 Struct_snapshot 함수와 Struct_snapshot_js
+ * (src/post.in.js)에 대한 vitest 테스트 겸 마이크로벤치마크.
+ *
+ * AVFrame / AVPacket / AVCodecParameters 의 스냅샷이 필드마다 접근자를 부른
+ * 결과와 같은지 확인하고, 프레임 하나와 패킷 하나를 읽는 데 드는 wasm 호출
+ * 수와 시간을 두 방식으로 비교해 기록한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+const ITERATIONS = 2000;
+
+// funcs.json 의 snapshots 와 같은 필드 (배열은 [이름, 개수])
+const FIELDS: Record<string, (string | [string, number])[]> = {
+  AVFrame: [
+    "width", "height", "format", "flags", "key_frame", "pict_type", "pts",
+    "ptshi", "duration", "durationhi", "time_base_num", "time_base_den",
+    "sample_aspect_ratio_num", "sample_aspect_ratio_den", "crop_top",
+    "crop_bottom", "crop_left", "crop_right", "nb_samples", "sample_rate",
+    "channels", "channel_layout", ["data", 8], ["linesize", 8],
+  ],
+  AVPacket: [
+    "data", "size", "pts", "ptshi", "dts", "dtshi", "duration", "durationhi",
+    "flags", "stream_index", "time_base_num", "time_base_den", "side_data",
+    "side_data_elems",
+  ],
+  AVCodecParameters: [
+    "codec_type", "codec_id", "codec_tag", "format", "bit_rate", "profile",
+    "level", "width", "height", "color_range", "color_primaries", "color_trc",
+    "color_space", "chroma_location", "sample_rate", "channels",
+    "channel_layoutmask", "extradata", "extradata_size", "coded_side_data",
+    "nb_coded_side_data",
+  ],
+};
+
+describe("Struct_snapshot", () => {
+  let libav: LibAVJS.LibAV;
+  let lib: any;
+  let fmt_ctx: number;
+  let streams: LibAVJS.Stream[];
+  let c: number, pkt: number, frame: number;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+    lib = libav;
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+
+    [fmt_ctx, streams] = await libav.ff_init_demuxer_file("in.mp4");
+    const stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_VIDEO)!;
+    [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+      codecpar: stream.codecpar,
+      time_base: [stream.time_base_num, stream.time_base_den],
+    });
+
+    // 디코딩된 프레임 하나를 frame 에, 마지막으로 읽은 패킷을 pkt 에 둔다
+    let ret = 0;
+    while (ret !== 0 || !(await libav.AVFrame_width(frame))) {
+      await libav.av_packet_unref(pkt);
+      ret = await libav.av_read_frame(fmt_ctx, pkt);
+      expect(ret).toBeGreaterThanOrEqual(0);
+      if ((await libav.AVPacket_stream_index(pkt)) !== stream.index) continue;
+      expect(await libav.avcodec_send_packet(c, pkt)).toBe(0);
+      ret = await libav.avcodec_receive_frame(c, frame);
+    }
+  });
+
+  afterAll(async () => {
+    if (libav) {
+      await libav.ff_free_decoder(c, pkt, frame);
+      await libav.avformat_close_input_js(fmt_ctx);
+      if (typeof libav.terminate === "function") libav.terminate();
+    }
+  });
+
+  // 필드마다 접근자를 불러 읽는다. 반환값은 [결과, wasm 호출 수]
+  function readEach(klass: string, ptr: number): [Record<string, any>, number] {
+    const ret: Record<string, any> = {};
+    let calls = 0;
+    for (const field of FIELDS[klass]) {
+      if (typeof field === "string") {
+        ret[field] = lib[`${klass}_${field}_sync`](ptr);
+        calls++;
+      } else {
+        const [name, count] = field;
+        ret[name] = [];
+        for (let i = 0; i < count; i++) {
+          ret[name].push(lib[`${klass}_${name}_a_sync`](ptr, i));
+          calls++;
+        }
+      }
+    }
+    return [ret, calls];
+  }
+
+  const ptrOf = (klass: string) =>
+    klass === "AVFrame"
+      ? frame
+      : klass === "AVPacket"
+        ? pkt
+        : streams[0].codecpar;
+
+  it.each(Object.keys(FIELDS))("%s: 스냅샷이 접근자와 같다", (klass) => {
+    const ptr = ptrOf(klass);
+    const [each] = readEach(klass, ptr);
+    expect(lib[`${klass}_snapshot_js_sync`](ptr)).toEqual(each);
+  });
+
+  it.each(Object.keys(FIELDS))("%s: 접근자 호출 수와 시간", (klass) => {
+    const ptr = ptrOf(klass);
+    const [, calls] = readEach(klass, ptr);
+
+    let start = performance.now();
+    for (let i = 0; i < ITERATIONS; i++) readEach(klass, ptr);
+    const eachTime = (performance.now() - start) / ITERATIONS;
+
+    start = performance.now();
+    for (let i = 0; i < ITERATIONS; i++) lib[`${klass}_snapshot_js_sync`](ptr);
+    const snapTime = (performance.now() - start) / ITERATIONS;
+
+    console.log(
+      `[struct-snapshot] ${klass}: ${calls} accessor calls ` +
+        `${(eachTime * 1000).toFixed(2)}us, 1 snapshot call ` +
+        `${(snapTime * 1000).toFixed(2)}us`,
+    );
+    expect(calls).toBeGreaterThan(10);
+  });
+
+  it("copyout 도 같은 결과를 낸다", async () => {
+    const f = await libav.ff_copyout_frame_video(frame);
+    expect(f.width).toBe(await libav.AVFrame_width(frame));
+    expect(f.layout!.length).toBeGreaterThan(0);
+    expect(f.layout![0].stride).toBe(await libav.AVFrame_linesize_a(frame, 0));
+
+    const p = await libav.ff_copyout_packet(pkt);
+    expect(p.data.length).toBe(await libav.AVPacket_size(pkt));
+    expect(p.pts).toBe(await libav.AVPacket_pts(pkt));
+
+    const cp = await libav.ff_copyout_codecpar(streams[0].codecpar);
+    expect(cp.codec_id).toBe(streams[0].codec_id);
+    expect(cp.extradata?.length ?? 0).toBe(
+      await libav.AVCodecParameters_extradata_size(streams[0].codecpar),
+    );
+
+    let start = performance.now();
+    for (let i = 0; i < 200; i++) await libav.ff_copyout_frame_video(frame);
+    console.log(
+      `[struct-snapshot] ff_copyout_frame_video ` +
+        `${((performance.now() - start) / 200).toFixed(3)}ms per frame`,
+    );
+    start = performance.now();
+    for (let i = 0; i < 2000; i++) await libav.ff_copyout_packet(pkt);
+    console.log(
+      `[struct-snapshot] ff_copyout_packet ` +
+        `${(((performance.now() - start) / 2000) * 1000).toFixed(2)}us per packet`,
+    );
+  });
+});
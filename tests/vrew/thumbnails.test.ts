@@ -0,0 +1,109 @@
+/*
+ * ff_extract_thumbnails_js / ff_copyout_thumbnails (src/p-avformat.in.js) 및
+ * ff_extract_thumbnails (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * 정렬되지 않은 시각 목록에 대해 요청 순서대로 썸네일이 나오는지, 키프레임
+ * 모드와 정확 모드에서 고른 프레임 시각이 맞는지, 한 스프라이트 버퍼에
+ * RGBA 로 채워지는지 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+function thumbnail(thumbs: LibAVJS.Thumbnails, i: number) {
+  const size = thumbs.width * thumbs.height * 4;
+  return thumbs.data.subarray(i * size, (i + 1) * size);
+}
+
+describe("ff_extract_thumbnails_js", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it("키프레임 모드: 요청 순서대로, 각 시각 이전의 키프레임으로 채운다", async () => {
+    const timestamps = [5, 1, 9, 1.2, 0, 1.2];
+    const thumbs = await libav.ff_extract_thumbnails_js("in.mp4", timestamps, {
+      width: 160,
+    });
+
+    expect(thumbs.count).toBe(timestamps.length);
+    expect(thumbs.width).toBe(160);
+    expect(thumbs.height).toBeGreaterThan(0);
+    expect(thumbs.data.length).toBe(
+      timestamps.length * thumbs.width * thumbs.height * 4,
+    );
+
+    timestamps.forEach((ts, i) => {
+      expect(thumbs.times[i]).toBeGreaterThanOrEqual(0);
+      expect(thumbs.times[i]).toBeLessThanOrEqual(ts + 1e-6);
+    });
+
+    // 같은 시각은 같은 프레임을 쓴다
+    expect(thumbs.times[5]).toBe(thumbs.times[3]);
+    expect(Array.from(thumbnail(thumbs, 5))).toEqual(
+      Array.from(thumbnail(thumbs, 3)),
+    );
+
+    // RGBA: 알파는 모두 불투명
+    expect(thumbs.data.every((v, i) => i % 4 !== 3 || v === 255)).toBe(true);
+    // 5초 지점 화면은 통째로 검지 않다
+    expect(thumbnail(thumbs, 0).some((v, j) => j % 4 !== 3 && v > 16)).toBe(true);
+  });
+
+  it("정확 모드: 각 시각에 보이는 프레임을 고른다", async () => {
+    const timestamps = [7.3, 2.05, 2.5, 0.5];
+    const thumbs = await libav.ff_extract_thumbnails_js("in.mp4", timestamps, {
+      width: 96,
+      height: 54,
+      exact: true,
+    });
+
+    expect(thumbs.width).toBe(96);
+    expect(thumbs.height).toBe(54);
+    timestamps.forEach((ts, i) => {
+      expect(thumbs.times[i]).toBeLessThanOrEqual(ts + 1e-6);
+      // bbb_input.mp4 는 24fps 이상이므로 한 프레임 이내
+      expect(ts - thumbs.times[i]).toBeLessThan(1 / 24 + 1e-6);
+    });
+  });
+
+  it("많은 시각도 한 번의 호출로 처리한다", async () => {
+    const timestamps = Array.from({ length: 200 }, (_, i) => (i * 10) / 200);
+    const start = performance.now();
+    const thumbs = await libav.ff_extract_thumbnails_js("in.mp4", timestamps, {
+      width: 64,
+    });
+    const elapsed = performance.now() - start;
+    console.log(`[thumbnails] 200 keyframe thumbnails in ${elapsed.toFixed(0)}ms`);
+
+    expect(thumbs.count).toBe(200);
+    // 키프레임 모드에서는 키프레임 수만큼의 서로 다른 프레임만 나온다
+    const distinct = new Set(Array.from(thumbs.times));
+    expect(distinct.size).toBeLessThan(200);
+    for (let i = 1; i < thumbs.count; i++)
+      expect(thumbs.times[i]).toBeGreaterThanOrEqual(thumbs.times[i - 1]);
+  });
+});
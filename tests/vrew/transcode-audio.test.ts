@@ -0,0 +1,136 @@
+/*
+ * ff_transcode_audio_js (src/p-avformat.in.js) 및 이 함수가 구동하는
+ * ff_transcode_audio (src/b-avformat.c)에 대한 vitest 테스트.
+ *
+ * MP3 이외의 인코더(AAC, PCM)로의 변환과, 작업당 버퍼 할당 횟수가 입력
+ * 길이와 무관하게 일정한지를 확인한다.
+ *
+ * 실행: npm run test:vrew  (Node 18+ 필요 — .nvmrc 참고)
+ */
+
+import { describe, it, expect, beforeAll, afterAll } from "vitest";
+import * as fs from "fs";
+import * as path from "path";
+import { createRequire } from "module";
+import type * as LibAVJS from "../../dist/libav.types";
+
+const ROOT = path.resolve(__dirname, "..", "..");
+const DIST = path.join(ROOT, "dist");
+
+// The vrew build is CommonJS; load it and its wasm from dist/.
+const require = createRequire(import.meta.url);
+const LibAVFactory = require(
+  path.join(DIST, "libav-vrew.js"),
+) as LibAVJS.LibAVWrapper;
+
+async function probeAudio(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+  try {
+    const stream = streams.find(
+      (s) => s.codec_type === libav.AVMEDIA_TYPE_AUDIO,
+    );
+    if (!stream) throw new Error(`No audio stream found in ${filename}`);
+
+    const codec_id = await libav.AVCodecParameters_codec_id(stream.codecpar);
+    return {
+      streamCount: streams.length,
+      name: await libav.avcodec_get_name(codec_id),
+    };
+  } finally {
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+// 파일의 첫 오디오 스트림을 디코딩해 채널당 샘플 수를 센다.
+async function countSamples(libav: LibAVJS.LibAV, filename: string) {
+  const [fmt_ctx, streams] = await libav.ff_init_demuxer_file(filename);
+  const stream = streams.find((s) => s.codec_type === libav.AVMEDIA_TYPE_AUDIO)!;
+  const [, c, pkt, frame] = await libav.ff_init_decoder(stream.codec_id, {
+    codecpar: stream.codecpar,
+    time_base: [stream.time_base_num, stream.time_base_den],
+  });
+  try {
+    const [, packets] = await libav.ff_read_frame_multi(fmt_ctx, pkt);
+    const frames = await libav.ff_decode_multi(
+      c,
+      pkt,
+      frame,
+      packets[stream.index] || [],
+      true,
+    );
+    return frames.reduce((n, f) => n + f.nb_samples!, 0);
+  } finally {
+    await libav.ff_free_decoder(c, pkt, frame);
+    await libav.avformat_close_input_js(fmt_ctx);
+  }
+}
+
+describe("ff_transcode_audio_js", () => {
+  let libav: LibAVJS.LibAV;
+
+  beforeAll(async () => {
+    libav = await LibAVFactory.LibAV({ base: DIST, noworker: true });
+
+    const input = fs.readFileSync(path.join(ROOT, "tests/files/bbb_input.mp4"));
+    await libav.writeFile("in.mp4", new Uint8Array(input));
+    expect(await libav.ff_slice_audio("in.mp4", "short.mp4", 0, 2)).toBe(0);
+  });
+
+  afterAll(() => {
+    if (libav && typeof libav.terminate === "function") libav.terminate();
+  });
+
+  it.each([
+    ["aac", "out.mp4", "aac"],
+    ["pcm_s16le", "out.wav", "pcm_s16le"],
+    ["mp3", "out.mp3", "mp3"],
+  ])("%s 인코더로 변환한다", async (encoder, output, codecName) => {
+    const { ret } = await libav.ff_transcode_audio_js("in.mp4", output, {
+      encoder,
+    });
+    expect(ret).toBe(0);
+
+    const info = await probeAudio(libav, output);
+    expect(info.streamCount).toBe(1);
+    expect(info.name).toBe(codecName);
+    await libav.unlink(output);
+  });
+
+  it.each([
+    ["pcm_s16le", "len.wav", 0],
+    ["aac", "len.mp4", 1024],
+  ])("%s: 마지막 짧은 프레임 때문에 길이가 늘지 않는다", async (encoder, output, frameSize) => {
+    const { ret } = await libav.ff_transcode_audio_js("short.mp4", output, {
+      encoder,
+    });
+    expect(ret).toBe(0);
+
+    const inSamples = await countSamples(libav, "short.mp4");
+    const outSamples = await countSamples(libav, output);
+    // 한 프레임 전체만큼 덧붙이면 frameSize 이상 길어진다
+    expect(Math.abs(outSamples - inSamples)).toBeLessThanOrEqual(frameSize ? frameSize - 1 : 0);
+    await libav.unlink(output);
+  });
+
+  it("버퍼 할당 횟수가 입력 길이와 무관하다", async () => {
+    const short = await libav.ff_transcode_audio_js("short.mp4", "short.mp3");
+    const long = await libav.ff_transcode_audio_js("in.mp4", "long.mp3");
+    expect(short.ret).toBe(0);
+    expect(long.ret).toBe(0);
+
+    // 변환 버퍼, 인코더 프레임, FIFO 를 한 번씩 할당하고 재사용한다.
+    expect(long.allocations).toBeGreaterThan(0);
+    expect(long.allocations).toBeLessThan(10);
+    expect(long.allocations).toBe(short.allocations);
+
+    await libav.unlink("short.mp3");
+    await libav.unlink("long.mp3");
+  });
+
+  it("알 수 없는 인코더는 음수 에러를 반환한다", async () => {
+    const { ret } = await libav.ff_transcode_audio_js("in.mp4", "x.mp3", {
+      encoder: "no-such-encoder",
+    });
+    expect(ret).toBeLessThan(0);
+  });
+});
@@ -1,13 +1,70 @@
 #!/usr/bin/env python3
-from http.server import HTTPServer, SimpleHTTPRequestHandler, test
+# Usage: cors-server.py [port] [delay in milliseconds]
+# The delay is added to every response, to simulate a remote server.
+from http.server import ThreadingHTTPServer, SimpleHTTPRequestHandler, test
+import os
+import re
 import sys
+import time
+
+delay = float(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0
 
 class CORSRequestHandler (SimpleHTTPRequestHandler):
+    range_length = None
+
     def end_headers (self):
         self.send_header('Access-Control-Allow-Origin', '*')
+        self.send_header('Access-Control-Allow-Headers', 'Range')
+        self.send_header('Access-Control-Expose-Headers', 'Content-Length, Content-Range')
         self.send_header('Cross-Origin-Opener-Policy', 'same-origin')
         self.send_header('Cross-Origin-Embedder-Policy', 'require-corp')
         SimpleHTTPRequestHandler.end_headers(self)
 
+    def do_OPTIONS (self):
+        self.send_response(204)
+        self.end_headers()
+
+    # Serve single-range requests ("bytes=start-" or "bytes=start-end"), so
+    # that jsfetch's block cache can be tested locally
+    def send_head (self):
+        if delay:
+            time.sleep(delay)
+        self.range_length = None
+        m = re.match(r'bytes=(\d+)-(\d*)$', self.headers.get('Range', ''))
+        path = self.translate_path(self.path)
+        if not m or not os.path.isfile(path):
+            return SimpleHTTPRequestHandler.send_head(self)
+
+        size = os.path.getsize(path)
+        start = int(m.group(1))
+        end = min(int(m.group(2)) if m.group(2) else size - 1, size - 1)
+        if start >= size:
+            self.send_response(416)
+            self.send_header('Content-Range', 'bytes */%d' % size)
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            return None
+
+        f = open(path, 'rb')
+        f.seek(start)
+        self.range_length = end - start + 1
+        self.send_response(206)
+        self.send_header('Content-Type', self.guess_type(path))
+        self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, size))
+        self.send_header('Content-Length', str(self.range_length))
+        self.end_headers()
+        return f
+
+    def copyfile (self, source, outputfile):
+        if self.range_length is None:
+            return SimpleHTTPRequestHandler.copyfile(self, source, outputfile)
+        remaining = self.range_length
+        while remaining > 0:
+            buf = source.read(min(remaining, 65536))
+            if not buf:
+                break
+            outputfile.write(buf)
+            remaining -= len(buf)
+
 if __name__ == '__main__':
-    test(CORSRequestHandler, HTTPServer, port=int(sys.argv[1]) if len(sys.argv) > 1 else 8000)
+    test(CORSRequestHandler, ThreadingHTTPServer, port=int(sys.argv[1]) if len(sys.argv) > 1 else 8000)
@@ -57,6 +57,9 @@ async function main() {
             }
         }
 
+        for (const snapshot of (fc.snapshots || []))
+            exports.push(`_${snapshot[0]}_snapshot`);
+
         for (const decl of (fc.freers || []))
             exports.push(`_${decl}`);
     }
@@ -66,6 +66,9 @@ async function main() {
             }
         }
 
+        for (const snapshot of (fc.snapshots || []))
+            normalFuncs.push(`${snapshot[0]}_snapshot`, `${snapshot[0]}_snapshot_js`);
+
         for (const decl of (fc.freers || []))
             normalFuncs.push(`${decl}_js`);
 
@@ -65,6 +65,13 @@ async function main() {
             }
         }
 
+        // And for snapshots
+        for (const snapshot of (fc.snapshots || [])) {
+            fc.functions.push(
+                [`${snapshot[0]}_snapshot`, null, ["number", "number"]]
+            );
+        }
+
         for (const decl of fc.functions) {
             out += `var ${decl[0]} = ` +
                 `Module.${decl[0]} = ` +
@@ -131,6 +138,16 @@ async function main() {
                 "};\n";
         }
 
+        for (const snapshot of (fc.snapshots || [])) {
+            const klass = snapshot[0];
+            out += `var ${klass}_snapshot_js = ` +
+                `Module.${klass}_snapshot_js = ` +
+                `CAccessors.${klass}_snapshot_js = ` +
+                "function(p) { " +
+                `return ff_snapshot(CAccessors.${klass}_snapshot, ${s(snapshot[1])}, p); ` +
+                "};\n";
+        }
+
         for (const copier of (fc.copiers || [])) {
             const type = copier[0];
             const typedArr = copier[1];
@@ -0,0 +1,85 @@
+#!/usr/bin/env node
+/*
+ * Copyright (C) 2019-2025 Yahweasel and contributors
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Generate the Struct_snapshot functions for a variant, from the "snapshots"
+ * of each of its components in funcs.json. Each one reads every listed field
+ * of a struct, through the same accessors as are exported individually, into
+ * a record of int32s, in one call. The output is included by bindings.c, after
+ * all of the accessors are defined. Struct_snapshot_js (in post.js) unpacks
+ * the record.
+ */
+
+const fs = require("fs/promises");
+
+// Must match ff_snapshot in post.in.js
+const MAX_FIELDS = 128;
+
+async function main() {
+    const variant = process.argv[2];
+
+    const funcs = JSON.parse(await fs.readFile("funcs.json", "utf8"));
+    const components = (
+        await fs.readFile(`configs/configs/${variant}/components.txt`, "utf8")
+    ).trim().split("\n");
+
+    let out = "/* Generated by tools/mk-snapshots.js from funcs.json. */\n";
+    const done = {};
+
+    for (const component of components) {
+        const fc = funcs[component];
+
+        for (const snapshot of (fc.snapshots || [])) {
+            const klass = snapshot[0];
+            // Components may be listed more than once, but C can't define twice
+            if (done[klass])
+                continue;
+            done[klass] = true;
+            const reads = [];
+            for (let field of snapshot[1]) {
+                if (typeof field === "string")
+                    field = {name: field};
+                const pf = `${klass}_${field.name}`;
+                if (field.rational) {
+                    reads.push(`${pf}_num(a)`, `${pf}_den(a)`);
+                } else if (field.count) {
+                    for (let i = 0; i < field.count; i++)
+                        reads.push(`${pf}_a(a, ${i})`);
+                } else {
+                    reads.push(`${pf}(a)`);
+                }
+            }
+
+            if (reads.length > MAX_FIELDS) {
+                throw new Error(
+                    `${klass} snapshot has ${reads.length} fields, ` +
+                    `more than ${MAX_FIELDS}`
+                );
+            }
+
+            out += `\nvoid ${klass}_snapshot(${klass} *a, int32_t *out) {\n`;
+            reads.forEach((read, idx) => {
+                // Pointers and 64-bit fields keep their low 32 bits, as they do through cwrap
+                out += `    out[${idx}] = (int32_t) (intptr_t) ${read};\n`;
+            });
+            out += "}\n";
+        }
+    }
+
+    process.stdout.write(out);
+}
+
+main();
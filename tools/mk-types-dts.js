@@ -122,6 +122,21 @@ async function main() {
             }
         }
 
+        // Convert snapshots to function declarations
+        for (const snapshot of (fc.snapshots || [])) {
+            const klass = snapshot[0];
+            fc.functions.push(
+                [
+                    `${klass}_snapshot`, null, ["number", "number"],
+                    paramNames("ptr", "out")
+                ],
+                [
+                    `${klass}_snapshot_js`, "Record<string, any>", ["number"],
+                    paramNames("ptr")
+                ]
+            );
+        }
+
         // Convert freers to function declarations
         for (const freer of (fc.freers || [])) {
             fc.functions.push([